@@ -61,6 +61,8 @@ free_ApplicationClassInstanceVars(ApplicationClassInstanceVars *v)
 {
 	GroupClass_freeTimers(&v->Timers, &v->removed_timers);
 
+	GroupClass_freeObjectNumbers(&v->used_numbers);
+
 	LIST_FREE(&v->DisplayStack, RootClassPtr, safe_free);
 
 	return;
@@ -135,7 +137,7 @@ ApplicationClass_Activation(ApplicationClass *a)
 	MHEGEngine_generateEvent(&a->rootClass.inst.ref, EventType_is_running, NULL);
 
 	/* time base for absolute timers */
-	gettimeofday(&a->inst.start_time, NULL);
+	MHEGTimer_getTime(&a->inst.start_time);
 
 	return true;
 }
@@ -74,6 +74,9 @@ BitmapClass_Preparation(BitmapClass *t)
 
 	default_BitmapClassInstanceVars(t, &t->inst);
 
+	/* start decoding the content now, so it is ready when we are activated */
+	MHEGEngine_prefetchBitmap(&t->inst.BitmapData, t->have_content_hook, t->content_hook);
+
 	/* add it to the DisplayStack of the active application */
 	MHEGEngine_addVisibleObject(&t->rootClass);
 
@@ -111,7 +111,7 @@ default_EntryFieldClassInstanceVars(EntryFieldClass *t, EntryFieldClassInstanceV
 			MHEGFont_defaultAttributes(&v->Font);
 	}
 
-	v->element = NULL;
+	v->layout = NULL;
 
 	/* EntryFieldClass */
 	v->EntryPoint = 0;
@@ -130,7 +130,7 @@ free_EntryFieldClassInstanceVars(EntryFieldClassInstanceVars *v)
 
 	free_MHEGFont(&v->Font);
 
-	LIST_FREE(&v->element, MHEGTextElement, safe_free);
+	MHEGFont_releaseLayout(&v->layout);
 
 	return;
 }
@@ -547,7 +547,7 @@ EntryFieldClass_contentAvailable(EntryFieldClass *t, OctetString *file)
 {
 	/* get rid of any existing content */
 	free_OctetString(&t->inst.TextData);
-	LIST_FREE(&t->inst.element, MHEGTextElement, safe_free);
+	MHEGFont_releaseLayout(&t->inst.layout);
 
 	/* load the new content */
 	MHEGEngine_loadFile(file, &t->inst.TextData);
@@ -564,6 +564,11 @@ EntryFieldClass_render(EntryFieldClass *t, MHEGDisplay *d, XYPosition *pos, Orig
 {
 	XYPosition ins_pos;
 	OriginalBoxSize ins_box;
+	LIST_TYPE(MHEGTextElement) *element;
+	bool tabs;
+	OctetString stars;
+	int len;
+	unsigned int i;
 
 	verbose("EntryFieldClass: %s; render", ExternalReference_name(&t->rootClass.inst.ref));
 
@@ -572,8 +577,48 @@ EntryFieldClass_render(EntryFieldClass *t, MHEGDisplay *d, XYPosition *pos, Orig
 
 	MHEGDisplay_setClipRectangle(d, &ins_pos, &ins_box);
 
+	/* draw the background */
+	MHEGDisplay_fillRectangle(d, &ins_pos, &ins_box, &t->inst.BackgroundColour);
+
+	/* layout the text if not already done */
+	if(t->inst.layout == NULL)
+	{
+		if(t->obscured_input)
+		{
+			/* display a '*' for each (possibly multibyte) character */
+			stars.size = 0;
+			stars.data = safe_malloc(t->inst.TextData.size);
+			for(i=0; i<t->inst.TextData.size; i+=len)
+			{
+				(void) next_utf8(&t->inst.TextData.data[i], t->inst.TextData.size - i, &len);
+				stars.data[stars.size++] = '*';
+			}
+			t->inst.layout = MHEGFont_getLayout(&t->inst.Font, &t->inst.TextColour, &stars, &t->inst.BoxSize,
+							    t->horizontal_justification, t->vertical_justification,
+							    t->line_orientation, t->start_corner, t->text_wrapping);
+			safe_free(stars.data);
+		}
+		else
+		{
+			t->inst.layout = MHEGFont_getLayout(&t->inst.Font, &t->inst.TextColour, &t->inst.TextData, &t->inst.BoxSize,
+							    t->horizontal_justification, t->vertical_justification,
+							    t->line_orientation, t->start_corner, t->text_wrapping);
+		}
+	}
+
+	/* tabs are treated as spaces if horizontal justification is not Justification_start */
+	tabs = (t->horizontal_justification == Justification_start);
+
+	/* draw each text element */
+	element = t->inst.layout->element;
+	while(element)
+	{
+		MHEGDisplay_drawTextElement(d, &t->inst.Position, &t->inst.Font, &element->item, tabs);
+		element = element->next;
+	}
+
 /* TODO */
-printf("TODO: EntryFieldClass_render\n");
+/* draw the cursor at EntryPoint */
 
 	MHEGDisplay_unsetClipRectangle(d);
 
@@ -7,6 +7,7 @@
 #include "MHEGEngine.h"
 #include "MHEGTimer.h"
 #include "GroupClass.h"
+#include "GroupItem.h"
 #include "GenericInteger.h"
 #include "GenericBoolean.h"
 #include "ExternalReference.h"
@@ -41,7 +42,7 @@ GroupClass_SetTimer(ExternalReference *ref, LIST_OF(Timer) **timer_list, LIST_OF
 			/* absolute time is the time since we generated an IsRunning event */
 			if(timer->item.absolute_time)
 			{
-				gettimeofday(&now, NULL);
+				MHEGTimer_getTime(&now);
 				interval = time_diff(&now, start_time) + value;
 			}
 			else
@@ -72,7 +73,7 @@ GroupClass_SetTimer(ExternalReference *ref, LIST_OF(Timer) **timer_list, LIST_OF
 			/* absolute time is the time since we generated an IsRunning event */
 			if(absolute)
 			{
-				gettimeofday(&now, NULL);
+				MHEGTimer_getTime(&now);
 				interval = time_diff(&now, start_time) + value;
 			}
 			else
@@ -166,3 +167,108 @@ GroupClass_freeTimers(LIST_OF(Timer) **timer_list, LIST_OF(MHEGTimer) **removed_
 	return;
 }
 
+
+/*
+ * the set of object numbers used in a GroupClass
+ * clones get numbers from FIRST_CLONED_OBJ_NUM upwards, so we only need to remember numbers in that range
+ * we only store the numbers the app was authored with, not the ones we give to clones
+ * so the set is normally empty
+ */
+
+#define OBJECT_NUMBER_SET_MIN	16
+
+/* Knuth's multiplicative hash, size is always a power of 2 */
+#define OBJECT_NUMBER_HASH(SET, NUM)	(((NUM) * 2654435761U) & ((SET)->size - 1))
+
+void
+GroupClass_initObjectNumbers(ObjectNumberSet *set, LIST_OF(GroupItem) *items)
+{
+	RootClass *r;
+
+	set->size = OBJECT_NUMBER_SET_MIN;
+	set->nused = 0;
+	set->slots = safe_malloc(set->size * sizeof(unsigned int));
+	bzero(set->slots, set->size * sizeof(unsigned int));
+
+	while(items)
+	{
+		if((r = GroupItem_rootClass(&items->item)) != NULL
+		&& r->inst.ref.object_number >= FIRST_CLONED_OBJ_NUM)
+			GroupClass_addObjectNumber(set, r->inst.ref.object_number);
+		items = items->next;
+	}
+
+	return;
+}
+
+bool
+GroupClass_objectNumberUsed(ObjectNumberSet *set, unsigned int num)
+{
+	unsigned int i;
+
+	if(num < FIRST_CLONED_OBJ_NUM || set->slots == NULL)
+		return false;
+
+	i = OBJECT_NUMBER_HASH(set, num);
+	while(set->slots[i] != 0)
+	{
+		if(set->slots[i] == num)
+			return true;
+		i = (i + 1) & (set->size - 1);
+	}
+
+	return false;
+}
+
+void
+GroupClass_addObjectNumber(ObjectNumberSet *set, unsigned int num)
+{
+	unsigned int *old_slots;
+	unsigned int old_size;
+	unsigned int i;
+
+	/* 0 marks an empty slot, and we don't need to remember numbers below FIRST_CLONED_OBJ_NUM */
+	if(num < FIRST_CLONED_OBJ_NUM || set->slots == NULL)
+		return;
+
+	/* keep it at most half full so the probe sequences stay short */
+	if((set->nused + 1) * 2 > set->size)
+	{
+		old_slots = set->slots;
+		old_size = set->size;
+		set->size *= 2;
+		set->nused = 0;
+		set->slots = safe_malloc(set->size * sizeof(unsigned int));
+		bzero(set->slots, set->size * sizeof(unsigned int));
+		for(i=0; i<old_size; i++)
+		{
+			if(old_slots[i] != 0)
+				GroupClass_addObjectNumber(set, old_slots[i]);
+		}
+		safe_free(old_slots);
+	}
+
+	i = OBJECT_NUMBER_HASH(set, num);
+	while(set->slots[i] != 0)
+	{
+		if(set->slots[i] == num)
+			return;
+		i = (i + 1) & (set->size - 1);
+	}
+	set->slots[i] = num;
+	set->nused ++;
+
+	return;
+}
+
+void
+GroupClass_freeObjectNumbers(ObjectNumberSet *set)
+{
+	safe_free(set->slots);
+
+	set->slots = NULL;
+	set->size = 0;
+	set->nused = 0;
+
+	return;
+}
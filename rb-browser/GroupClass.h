@@ -14,5 +14,10 @@ void GroupClass_timerFired(ExternalReference *, int, MHEGTimer, LIST_OF(Timer) *
 
 void GroupClass_freeTimers(LIST_OF(Timer) **, LIST_OF(MHEGTimer) **);
 
+void GroupClass_initObjectNumbers(ObjectNumberSet *, LIST_OF(GroupItem) *);
+bool GroupClass_objectNumberUsed(ObjectNumberSet *, unsigned int);
+void GroupClass_addObjectNumber(ObjectNumberSet *, unsigned int);
+void GroupClass_freeObjectNumbers(ObjectNumberSet *);
+
 #endif	/* __GROUPCLASS_H__ */
 
@@ -111,7 +111,7 @@ default_HyperTextClassInstanceVars(HyperTextClass *t, HyperTextClassInstanceVars
 			MHEGFont_defaultAttributes(&v->Font);
 	}
 
-	v->element = NULL;
+	v->layout = NULL;
 
 	/* HyperTextClass */
 	v->LastAnchorFired.size = 0;
@@ -132,7 +132,7 @@ free_HyperTextClassInstanceVars(HyperTextClassInstanceVars *v)
 
 	free_MHEGFont(&v->Font);
 
-	LIST_FREE(&v->element, MHEGTextElement, safe_free);
+	MHEGFont_releaseLayout(&v->layout);
 
 	free_OctetString(&v->LastAnchorFired);
 
@@ -541,7 +541,7 @@ HyperTextClass_contentAvailable(HyperTextClass *t, OctetString *file)
 {
 	/* get rid of any existing content */
 	free_OctetString(&t->inst.TextData);
-	LIST_FREE(&t->inst.element, MHEGTextElement, safe_free);
+	MHEGFont_releaseLayout(&t->inst.layout);
 
 	/* load the new content */
 	MHEGEngine_loadFile(file, &t->inst.TextData);
@@ -558,6 +558,8 @@ HyperTextClass_render(HyperTextClass *t, MHEGDisplay *d, XYPosition *pos, Origin
 {
 	XYPosition ins_pos;
 	OriginalBoxSize ins_box;
+	LIST_TYPE(MHEGTextElement) *element;
+	bool tabs;
 
 	verbose("HyperTextClass: %s; render", ExternalReference_name(&t->rootClass.inst.ref));
 
@@ -566,8 +568,30 @@ HyperTextClass_render(HyperTextClass *t, MHEGDisplay *d, XYPosition *pos, Origin
 
 	MHEGDisplay_setClipRectangle(d, &ins_pos, &ins_box);
 
+	/* draw the background */
+	MHEGDisplay_fillRectangle(d, &ins_pos, &ins_box, &t->inst.BackgroundColour);
+
+	/* layout the text if not already done, anchor tags are ignored by the layout code */
+	if(t->inst.layout == NULL)
+	{
+		t->inst.layout = MHEGFont_getLayout(&t->inst.Font, &t->inst.TextColour, &t->inst.TextData, &t->inst.BoxSize,
+						    t->horizontal_justification, t->vertical_justification,
+						    t->line_orientation, t->start_corner, t->text_wrapping);
+	}
+
+	/* tabs are treated as spaces if horizontal justification is not Justification_start */
+	tabs = (t->horizontal_justification == Justification_start);
+
+	/* draw each text element */
+	element = t->inst.layout->element;
+	while(element)
+	{
+		MHEGDisplay_drawTextElement(d, &t->inst.Position, &t->inst.Font, &element->item, tabs);
+		element = element->next;
+	}
+
 /* TODO */
-printf("TODO: HyperTextClass_render\n");
+/* highlight the anchor at FocusPosition */
 
 	MHEGDisplay_unsetClipRectangle(d);
 
@@ -183,19 +183,22 @@ LinkClass_conditionMet(LinkClass *l, ExternalReference *src, EventType type, Eve
 	switch(link_src->choice)
 	{
 	case ObjectReference_internal_reference:
-		if(OctetString_cmp(&src->group_identifier, &link_ref->group_identifier) != 0
-		|| src->object_number != link_src->u.internal_reference)
+		/* fastest first */
+		if(src->object_number != link_src->u.internal_reference
+		|| OctetString_cmp(&src->group_identifier, &link_ref->group_identifier) != 0)
 			return false;
 		break;
 
 	case ObjectReference_external_reference:
+		/* don't bother making the group id absolute unless the object numbers match */
+		if(src->object_number != link_src->u.external_reference.object_number)
+			return false;
 		/* make sure the event src is an absolute group id (ie starts with ~//) */
 		fullname = MHEGEngine_absoluteFilename(&link_src->u.external_reference.group_identifier);
 		absolute.size = strlen(fullname);
 		absolute.data = fullname;
 		link_gid = &absolute;
-		if(OctetString_cmp(&src->group_identifier, link_gid) != 0
-		|| src->object_number != link_src->u.external_reference.object_number)
+		if(OctetString_cmp(&src->group_identifier, link_gid) != 0)
 			return false;
 		break;
 
@@ -5,33 +5,58 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #include "MHEGEngine.h"
 #include "MHEGApp.h"
 #include "ApplicationClass.h"
+#include "GroupItem.h"
+#include "RootClass.h"
 #include "utils.h"
 
+/* guess at how much memory the decoded objects need compared to the DER data */
+#define ARENA_SIZE_RATIO	4
+
+/* internal functions */
+static int decode_object(OctetString *, InterchangedObject *, der_arena *);
+static void free_object(InterchangedObject *, der_arena *);
+
+static LIST_TYPE(MHEGSceneCacheEntry) *find_scene(MHEGApp *, OctetString *, OctetString *, uint32_t);
+static void add_scene(MHEGApp *, OctetString *, OctetString *, uint32_t);
+static void copy_scene(InterchangedObject *, der_arena *, InterchangedObject *, size_t);
+static void free_scene(MHEGSceneCacheEntry *);
+static void register_objects(SceneClass *, bool);
+static void register_object(RootClass *, bool);
+
 void
 MHEGApp_init(MHEGApp *m)
 {
 	m->app = NULL;
 	m->scene = NULL;
 
+	der_arena_init(&m->app_arena, 0);
+	der_arena_init(&m->scene_arena, 0);
+
+	m->scene_cache = NULL;
+	m->scene_cached = false;
+
 	return;
 }
 
 void
 MHEGApp_fini(MHEGApp *m)
 {
-	if(m->app != NULL)
-		free_InterchangedObject(m->app);
-
 	if(m->scene != NULL)
-		free_InterchangedObject(m->scene);
+		free_object(m->scene, &m->scene_arena);
+
+	if(m->app != NULL)
+		free_object(m->app, &m->app_arena);
 
 	safe_free(m->app);
 	safe_free(m->scene);
 
+	MHEGApp_flushSceneCache(m);
+
 	/* in case it gets reused */
 	MHEGApp_init(m);
 
@@ -47,8 +72,7 @@ MHEGApp_fini(MHEGApp *m)
 ApplicationClass *
 MHEGApp_loadApplication(MHEGApp *m, OctetString *derfile)
 {
-	FILE *der;
-	int len;
+	OctetString data;
 	int rc;
 
 	/* assert */
@@ -56,14 +80,16 @@ MHEGApp_loadApplication(MHEGApp *m, OctetString *derfile)
 		fatal("MHEGApp_loadApplication: group ID '%.*s' is not absolute", derfile->size, derfile->data);
 
 	if(m->app != NULL)
-		free_InterchangedObject(m->app);
+		free_object(m->app, &m->app_arena);
 	else
 		m->app = safe_malloc(sizeof(InterchangedObject));
 	bzero(m->app, sizeof(InterchangedObject));
 
-	if((der = MHEGEngine_openFile(derfile)) == NULL)
+	/* load it into memory, it may already have been prefetched */
+	if(!MHEGEngine_loadFile(derfile, &data))
 	{
 		error("Unable to open '%.*s'", derfile->size, derfile->data);
+		safe_free(data.data);
 		safe_free(m->app);
 		m->app = NULL;
 		return NULL;
@@ -71,16 +97,13 @@ MHEGApp_loadApplication(MHEGApp *m, OctetString *derfile)
 
 	/* so all the ObjectReferences get resolved to the current file */
 	MHEGEngine_setDERObject(derfile);
-	/* DER decode it */
-	fseek(der, 0, SEEK_END);
-	len = ftell(der);
-	rewind(der);
-	rc = der_decode_InterchangedObject(der, m->app, len);
-	fclose(der);
+	/* DER decode it straight from memory */
+	rc = decode_object(&data, m->app, &m->app_arena);
+	safe_free(data.data);
 
 	if(rc < 0 || m->app->choice != InterchangedObject_application)
 	{
-		free_InterchangedObject(m->app);
+		free_object(m->app, &m->app_arena);
 		safe_free(m->app);
 		m->app = NULL;
 		if(rc < 0)
@@ -102,8 +125,9 @@ MHEGApp_loadApplication(MHEGApp *m, OctetString *derfile)
 SceneClass *
 MHEGApp_loadScene(MHEGApp *m, OctetString *derfile)
 {
-	FILE *der;
-	int len;
+	OctetString data;
+	uint32_t hash;
+	LIST_TYPE(MHEGSceneCacheEntry) *cached;
 	int rc;
 
 	/* assert */
@@ -111,14 +135,16 @@ MHEGApp_loadScene(MHEGApp *m, OctetString *derfile)
 		fatal("MHEGApp_loadApplication: group ID '%.*s' is not absolute", derfile->size, derfile->data);
 
 	if(m->scene != NULL)
-		free_InterchangedObject(m->scene);
+		free_object(m->scene, &m->scene_arena);
 	else
 		m->scene = safe_malloc(sizeof(InterchangedObject));
 	bzero(m->scene, sizeof(InterchangedObject));
 
-	if((der = MHEGEngine_openFile(derfile)) == NULL)
+	/* load it into memory, it may already have been prefetched */
+	if(!MHEGEngine_loadFile(derfile, &data))
 	{
 		error("Unable to open '%.*s'", derfile->size, derfile->data);
+		safe_free(data.data);
 		safe_free(m->scene);
 		m->scene = NULL;
 		return NULL;
@@ -126,16 +152,26 @@ MHEGApp_loadScene(MHEGApp *m, OctetString *derfile)
 
 	/* so all the ObjectReferences get resolved to the current file */
 	MHEGEngine_setDERObject(derfile);
-	/* DER decode it */
-	fseek(der, 0, SEEK_END);
-	len = ftell(der);
-	rewind(der);
-	rc = der_decode_InterchangedObject(der, m->scene, len);
-	fclose(der);
+
+	/* have we decoded this version of the scene before */
+	hash = OctetString_hash(&data);
+	if((cached = find_scene(m, derfile, &data, hash)) != NULL)
+	{
+		verbose("Scene '%.*s' is in the cache", derfile->size, derfile->data);
+		safe_free(data.data);
+		copy_scene(m->scene, &m->scene_arena, &cached->item.scene, cached->item.arena.used);
+		register_objects(&m->scene->u.scene, true);
+		m->scene_cached = true;
+		return &m->scene->u.scene;
+	}
+
+	/* DER decode it straight from memory */
+	rc = decode_object(&data, m->scene, &m->scene_arena);
 
 	if(rc < 0 || m->scene->choice != InterchangedObject_scene)
 	{
-		free_InterchangedObject(m->scene);
+		safe_free(data.data);
+		free_object(m->scene, &m->scene_arena);
 		safe_free(m->scene);
 		m->scene = NULL;
 		if(rc < 0)
@@ -145,7 +181,208 @@ MHEGApp_loadScene(MHEGApp *m, OctetString *derfile)
 		return NULL;
 	}
 
+	/* keep a copy before Preparation changes anything */
+	add_scene(m, derfile, &data, hash);
+	safe_free(data.data);
+	m->scene_cached = false;
+
 	return &m->scene->u.scene;
 }
 
+/*
+ * forget all the decoded scenes
+ * eg when we retune, the files on the new service will be different
+ */
+
+void
+MHEGApp_flushSceneCache(MHEGApp *m)
+{
+	LIST_FREE_ITEMS(&m->scene_cache, MHEGSceneCacheEntry, free_scene, safe_free);
+
+	return;
+}
+
+/*
+ * decode the objects into the arena, so there is only one malloc per arena chunk
+ * returns the der_decode_InterchangedObject() return code
+ */
+
+static int
+decode_object(OctetString *data, InterchangedObject *obj, der_arena *arena)
+{
+	der_cursor der;
+	struct timespec start, end;
+	int rc;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	der_arena_init(arena, data->size * ARENA_SIZE_RATIO);
+	der_arena_begin(arena);
+	der_cursor_init(&der, data->data, data->size);
+	rc = der_decode_InterchangedObject(&der, obj, data->size);
+	der_arena_end(arena);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	verbose("Decoded %u bytes in %.3f ms: %lu allocations from %u arena chunks (%lu of %lu KB used)",
+		data->size,
+		((end.tv_sec - start.tv_sec) * 1000.0) + ((end.tv_nsec - start.tv_nsec) / 1000000.0),
+		arena->nallocs, arena->nchunks, (unsigned long) (arena->used / 1024), (unsigned long) (arena->size / 1024));
+
+	return rc;
+}
+
+/*
+ * free_InterchangedObject still walks the tree so each object gets unregistered from the engine
+ * but it only really frees clones and data created at run time (they came from safe_malloc)
+ * the decoded objects all go at once when we release the arena
+ */
+
+static void
+free_object(InterchangedObject *obj, der_arena *arena)
+{
+	free_InterchangedObject(obj);
+	der_arena_release(arena);
+
+	return;
+}
+
+/*
+ * returns the cache entry for this version of the scene, or NULL if it is not cached
+ * if we have a different version of the scene, the carousel has been updated, so get rid of it
+ * a hit becomes the most recently used entry
+ */
+
+static LIST_TYPE(MHEGSceneCacheEntry) *
+find_scene(MHEGApp *m, OctetString *gid, OctetString *data, uint32_t hash)
+{
+	LIST_TYPE(MHEGSceneCacheEntry) *entry = m->scene_cache;
+
+	while(entry)
+	{
+		if(OctetString_cmp(&entry->item.group_id, gid) == 0)
+		{
+			LIST_REMOVE(&m->scene_cache, entry);
+			if(entry->item.hash == hash
+			&& OctetString_cmp(&entry->item.der, data) == 0)
+			{
+				LIST_PREPEND(&m->scene_cache, entry);
+				return entry;
+			}
+			verbose("Scene '%.*s' has changed, removing it from the cache", gid->size, gid->data);
+			free_scene(&entry->item);
+			safe_free(entry);
+			return NULL;
+		}
+		entry = entry->next;
+	}
 
+	return NULL;
+}
+
+/*
+ * add a pristine copy of the newly decoded m->scene to the front of the cache
+ * gets rid of the least recently used scene if the cache is full
+ */
+
+static void
+add_scene(MHEGApp *m, OctetString *gid, OctetString *data, uint32_t hash)
+{
+	LIST_TYPE(MHEGSceneCacheEntry) *entry;
+	LIST_TYPE(MHEGSceneCacheEntry) *tail;
+	unsigned int nentries = 0;
+
+	entry = safe_mallocz(sizeof(LIST_TYPE(MHEGSceneCacheEntry)));
+	OctetString_dup(&entry->item.group_id, gid);
+	entry->item.hash = hash;
+	OctetString_dup(&entry->item.der, data);
+	copy_scene(&entry->item.scene, &entry->item.arena, m->scene, m->scene_arena.used);
+	/* the copy is not registered with the engine */
+	register_objects(&entry->item.scene.u.scene, false);
+
+	LIST_PREPEND(&m->scene_cache, entry);
+
+	for(entry=m->scene_cache; entry; entry=entry->next)
+		nentries ++;
+	if(nentries > MHEGAPP_SCENE_CACHE_SIZE)
+	{
+		tail = m->scene_cache->prev;
+		verbose("Removing scene '%.*s' from the cache", tail->item.group_id.size, tail->item.group_id.data);
+		LIST_REMOVE(&m->scene_cache, tail);
+		free_scene(&tail->item);
+		safe_free(tail);
+	}
+
+	return;
+}
+
+/*
+ * deep copy src into dst, dst's objects go in the given arena
+ * size is how much memory src's objects take up
+ */
+
+static void
+copy_scene(InterchangedObject *dst, der_arena *arena, InterchangedObject *src, size_t size)
+{
+	der_arena_init(arena, size);
+	der_arena_begin(arena);
+	dup_InterchangedObject(dst, src);
+	der_arena_end(arena);
+
+	return;
+}
+
+/*
+ * nothing in the cache is registered with the engine, so we just need to release the arena
+ */
+
+static void
+free_scene(MHEGSceneCacheEntry *entry)
+{
+	der_arena_release(&entry->arena);
+	free_OctetString(&entry->group_id);
+	free_OctetString(&entry->der);
+
+	return;
+}
+
+/*
+ * the dup_ functions copy the RootClass instance vars too
+ * so give each object fresh ones, as if it had just been decoded
+ * if add is true, also register the objects with the engine, as der_decode_RootClass does
+ * MHEGEngine_setDERObject must have been called first
+ */
+
+static void
+register_objects(SceneClass *scene, bool add)
+{
+	LIST_TYPE(GroupItem) *gi;
+
+	register_object(&scene->rootClass, add);
+
+	for(gi=scene->items; gi; gi=gi->next)
+		register_object(GroupItem_rootClass(&gi->item), add);
+
+	return;
+}
+
+static void
+register_object(RootClass *r, bool add)
+{
+	unsigned int rtti;
+
+	if(r == NULL)
+		return;
+
+	/* der_decode_TYPE sets the RTTI after it has registered the object */
+	rtti = r->inst.rtti;
+
+	if(add)
+		RootClass_registerObject(r);
+	else
+		bzero(&r->inst, sizeof(RootClassInstanceVars));
+
+	r->inst.rtti = rtti;
+
+	return;
+}
@@ -5,12 +5,33 @@
 #ifndef __MHEGAPP_H__
 #define __MHEGAPP_H__
 
+#include <stdint.h>
+#include <stdbool.h>
+
 #include "ISO13522-MHEG-5.h"
 
+/* max number of decoded scenes we keep so we can go back to them without decoding them again */
+#define MHEGAPP_SCENE_CACHE_SIZE	4
+
+typedef struct
+{
+	OctetString group_id;		/* absolute group ID of the scene */
+	uint32_t hash;			/* hash of the DER data */
+	OctetString der;		/* the DER data, so we notice if the carousel has updated the file */
+	InterchangedObject scene;	/* pristine decoded scene, its objects are not registered with the engine */
+	der_arena arena;		/* the scene objects live in here */
+} MHEGSceneCacheEntry;
+
+DEFINE_LIST_OF(MHEGSceneCacheEntry);
+
 typedef struct
 {
 	InterchangedObject *app;
 	InterchangedObject *scene;
+	der_arena app_arena;		/* the decoded app and scene objects live in these */
+	der_arena scene_arena;
+	LIST_OF(MHEGSceneCacheEntry) *scene_cache;	/* most recently used first */
+	bool scene_cached;		/* true if the current scene was copied from the cache */
 } MHEGApp;
 
 void MHEGApp_init(MHEGApp *);
@@ -19,5 +40,7 @@ void MHEGApp_fini(MHEGApp *);
 ApplicationClass *MHEGApp_loadApplication(MHEGApp *, OctetString *);
 SceneClass *MHEGApp_loadScene(MHEGApp *, OctetString *);
 
+void MHEGApp_flushSceneCache(MHEGApp *);
+
 #endif	/* __MHEGAPP_H__ */
 
@@ -17,6 +17,7 @@ MHEGAudioOutput_init(MHEGAudioOutput *a)
 	int err;
 
 	a->ctx = NULL;
+	a->rate = 0;
 
 	if((err = snd_pcm_open(&a->ctx, ALSA_AUDIO_DEVICE, SND_PCM_STREAM_PLAYBACK, 0)) < 0)
 	{
@@ -100,6 +101,8 @@ MHEGAudioOutput_setParams(MHEGAudioOutput *a, snd_pcm_format_t format, unsigned
 
 	snd_pcm_hw_params_free(hw_params);
 
+	a->rate = rate;
+
 	return true;
 }
 
@@ -124,3 +127,28 @@ MHEGAudioOutput_addSamples(MHEGAudioOutput *a, uint16_t *samples, unsigned int n
 	return;
 }
 
+/*
+ * sets *secs to how long it will be before the last sample we added is played
+ * returns false if we don't know
+ */
+
+bool
+MHEGAudioOutput_getDelay(MHEGAudioOutput *a, double *secs)
+{
+	snd_pcm_sframes_t frames;
+
+	if(a->ctx == NULL || a->rate == 0)
+		return false;
+
+	if(snd_pcm_delay(a->ctx, &frames) < 0)
+		return false;
+
+	/* can be negative after an underrun */
+	if(frames < 0)
+		frames = 0;
+
+	*secs = (double) frames / a->rate;
+
+	return true;
+}
+
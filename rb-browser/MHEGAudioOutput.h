@@ -12,6 +12,7 @@
 typedef struct
 {
 	snd_pcm_t *ctx;
+	unsigned int rate;		/* sample rate we actually got */
 } MHEGAudioOutput;
 
 /* default ALSA device */
@@ -24,4 +25,6 @@ bool MHEGAudioOutput_setParams(MHEGAudioOutput *, snd_pcm_format_t, unsigned int
 
 void MHEGAudioOutput_addSamples(MHEGAudioOutput *, uint16_t *, unsigned int);
 
+bool MHEGAudioOutput_getDelay(MHEGAudioOutput *, double *);
+
 #endif	/* __MHEGAUDIOOUTPUT_H__ */
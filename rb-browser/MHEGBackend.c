@@ -6,11 +6,13 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/inotify.h>
 
 #include "MHEGEngine.h"
 #include "si.h"
@@ -33,12 +35,17 @@ static int get_host_addr(char *, struct in_addr *);
 
 static char *external_filename(MHEGBackend *, OctetString *);
 
+static int local_notify_open(void);
+
 /* local backend funcs */
 bool local_checkContentRef(MHEGBackend *, ContentReference *);
 bool local_loadFile(MHEGBackend *, OctetString *, OctetString *);
 FILE *local_openFile(MHEGBackend *, OctetString *);
 void local_retune(MHEGBackend *, OctetString *);
 bool local_isServiceAvailable(MHEGBackend *, OctetString *);
+bool local_watchContentRef(MHEGBackend *, ContentReference *);
+void local_unwatchContent(MHEGBackend *);
+bool local_readNotify(MHEGBackend *);
 
 static struct MHEGBackendFns local_backend_fns =
 {
@@ -50,6 +57,9 @@ static struct MHEGBackendFns local_backend_fns =
 	local_retune,			/* retune */
 	get_service_url,		/* getServiceURL */
 	local_isServiceAvailable,	/* isServiceAvailable */
+	local_watchContentRef,		/* watchContentRef */
+	local_unwatchContent,		/* unwatchContent */
+	local_readNotify,		/* readNotify */
 };
 
 /* remote backend funcs */
@@ -58,6 +68,9 @@ bool remote_loadFile(MHEGBackend *, OctetString *, OctetString *);
 FILE *remote_openFile(MHEGBackend *, OctetString *);
 void remote_retune(MHEGBackend *, OctetString *);
 bool remote_isServiceAvailable(MHEGBackend *, OctetString *);
+bool remote_watchContentRef(MHEGBackend *, ContentReference *);
+void remote_unwatchContent(MHEGBackend *);
+bool remote_readNotify(MHEGBackend *);
 
 static struct MHEGBackendFns remote_backend_fns =
 {
@@ -69,6 +82,9 @@ static struct MHEGBackendFns remote_backend_fns =
 	remote_retune,			/* retune */
 	get_service_url,		/* getServiceURL */
 	remote_isServiceAvailable,	/* isServiceAvailable */
+	remote_watchContentRef,		/* watchContentRef */
+	remote_unwatchContent,		/* unwatchContent */
+	remote_readNotify,		/* readNotify */
 };
 
 /* public interface */
@@ -86,6 +102,12 @@ MHEGBackend_init(MHEGBackend *b, bool remote, char *srg_loc)
 	/* no connection to the backend yet */
 	b->be_sock = NULL;
 
+	/* not watching for any files yet */
+	b->notify_fd = -1;
+
+	/* the engine and the prefetch thread share the backend */
+	pthread_mutex_init(&b->lock, NULL);
+
 	/* don't know rec://svc/def yet */
 	b->rec_svc_def.size = 0;
 	b->rec_svc_def.data = NULL;
@@ -107,6 +129,8 @@ MHEGBackend_init(MHEGBackend *b, bool remote, char *srg_loc)
 		b->fns = &local_backend_fns;
 		b->base_dir = safe_strdup(srg_loc);
 		verbose("Local backend; carousel file root '%s'", srg_loc);
+		/* so the engine can sleep until missing files turn up in the service gateway */
+		b->notify_fd = local_notify_open();
 		/* initialise rec://svc/def value */
 		local_set_service_url(b);
 	}
@@ -124,10 +148,15 @@ MHEGBackend_fini(MHEGBackend *b)
 	&& remote_command(b, true, "quit\n") != NULL)
 		fclose(b->be_sock);
 
+	if(b->notify_fd != -1)
+		close(b->notify_fd);
+
 	safe_free(b->base_dir);
 
 	safe_free(b->rec_svc_def.data);
 
+	pthread_mutex_destroy(&b->lock);
+
 	return;
 }
 
@@ -487,7 +516,8 @@ get_host_addr(char *host, struct in_addr *output)
  * returns a ptr to a static string that will be overwritten by the next call to this routine
  */
 
-static char _external[PATH_MAX];
+/* the engine and prefetch threads both call this */
+static __thread char _external[PATH_MAX];
 
 static char *
 external_filename(MHEGBackend *t, OctetString *name)
@@ -672,6 +702,110 @@ local_isServiceAvailable(MHEGBackend *t, OctetString *service)
 	return exists;
 }
 
+/*
+ * the events that may mean a file we are waiting for has arrived
+ * the carousel is usually written by another process, so we want to know when it has finished writing the file
+ */
+
+#define LOCAL_NOTIFY_EVENTS	(IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB)
+
+/*
+ * ask to be told via notify_fd when the file may have arrived
+ * we watch the deepest directory on its path that exists
+ * if that turns out to be a parent directory, we will be told when the next directory down is created
+ * and the engine will call us again to watch that
+ * returns false if we can't watch it, in which case the engine will have to keep checking
+ */
+
+bool
+local_watchContentRef(MHEGBackend *t, ContentReference *name)
+{
+	char dir[PATH_MAX];
+	char *slash;
+
+	if(t->notify_fd == -1)
+		return false;
+
+	snprintf(dir, sizeof(dir), "%s", external_filename(t, name));
+
+	do
+	{
+		if((slash = strrchr(dir, '/')) == NULL)
+			strcpy(dir, ".");
+		else if(slash == dir)
+			dir[1] = '\0';
+		else
+			*slash = '\0';
+		/* watching the same directory again just returns the existing watch */
+		if(inotify_add_watch(t->notify_fd, dir, LOCAL_NOTIFY_EVENTS) >= 0)
+			return true;
+	}
+	while(errno == ENOENT && strcmp(dir, ".") != 0 && strcmp(dir, "/") != 0);
+
+	verbose("Unable to watch '%s': %s", dir, strerror(errno));
+
+	return false;
+}
+
+/*
+ * stop watching for all missing files
+ * quicker to start again with a new inotify fd than remove each watch
+ */
+
+void
+local_unwatchContent(MHEGBackend *t)
+{
+	if(t->notify_fd == -1)
+		return;
+
+	close(t->notify_fd);
+	t->notify_fd = local_notify_open();
+
+	return;
+}
+
+/*
+ * read any pending inotify events
+ * we don't look at which files they are for, the engine just checks all its missing files again
+ * returns true if there were any events
+ */
+
+bool
+local_readNotify(MHEGBackend *t)
+{
+	/* big enough for at least one event with the longest filename */
+	char buf[sizeof(struct inotify_event) + NAME_MAX + 1] __attribute__((aligned(__alignof__(struct inotify_event))));
+	bool changed = false;
+	ssize_t len;
+
+	if(t->notify_fd == -1)
+		return false;
+
+	while((len = read(t->notify_fd, buf, sizeof(buf))) > 0)
+		changed = true;
+
+	if(len < 0 && errno != EAGAIN && errno != EINTR)
+		error("Unable to read inotify events: %s", strerror(errno));
+
+	return changed;
+}
+
+/*
+ * returns a non-blocking inotify fd, or -1 if we can't get one
+ * the engine will fall back to checking for missing files on a timer
+ */
+
+static int
+local_notify_open(void)
+{
+	int fd;
+
+	if((fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+		error("Unable to create inotify fd: %s", strerror(errno));
+
+	return fd;
+}
+
 /*
  * remote routines
  */
@@ -859,3 +993,26 @@ remote_isServiceAvailable(MHEGBackend *t, OctetString *service)
 
 	return available;
 }
+
+/*
+ * the remote backend has no way to tell us when a file arrives
+ * so the engine has to keep asking
+ */
+
+bool
+remote_watchContentRef(MHEGBackend *t, ContentReference *name)
+{
+	return false;
+}
+
+void
+remote_unwatchContent(MHEGBackend *t)
+{
+	return;
+}
+
+bool
+remote_readNotify(MHEGBackend *t)
+{
+	return false;
+}
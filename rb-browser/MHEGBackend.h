@@ -7,6 +7,7 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <pthread.h>
 #include <netinet/in.h>
 
 /* default TCP port to contact backend on */
@@ -27,6 +28,8 @@ typedef struct MHEGBackend
 	char *base_dir;			/* local Service Gateway root directory */
 	struct sockaddr_in addr;	/* remote backend IP and port */
 	FILE *be_sock;			/* connection to remote backend */
+	int notify_fd;			/* inotify fd watching for missing local carousel files, -1 if none */
+	pthread_mutex_t lock;		/* held while calling any of the functions below */
 	/* function pointers */
 	struct MHEGBackendFns
 	{
@@ -46,6 +49,12 @@ typedef struct MHEGBackend
 		const OctetString *(*getServiceURL)(struct MHEGBackend *);
 		/* return true if the engine is able to receive the given service (dvb:// URL format) */
 		bool (*isServiceAvailable)(struct MHEGBackend *, OctetString *);
+		/* ask to be told via notify_fd when a missing carousel file may have arrived, false if we can't be told */
+		bool (*watchContentRef)(struct MHEGBackend *, ContentReference *);
+		/* stop watching for all missing carousel files */
+		void (*unwatchContent)(struct MHEGBackend *);
+		/* read any pending notifications from notify_fd, true if something may have arrived */
+		bool (*readNotify)(struct MHEGBackend *);
 	} *fns;
 } MHEGBackend;
 
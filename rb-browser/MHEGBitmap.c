@@ -0,0 +1,649 @@
+/*
+ * MHEGBitmap.c
+ *
+ * cache of decoded PNG and MPEG I-frame bitmaps
+ * the same content is only decoded and sent to the X server once, no matter how many BitmapClass objects use it
+ * content can be queued for decoding by a pool of worker threads before it is needed
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <ffmpeg/avformat.h>
+
+#include "MHEGEngine.h"
+#include "MHEGBitmap.h"
+#include "MHEGDisplay.h"
+#include "readpng.h"
+#include "listof.h"
+#include "utils.h"
+
+/* where an entry in the cache has got to */
+typedef enum
+{
+	BitmapState_queued,		/* waiting to be decoded */
+	BitmapState_decoding,		/* being decoded */
+	BitmapState_decoded,		/* decoded, but not yet sent to the X server */
+	BitmapState_ready,		/* the Pixmap and Picture have been created */
+	BitmapState_failed		/* unable to decode the content */
+} BitmapState;
+
+typedef struct
+{
+	MHEGBitmap bitmap;		/* what we give to the BitmapClass */
+	unsigned int refs;		/* number of BitmapClass objects using it */
+	uint32_t hash;			/* hash of the content */
+	OctetString data;		/* our copy of the content */
+	bool mpeg;			/* true => data is an MPEG I-frame, false => PNG */
+	BitmapState state;
+	MHEGPixels pixels;		/* decoded pixels, until they are given to the display backend */
+	size_t nbytes;			/* size of the decoded bitmap */
+} BitmapCacheEntry;
+
+DEFINE_LIST_OF(BitmapCacheEntry);
+
+/* internal functions */
+static LIST_TYPE(BitmapCacheEntry) *find_entry(OctetString *, bool, uint32_t);
+static LIST_TYPE(BitmapCacheEntry) *add_entry(OctetString *, bool, uint32_t);
+static void free_entry(LIST_TYPE(BitmapCacheEntry) *);
+static void evict_entries(void);
+
+static void decode_entry(BitmapCacheEntry *, AVCodecContext *);
+static bool decode_png(OctetString *, MHEGPixels *);
+static bool decode_mpeg(AVCodecContext *, OctetString *, MHEGPixels *);
+static AVCodecContext *open_mpeg_decoder(void);
+static void close_mpeg_decoder(AVCodecContext *);
+static void *decode_thread(void *);
+
+/*
+ * the cache, most recently used first
+ * _cache_lock protects everything here
+ * only the engine thread adds or removes entries, the worker threads just decode them
+ */
+static LIST_OF(BitmapCacheEntry) *_cache = NULL;
+static pthread_mutex_t _cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _work_cond = PTHREAD_COND_INITIALIZER;	/* signalled when there is something to decode */
+static pthread_cond_t _done_cond = PTHREAD_COND_INITIALIZER;	/* signalled when something has been decoded */
+static size_t _cache_bytes = 0;					/* size of all the decoded bitmaps in the cache */
+static unsigned int _nqueued = 0;				/* number of entries waiting to be decoded */
+static unsigned int _hits = 0;
+static unsigned int _misses = 0;
+
+/* worker threads */
+static bool _stop = false;
+static unsigned int _nworkers = 0;
+static pthread_t _worker_tid[MHEGBITMAP_MAX_WORKERS];
+static AVCodecContext *_worker_mpeg[MHEGBITMAP_MAX_WORKERS];
+
+/* MPEG decoder for the engine thread, opened when first needed */
+static AVCodecContext *_engine_mpeg = NULL;
+
+/*
+ * start the worker threads
+ * call after MHEGDisplay_init()
+ */
+
+void
+MHEGBitmap_initCache(void)
+{
+	long ncpus;
+	unsigned int i;
+
+	/* one worker per CPU */
+	if((ncpus = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		ncpus = 1;
+	_nworkers = MIN(ncpus, MHEGBITMAP_MAX_WORKERS);
+
+	_stop = false;
+	for(i=0; i<_nworkers; i++)
+	{
+		/* avcodec_open is not thread safe, so open the decoders here */
+		_worker_mpeg[i] = open_mpeg_decoder();
+		if(pthread_create(&_worker_tid[i], NULL, decode_thread, _worker_mpeg[i]) != 0)
+			fatal("Unable to create bitmap decoder thread");
+	}
+
+	verbose("MHEGBitmap: %u decoder threads", _nworkers);
+
+	return;
+}
+
+/*
+ * stop the worker threads and free everything in the cache
+ * call before MHEGDisplay_fini()
+ */
+
+void
+MHEGBitmap_freeCache(void)
+{
+	unsigned int i;
+
+	/* stop the workers */
+	pthread_mutex_lock(&_cache_lock);
+	_stop = true;
+	pthread_cond_broadcast(&_work_cond);
+	pthread_mutex_unlock(&_cache_lock);
+
+	for(i=0; i<_nworkers; i++)
+	{
+		pthread_join(_worker_tid[i], NULL);
+		close_mpeg_decoder(_worker_mpeg[i]);
+	}
+	_nworkers = 0;
+
+	if(_engine_mpeg != NULL)
+	{
+		close_mpeg_decoder(_engine_mpeg);
+		_engine_mpeg = NULL;
+	}
+
+	/* we are shutting down, so free everything even if it is still in use */
+	while(_cache)
+	{
+		LIST_TYPE(BitmapCacheEntry) *entry = _cache;
+		LIST_REMOVE(&_cache, entry);
+		free_entry(entry);
+	}
+	_cache_bytes = 0;
+	_nqueued = 0;
+
+	return;
+}
+
+/*
+ * start decoding the content in the background, if it is not already in the cache
+ * mpeg should be true for an MPEG I-frame, false for PNG
+ */
+
+void
+MHEGBitmap_prefetch(OctetString *data, bool mpeg)
+{
+	uint32_t hash;
+
+	/* nothing to do, or no one to do it */
+	if(data == NULL || data->size == 0 || _nworkers == 0)
+		return;
+
+	hash = OctetString_hash(data);
+
+	pthread_mutex_lock(&_cache_lock);
+
+	if(find_entry(data, mpeg, hash) == NULL)
+	{
+		(void) add_entry(data, mpeg, hash);
+		pthread_cond_signal(&_work_cond);
+		/* make room for it */
+		evict_entries();
+	}
+
+	pthread_mutex_unlock(&_cache_lock);
+
+	return;
+}
+
+/*
+ * returns a bitmap for the given PNG (mpeg=false) or MPEG I-frame (mpeg=true) content
+ * returns NULL if the content can't be decoded
+ * call MHEGBitmap_release() when you are done with it
+ */
+
+MHEGBitmap *
+MHEGBitmap_get(OctetString *data, bool mpeg)
+{
+	LIST_TYPE(BitmapCacheEntry) *entry;
+	BitmapCacheEntry *e;
+	MHEGBitmap *bitmap;
+	uint32_t hash;
+	bool hit;
+
+	/* nothing to do */
+	if(data == NULL || data->size == 0)
+		return NULL;
+
+	hash = OctetString_hash(data);
+
+	pthread_mutex_lock(&_cache_lock);
+
+	/* do we already have it */
+	if((entry = find_entry(data, mpeg, hash)) != NULL)
+	{
+		hit = true;
+		_hits ++;
+		/* move it to the front */
+		LIST_REMOVE(&_cache, entry);
+		LIST_PREPEND(&_cache, entry);
+	}
+	else
+	{
+		hit = false;
+		_misses ++;
+		entry = add_entry(data, mpeg, hash);
+	}
+	e = &entry->item;
+
+	/* if no one has started decoding it yet, do it ourselves */
+	if(e->state == BitmapState_queued)
+	{
+		e->state = BitmapState_decoding;
+		_nqueued --;
+		pthread_mutex_unlock(&_cache_lock);
+		if(mpeg && _engine_mpeg == NULL)
+			_engine_mpeg = open_mpeg_decoder();
+		decode_entry(e, _engine_mpeg);
+		pthread_mutex_lock(&_cache_lock);
+	}
+
+	/* wait for a worker to finish decoding it */
+	while(e->state == BitmapState_decoding)
+		pthread_cond_wait(&_done_cond, &_cache_lock);
+
+	/* give it to the display backend if we have not done so already */
+	if(e->state == BitmapState_decoded)
+	{
+		MHEGDisplay_newBitmap(MHEGEngine_getDisplay(), &e->pixels, &e->bitmap);
+		/* NULL if the backend kept the pixels */
+		safe_free(e->pixels.data);
+		e->pixels.data = NULL;
+		e->state = BitmapState_ready;
+	}
+
+	if(e->state == BitmapState_ready)
+	{
+		e->refs ++;
+		bitmap = &e->bitmap;
+	}
+	else
+	{
+		/* don't keep failed content */
+		LIST_REMOVE(&_cache, entry);
+		free_entry(entry);
+		bitmap = NULL;
+	}
+
+	evict_entries();
+
+	verbose("MHEGBitmap: cache %s (hits=%u misses=%u; %u%%)", hit ? "hit" : "miss",
+		_hits, _misses, (_hits * 100) / (_hits + _misses));
+
+	pthread_mutex_unlock(&_cache_lock);
+
+	return bitmap;
+}
+
+/*
+ * the bitmap stays in the cache until we need the space
+ */
+
+void
+MHEGBitmap_release(MHEGBitmap *bitmap)
+{
+	LIST_TYPE(BitmapCacheEntry) *entry;
+
+	if(bitmap == NULL)
+		return;
+
+	/* the bitmap is embedded in its cache list item */
+	entry = (LIST_TYPE(BitmapCacheEntry) *) ((char *) bitmap - offsetof(LIST_TYPE(BitmapCacheEntry), item.bitmap));
+
+	pthread_mutex_lock(&_cache_lock);
+
+	if(entry->item.refs > 0)
+		entry->item.refs --;
+	else
+		error("MHEGBitmap_release: bitmap is not in use");
+
+	evict_entries();
+
+	pthread_mutex_unlock(&_cache_lock);
+
+	return;
+}
+
+/*
+ * _cache_lock must be held by the caller
+ */
+
+static LIST_TYPE(BitmapCacheEntry) *
+find_entry(OctetString *data, bool mpeg, uint32_t hash)
+{
+	LIST_TYPE(BitmapCacheEntry) *entry = _cache;
+
+	while(entry)
+	{
+		if(entry->item.hash == hash
+		&& entry->item.mpeg == mpeg
+		&& OctetString_cmp(&entry->item.data, data) == 0)
+			return entry;
+		entry = entry->next;
+	}
+
+	return NULL;
+}
+
+/*
+ * adds a new entry to the front of the cache, waiting to be decoded
+ * _cache_lock must be held by the caller
+ */
+
+static LIST_TYPE(BitmapCacheEntry) *
+add_entry(OctetString *data, bool mpeg, uint32_t hash)
+{
+	LIST_TYPE(BitmapCacheEntry) *entry;
+
+	entry = safe_mallocz(sizeof(LIST_TYPE(BitmapCacheEntry)));
+	entry->item.refs = 0;
+	entry->item.hash = hash;
+	OctetString_dup(&entry->item.data, data);
+	entry->item.mpeg = mpeg;
+	entry->item.state = BitmapState_queued;
+	entry->item.pixels.data = NULL;
+	entry->item.nbytes = 0;
+
+	LIST_PREPEND(&_cache, entry);
+	_nqueued ++;
+
+	return entry;
+}
+
+/*
+ * entry must already be removed from the cache
+ * must be called from the engine thread
+ */
+
+static void
+free_entry(LIST_TYPE(BitmapCacheEntry) *entry)
+{
+	BitmapCacheEntry *e = &entry->item;
+
+	if(e->state == BitmapState_ready)
+		MHEGDisplay_freeBitmap(MHEGEngine_getDisplay(), &e->bitmap);
+
+	_cache_bytes -= e->nbytes;
+
+	safe_free(e->pixels.data);
+	free_OctetString(&e->data);
+	safe_free(entry);
+
+	return;
+}
+
+/*
+ * free the least recently used entries that are not in use until the cache fits in MHEGBITMAP_CACHE_SIZE
+ * also gets rid of any content we could not decode
+ * _cache_lock must be held by the caller
+ */
+
+static void
+evict_entries(void)
+{
+	LIST_TYPE(BitmapCacheEntry) *entry;
+	LIST_TYPE(BitmapCacheEntry) *prev;
+
+	if(_cache == NULL)
+		return;
+
+	/* start at the tail */
+	entry = _cache->prev;
+	while(entry)
+	{
+		/* the head's prev is the tail */
+		prev = (entry == _cache) ? NULL : entry->prev;
+		if(entry->item.refs == 0
+		&& (entry->item.state == BitmapState_failed
+		 || ((entry->item.state == BitmapState_decoded || entry->item.state == BitmapState_ready)
+		     && _cache_bytes > MHEGBITMAP_CACHE_SIZE)))
+		{
+			LIST_REMOVE(&_cache, entry);
+			free_entry(entry);
+		}
+		entry = prev;
+	}
+
+	return;
+}
+
+/*
+ * e->state must be BitmapState_decoding
+ * called without _cache_lock held
+ */
+
+static void
+decode_entry(BitmapCacheEntry *e, AVCodecContext *codec_ctx)
+{
+	MHEGPixels pixels;
+	bool ok;
+
+	if(e->mpeg)
+		ok = decode_mpeg(codec_ctx, &e->data, &pixels);
+	else
+		ok = decode_png(&e->data, &pixels);
+
+	pthread_mutex_lock(&_cache_lock);
+	if(ok)
+	{
+		e->pixels = pixels;
+		e->nbytes = pixels.width * pixels.height * 4;
+		_cache_bytes += e->nbytes;
+		e->state = BitmapState_decoded;
+	}
+	else
+	{
+		e->state = BitmapState_failed;
+	}
+	pthread_cond_broadcast(&_done_cond);
+	pthread_mutex_unlock(&_cache_lock);
+
+	return;
+}
+
+static void *
+decode_thread(void *arg)
+{
+	AVCodecContext *codec_ctx = (AVCodecContext *) arg;
+	LIST_TYPE(BitmapCacheEntry) *entry;
+
+	pthread_mutex_lock(&_cache_lock);
+	while(!_stop)
+	{
+		if(_nqueued == 0)
+		{
+			pthread_cond_wait(&_work_cond, &_cache_lock);
+			continue;
+		}
+		/* most recently requested first */
+		entry = _cache;
+		while(entry && entry->item.state != BitmapState_queued)
+			entry = entry->next;
+		if(entry == NULL)
+		{
+			/* shouldn't happen */
+			_nqueued = 0;
+			continue;
+		}
+		entry->item.state = BitmapState_decoding;
+		_nqueued --;
+		pthread_mutex_unlock(&_cache_lock);
+		decode_entry(&entry->item, codec_ctx);
+		pthread_mutex_lock(&_cache_lock);
+	}
+	pthread_mutex_unlock(&_cache_lock);
+
+	return NULL;
+}
+
+/*
+ * convert the given PNG data to an internal format
+ * returns false on error
+ */
+
+static bool
+decode_png(OctetString *png, MHEGPixels *out)
+{
+	png_uint_32 width, height;
+	unsigned char *rgba;
+	unsigned int i;
+
+	/* convert the PNG into a standard format we can use as an XImage */
+	if((rgba = readpng_get_image(png->data, png->size, &width, &height)) == NULL)
+	{
+		error("Unable to decode PNG file");
+		return false;
+	}
+
+	/*
+	 * we now have an array of 32-bit RGBA pixels in network byte order
+	 * ie if pix is a char *: pix[0] = R, pix[1] = G, pix[2] = B, pix[3] = A
+	 * we need to convert it to ffmpeg's PIX_FMT_RGBA32 format
+	 * ffmpeg always stores PIX_FMT_RGBA32 as
+	 *  (A << 24) | (R << 16) | (G << 8) | B
+	 * no matter what byte order our CPU uses. ie,
+	 * it is stored as BGRA on little endian CPU architectures and ARGB on big endian CPUs
+	 */
+	for(i=0; i<width*height; i++)
+	{
+		uint8_t a, r, g, b;
+		uint32_t pix;
+		/*
+		 * if the pixel is transparent, set the RGB components to 0
+		 * otherwise, if we scale up the bitmap in fullscreen mode,
+		 * we may end up with a border around the image
+		 * this happens, for example, with the BBC's "Press Red" image
+		 * it has a transparent box around it, but the RGB values are not 0 in the transparent area
+		 * when we scale it up we get a pink border around it
+		 */
+		a = rgba[(i * 4) + 3];
+		if(a == 0)
+		{
+			pix = 0;
+		}
+		else
+		{
+			r = rgba[(i * 4) + 0];
+			g = rgba[(i * 4) + 1];
+			b = rgba[(i * 4) + 2];
+			pix = (a << 24) | (r << 16) | (g << 8) | b;
+		}
+		*((uint32_t *) &rgba[i * 4]) = pix;
+	}
+
+	/* convert the PIX_FMT_RGBA32 data to the X server's format */
+	MHEGDisplay_convertRGBA(MHEGEngine_getDisplay(), rgba, width, height, out);
+
+	/* clean up */
+	readpng_free_image(rgba);
+
+	return true;
+}
+
+/*
+ * convert the given MPEG I-frame data to an internal format
+ * codec_ctx is left ready to decode the next I-frame
+ * returns false on error
+ */
+
+static bool
+decode_mpeg(AVCodecContext *codec_ctx, OctetString *mpeg, MHEGPixels *out)
+{
+	AVFrame *yuv_frame;
+	AVFrame *rgb_frame;
+	unsigned char *padded;
+	unsigned char *data;
+	unsigned int size;
+	int used;
+	int got_picture;
+	unsigned int width;
+	unsigned int height;
+	int nbytes;
+	unsigned char *rgba;
+	bool ok;
+
+	if((yuv_frame = avcodec_alloc_frame()) == NULL)
+		fatal("Out of memory");
+	if((rgb_frame = avcodec_alloc_frame()) == NULL)
+		fatal("Out of memory");
+
+	/* ffmpeg may read passed the end of the buffer, so pad it out */
+	padded = safe_malloc(mpeg->size + FF_INPUT_BUFFER_PADDING_SIZE);
+	memcpy(padded, mpeg->data, mpeg->size);
+	memset(padded + mpeg->size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+
+	/* decode the YUV frame */
+	data = padded;
+	size = mpeg->size;
+	do
+	{
+		used = avcodec_decode_video(codec_ctx, yuv_frame, &got_picture, data, size);
+		data += used;
+		size -= used;
+	}
+	while(!got_picture && size > 0);
+	/* need to call it one final time with size=0, to actually get the frame */
+	if(!got_picture)
+		(void) avcodec_decode_video(codec_ctx, yuv_frame, &got_picture, data, size);
+
+	if(!got_picture)
+	{
+		error("Unable to decode MPEG image");
+		ok = false;
+	}
+	else
+	{
+		/* convert to RGBA */
+		width = codec_ctx->width;
+		height = codec_ctx->height;
+		if((nbytes = avpicture_get_size(PIX_FMT_RGBA32, width, height)) < 0)
+			fatal("Invalid MPEG image");
+		rgba = safe_malloc(nbytes);
+		avpicture_fill((AVPicture *) rgb_frame, rgba, PIX_FMT_RGBA32, width, height);
+		img_convert((AVPicture *) rgb_frame, PIX_FMT_RGBA32, (AVPicture*) yuv_frame, codec_ctx->pix_fmt, width, height);
+		/* convert the PIX_FMT_RGBA32 data to the X server's format */
+		MHEGDisplay_convertRGBA(MHEGEngine_getDisplay(), rgba, width, height, out);
+		safe_free(rgba);
+		ok = true;
+	}
+
+	/* forget this frame, so the decoder is ready for the next one */
+	avcodec_flush_buffers(codec_ctx);
+
+	/* clean up */
+	safe_free(padded);
+	av_free(yuv_frame);
+	av_free(rgb_frame);
+
+	return ok;
+}
+
+/*
+ * rather than opening a new decoder for each I-frame, each thread keeps one open
+ */
+
+static AVCodecContext *
+open_mpeg_decoder(void)
+{
+	AVCodecContext *codec_ctx;
+	AVCodec *codec;
+
+	if((codec_ctx = avcodec_alloc_context()) == NULL)
+		fatal("Out of memory");
+
+	if((codec = avcodec_find_decoder(CODEC_ID_MPEG2VIDEO)) == NULL)
+		fatal("Unable to initialise MPEG decoder");
+
+	if(avcodec_open(codec_ctx, codec) < 0)
+		fatal("Unable to open video codec");
+
+	return codec_ctx;
+}
+
+static void
+close_mpeg_decoder(AVCodecContext *codec_ctx)
+{
+	avcodec_close(codec_ctx);
+	av_free(codec_ctx);
+
+	return;
+}
@@ -5,14 +5,41 @@
 #ifndef __MHEGBITMAP_H__
 #define __MHEGBITMAP_H__
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <X11/X.h>
 #include <X11/extensions/Xrender.h>
 
+#include "der_decode.h"
+
 typedef struct
 {
 	Pixmap image;		/* the Bitmap image */
 	Picture image_pic;	/* XRender wrapper for the image */
+	uint32_t *data;		/* the image in memory, if the display backend does not use an X server */
+	unsigned int width;
+	unsigned int height;
 } MHEGBitmap;
 
-#endif	/* __MHEGBITMAP_H__ */
+/* decoded pixels, in the same format as the Bitmap image, waiting to be given to the display backend */
+typedef struct
+{
+	unsigned char *data;
+	unsigned int width;
+	unsigned int height;
+} MHEGPixels;
+
+/* max number of threads used to decode bitmaps in the background */
+#define MHEGBITMAP_MAX_WORKERS	4
 
+/* max bytes of decoded bitmaps to keep when they are no longer used */
+#define MHEGBITMAP_CACHE_SIZE	(32 * 1024 * 1024)
+
+void MHEGBitmap_initCache(void);
+void MHEGBitmap_freeCache(void);
+
+void MHEGBitmap_prefetch(OctetString *, bool);
+MHEGBitmap *MHEGBitmap_get(OctetString *, bool);
+void MHEGBitmap_release(MHEGBitmap *);
+
+#endif	/* __MHEGBITMAP_H__ */
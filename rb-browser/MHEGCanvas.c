@@ -2,17 +2,36 @@
  * MHEGCanvas.c
  */
 
+#include <stdio.h>
 #include <math.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <X11/Xlib.h>
 #include <X11/extensions/Xrender.h>
+#include <X11/extensions/XShm.h>
 
 #include "ISO13522-MHEG-5.h"
 #include "MHEGCanvas.h"
 #include "MHEGEngine.h"
+#include "raster.h"
 #include "utils.h"
 
+/* MHEG angles are in degrees * 64 */
+#define ARC_RADIANS(A)	(((double) (A) / 64.0) * M_PI / 180.0)
+#define ARC_FULL(A)	((A) >= (360 * 64) || (A) <= -(360 * 64))
+
 /* internal functions */
-static unsigned long pixel_value(XRenderPictFormat *, MHEGColour *);
+static bool create_shm_image(MHEGCanvas *, MHEGDisplay *);
+static int shm_error(Display *, XErrorEvent *);
+static void start_drawing(MHEGCanvas *);
+static int line_style(int);
+static double line_centre(int);
+static RasterPoint *list_points(MHEGDisplay *, LIST_OF(XYPosition) *, unsigned int *);
+static uint32_t pixel_value(XRenderPictFormat *, MHEGColour *);
+static void fill_pixels(MHEGCanvas *, int, int, int, int, uint32_t, bool);
+
+/* set if the X server can't attach to our shared memory */
+static bool _shm_failed = false;
 
 MHEGCanvas *
 new_MHEGCanvas(unsigned int width, unsigned int height)
@@ -27,10 +46,33 @@ new_MHEGCanvas(unsigned int width, unsigned int height)
 	/* no border set yet */
 	c->border = 0;
 
+	/* no X server, draw in memory in the display's format */
+	if(d->dpy == NULL)
+	{
+		c->pic_format = d->argb_format;
+		c->pixels = safe_mallocz(c->width * c->height * sizeof(uint32_t));
+		raster_init(&c->raster, c->pixels, c->width, c->height);
+		return c;
+	}
+
 	/* we want a 32-bit RGBA pixel format */
 	c->pic_format = XRenderFindStandardFormat(d->dpy, PictStandardARGB32);
 
-	/* create a Pixmap to draw on */
+	/* draw in shared memory if we can, so uploading the pixels does not send them down the X connection */
+	if(!XShmQueryExtension(d->dpy) || !create_shm_image(c, d))
+	{
+		c->pixels = safe_mallocz(c->width * c->height * sizeof(uint32_t));
+		if((c->image = XCreateImage(d->dpy, NULL, 32, ZPixmap, 0, (char *) c->pixels, c->width, c->height, 32, 0)) == NULL)
+			fatal("XCreateImage failed");
+	}
+	/* passed NULL Visual when creating the XImage, so set the rgb masks now */
+	c->image->red_mask = c->pic_format->direct.redMask << c->pic_format->direct.red;
+	c->image->green_mask = c->pic_format->direct.greenMask << c->pic_format->direct.green;
+	c->image->blue_mask = c->pic_format->direct.blueMask << c->pic_format->direct.blue;
+
+	raster_init(&c->raster, c->pixels, c->width, c->height);
+
+	/* create a Pixmap to upload the pixels to */
 	c->contents = XCreatePixmap(d->dpy, d->win, c->width, c->height, 32);
 	/* associate a Picture with it */
 	c->contents_pic = XRenderCreatePicture(d->dpy, c->contents, c->pic_format, 0, NULL);
@@ -38,6 +80,9 @@ new_MHEGCanvas(unsigned int width, unsigned int height)
 	/* and a Graphics Context */
 	c->gc = XCreateGC(d->dpy, c->contents, 0, NULL);
 
+	/* the Pixmap contents are undefined until we upload the pixels */
+	raster_addDamage(&c->raster, 0, 0, c->width, c->height);
+
 	return c;
 }
 
@@ -50,15 +95,75 @@ free_MHEGCanvas(MHEGCanvas *c)
 	if(c == NULL)
 		fatal("free_MHEGCanvas: passed a NULL canvas");
 
-	XRenderFreePicture(d->dpy, c->contents_pic);
-	XFreePixmap(d->dpy, c->contents);
-	XFreeGC(d->dpy, c->gc);
+	raster_fini(&c->raster);
+
+	if(c->image == NULL)
+	{
+		safe_free(c->pixels);
+	}
+	else
+	{
+		XRenderFreePicture(d->dpy, c->contents_pic);
+		XFreePixmap(d->dpy, c->contents);
+		XFreeGC(d->dpy, c->gc);
+		if(c->use_shm)
+		{
+			XShmDetach(d->dpy, &c->shm);
+			shmdt(c->shm.shmaddr);
+		}
+		else
+		{
+			safe_free(c->pixels);
+		}
+		/* we own the XImage data, make sure XDestroyImage doesn't try to free it */
+		c->image->data = NULL;
+		XDestroyImage(c->image);
+	}
 
 	safe_free(c);
 
 	return;
 }
 
+/*
+ * copy the pixels that have changed since the last upload onto the X server
+ * called before the canvas is drawn on the display, so the X server only sees one request per change
+ */
+
+void
+MHEGCanvas_upload(MHEGCanvas *c)
+{
+	MHEGDisplay *d = MHEGEngine_getDisplay();
+	Raster *r = &c->raster;
+	int x, y, w, h;
+
+	/* no X server, or nothing has changed */
+	if(c->image == NULL
+	|| r->damage_x0 >= r->damage_x1
+	|| r->damage_y0 >= r->damage_y1)
+		return;
+
+	x = r->damage_x0;
+	y = r->damage_y0;
+	w = r->damage_x1 - r->damage_x0;
+	h = r->damage_y1 - r->damage_y0;
+
+	if(c->use_shm)
+	{
+		XShmPutImage(d->dpy, c->contents, c->gc, c->image, x, y, x, y, w, h, False);
+		/* don't draw on the pixels again until the X server has read them */
+		c->shm_busy = true;
+	}
+	else
+	{
+		XPutImage(d->dpy, c->contents, c->gc, c->image, x, y, x, y, w, h);
+	}
+
+	raster_resetDamage(r);
+
+	return;
+}
+
 /*
  * set a border, no drawing will be done in the border (apart from the border itself)
  * width is in pixels (and will be scaled up by this routine in full screen mode)
@@ -66,43 +171,51 @@ free_MHEGCanvas(MHEGCanvas *c)
  * LineStyle_solid
  * LineStyle_dashed
  * LineStyle_dotted
- * (note: UK MHEG Profile says we can treat ALL line styles as solid)
+ * (note: UK MHEG Profile says we can treat ALL line styles as solid, but we draw the gaps)
  */
 
 void
 MHEGCanvas_setBorder(MHEGCanvas *c, int width, int style, MHEGColour *colour)
 {
 	MHEGDisplay *d = MHEGEngine_getDisplay();
-	XGCValues gcvals;
-	XRectangle clip_rect;
+	uint32_t pixel;
+	double half;
+	RasterPoint edge[4];
 
 	if(width <= 0)
 		return;
 
-	if(style != LineStyle_solid)
-		error("MHEGCanvas_setBorder: LineStyle %d not supported (using a solid line)", style);
+	start_drawing(c);
 
 	/* scale width if fullscreen */
 	c->border = MHEGDisplay_scaleX(d, width);
 
-	/* draw the border */
-	gcvals.foreground = pixel_value(c->pic_format, colour);
-	XChangeGC(d->dpy, c->gc, GCForeground, &gcvals);
-	/* top */
-	XFillRectangle(d->dpy, c->contents, c->gc, 0, 0, c->width, c->border);
-	/* bottom */
-	XFillRectangle(d->dpy, c->contents, c->gc, 0, c->height - c->border, c->width, c->border);
-	/* left */
-	XFillRectangle(d->dpy, c->contents, c->gc, 0, 0, c->border, c->height);
-	/* right */
-	XFillRectangle(d->dpy, c->contents, c->gc, c->width - c->border, 0, c->border, c->height);
-
-	/* set a clip mask, so no futher drawing will change the border */
-	clip_rect.x = c->border;
-	clip_rect.y = c->border;
-	clip_rect.width = c->width - (2 * c->border);
-	clip_rect.height = c->height - (2 * c->border);
-	XSetClipRectangles(d->dpy, c->gc, 0, 0, &clip_rect, 1, Unsorted);
+	pixel = pixel_value(c->pic_format, colour);
+	if(style == LineStyle_solid)
+	{
+		/* top, bottom, left, right */
+		fill_pixels(c, 0, 0, c->width, c->border, pixel, false);
+		fill_pixels(c, 0, c->height - c->border, c->width, c->border, pixel, false);
+		fill_pixels(c, 0, 0, c->border, c->height, pixel, false);
+		fill_pixels(c, c->width - c->border, 0, c->border, c->height, pixel, false);
+	}
+	else
+	{
+		/* a line along the middle of the border, the gaps are left transparent */
+		half = c->border / 2.0;
+		edge[0].x = half;
+		edge[0].y = half;
+		edge[1].x = c->width - half;
+		edge[1].y = half;
+		edge[2].x = c->width - half;
+		edge[2].y = c->height - half;
+		edge[3].x = half;
+		edge[3].y = c->height - half;
+		raster_strokePath(&c->raster, edge, 4, true, c->border, line_style(style), pixel);
+	}
+
+	/* no futher drawing will change the border */
+	raster_setClip(&c->raster, c->border, c->border, c->width - c->border, c->height - c->border);
 
 	return;
 }
@@ -116,9 +229,11 @@ MHEGCanvas_setBorder(MHEGCanvas *c, int width, int style, MHEGColour *colour)
  * LineStyle_solid
  * LineStyle_dashed
  * LineStyle_dotted
- * but, the UK MHEG Profile says we can treat ALL line styles as solid
+ * the UK MHEG Profile says we can treat ALL line styles as solid, but we draw dashed and dotted lines
+ * lines have square ends and mitred corners, like X's default GC
  * UK MHEG Profile says no alpha blending is done within the DynamicLineArtClass canvas
  * ie all pixel values are put directly onto the canvas, replacing what was there before
+ * (apart from the anti-aliased edges of each shape, which are mixed with what was there before)
  */
 
 /*
@@ -128,14 +243,9 @@ MHEGCanvas_setBorder(MHEGCanvas *c, int width, int style, MHEGColour *colour)
 void
 MHEGCanvas_clear(MHEGCanvas *c, MHEGColour *colour)
 {
-	MHEGDisplay *d = MHEGEngine_getDisplay();
-	XGCValues gcvals;
+	start_drawing(c);
 
-	gcvals.foreground = pixel_value(c->pic_format, colour);
-	XChangeGC(d->dpy, c->gc, GCForeground, &gcvals);
-
-	/* width/height are already scaled as needed */
-	XFillRectangle(d->dpy, c->contents, c->gc, c->border, c->border, c->width - (2 * c->border), c->height - (2 * c->border));
+	fill_pixels(c, c->border, c->border, c->width - (2 * c->border), c->height - (2 * c->border), pixel_value(c->pic_format, colour), true);
 
 	return;
 }
@@ -150,14 +260,15 @@ void
 MHEGCanvas_drawArc(MHEGCanvas *c, XYPosition *pos, OriginalBoxSize *box, int start, int arc, int width, int style, MHEGColour *colour)
 {
 	MHEGDisplay *d = MHEGEngine_getDisplay();
-	XGCValues gcvals;
 	int x, y, w, h;
+	double off;
+	RasterPoint *pts;
+	unsigned int npts;
 
 	if(width <= 0)
 		return;
 
-	if(style != LineStyle_solid)
-		error("MHEGCanvas_drawArc: LineStyle %d not supported (using a solid line)", style);
+	start_drawing(c);
 
 	/* scale up if fullscreen */
 	x = MHEGDisplay_scaleX(d, pos->x_position);
@@ -166,13 +277,10 @@ MHEGCanvas_drawArc(MHEGCanvas *c, XYPosition *pos, OriginalBoxSize *box, int sta
 	h = MHEGDisplay_scaleY(d, box->y_length);
 	width = MHEGDisplay_scaleX(d, width);
 
-	/* set up the GC values */
-	gcvals.foreground = pixel_value(c->pic_format, colour);
-	gcvals.line_width = width;
-	XChangeGC(d->dpy, c->gc, GCForeground | GCLineWidth, &gcvals);
-
-	/* luckily X uses the same params as MHEG */
-	XDrawArc(d->dpy, c->contents, c->gc, x, y, w, h, start, arc);
+	off = line_centre(width);
+	npts = raster_arcPoints(&c->raster, &pts, x + (w / 2.0) + off, y + (h / 2.0) + off, w / 2.0, h / 2.0,
+				ARC_RADIANS(start), ARC_RADIANS(arc), false);
+	raster_strokePath(&c->raster, pts, npts, ARC_FULL(arc), width, line_style(style), pixel_value(c->pic_format, colour));
 
 	return;
 }
@@ -190,14 +298,12 @@ MHEGCanvas_drawSector(MHEGCanvas *c,
 		      int width, int style, MHEGColour *line_col, MHEGColour *fill_col)
 {
 	MHEGDisplay *d = MHEGEngine_getDisplay();
-	XGCValues gcvals;
 	int x, y, w, h;
-	int cx, cy;
-	double start_rads, end_rads;
-	int edgex, edgey;
+	double off;
+	RasterPoint *pts;
+	unsigned int npts;
 
-	if(style != LineStyle_solid)
-		error("MHEGCanvas_drawSector: LineStyle %d not supported (using a solid line)", style);
+	start_drawing(c);
 
 	/* scale up if fullscreen */
 	x = MHEGDisplay_scaleX(d, pos->x_position);
@@ -207,42 +313,19 @@ MHEGCanvas_drawSector(MHEGCanvas *c,
 	width = MHEGDisplay_scaleX(d, width);
 
 	/* fill it */
-	gcvals.foreground = pixel_value(c->pic_format, fill_col);
-	gcvals.arc_mode = ArcPieSlice;
-	XChangeGC(d->dpy, c->gc, GCForeground | GCArcMode, &gcvals);
-
-	/* luckily X uses the same params as MHEG */
-	XFillArc(d->dpy, c->contents, c->gc, x, y, w, h, start, arc);
+	npts = raster_arcPoints(&c->raster, &pts, x + (w / 2.0), y + (h / 2.0), w / 2.0, h / 2.0,
+				ARC_RADIANS(start), ARC_RADIANS(arc), true);
+	raster_fillPolygon(&c->raster, pts, npts, pixel_value(c->pic_format, fill_col));
 
 	/* draw the outline */
 	if(width <= 0)
 		return;
 
-	gcvals.foreground = pixel_value(c->pic_format, line_col);
-	gcvals.line_width = width;
-	XChangeGC(d->dpy, c->gc, GCForeground | GCLineWidth, &gcvals);
-
-	/* easy bit */
-	XDrawArc(d->dpy, c->contents, c->gc, x, y, w, h, start, arc);
-
-	/* lines from the centre to the start and end of the arc */
-	cx = x + (w / 2);
-	cy = y + (h / 2);
-	start_rads = ((double) start / 64.0) * M_PI / 180.0;
-	edgex = cos(start_rads) * (w / 2);
-	edgey = sin(start_rads) * (h / 2);
-	/* cy - edgey, because Y increases as we go down the screen */
-	XDrawLine(d->dpy, c->contents, c->gc, cx, cy, cx + edgex, cy - edgey);
-
-	end_rads = ((double) (start + arc) / 64.0) * M_PI / 180.0;
-	edgex = cos(end_rads) * (w / 2);
-	edgey = sin(end_rads) * (h / 2);
-	XDrawLine(d->dpy, c->contents, c->gc, cx, cy, cx + edgex, cy - edgey);
-
-/* TODO */
-/* make proper joins between the arc and the 2 lines */
-/* ends of the arc are on a tangent to the ellipse */
-/* can't join to a length 0 line because it has no direction, but a 1 pixel long line may be too long */
+	/* the arc and the lines to the centre are one path, so the corners are joined properly */
+	off = line_centre(width);
+	npts = raster_arcPoints(&c->raster, &pts, x + (w / 2.0) + off, y + (h / 2.0) + off, w / 2.0, h / 2.0,
+				ARC_RADIANS(start), ARC_RADIANS(arc), true);
+	raster_strokePath(&c->raster, pts, npts, true, width, line_style(style), pixel_value(c->pic_format, line_col));
 
 	return;
 }
@@ -255,28 +338,24 @@ void
 MHEGCanvas_drawLine(MHEGCanvas *c, XYPosition *p1, XYPosition *p2, int width, int style, MHEGColour *colour)
 {
 	MHEGDisplay *d = MHEGEngine_getDisplay();
-	XGCValues gcvals;
-	int x1, y1, x2, y2;
+	RasterPoint pts[2];
+	double off;
 
 	if(width <= 0)
 		return;
 
-	if(style != LineStyle_solid)
-		error("MHEGCanvas_drawLine: LineStyle %d not supported (using a solid line)", style);
+	start_drawing(c);
 
 	/* scale up if fullscreen */
-	x1 = MHEGDisplay_scaleX(d, p1->x_position);
-	y1 = MHEGDisplay_scaleY(d, p1->y_position);
-	x2 = MHEGDisplay_scaleX(d, p2->x_position);
-	y2 = MHEGDisplay_scaleY(d, p2->y_position);
 	width = MHEGDisplay_scaleX(d, width);
 
-	/* set up the GC values */
-	gcvals.foreground = pixel_value(c->pic_format, colour);
-	gcvals.line_width = width;
-	XChangeGC(d->dpy, c->gc, GCForeground | GCLineWidth, &gcvals);
+	off = line_centre(width);
+	pts[0].x = MHEGDisplay_scaleX(d, p1->x_position) + off;
+	pts[0].y = MHEGDisplay_scaleY(d, p1->y_position) + off;
+	pts[1].x = MHEGDisplay_scaleX(d, p2->x_position) + off;
+	pts[1].y = MHEGDisplay_scaleY(d, p2->y_position) + off;
 
-	XDrawLine(d->dpy, c->contents, c->gc, x1, y1, x2, y2);
+	raster_strokePath(&c->raster, pts, 2, false, width, line_style(style), pixel_value(c->pic_format, colour));
 
 	return;
 }
@@ -291,11 +370,12 @@ void
 MHEGCanvas_drawOval(MHEGCanvas *c, XYPosition *pos, OriginalBoxSize *box, int width, int style, MHEGColour *line_col, MHEGColour *fill_col)
 {
 	MHEGDisplay *d = MHEGEngine_getDisplay();
-	XGCValues gcvals;
 	int x, y, w, h;
+	double off;
+	RasterPoint *pts;
+	unsigned int npts;
 
-	if(style != LineStyle_solid)
-		error("MHEGCanvas_drawOval: LineStyle %d not supported (using a solid line)", style);
+	start_drawing(c);
 
 	/* scale up if fullscreen */
 	x = MHEGDisplay_scaleX(d, pos->x_position);
@@ -305,20 +385,16 @@ MHEGCanvas_drawOval(MHEGCanvas *c, XYPosition *pos, OriginalBoxSize *box, int wi
 	width = MHEGDisplay_scaleX(d, width);
 
 	/* fill it */
-	gcvals.foreground = pixel_value(c->pic_format, fill_col);
-	XChangeGC(d->dpy, c->gc, GCForeground, &gcvals);
-
-	XFillArc(d->dpy, c->contents, c->gc, x, y, w, h, 0, 360 * 64);
+	npts = raster_arcPoints(&c->raster, &pts, x + (w / 2.0), y + (h / 2.0), w / 2.0, h / 2.0, 0.0, 2.0 * M_PI, false);
+	raster_fillPolygon(&c->raster, pts, npts, pixel_value(c->pic_format, fill_col));
 
 	/* draw the outline */
 	if(width <= 0)
 		return;
 
-	gcvals.foreground = pixel_value(c->pic_format, line_col);
-	gcvals.line_width = width;
-	XChangeGC(d->dpy, c->gc, GCForeground | GCLineWidth, &gcvals);
-
-	XDrawArc(d->dpy, c->contents, c->gc, x, y, w, h, 0, 360 * 64);
+	off = line_centre(width);
+	npts = raster_arcPoints(&c->raster, &pts, x + (w / 2.0) + off, y + (h / 2.0) + off, w / 2.0, h / 2.0, 0.0, 2.0 * M_PI, false);
+	raster_strokePath(&c->raster, pts, npts, true, width, line_style(style), pixel_value(c->pic_format, line_col));
 
 	return;
 }
@@ -334,60 +410,36 @@ void
 MHEGCanvas_drawPolygon(MHEGCanvas *c, LIST_OF(XYPosition) *xy_list, int width, int style, MHEGColour *line_col, MHEGColour *fill_col)
 {
 	MHEGDisplay *d = MHEGEngine_getDisplay();
-	LIST_TYPE(XYPosition) *pos;
-	unsigned int nxpts;
-	XPoint *xpts;
+	RasterPoint *pts;
+	unsigned int npts;
 	unsigned int i;
-	XGCValues gcvals;
+	double off;
 
-	if(style != LineStyle_solid)
-		error("MHEGCanvas_drawPolygon: LineStyle %d not supported (using a solid line)", style);
-
-	/* scale up if fullscreen */
-	width = MHEGDisplay_scaleX(d, width);
-
-	/* convert the XYPosition list into an array of XPoint's */
-	nxpts = 0;
-	for(pos=xy_list; pos; pos=pos->next)
-		nxpts ++;
-
-	if(nxpts == 0)
+	if((pts = list_points(d, xy_list, &npts)) == NULL)
 		return;
 
-	/* +1 so we can close it for XDrawLines */
-	xpts = safe_malloc((nxpts + 1) * sizeof(XPoint));
+	start_drawing(c);
 
-	pos = xy_list;
-	for(i=0; i<nxpts; i++)
-	{
-		/* scale up if fullscreen */
-		xpts[i].x = MHEGDisplay_scaleX(d, pos->item.x_position);
-		xpts[i].y = MHEGDisplay_scaleY(d, pos->item.y_position);
-		pos = pos->next;
-	}
+	/* scale up if fullscreen */
+	width = MHEGDisplay_scaleX(d, width);
 
 	/* fill it */
-	gcvals.foreground = pixel_value(c->pic_format, fill_col);
-	XChangeGC(d->dpy, c->gc, GCForeground, &gcvals);
-
-	XFillPolygon(d->dpy, c->contents, c->gc, xpts, nxpts, Convex, CoordModeOrigin);
+	raster_fillPolygon(&c->raster, pts, npts, pixel_value(c->pic_format, fill_col));
 
 	/* draw the outline */
 	if(width > 0)
 	{
-		/* close the polygon */
-		xpts[nxpts].x = MHEGDisplay_scaleX(d, xy_list->item.x_position);
-		xpts[nxpts].y = MHEGDisplay_scaleY(d, xy_list->item.y_position);
-		/* set the line width and colour */
-		gcvals.foreground = pixel_value(c->pic_format, line_col);
-		gcvals.line_width = width;
-		XChangeGC(d->dpy, c->gc, GCForeground | GCLineWidth, &gcvals);
-		/* draw it */
-		XDrawLines(d->dpy, c->contents, c->gc, xpts, nxpts + 1, CoordModeOrigin);
+		off = line_centre(width);
+		for(i=0; i<npts; i++)
+		{
+			pts[i].x += off;
+			pts[i].y += off;
+		}
+		raster_strokePath(&c->raster, pts, npts, true, width, line_style(style), pixel_value(c->pic_format, line_col));
 	}
 
 	/* clean up */
-	safe_free(xpts);
+	safe_free(pts);
 
 	return;
 }
@@ -401,50 +453,32 @@ void
 MHEGCanvas_drawPolyline(MHEGCanvas *c, LIST_OF(XYPosition) *xy_list, int width, int style, MHEGColour *colour)
 {
 	MHEGDisplay *d = MHEGEngine_getDisplay();
-	LIST_TYPE(XYPosition) *pos;
-	unsigned int nxpts;
-	XPoint *xpts;
+	RasterPoint *pts;
+	unsigned int npts;
 	unsigned int i;
-	XGCValues gcvals;
+	double off;
 
 	if(width <= 0)
 		return;
 
-	if(style != LineStyle_solid)
-		error("MHEGCanvas_drawPolyline: LineStyle %d not supported (using a solid line)", style);
+	if((pts = list_points(d, xy_list, &npts)) == NULL)
+		return;
+
+	start_drawing(c);
 
 	/* scale up if fullscreen */
 	width = MHEGDisplay_scaleX(d, width);
 
-	/* convert the XYPosition list into an array of XPoint's */
-	nxpts = 0;
-	for(pos=xy_list; pos; pos=pos->next)
-		nxpts ++;
-
-	if(nxpts == 0)
-		return;
-
-	xpts = safe_malloc(nxpts * sizeof(XPoint));
-
-	pos = xy_list;
-	for(i=0; i<nxpts; i++)
+	off = line_centre(width);
+	for(i=0; i<npts; i++)
 	{
-		/* scale up if fullscreen */
-		xpts[i].x = MHEGDisplay_scaleX(d, pos->item.x_position);
-		xpts[i].y = MHEGDisplay_scaleY(d, pos->item.y_position);
-		pos = pos->next;
+		pts[i].x += off;
+		pts[i].y += off;
 	}
-
-	/* set the line width and colour */
-	gcvals.foreground = pixel_value(c->pic_format, colour);
-	gcvals.line_width = width;
-	XChangeGC(d->dpy, c->gc, GCForeground | GCLineWidth, &gcvals);
-
-	/* draw it */
-	XDrawLines(d->dpy, c->contents, c->gc, xpts, nxpts, CoordModeOrigin);
+	raster_strokePath(&c->raster, pts, npts, false, width, line_style(style), pixel_value(c->pic_format, colour));
 
 	/* clean up */
-	safe_free(xpts);
+	safe_free(pts);
 
 	return;
 }
@@ -459,11 +493,13 @@ void
 MHEGCanvas_drawRectangle(MHEGCanvas *c, XYPosition *pos, OriginalBoxSize *box, int width, int style, MHEGColour *line_col, MHEGColour *fill_col)
 {
 	MHEGDisplay *d = MHEGEngine_getDisplay();
-	XGCValues gcvals;
 	int x, y, w, h;
+	uint32_t pixel;
+	int half;
+	double off;
+	RasterPoint edge[4];
 
-	if(style != LineStyle_solid)
-		error("MHEGCanvas_drawRectangle: LineStyle %d not supported (using a solid line)", style);
+	start_drawing(c);
 
 	/* scale up if fullscreen */
 	x = MHEGDisplay_scaleX(d, pos->x_position);
@@ -472,41 +508,237 @@ MHEGCanvas_drawRectangle(MHEGCanvas *c, XYPosition *pos, OriginalBoxSize *box, i
 	h = MHEGDisplay_scaleY(d, box->y_length);
 	width = MHEGDisplay_scaleX(d, width);
 
-	/* fill it */
-	gcvals.foreground = pixel_value(c->pic_format, fill_col);
-	XChangeGC(d->dpy, c->gc, GCForeground, &gcvals);
-
-	XFillRectangle(d->dpy, c->contents, c->gc, x, y, w, h);
+	/* fill it, no need to anti-alias the edges */
+	fill_pixels(c, x, y, w, h, pixel_value(c->pic_format, fill_col), true);
 
-	/* draw the outline */
+	/* draw the outline, it is centred on the edges of the box, like XDrawRectangle */
 	if(width <= 0)
 		return;
 
-	gcvals.foreground = pixel_value(c->pic_format, line_col);
-	gcvals.line_width = width;
-	XChangeGC(d->dpy, c->gc, GCForeground | GCLineWidth, &gcvals);
+	pixel = pixel_value(c->pic_format, line_col);
+	if(style == LineStyle_solid)
+	{
+		half = width / 2;
+		fill_pixels(c, x - half, y - half, w + width, width, pixel, true);
+		fill_pixels(c, x - half, (y + h) - half, w + width, width, pixel, true);
+		fill_pixels(c, x - half, y - half, width, h + width, pixel, true);
+		fill_pixels(c, (x + w) - half, y - half, width, h + width, pixel, true);
+	}
+	else
+	{
+		/* the same pixels as the solid outline, but with gaps in */
+		off = line_centre(width);
+		edge[0].x = x + off;
+		edge[0].y = y + off;
+		edge[1].x = x + w + off;
+		edge[1].y = y + off;
+		edge[2].x = x + w + off;
+		edge[2].y = y + h + off;
+		edge[3].x = x + off;
+		edge[3].y = y + h + off;
+		raster_strokePath(&c->raster, edge, 4, true, width, line_style(style), pixel);
+	}
+
+	return;
+}
+
+/*
+ * put the canvas pixels in shared memory
+ * returns false if we can't, in which case we just use ordinary memory
+ */
+
+static bool
+create_shm_image(MHEGCanvas *c, MHEGDisplay *d)
+{
+	XErrorHandler old_handler;
+
+	if((c->image = XShmCreateImage(d->dpy, NULL, 32, ZPixmap, NULL, &c->shm, c->width, c->height)) == NULL)
+		return false;
+
+	/* the rasteriser expects no padding at the end of each line */
+	if(c->image->bytes_per_line != c->width * sizeof(uint32_t))
+		goto failed;
+
+	if((c->shm.shmid = shmget(IPC_PRIVATE, c->image->bytes_per_line * c->height, IPC_CREAT | 0600)) == -1)
+		goto failed;
+	if((c->shm.shmaddr = shmat(c->shm.shmid, NULL, 0)) == (void *) -1)
+	{
+		shmctl(c->shm.shmid, IPC_RMID, NULL);
+		goto failed;
+	}
+	c->shm.readOnly = True;
+
+	/* the X server may not be able to see our memory (eg if it is on another machine) */
+	_shm_failed = false;
+	old_handler = XSetErrorHandler(shm_error);
+	XShmAttach(d->dpy, &c->shm);
+	XSync(d->dpy, False);
+	XSetErrorHandler(old_handler);
+
+	/* we and the X server are attached now, so it will go away when we both detach */
+	shmctl(c->shm.shmid, IPC_RMID, NULL);
+
+	if(_shm_failed)
+	{
+		verbose("MHEGCanvas: unable to use shared memory, using XPutImage");
+		shmdt(c->shm.shmaddr);
+		goto failed;
+	}
+
+	/* shared memory is zeroed when it is created, so the canvas starts off transparent */
+	c->image->data = c->shm.shmaddr;
+	c->pixels = (uint32_t *) c->shm.shmaddr;
+	c->use_shm = true;
+
+	return true;
+
+failed:
+	XDestroyImage(c->image);
+	c->image = NULL;
+
+	return false;
+}
+
+static int
+shm_error(Display *dpy, XErrorEvent *ev)
+{
+	_shm_failed = true;
+
+	return 0;
+}
+
+/*
+ * call before changing any pixels
+ * waits for the X server to finish reading from the shared memory
+ */
 
-	XDrawRectangle(d->dpy, c->contents, c->gc, x, y, w, h);
+static void
+start_drawing(MHEGCanvas *c)
+{
+	MHEGDisplay *d;
+
+	if(c->shm_busy)
+	{
+		d = MHEGEngine_getDisplay();
+		XSync(d->dpy, False);
+		c->shm_busy = false;
+	}
 
 	return;
 }
 
+static int
+line_style(int style)
+{
+	switch(style)
+	{
+	case LineStyle_solid:
+		return RASTER_SOLID;
+
+	case LineStyle_dashed:
+		return RASTER_DASHED;
+
+	case LineStyle_dotted:
+		return RASTER_DOTTED;
+
+	default:
+		error("MHEGCanvas: unknown LineStyle %d (using a solid line)", style);
+		return RASTER_SOLID;
+	}
+}
+
+/*
+ * X puts the centre of a line on the coords you give it
+ * so, an odd width line only covers whole pixels if we move it to the middle of a pixel
+ */
+
+static double
+line_centre(int width)
+{
+	return (width & 1) ? 0.5 : 0.0;
+}
+
+/*
+ * convert the XYPosition list into an array of RasterPoint's (scaled up if fullscreen)
+ * returns NULL if the list is empty
+ * the caller should safe_free the array
+ */
+
+static RasterPoint *
+list_points(MHEGDisplay *d, LIST_OF(XYPosition) *xy_list, unsigned int *npts)
+{
+	LIST_TYPE(XYPosition) *pos;
+	RasterPoint *pts;
+	unsigned int i;
+
+	*npts = 0;
+	for(pos=xy_list; pos; pos=pos->next)
+		(*npts) ++;
+
+	if(*npts == 0)
+		return NULL;
+
+	pts = safe_malloc(*npts * sizeof(RasterPoint));
+
+	pos = xy_list;
+	for(i=0; i<*npts; i++)
+	{
+		pts[i].x = MHEGDisplay_scaleX(d, pos->item.x_position);
+		pts[i].y = MHEGDisplay_scaleY(d, pos->item.y_position);
+		pos = pos->next;
+	}
+
+	return pts;
+}
+
 /*
- * convert the MHEGColour to a pixel value
+ * convert the MHEGColour to a premultiplied pixel value
  */
 
-static unsigned long
+static uint32_t
 pixel_value(XRenderPictFormat *format, MHEGColour *colour)
 {
-	unsigned long pixel;
+	/* MHEGColour uses transparency, XRender uses opacity */
+	unsigned int alpha = 255 - colour->t;
+	uint32_t pixel;
 
 	/* MHEGColour and PictStandardARGB32 both have 8-bits per RGBA component */
-	pixel = colour->r << format->direct.red;
-	pixel |= colour->g << format->direct.green;
-	pixel |= colour->b << format->direct.blue;
-	/* MHEGColour uses transparency, XRender uses opacity */
-	pixel |= (255 - colour->t) << format->direct.alpha;
+	pixel = ((colour->r * alpha) / 255) << format->direct.red;
+	pixel |= ((colour->g * alpha) / 255) << format->direct.green;
+	pixel |= ((colour->b * alpha) / 255) << format->direct.blue;
+	pixel |= alpha << format->direct.alpha;
 
 	return pixel;
 }
 
+/*
+ * set the given rectangle in the canvas to pixel
+ * if inside is true, it is also clipped so it does not draw on the border
+ */
+
+static void
+fill_pixels(MHEGCanvas *c, int x, int y, int w, int h, uint32_t pixel, bool inside)
+{
+	int min = inside ? c->border : 0;
+	int max_x = c->width - min;
+	int max_y = c->height - min;
+	int x1, y1;
+	int row, col;
+	uint32_t *dst;
+
+	x1 = MIN(x + w, max_x);
+	y1 = MIN(y + h, max_y);
+	x = MAX(x, min);
+	y = MAX(y, min);
+
+	for(row=y; row<y1; row++)
+	{
+		dst = &c->pixels[row * c->width];
+		for(col=x; col<x1; col++)
+			dst[col] = pixel;
+	}
+
+	raster_addDamage(&c->raster, x, y, x1 - x, y1 - y);
+
+	return;
+}
@@ -5,23 +5,41 @@
 #ifndef __MHEGCANVAS_H__
 #define __MHEGCANVAS_H__
 
+#include <stdint.h>
+#include <stdbool.h>
 #include <X11/Xlib.h>
 #include <X11/extensions/Xrender.h>
+#include <X11/extensions/XShm.h>
 
+#include "raster.h"
+
+/*
+ * we always draw on pixels in memory
+ * if the display has an X server, the parts that have changed are uploaded to the contents Pixmap when the canvas is displayed
+ */
 typedef struct
 {
 	unsigned int width;		/* in pixels, will be the scaled up value in fullscreen mode */
 	unsigned int height;		/* in pixels, will be the scaled up value in fullscreen mode */
 	unsigned int border;		/* border width in pixels (the scaled value in fullscreen mode) */
-	Pixmap contents;		/* current image */
-	Picture contents_pic;		/* XRender wrapper */
+	uint32_t *pixels;		/* current image, premultiplied ARGB in pic_format's layout */
 	XRenderPictFormat *pic_format;	/* pixel format */
-	GC gc;				/* contains the clip mask for the border */
+	Raster raster;			/* draws on pixels, clipped so it does not draw on the border */
+	/* these are only used if the display has an X server */
+	Pixmap contents;		/* copy of pixels on the X server */
+	Picture contents_pic;		/* XRender wrapper */
+	GC gc;
+	XImage *image;			/* wraps pixels so we can upload them */
+	bool use_shm;			/* true => pixels are in shared memory */
+	XShmSegmentInfo shm;
+	bool shm_busy;			/* true => the X server may still be reading from pixels */
 } MHEGCanvas;
 
 MHEGCanvas *new_MHEGCanvas(unsigned int, unsigned int);
 void free_MHEGCanvas(MHEGCanvas *);
 
+void MHEGCanvas_upload(MHEGCanvas *);
+
 void MHEGCanvas_setBorder(MHEGCanvas *, int, int, MHEGColour *);
 
 void MHEGCanvas_clear(MHEGCanvas *, MHEGColour *);
@@ -5,36 +5,39 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
+#include <limits.h>
 #include <errno.h>
-#include <png.h>
+#include <time.h>
 #include <X11/Xlib.h>
-#include <X11/Xutil.h>
-#include <X11/extensions/Xrender.h>
-#include <X11/Intrinsic.h>
-#include <X11/Shell.h>
 #include <X11/keysym.h>
 #include <ffmpeg/avformat.h>
 
 #include "MHEGEngine.h"
 #include "MHEGDisplay.h"
-#include "readpng.h"
+#include "display_x11.h"
+#include "display_soft.h"
+#include "pixconv.h"
 #include "utils.h"
 
 /* internal utils */
 static MHEGKeyMapEntry *load_keymap(char *);
+static void add_damage(MHEGDisplay *, int, int, int, int);
+static int64_t now_usecs(void);
 
-static void display_colour(XRenderColor *, MHEGColour *);
-
-/* from GDK MwmUtils.h */
-#define MWM_HINTS_DECORATIONS	(1L << 1)
-typedef struct
+static struct
+{
+	char *name;
+	char *desc;
+	MHEGDisplayMethod *fns;
+} display_methods[] =
 {
-	unsigned long flags;
-	unsigned long functions;
-	unsigned long decorations;
-	long input_mode;
-	unsigned long status;
-} MotifWmHints;
+	{ "x11", "Draws on an X Window using XRender", &display_x11_fns},
+	{ "soft", "Draws in memory, does not need an X server", &display_soft_fns},
+	{ NULL, NULL}
+};
+
+#define DEFAULT_DISPLAY_METHOD	&display_x11_fns
 
 /* default keyboard mapping */
 static MHEGKeyMapEntry default_keymap[] =
@@ -64,193 +67,83 @@ static MHEGKeyMapEntry default_keymap[] =
 	{ 0, 0 }			/* terminator */
 };
 
-void
-MHEGDisplay_init(MHEGDisplay *d, bool fullscreen, char *keymap)
-{
-	unsigned int xrender_major;
-	unsigned int xrender_minor;
-	int x, y;
-	XVisualInfo visinfo;
-	unsigned long mask;
-	XSetWindowAttributes attr;
-	Atom wm_delete_window;
-	XSizeHints hint;
-	unsigned long gcmask;
-	XGCValues gcvals;
-	XRenderPictFormat *pic_format;
-	XRenderPictureAttributes pa;
-	Pixmap textfg;
-	/* fake argc, argv for XtDisplayInitialize */
-	int argc = 0;
-	char *argv[1] = { NULL };
-
-	/* remember if we are using fullscreen mode */
-	d->fullscreen = fullscreen;
+/*
+ * pass NULL to use the default
+ */
 
-	/* keyboard mapping */
-	if(keymap != NULL)
-		d->keymap = load_keymap(keymap);
-	else
-		d->keymap = default_keymap;
+MHEGDisplayMethod *
+MHEGDisplayMethod_fromString(char *name)
+{
+	unsigned int i;
 
-	/* so X requests/replies in different threads don't get interleaved */
-	XInitThreads();
+	if(name == NULL)
+		return DEFAULT_DISPLAY_METHOD;
 
-	if((d->dpy = XOpenDisplay(NULL)) == NULL)
-		fatal("Unable to open display");
+	for(i=0; display_methods[i].name; i++)
+		if(strcasecmp(name, display_methods[i].name) == 0)
+			return display_methods[i].fns;
 
-	/* check the X server supports at least XRender 0.6 (needed for Bilinear filter) */
-	xrender_major = 0;
-	xrender_minor = 10;
-	if(!XRenderQueryVersion(d->dpy, &xrender_major, &xrender_minor)
-	|| xrender_minor < 6)
-		fatal("X Server does not support XRender 0.6 or above");
+	fatal("Unknown display method '%s'. %s", name, MHEGDisplayMethod_getUsage());
 
-	/* size of the Window */
-	if(fullscreen)
-	{
-		d->xres = WidthOfScreen(DefaultScreenOfDisplay(d->dpy));
-		d->yres = HeightOfScreen(DefaultScreenOfDisplay(d->dpy));
-	}
-	else
-	{
-		/* resolution defined in UK MHEG Profile */
-		d->xres = MHEG_XRES;
-		d->yres = MHEG_YRES;
-	}
+	/* not reached */
+	return NULL;
+}
 
-	/* create the window */
-	x = (WidthOfScreen(DefaultScreenOfDisplay(d->dpy)) - d->xres) / 2;
-	y = (HeightOfScreen(DefaultScreenOfDisplay(d->dpy)) - d->yres) / 2;
+/* must be big enough to hold the names of them all */
+static char _usage[512];
 
-	/* remember the colour depth and Visual used by the Window */
-	d->depth = DefaultDepth(d->dpy, DefaultScreen(d->dpy));
-	if(!XMatchVisualInfo(d->dpy, DefaultScreen(d->dpy), d->depth, TrueColor, &visinfo))
-		fatal("Unable to find a TrueColour Visual");
-	d->vis = visinfo.visual;
+char *
+MHEGDisplayMethod_getUsage(void)
+{
+	unsigned int i;
+	char method[80];
 
-	/*
-	 * if the default Visual is not TrueColor we need to create a Colormap for our Visual
-	 * this is probably only gonna happen for 8 bit displays
-	 * you *really* want a 16 or 24 bit colour display
-	 */
-	if(DefaultVisual(d->dpy, DefaultScreen(d->dpy))->class != TrueColor)
-	{
-		d->cmap = XCreateColormap(d->dpy, DefaultRootWindow(d->dpy), d->vis, AllocNone);
-		XInstallColormap(d->dpy, d->cmap);
-		mask = CWColormap;
-		attr.colormap = d->cmap;
-	}
-	else
-	{
-		d->cmap = None;
-		mask = 0;
-	}
+	snprintf(_usage, sizeof(_usage), "Available display methods are:");
 
-	/* don't need any special toolkits or widgets, just a canvas to draw on */
-	d->win = XCreateWindow(d->dpy,
-			       DefaultRootWindow(d->dpy),
-			       x, y, d->xres, d->yres, 0,
-			       d->depth, InputOutput, d->vis,
-			       mask, &attr);
-
-	/* in case the WM ignored where we want it placed */
-	hint.flags = USSize | USPosition | PPosition | PSize;
-	hint.x = x;
-	hint.y = y;
-	hint.width = d->xres;
-	hint.height = d->yres;
-	XSetWMNormalHints(d->dpy, d->win, &hint);
-
-	if(fullscreen)
+	for(i=0; display_methods[i].name; i++)
 	{
-		GC gc;
-		Pixmap no_pixmap;
-		XColor no_colour;
-		Cursor no_cursor;
-		/* this is how GDK makes Windows fullscreen */
-		XEvent xev;
-		Atom motif_wm_hints;
-		MotifWmHints mwmhints;
-		xev.xclient.type = ClientMessage;
-		xev.xclient.serial = 0;
-		xev.xclient.send_event = True;
-		xev.xclient.window = d->win;
-		xev.xclient.message_type = XInternAtom(d->dpy, "_NET_WM_STATE", False);
-		xev.xclient.format = 32;
-		xev.xclient.data.l[0] = XInternAtom(d->dpy, "_NET_WM_STATE_ADD", False);
-		xev.xclient.data.l[1] = XInternAtom(d->dpy, "_NET_WM_STATE_FULLSCREEN", False);
-		xev.xclient.data.l[2] = 0;
-		xev.xclient.data.l[3] = 0;
-		xev.xclient.data.l[4] = 0;
-		XSendEvent(d->dpy, DefaultRootWindow(d->dpy), False, SubstructureRedirectMask | SubstructureNotifyMask, &xev);
-		/* get rid of the Window decorations */
-		motif_wm_hints = XInternAtom(d->dpy, "_MOTIF_WM_HINTS", False);
-		mwmhints.flags = MWM_HINTS_DECORATIONS;
-		mwmhints.decorations = 0;
-		XChangeProperty(d->dpy, d->win,
-				motif_wm_hints, motif_wm_hints, 32, PropModeReplace,
-				(unsigned char *) &mwmhints, sizeof(MotifWmHints) / sizeof(long));
-		/*
-		 * get rid of the cursor when the mouse is over our Window
-		 * make the cursor a 1x1 Pixmap with no pixels displayed by the mask
-		 */
-		no_pixmap = XCreatePixmap(d->dpy, d->win, 1, 1, 1);
-		gcmask = GCForeground;
-		gcvals.foreground = 0;
-		gc = XCreateGC(d->dpy, no_pixmap, gcmask, &gcvals);
-		XDrawPoint(d->dpy, no_pixmap, gc, 0, 0);
-		XFreeGC(d->dpy, gc);
-		no_cursor = XCreatePixmapCursor(d->dpy, no_pixmap, no_pixmap, &no_colour, &no_colour, 0, 0);
-		XFreePixmap(d->dpy, no_pixmap);
-		XDefineCursor(d->dpy, d->win, no_cursor);
+		bool dflt = (display_methods[i].fns == DEFAULT_DISPLAY_METHOD);
+		snprintf(method, sizeof(method), "\n%s\t%s%s", display_methods[i].name, display_methods[i].desc, dflt ? " (default)" : "");
+		/* assumes _usage[] is big enough */
+		strcat(_usage, method);
 	}
 
-	/* want to get Expose and KeyPress events */
-	mask = CWEventMask;
-	attr.event_mask = ExposureMask | KeyPressMask;
-	XChangeWindowAttributes(d->dpy, d->win, mask, &attr);
-
-	/* get a ClientMessage event when the window's close button is clicked */
-	wm_delete_window = XInternAtom(d->dpy, "WM_DELETE_WINDOW", False);
-	XSetWMProtocols(d->dpy, d->win, &wm_delete_window, 1);
+	return _usage;
+}
 
-	/*
-	 * create an XRender Picture for the Window contents
-	 * we composite the video frame and the MHEG overlay onto this, then copy it onto the Window
-	 */
-	pic_format = XRenderFindVisualFormat(d->dpy, d->vis);
-	d->contents = XCreatePixmap(d->dpy, d->win, d->xres, d->yres, d->depth);
-	d->contents_pic = XRenderCreatePicture(d->dpy, d->contents, pic_format, 0, NULL);
+void
+MHEGDisplay_init(MHEGDisplay *d, MHEGDisplayMethod *fns, bool fullscreen, char *keymap)
+{
+	/* assert */
+	if(fns == NULL)
+		fatal("MHEGDisplay_init: display method not defined");
 
-	/* create a 32-bit XRender Picture to draw the MHEG objects on */
-	pic_format = XRenderFindStandardFormat(d->dpy, PictStandardARGB32);
-	d->next_overlay = XCreatePixmap(d->dpy, d->win, d->xres, d->yres, 32);
-	d->next_overlay_pic = XRenderCreatePicture(d->dpy, d->next_overlay, pic_format, 0, NULL);
-	d->used_overlay = XCreatePixmap(d->dpy, d->win, d->xres, d->yres, 32);
-	d->used_overlay_pic = XRenderCreatePicture(d->dpy, d->used_overlay, pic_format, 0, NULL);
+	d->fns = fns;
+	d->ctx = NULL;
 
-	/* a 1x1 Picture to hold the text foreground colour */
-	textfg = XCreatePixmap(d->dpy, d->win, 1, 1, 32);
-	pa.repeat = True;
-	d->textfg_pic = XRenderCreatePicture(d->dpy, textfg, pic_format, CPRepeat, &pa);
+	/* remember if we are using fullscreen mode */
+	d->fullscreen = fullscreen;
 
-	/* a GC to draw on the Window */
-	d->win_gc = XCreateGC(d->dpy, d->win, 0, &gcvals);
+	/* keyboard mapping */
+	if(keymap != NULL)
+		d->keymap = load_keymap(keymap);
+	else
+		d->keymap = default_keymap;
 
-	/* a GC to XCopyArea next_overlay to used_overlay (need to avoid any XRender clip mask on next_overlay) */
-	d->overlay_gc = XCreateGC(d->dpy, d->next_overlay, 0, &gcvals);
+	/* not saving any frames yet */
+	d->dump_prefix = NULL;
+	d->nframes = 0;
 
-	/* get the window on the screen */
-	XMapWindow(d->dpy, d->win);
+	/* nothing copied to the used_overlay yet */
+	bzero(&d->stats, sizeof(d->stats));
+	d->start_usecs = now_usecs();
 
-	/* needs to be realised before we can set the title */
-	XStoreName(d->dpy, d->win, WINDOW_TITLE);
+	/* open the output */
+	(*(d->fns->init))(d);
 
-	/* rather than having to implement our own timers we use Xt, so initialise it */
-	XtToolkitInitialize();
-	d->app = XtCreateApplicationContext();
-	XtDisplayInitialize(d->app, d->dpy, APP_NAME, APP_CLASS, NULL, 0, &argc, argv);
+	/* now we know the output resolution, nothing is clipped or drawn on yet */
+	MHEGDisplay_unsetClipRectangle(d);
+	d->ndamaged = 0;
 
 	/* init ffmpeg */
 	av_register_all();
@@ -261,8 +154,14 @@ MHEGDisplay_init(MHEGDisplay *d, bool fullscreen, char *keymap)
 void
 MHEGDisplay_fini(MHEGDisplay *d)
 {
-	/* calls XCloseDisplay for us which free's all our Windows, Pixmaps, etc */
-	XtDestroyApplicationContext(d->app);
+	MHEGDisplayStats stats;
+
+	MHEGDisplay_getStats(d, &stats);
+	verbose("Overlay: %lu transfers, %lu rectangles, %.1f MB copied (%.1f MB for whole overlays); %.1f MB per second",
+		stats.noverlays, stats.nrects, stats.overlay_bytes / 1000000.0, stats.full_bytes / 1000000.0,
+		(stats.usecs > 0) ? stats.overlay_bytes / (double) stats.usecs : 0.0);
+
+	(*(d->fns->fini))(d);
 
 	return;
 }
@@ -277,82 +176,7 @@ MHEGDisplay_fini(MHEGDisplay *d)
 bool
 MHEGDisplay_processEvents(MHEGDisplay *d, bool block)
 {
-	bool quit = false;
-	XEvent event;
-	XAnyEvent *any;
-	XKeyEvent *key;
-	KeySym sym;
-	MHEGKeyMapEntry *map;
-	XExposeEvent *exp;
-	XClientMessageEvent *cm;
-	static Atom wm_protocols = 0;
-	static Atom wm_delete_window = 0;
-
-	/* dont block if only a Timer is pending */
-	if(!block
-	&& (XtAppPending(d->app) & ~XtIMTimer) == 0)
-		return false;
-
-	/* this will block if no events are pending */
-	XtAppNextEvent(d->app, &event);
-
-	/* is it our window */
-	any = &event.xany;
-	if(any->display != d->dpy || any->window != d->win)
-	{
-		/* pass it on to Xt */
-		XtDispatchEvent(&event);
-		return false;
-	}
-
-	switch(event.type)
-	{
-	case KeyPress:
-		key = &event.xkey;
-		sym = XKeycodeToKeysym(d->dpy, key->keycode, 0);
-		/* find the KeySym in the keyboard map */
-		map = d->keymap;
-		while(map->mheg_key != 0 && map->x_key != sym)
-			map ++;
-		if(map->mheg_key != 0)
-		{
-			verbose("KeyPress: %s (%u)", XKeysymToString(sym), map->mheg_key);
-			MHEGEngine_keyPressed(map->mheg_key);
-		}
-		break;
-
-	case Expose:
-		exp = &event.xexpose;
-		XCopyArea(d->dpy, d->contents, d->win, d->win_gc, exp->x, exp->y, exp->width, exp->height, exp->x, exp->y);
-		break;
-
-	case NoExpose:
-		/* ignore it */
-		break;
-
-	case ClientMessage:
-		cm = &event.xclient;
-		/* cache these Atoms */
-		if(wm_protocols == 0)
-		{
-			wm_protocols = XInternAtom(d->dpy, "WM_PROTOCOLS", False);
-			wm_delete_window = XInternAtom(d->dpy, "WM_DELETE_WINDOW", False);
-		}
-		if(cm->message_type == wm_protocols
-		&& cm->format == 32
-		&& cm->data.l[0] == wm_delete_window)
-			quit = true;
-		else
-			verbose("Ignoring ClientMessage type %s", XGetAtomName(d->dpy, cm->message_type));
-		break;
-
-	default:
-		/* pass it on to Xt */
-		XtDispatchEvent(&event);
-		break;
-	}
-
-	return quit;
+	return (*(d->fns->processEvents))(d, block);
 }
 
 /*
@@ -365,6 +189,7 @@ MHEGDisplay_refresh(MHEGDisplay *d, XYPosition *pos, OriginalBoxSize *box)
 {
 	int x, y;
 	unsigned int w, h;
+	char filename[PATH_MAX];
 
 	/* scale if fullscreen */
 	x = MHEGDisplay_scaleX(d, pos->x_position);
@@ -372,15 +197,16 @@ MHEGDisplay_refresh(MHEGDisplay *d, XYPosition *pos, OriginalBoxSize *box)
 	w = MHEGDisplay_scaleX(d, box->x_length);
 	h = MHEGDisplay_scaleY(d, box->y_length);
 
-	/*
-	 * if video is being displayed, the current frame will already be in d->contents
-	 * (drawn by the video thread)
-	 * overlay the MHEG objects onto the video in d->contents
-	 */
-	XRenderComposite(d->dpy, PictOpOver, d->used_overlay_pic, None, d->contents_pic, x, y, x, y, x, y, w, h);
+	(*(d->fns->refresh))(d, x, y, w, h);
+
+	/* save the frame if we have been asked to */
+	if(d->dump_prefix != NULL)
+	{
+		snprintf(filename, sizeof(filename), "%s%06u.png", d->dump_prefix, d->nframes);
+		MHEGDisplay_savePNG(d, filename);
+	}
 
-	/* copy the Window contents onto the screen */
-	XCopyArea(d->dpy, d->contents, d->win, d->win_gc, x, y, w, h, x, y);
+	d->nframes ++;
 
 	return;
 }
@@ -401,18 +227,19 @@ MHEGDisplay_clearScreen(MHEGDisplay *d)
 	/* refresh the screen */
 	MHEGDisplay_refresh(d, &pos, &box);
 
-	XFlush(d->dpy);
+	if(d->dpy != NULL)
+		XFlush(d->dpy);
 
 	return;
 }
 
 /*
- * all these drawing routines draw onto next_overlay_pic
+ * all these drawing routines draw onto the next_overlay
  * all coords should be in the range 0-MHEG_XRES, 0-MHEG_YRES
  * the drawing routines themselves will scale the coords to full screen if needed
  * you have to call MHEGDisplay_useOverlay() when you have finished drawing
  * this copies next_overlay onto used_overlay
- * used_overlay_pic is composited onto any video and put on the screen by MHEGDisplay_refresh()
+ * used_overlay is composited onto any video and put on the screen by MHEGDisplay_refresh()
  */
 
 /*
@@ -423,15 +250,22 @@ MHEGDisplay_clearScreen(MHEGDisplay *d)
 void
 MHEGDisplay_setClipRectangle(MHEGDisplay *d, XYPosition *pos, OriginalBoxSize *box)
 {
-	XRectangle clip;
+	int x, y;
+	unsigned int w, h;
 
 	/* scale if fullscreen */
-	clip.x = MHEGDisplay_scaleX(d, pos->x_position);
-	clip.y = MHEGDisplay_scaleY(d, pos->y_position);
-	clip.width = MHEGDisplay_scaleX(d, box->x_length);
-	clip.height = MHEGDisplay_scaleY(d, box->y_length);
+	x = MHEGDisplay_scaleX(d, pos->x_position);
+	y = MHEGDisplay_scaleY(d, pos->y_position);
+	w = MHEGDisplay_scaleX(d, box->x_length);
+	h = MHEGDisplay_scaleY(d, box->y_length);
 
-	XRenderSetPictureClipRectangles(d->dpy, d->next_overlay_pic, 0, 0, &clip, 1);
+	(*(d->fns->setClipRectangle))(d, x, y, w, h);
+
+	/* remember it so we know what the drawing routines can change */
+	d->clip.x0 = MAX(x, 0);
+	d->clip.y0 = MAX(y, 0);
+	d->clip.x1 = MIN(x + (int) w, (int) d->xres);
+	d->clip.y1 = MIN(y + (int) h, (int) d->yres);
 
 	return;
 }
@@ -443,16 +277,12 @@ MHEGDisplay_setClipRectangle(MHEGDisplay *d, XYPosition *pos, OriginalBoxSize *b
 void
 MHEGDisplay_unsetClipRectangle(MHEGDisplay *d)
 {
-	/*
-	 * this doesn't work...
-	 * XRenderSetPictureClipRectangles(d->dpy, d->next_overlay_pic, 0, 0, NULL, 0);
-	 */
+	(*(d->fns->unsetClipRectangle))(d);
 
-	XRenderPictureAttributes attr;
-
-	attr.clip_mask = None;
-
-	XRenderChangePicture(d->dpy, d->next_overlay_pic, CPClipMask, &attr);
+	d->clip.x0 = 0;
+	d->clip.y0 = 0;
+	d->clip.x1 = d->xres;
+	d->clip.y1 = d->yres;
 
 	return;
 }
@@ -466,7 +296,6 @@ MHEGDisplay_unsetClipRectangle(MHEGDisplay *d)
 void
 MHEGDisplay_drawHoriLine(MHEGDisplay *d, XYPosition *pos, unsigned int len, int width, int style, MHEGColour *col)
 {
-	XRenderColor rcol;
 	int x, y;
 	unsigned int w, h;
 
@@ -474,9 +303,6 @@ MHEGDisplay_drawHoriLine(MHEGDisplay *d, XYPosition *pos, unsigned int len, int
 	if(col->t == MHEGCOLOUR_TRANSPARENT || width <= 0)
 		return;
 
-	/* convert to internal colour format */
-	display_colour(&rcol, col);
-
 	/* scale if fullscreen */
 	x = MHEGDisplay_scaleX(d, pos->x_position);
 	y = MHEGDisplay_scaleY(d, pos->y_position);
@@ -489,7 +315,8 @@ if(style != LineStyle_solid)
 printf("TODO: LineStyle %d\n", style);
 
 	/* draw a rectangle */
-	XRenderFillRectangle(d->dpy, PictOpOver, d->next_overlay_pic, &rcol, x, y, w, h);
+	(*(d->fns->fillRectangle))(d, x, y, w, h, col, false);
+	add_damage(d, x, y, w, h);
 
 	return;
 }
@@ -503,7 +330,6 @@ printf("TODO: LineStyle %d\n", style);
 void
 MHEGDisplay_drawVertLine(MHEGDisplay *d, XYPosition *pos, unsigned int len, int width, int style, MHEGColour *col)
 {
-	XRenderColor rcol;
 	int x, y;
 	unsigned int w, h;
 
@@ -511,9 +337,6 @@ MHEGDisplay_drawVertLine(MHEGDisplay *d, XYPosition *pos, unsigned int len, int
 	if(col->t == MHEGCOLOUR_TRANSPARENT || width <= 0)
 		return;
 
-	/* convert to internal colour format */
-	display_colour(&rcol, col);
-
 	/* scale if fullscreen */
 	x = MHEGDisplay_scaleX(d, pos->x_position);
 	y = MHEGDisplay_scaleY(d, pos->y_position);
@@ -526,7 +349,8 @@ if(style != LineStyle_solid)
 printf("TODO: LineStyle %d\n", style);
 
 	/* draw a rectangle */
-	XRenderFillRectangle(d->dpy, PictOpOver, d->next_overlay_pic, &rcol, x, y, w, h);
+	(*(d->fns->fillRectangle))(d, x, y, w, h, col, false);
+	add_damage(d, x, y, w, h);
 
 	return;
 }
@@ -538,7 +362,6 @@ printf("TODO: LineStyle %d\n", style);
 void
 MHEGDisplay_fillRectangle(MHEGDisplay *d, XYPosition *pos, OriginalBoxSize *box, MHEGColour *col)
 {
-	XRenderColor rcol;
 	int x, y;
 	unsigned int w, h;
 
@@ -546,40 +369,41 @@ MHEGDisplay_fillRectangle(MHEGDisplay *d, XYPosition *pos, OriginalBoxSize *box,
 	if(col->t == MHEGCOLOUR_TRANSPARENT)
 		return;
 
-	/* convert to internal colour format */
-	display_colour(&rcol, col);
-
 	/* scale if fullscreen */
 	x = MHEGDisplay_scaleX(d, pos->x_position);
 	y = MHEGDisplay_scaleY(d, pos->y_position);
 	w = MHEGDisplay_scaleX(d, box->x_length);
 	h = MHEGDisplay_scaleY(d, box->y_length);
 
-	XRenderFillRectangle(d->dpy, PictOpOver, d->next_overlay_pic, &rcol, x, y, w, h);
+	(*(d->fns->fillRectangle))(d, x, y, w, h, col, false);
+	add_damage(d, x, y, w, h);
 
 	return;
 }
 
 /*
  * explicitly make a transparent rectangle in the MHEG overlay
- * MHEGDisplay_fillRectangle() uses PictOpOver => it can't create a transparent box in the output
- * this uses PictOpSrc
+ * MHEGDisplay_fillRectangle() blends onto the overlay => it can't create a transparent box in the output
+ * this replaces the overlay pixels
  */
 
 void
 MHEGDisplay_fillTransparentRectangle(MHEGDisplay *d, XYPosition *pos, OriginalBoxSize *box)
 {
-	XRenderColor rcol = {0, 0, 0, 0};
+	MHEGColour col;
 	int x, y;
 	unsigned int w, h;
 
+	MHEGColour_transparent(&col);
+
 	/* scale if fullscreen */
 	x = MHEGDisplay_scaleX(d, pos->x_position);
 	y = MHEGDisplay_scaleY(d, pos->y_position);
 	w = MHEGDisplay_scaleX(d, box->x_length);
 	h = MHEGDisplay_scaleY(d, box->y_length);
 
-	XRenderFillRectangle(d->dpy, PictOpSrc, d->next_overlay_pic, &rcol, x, y, w, h);
+	(*(d->fns->fillRectangle))(d, x, y, w, h, &col, true);
+	add_damage(d, x, y, w, h);
 
 	return;
 }
@@ -601,7 +425,8 @@ MHEGDisplay_drawBitmap(MHEGDisplay *d, XYPosition *src, OriginalBoxSize *box, MH
 
 	/*
 	 * scale up if fullscreen
-	 * the bitmap itself is scaled when it is created in MHEGDisplay_newBitmap()
+	 * the bitmap itself is scaled when it is created in MHEGBitmap_fromRGBA()
+	 * so this is just a plain unscaled composite
 	 */
 	src_x = MHEGDisplay_scaleX(d, src->x_position);
 	src_y = MHEGDisplay_scaleY(d, src->y_position);
@@ -610,8 +435,8 @@ MHEGDisplay_drawBitmap(MHEGDisplay *d, XYPosition *src, OriginalBoxSize *box, MH
 	dst_x = MHEGDisplay_scaleX(d, dst->x_position);
 	dst_y = MHEGDisplay_scaleY(d, dst->y_position);
 
-	XRenderComposite(d->dpy, PictOpOver, bitmap->image_pic, None, d->next_overlay_pic,
-			 src_x, src_y, src_x, src_y, dst_x, dst_y, w, h);
+	(*(d->fns->drawBitmap))(d, bitmap, src_x, src_y, w, h, dst_x, dst_y);
+	add_damage(d, dst_x, dst_y, w, h);
 
 	return;
 }
@@ -638,8 +463,8 @@ MHEGDisplay_drawCanvas(MHEGDisplay *d, XYPosition *src, OriginalBoxSize *box, MH
 	dst_x = MHEGDisplay_scaleX(d, dst->x_position);
 	dst_y = MHEGDisplay_scaleY(d, dst->y_position);
 
-	XRenderComposite(d->dpy, PictOpOver, canvas->contents_pic, None, d->next_overlay_pic,
-			 src_x, src_y, src_x, src_y, dst_x, dst_y, w, h);
+	(*(d->fns->drawCanvas))(d, canvas, src_x, src_y, w, h, dst_x, dst_y);
+	add_damage(d, dst_x, dst_y, w, h);
 
 	return;
 }
@@ -655,51 +480,53 @@ MHEGDisplay_drawCanvas(MHEGDisplay *d, XYPosition *src, OriginalBoxSize *box, MH
 void
 MHEGDisplay_drawTextElement(MHEGDisplay *d, XYPosition *pos, MHEGFont *font, MHEGTextElement *text, bool tabs)
 {
-	XRenderColor rcol;
 	int orig_x;
 	int x, y;
 	int scrn_x;
-	FT_Face face;
-	FT_GlyphSlot slot;
-	FT_UInt glyph;
+	FT_UShort units_per_EM;
+	MHEGGlyph *glyph;
 	FT_UInt previous;
-	FT_Vector kern;
-	FT_Error err;
 	unsigned char *data;
 	unsigned int size;
 	int utf8;
 	int len;
 	int ntabs;
+	unsigned int nglyphs;
+	/* reused for each text element, we only draw from the engine thread */
+	static XftGlyphSpec *specs = NULL;
+	static size_t specs_size = 0;
 
 	/* is there any text */
 	if(text->size == 0)
 		return;
 
-	/* convert to internal colour format */
-	display_colour(&rcol, &text->col);
+	/* assert */
+	if(font->cache == NULL)
+		fatal("MHEGDisplay_drawTextElement: font has not been opened");
 
 	/* scale the x origin if fullscreen */
 	orig_x = MHEGDisplay_scaleX(d, pos->x_position);
 	/* y coord does not change */
 	y = MHEGDisplay_scaleY(d, pos->y_position + text->y);
 
-	/* set the text foreground colour */
-	XRenderFillRectangle(d->dpy, PictOpSrc, d->textfg_pic, &rcol, 0, 0, 1, 1);
+	/* at most one glyph per byte of text */
+	specs = safe_fast_realloc(specs, &specs_size, text->size * sizeof(XftGlyphSpec));
+	nglyphs = 0;
 
 	/*
 	 * can't just use XftTextRenderUtf8() because:
 	 * - it doesn't do kerning
 	 * - text may include tabs
+	 * we do all layout calculations with the unscaled font metrics
+	 * then render the whole element with a single request
 	 */
-	/* we do all layout calculations with the unscaled font metrics */
-	face = XftLockFace(font->font);
-	slot = face->glyph;
+	units_per_EM = font->cache->units_per_EM;
 
 	/* no previous glyph yet */
 	previous = 0;
 
 	/* x in font units */
-	x = text->x * face->units_per_EM;
+	x = text->x * units_per_EM;
 
 	data = text->data;
 	size = text->size;
@@ -713,45 +540,47 @@ MHEGDisplay_drawTextElement(MHEGDisplay *d, XYPosition *pos, MHEGFont *font, MHE
 		if(utf8 == 0x09 && tabs)
 		{
 			/* min amount a tab should advance the text pos */
-			x += font->xOffsetLeft * face->units_per_EM;
+			x += font->xOffsetLeft * units_per_EM;
 			/* move to the next tab stop */
-			ntabs = x / (MHEG_TAB_WIDTH * face->units_per_EM);
-			x = ((ntabs + 1) * MHEG_TAB_WIDTH) * face->units_per_EM;
+			ntabs = x / (MHEG_TAB_WIDTH * units_per_EM);
+			x = ((ntabs + 1) * MHEG_TAB_WIDTH) * units_per_EM;
 			continue;
 		}
 		/* we are treating tabs as spaces */
 		if(utf8 == 0x09)
 			utf8 = 0x20;
-		/* get the glyph index for the UTF8 char */
-		glyph = FT_Get_Char_Index(face, utf8);
+		/* get the glyph for the UTF8 char */
+		glyph = MHEGFont_getGlyph(font, utf8);
 		/* do any kerning if necessary */
-		if(previous != 0 && FT_HAS_KERNING(face))
-		{
-			FT_Get_Kerning(face, previous, glyph, FT_KERNING_UNSCALED, &kern);
-			x += (kern.x * font->size * 45) / 56;
-		}
+		if(previous != 0)
+			x += (MHEGFont_getKerning(font, previous, glyph->glyph) * font->size * 45) / 56;
 		/* remember the glyph for kerning next time */
-		previous = glyph;
-		/* render it */
-		XftUnlockFace(font->font);
+		previous = glyph->glyph;
 		/* round up/down the X coord */
 		scrn_x = MHEGDisplay_scaleX(d, x);
-		scrn_x = (scrn_x + (face->units_per_EM / 2)) / face->units_per_EM;
-		XftGlyphRender(d->dpy, PictOpOver, d->textfg_pic, font->font, d->next_overlay_pic,
-			       0, 0, orig_x + scrn_x, y,
-			       &glyph, 1);
-		face = XftLockFace(font->font);
-		slot = face->glyph;
+		scrn_x = (scrn_x + (units_per_EM / 2)) / units_per_EM;
+		/* add it to the glyph run */
+		specs[nglyphs].glyph = glyph->glyph;
+		specs[nglyphs].x = orig_x + scrn_x;
+		specs[nglyphs].y = y;
+		nglyphs ++;
 		/* advance x */
-		err = FT_Load_Glyph(face, glyph, FT_LOAD_NO_SCALE);
-		if(err)
+		if(!glyph->valid)
 			continue;
-		x += (slot->advance.x * font->size * 45) / 56;
+		x += (glyph->advance * font->size * 45) / 56;
 		/* add on (letter spacing / 256) * units_per_EM */
-		x += (face->units_per_EM * font->letter_spc * 45) / (256 * 56);
+		x += (units_per_EM * font->letter_spc * 45) / (256 * 56);
 	}
 
-	XftUnlockFace(font->font);
+	/*
+	 * render the whole run
+	 * we don't know the glyph extents here, but text is always drawn inside its object's clip rectangle
+	 */
+	if(nglyphs > 0)
+	{
+		(*(d->fns->drawGlyphs))(d, font, &text->col, specs, nglyphs);
+		add_damage(d, d->clip.x0, d->clip.y0, d->clip.x1 - d->clip.x0, d->clip.y1 - d->clip.y0);
+	}
 
 	return;
 }
@@ -759,302 +588,205 @@ MHEGDisplay_drawTextElement(MHEGDisplay *d, XYPosition *pos, MHEGFont *font, MHE
 /*
  * copy the contents of next_overlay onto used_overlay
  * ie all drawing done since the last call to this will appear on the screen at the next refresh()
+ * only the areas that have been drawn on since the last call are copied
  */
 
 void
 MHEGDisplay_useOverlay(MHEGDisplay *d)
 {
-	/* avoid any XRender clip mask */
-	XCopyArea(d->dpy, d->next_overlay, d->used_overlay, d->overlay_gc, 0, 0, d->xres, d->yres, 0, 0);
+	MHEGDisplayRect *r;
+	unsigned int w, h;
+	unsigned int i;
+
+	for(i=0; i<d->ndamaged; i++)
+	{
+		r = &d->damaged[i];
+		w = r->x1 - r->x0;
+		h = r->y1 - r->y0;
+		(*(d->fns->useOverlay))(d, r->x0, r->y0, w, h);
+		d->stats.nrects ++;
+		d->stats.overlay_bytes += (uint64_t) w * h * sizeof(uint32_t);
+	}
+	d->ndamaged = 0;
+
+	d->stats.noverlays ++;
+	d->stats.full_bytes += (uint64_t) d->xres * d->yres * sizeof(uint32_t);
+
+	return;
+}
+
+void
+MHEGDisplay_getStats(MHEGDisplay *d, MHEGDisplayStats *stats)
+{
+	*stats = d->stats;
+	stats->usecs = now_usecs() - d->start_usecs;
 
 	return;
 }
 
 /*
- * convert the given PNG data to an internal format
- * returns NULL on error
+ * convert an array of ffmpeg's PIX_FMT_RGBA32 pixels to the format used by our 32-bit Pictures
+ * ffmpeg always stores PIX_FMT_RGBA32 as
+ *  (A << 24) | (R << 16) | (G << 8) | B
+ * no matter what byte order our CPU uses. ie,
+ * it is stored as BGRA on little endian CPU architectures and ARGB on big endian CPUs
+ * if we are using fullscreen mode, the pixels are also scaled up to the output resolution
+ * does not call the display backend, so it is safe to call from any thread
+ * the caller should safe_free out->data when done
  */
 
-MHEGBitmap *
-MHEGDisplay_newPNGBitmap(MHEGDisplay *d, OctetString *png)
+void
+MHEGDisplay_convertRGBA(MHEGDisplay *d, unsigned char *rgba, unsigned int width, unsigned int height, MHEGPixels *out)
 {
-	MHEGBitmap *b;
-	png_uint_32 width, height;
-	unsigned char *rgba;
-	unsigned int i;
-
-	/* nothing to do */
-	if(png == NULL || png->size == 0)
-		return NULL;
+	XRenderPictFormat *pic_format = d->argb_format;
+	unsigned char *xdata;
+	unsigned char *scaled;
+	unsigned int xwidth, xheight;
 
-	/* convert the PNG into a standard format we can use as an XImage */
-	if((rgba = readpng_get_image(png->data, png->size, &width, &height)) == NULL)
-	{
-		error("Unable to decode PNG file");
-		return NULL;
-	}
+	/*
+	 * copy the RGBA values into a block we can use as XImage data
+	 * swap the RGBA components as needed and premultiply them by the alpha value, as XRender expects
+	 * 4 bytes per pixel
+	 */
+	xdata = safe_malloc(width * height * 4);
+	pixconv_premultiply((uint32_t *) xdata, (uint32_t *) rgba, width * height,
+			    pic_format->direct.alpha, pic_format->direct.red,
+			    pic_format->direct.green, pic_format->direct.blue);
 
 	/*
-	 * we now have an array of 32-bit RGBA pixels in network byte order
-	 * ie if pix is a char *: pix[0] = R, pix[1] = G, pix[2] = B, pix[3] = A
-	 * we need to convert it to ffmpeg's PIX_FMT_RGBA32 format
-	 * ffmpeg always stores PIX_FMT_RGBA32 as
-	 *  (A << 24) | (R << 16) | (G << 8) | B
-	 * no matter what byte order our CPU uses. ie,
-	 * it is stored as BGRA on little endian CPU architectures and ARGB on big endian CPUs
+	 * if we are using fullscreen mode, scale the image once now
+	 * rather than getting XRender to scale it every time we draw it
 	 */
-	for(i=0; i<width*height; i++)
+	xwidth = MHEGDisplay_scaleX(d, width);
+	xheight = MHEGDisplay_scaleY(d, height);
+	if(xwidth == 0)
+		xwidth = 1;
+	if(xheight == 0)
+		xheight = 1;
+	if(xwidth != width || xheight != height)
 	{
-		uint8_t a, r, g, b;
-		uint32_t pix;
-		/*
-		 * if the pixel is transparent, set the RGB components to 0
-		 * otherwise, if we scale up the bitmap in fullscreen mode,
-		 * we may end up with a border around the image
-		 * this happens, for example, with the BBC's "Press Red" image
-		 * it has a transparent box around it, but the RGB values are not 0 in the transparent area
-		 * when we scale it up we get a pink border around it
-		 */
-		a = rgba[(i * 4) + 3];
-		if(a == 0)
-		{
-			pix = 0;
-		}
-		else
-		{
-			r = rgba[(i * 4) + 0];
-			g = rgba[(i * 4) + 1];
-			b = rgba[(i * 4) + 2];
-			pix = (a << 24) | (r << 16) | (g << 8) | b;
-		}
-		*((uint32_t *) &rgba[i * 4]) = pix;
+/* TODO */
+/* take aspect ratio into account */
+		scaled = safe_malloc(xwidth * xheight * 4);
+		pixconv_scale((uint32_t *) scaled, xwidth, xheight, (uint32_t *) xdata, width, height);
+		safe_free(xdata);
+		xdata = scaled;
 	}
 
-	/* convert the PIX_FMT_RGBA32 data to a MHEGBitmap */
-	b = MHEGBitmap_fromRGBA(d, rgba, width, height);
+	out->data = xdata;
+	out->width = xwidth;
+	out->height = xheight;
 
-	/* clean up */
-	readpng_free_image(rgba);
+	return;
+}
 
-	return b;
+/*
+ * give pixels from MHEGDisplay_convertRGBA() to the display backend
+ * the backend may keep pixels->data, in which case it sets it to NULL
+ */
+
+void
+MHEGDisplay_newBitmap(MHEGDisplay *d, MHEGPixels *pixels, MHEGBitmap *bitmap)
+{
+	(*(d->fns->newBitmap))(d, pixels, bitmap);
+
+	return;
 }
 
 /*
- * convert the given MPEG I-frame data to an internal format
- * returns NULL on error
+ * frees the resources the backend uses for the bitmap, but not the MHEGBitmap itself
  */
 
-MHEGBitmap *
-MHEGDisplay_newMPEGBitmap(MHEGDisplay *d, OctetString *mpeg)
+void
+MHEGDisplay_freeBitmap(MHEGDisplay *d, MHEGBitmap *b)
 {
-	MHEGBitmap *b;
-	AVCodecContext *codec_ctx;
-	AVCodec *codec;
-	AVFrame *yuv_frame;
-	AVFrame *rgb_frame;
-	unsigned char *padded;
-	unsigned char *data;
-	unsigned int size;
-	int used;
-	int got_picture;
-	unsigned int width;
-	unsigned int height;
-	int nbytes;
-	unsigned char *rgba = NULL;
-
-	/* nothing to do */
-	if(mpeg == NULL || mpeg->size == 0)
-		return NULL;
-
-	/* use ffmpeg to convert the data into a standard format we can use as an XImage */
-	if((codec_ctx = avcodec_alloc_context()) == NULL)
-		fatal("Out of memory");
-
-	if((codec = avcodec_find_decoder(CODEC_ID_MPEG2VIDEO)) == NULL)
-		fatal("Unable to initialise MPEG decoder");
-
-	if(avcodec_open(codec_ctx, codec) < 0)
-		fatal("Unable to open video codec");
-
-	if((yuv_frame = avcodec_alloc_frame()) == NULL)
-		fatal("Out of memory");
-	if((rgb_frame = avcodec_alloc_frame()) == NULL)
-		fatal("Out of memory");
-
-	/* ffmpeg may read passed the end of the buffer, so pad it out */
-	padded = safe_malloc(mpeg->size + FF_INPUT_BUFFER_PADDING_SIZE);
-	memcpy(padded, mpeg->data, mpeg->size);
-	memset(padded + mpeg->size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
-
-	/* decode the YUV frame */
-	data = padded;
-	size = mpeg->size;
-	do
-	{
-		used = avcodec_decode_video(codec_ctx, yuv_frame, &got_picture, data, size);
-		data += used;
-		size -= used;
-	}
-	while(!got_picture && size > 0);
-	/* need to call it one final time with size=0, to actually get the frame */
-	if(!got_picture)
-		(void) avcodec_decode_video(codec_ctx, yuv_frame, &got_picture, data, size);
+	(*(d->fns->freeBitmap))(d, b);
 
-	if(!got_picture)
-	{
-		error("Unable to decode MPEG image");
-		b = NULL;
-	}
-	else
-	{
-		/* convert to RGBA */
-		width = codec_ctx->width;
-		height = codec_ctx->height;
-		if((nbytes = avpicture_get_size(PIX_FMT_RGBA32, width, height)) < 0)
-			fatal("Invalid MPEG image");
-		rgba = safe_malloc(nbytes);
-		avpicture_fill((AVPicture *) rgb_frame, rgba, PIX_FMT_RGBA32, width, height);
-		img_convert((AVPicture *) rgb_frame, PIX_FMT_RGBA32, (AVPicture*) yuv_frame, codec_ctx->pix_fmt, width, height);
-		/* convert the PIX_FMT_RGBA32 data to a MHEGBitmap */
-		b = MHEGBitmap_fromRGBA(d, rgba, width, height);
-	}
+	return;
+}
+
+/*
+ * open f->name at the given pixel size and aspect ratio
+ * sets f->font, leaves it NULL if the font does not exist
+ */
 
-	/* clean up */
-	safe_free(padded);
-	safe_free(rgba);
-	av_free(yuv_frame);
-	av_free(rgb_frame);
-	avcodec_close(codec_ctx);
+void
+MHEGDisplay_openFont(MHEGDisplay *d, MHEGFont *f, double pixel_size, double aspect)
+{
+	f->font = NULL;
 
-	return b;
+	(*(d->fns->openFont))(d, f, pixel_size, aspect);
+
+	return;
 }
 
 void
-MHEGDisplay_freeBitmap(MHEGDisplay *d, MHEGBitmap *b)
+MHEGDisplay_closeFont(MHEGDisplay *d, MHEGFont *f)
 {
-	if(b != NULL)
-	{
-		XRenderFreePicture(d->dpy, b->image_pic);
-		XFreePixmap(d->dpy, b->image);
-		safe_free(b);
-	}
+	(*(d->fns->closeFont))(d, f);
+
+	f->font = NULL;
 
 	return;
 }
 
 /*
- * construct a MHEGBitmap from an array of ffmpeg's PIX_FMT_RGBA32 pixels
- * ffmpeg always stores PIX_FMT_RGBA32 as
- *  (A << 24) | (R << 16) | (G << 8) | B
- * no matter what byte order our CPU uses. ie,
- * it is stored as BGRA on little endian CPU architectures and ARGB on big endian CPUs
+ * returns the FreeType face for an open font
+ * call MHEGDisplay_unlockFace() when you have finished with it
  */
 
-MHEGBitmap *
-MHEGBitmap_fromRGBA(MHEGDisplay *d, unsigned char *rgba, unsigned int width, unsigned int height)
+FT_Face
+MHEGDisplay_lockFace(MHEGDisplay *d, MHEGFont *f)
 {
-	MHEGBitmap *bitmap;
-	unsigned char *xdata;
-	uint32_t rgba_pix;
-	uint32_t xpix;
-	uint8_t r, g, b, a;
-	unsigned int i, npixs;
-	XImage *ximg;
-	XRenderPictFormat *pic_format;
-	enum PixelFormat av_format;
-	GC gc;
-
-	bitmap = safe_malloc(sizeof(MHEGBitmap));
-	bzero(bitmap, sizeof(MHEGBitmap));
-
-	/* find a matching XRender pixel format */
-	pic_format = XRenderFindStandardFormat(d->dpy, PictStandardARGB32);
-	av_format = find_av_pix_fmt(32,
-				    pic_format->direct.redMask << pic_format->direct.red,
-				    pic_format->direct.greenMask << pic_format->direct.green,
-				    pic_format->direct.blueMask << pic_format->direct.blue);
-
-	/* copy the RGBA values into a block we can use as XImage data */
-	npixs = width * height;
-	/* 4 bytes per pixel */
-	xdata = safe_malloc(npixs * 4);
-	/* are the pixel layouts exactly the same */
-	if(av_format == PIX_FMT_RGBA32)
-	{
-		memcpy(xdata, rgba, npixs * 4);
-	}
-	else
-	{
-		/* swap the RGBA components as needed */
-		for(i=0; i<npixs; i++)
-		{
-			rgba_pix = *((uint32_t *) &rgba[i * 4]);
-			a = (rgba_pix >> 24) & 0xff;
-			r = (rgba_pix >> 16) & 0xff;
-			g = (rgba_pix >> 8) & 0xff;
-			b = rgba_pix & 0xff;
-			/* is it transparent */
-			if(a == 0)
-			{
-				xpix = 0;
-			}
-			else
-			{
-				xpix = a << pic_format->direct.alpha;
-				xpix |= r << pic_format->direct.red;
-				xpix |= g << pic_format->direct.green;
-				xpix |= b << pic_format->direct.blue;
-			}
-			*((uint32_t *) &xdata[i * 4]) = xpix;
-		}
-	}
+	return (*(d->fns->lockFace))(d, f);
+}
+
+void
+MHEGDisplay_unlockFace(MHEGDisplay *d, MHEGFont *f)
+{
+	(*(d->fns->unlockFace))(d, f);
+
+	return;
+}
 
-	/* get X to draw the XImage onto a Pixmap */
-	if((ximg = XCreateImage(d->dpy, NULL, 32, ZPixmap, 0, xdata, width, height, 32, 0)) == NULL)
-		fatal("XCreateImage failed");
-	/* passed NULL Visual to XCreateImage, so set the rgb masks now */
-	ximg->red_mask = pic_format->direct.redMask;
-	ximg->green_mask = pic_format->direct.greenMask;
-	ximg->blue_mask = pic_format->direct.blueMask;
-	/* create the Pixmap */
-	bitmap->image = XCreatePixmap(d->dpy, d->win, width, height, 32);
-	gc = XCreateGC(d->dpy, bitmap->image, 0, NULL);
-	XPutImage(d->dpy, bitmap->image, gc, ximg, 0, 0, 0, 0, width, height);
-	XFreeGC(d->dpy, gc);
-
-	/* associate a Picture with it */
-	bitmap->image_pic = XRenderCreatePicture(d->dpy, bitmap->image, pic_format, 0, NULL);
-
-	/* if we are using fullscreen mode, scale the image */
-	if(d->fullscreen)
+/*
+ * returns true if the given font family is installed
+ */
+
+bool
+MHEGDisplay_fontExists(MHEGDisplay *d, char *family)
+{
+	return (*(d->fns->fontExists))(d, family);
+}
+
+/*
+ * save the current output as a PNG file
+ * returns false if it could not be saved
+ */
+
+bool
+MHEGDisplay_savePNG(MHEGDisplay *d, char *filename)
+{
+	if(d->fns->savePNG == NULL)
 	{
-printf("TODO: MHEGBitmap_fromRGBA: take aspect ratio into account\n");
-		/* set up the matrix to scale it */
-		XTransform xform;
-		/* X */
-		xform.matrix[0][0] = (MHEG_XRES << 16) / d->xres;
-		xform.matrix[0][1] = 0;
-		xform.matrix[0][2] = 0;
-		/* Y */
-		xform.matrix[1][0] = 0;
-		xform.matrix[1][1] = (MHEG_YRES << 16) / d->yres;
-		xform.matrix[1][2] = 0;
-		/* Z */
-		xform.matrix[2][0] = 0;
-		xform.matrix[2][1] = 0;
-		xform.matrix[2][2] = 1 << 16;
-		/* scale it */
-		XRenderSetPictureTransform(d->dpy, bitmap->image_pic, &xform);
-		/* set a filter to smooth the edges */
-		XRenderSetPictureFilter(d->dpy, bitmap->image_pic, FilterBilinear, 0, 0);
+		error("Display method can not save PNG files");
+		return false;
 	}
 
-	/* we alloc'ed the XImage data, make sure XDestroyImage doesn't try to free it */
-	safe_free(xdata);
-	ximg->data = NULL;
-	XDestroyImage(ximg);
+	return (*(d->fns->savePNG))(d, filename);
+}
+
+/*
+ * save every frame from now on as <prefix>NNNNNN.png
+ * NNNNNN is the frame number, pass NULL to stop
+ */
+
+void
+MHEGDisplay_dumpFrames(MHEGDisplay *d, char *prefix)
+{
+	d->dump_prefix = prefix;
 
-	return bitmap;
+	return;
 }
 
 /*
@@ -1125,20 +857,72 @@ load_keymap(char *filename)
 }
 
 /*
- * convert MHEGColour to internal format
+ * remember that the given area of next_overlay has been drawn on
+ * coords are in the output resolution, the area is clipped to the current clip rectangle
+ * if it touches an area we already have, they are merged
+ * if we have too many areas, they are all merged into their bounding box
  */
 
 static void
-display_colour(XRenderColor *out, MHEGColour *in)
+add_damage(MHEGDisplay *d, int x, int y, int w, int h)
 {
-	/* expand to 16 bits per channel */
-	out->red = (in->r << 8) | in->r;
-	out->green = (in->g << 8) | in->g;
-	out->blue = (in->b << 8) | in->b;
+	int x0 = MAX(x, d->clip.x0);
+	int y0 = MAX(y, d->clip.y0);
+	int x1 = MIN(x + w, d->clip.x1);
+	int y1 = MIN(y + h, d->clip.y1);
+	MHEGDisplayRect *r;
+	unsigned int i;
+
+	if(x0 >= x1 || y0 >= y1)
+		return;
+
+	/* usually we are drawing an object inside the area we have just cleared */
+	for(i=0; i<d->ndamaged; i++)
+	{
+		r = &d->damaged[i];
+		if(x0 <= r->x1 && x1 >= r->x0 && y0 <= r->y1 && y1 >= r->y0)
+		{
+			r->x0 = MIN(r->x0, x0);
+			r->y0 = MIN(r->y0, y0);
+			r->x1 = MAX(r->x1, x1);
+			r->y1 = MAX(r->y1, y1);
+			return;
+		}
+	}
 
-	/* XRender has 0 as transparent and 65535 as opaque */
-	out->alpha = ((255 - in->t) << 8) | (255 - in->t);
+	if(d->ndamaged == MHEG_MAX_DAMAGE)
+	{
+		r = &d->damaged[0];
+		for(i=1; i<d->ndamaged; i++)
+		{
+			r->x0 = MIN(r->x0, d->damaged[i].x0);
+			r->y0 = MIN(r->y0, d->damaged[i].y0);
+			r->x1 = MAX(r->x1, d->damaged[i].x1);
+			r->y1 = MAX(r->y1, d->damaged[i].y1);
+		}
+		r->x0 = MIN(r->x0, x0);
+		r->y0 = MIN(r->y0, y0);
+		r->x1 = MAX(r->x1, x1);
+		r->y1 = MAX(r->y1, y1);
+		d->ndamaged = 1;
+		return;
+	}
+
+	r = &d->damaged[d->ndamaged ++];
+	r->x0 = x0;
+	r->y0 = y0;
+	r->x1 = x1;
+	r->y1 = y1;
 
 	return;
 }
 
+static int64_t
+now_usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000000LL) + (ts.tv_nsec / 1000);
+}
@@ -6,9 +6,11 @@
 #define __MHEGDISPLAY_H__
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <X11/Xlib.h>
 #include <X11/Intrinsic.h>
 #include <X11/extensions/Xrender.h>
+#include <X11/Xft/Xft.h>
 
 #include "MHEGColour.h"
 #include "MHEGBitmap.h"
@@ -33,14 +35,90 @@ typedef struct
 	unsigned int mheg_key;		/* MHEGKey_xxx value */
 } MHEGKeyMapEntry;
 
+/*
+ * we remember this many separate areas of next_overlay that have been drawn on
+ * after that, we just remember their bounding box
+ */
+#define MHEG_MAX_DAMAGE	8
+
+/* a rectangle in output coords, x1 and y1 are exclusive */
 typedef struct
 {
+	int x0, y0;
+	int x1, y1;
+} MHEGDisplayRect;
+
+/* overlay transfers */
+typedef struct
+{
+	unsigned long noverlays;	/* calls to MHEGDisplay_useOverlay() */
+	unsigned long nrects;		/* rectangles copied from next_overlay to used_overlay */
+	uint64_t overlay_bytes;		/* bytes copied */
+	uint64_t full_bytes;		/* bytes we would have copied if we did the whole overlay each time */
+	int64_t usecs;			/* time since the display was opened */
+} MHEGDisplayStats;
+
+struct MHEGDisplay;
+
+/*
+ * a display backend
+ * the MHEGDisplay_xxx functions scale all coords to the output resolution before calling these
+ */
+typedef struct MHEGDisplayFns
+{
+	/* open the output, set xres/yres and app */
+	void (*init)(struct MHEGDisplay *);
+	/* close everything init opened */
+	void (*fini)(struct MHEGDisplay *);
+	/* process the next GUI event, return true if the GUI wants us to quit */
+	bool (*processEvents)(struct MHEGDisplay *, bool);
+	/* composite used_overlay onto the contents in the given area and put it on the screen */
+	void (*refresh)(struct MHEGDisplay *, int, int, unsigned int, unsigned int);
+	/* drawing on next_overlay */
+	void (*setClipRectangle)(struct MHEGDisplay *, int, int, unsigned int, unsigned int);
+	void (*unsetClipRectangle)(struct MHEGDisplay *);
+	/* if the bool is true, replace the overlay pixels, rather than blending onto them */
+	void (*fillRectangle)(struct MHEGDisplay *, int, int, unsigned int, unsigned int, MHEGColour *, bool);
+	/* src x, y, width, height, dst x, y */
+	void (*drawBitmap)(struct MHEGDisplay *, MHEGBitmap *, int, int, unsigned int, unsigned int, int, int);
+	void (*drawCanvas)(struct MHEGDisplay *, MHEGCanvas *, int, int, unsigned int, unsigned int, int, int);
+	/* a run of glyphs from the font's face */
+	void (*drawGlyphs)(struct MHEGDisplay *, MHEGFont *, MHEGColour *, XftGlyphSpec *, unsigned int);
+	/* copy the given area of next_overlay onto used_overlay */
+	void (*useOverlay)(struct MHEGDisplay *, int, int, unsigned int, unsigned int);
+	/* MHEGBitmap's, the backend may take ownership of the MHEGPixels data and set it to NULL */
+	void (*newBitmap)(struct MHEGDisplay *, MHEGPixels *, MHEGBitmap *);
+	void (*freeBitmap)(struct MHEGDisplay *, MHEGBitmap *);
+	/* fonts, pixel size, aspect ratio */
+	void (*openFont)(struct MHEGDisplay *, MHEGFont *, double, double);
+	void (*closeFont)(struct MHEGDisplay *, MHEGFont *);
+	FT_Face (*lockFace)(struct MHEGDisplay *, MHEGFont *);
+	void (*unlockFace)(struct MHEGDisplay *, MHEGFont *);
+	bool (*fontExists)(struct MHEGDisplay *, char *);
+	/* write the current contents to a PNG file, NULL if the backend can't do it */
+	bool (*savePNG)(struct MHEGDisplay *, char *);
+} MHEGDisplayMethod;
+
+typedef struct MHEGDisplay
+{
+	MHEGDisplayMethod *fns;			/* backend */
+	void *ctx;				/* backend's private data */
 	bool fullscreen;			/* -f cmd line flag */
 	XtAppContext app;			/* Xt application context */
+	unsigned int xres;			/* output resolution in pixels */
+	unsigned int yres;
+	XRenderPictFormat *argb_format;		/* format of all our 32-bit Pictures (or in memory images) */
+	MHEGKeyMapEntry *keymap;		/* keyboard mapping */
+	char *dump_prefix;			/* if not NULL, save each frame as a PNG file starting with this */
+	unsigned int nframes;			/* number of times we have refreshed the output */
+	MHEGDisplayRect clip;			/* current clip rectangle on next_overlay */
+	unsigned int ndamaged;			/* areas of next_overlay drawn on since the last MHEGDisplay_useOverlay() */
+	MHEGDisplayRect damaged[MHEG_MAX_DAMAGE];
+	int64_t start_usecs;			/* when the display was opened */
+	MHEGDisplayStats stats;
+	/* X11 backend, dpy is NULL if we are not using an X server */
 	Display *dpy;				/* X Display */
 	Window win;				/* Window to display our Picture */
-	unsigned int xres;			/* Window resolution in pixels */
-	unsigned int yres;
 	GC win_gc;				/* GC to draw on the Window */
 	int depth;				/* colour depth of the Window */
 	Visual *vis;				/* Visual (ie pixel format) used by the Window */
@@ -53,10 +131,12 @@ typedef struct
 	Picture used_overlay_pic;		/* used_overlay_pic is composited onto the video */
 	GC overlay_gc;				/* GC to XCopyArea next_overlay to used_overlay */
 	Picture textfg_pic;			/* 1x1 solid foreground colour for text */
-	MHEGKeyMapEntry *keymap;		/* keyboard mapping */
 } MHEGDisplay;
 
-void MHEGDisplay_init(MHEGDisplay *, bool, char *);
+MHEGDisplayMethod *MHEGDisplayMethod_fromString(char *);
+char *MHEGDisplayMethod_getUsage(void);
+
+void MHEGDisplay_init(MHEGDisplay *, MHEGDisplayMethod *, bool, char *);
 void MHEGDisplay_fini(MHEGDisplay *);
 
 bool MHEGDisplay_processEvents(MHEGDisplay *, bool);
@@ -78,13 +158,23 @@ void MHEGDisplay_drawCanvas(MHEGDisplay *, XYPosition *, OriginalBoxSize *, MHEG
 void MHEGDisplay_drawTextElement(MHEGDisplay *, XYPosition *, MHEGFont *, MHEGTextElement *, bool);
 
 void MHEGDisplay_useOverlay(MHEGDisplay *);
+void MHEGDisplay_getStats(MHEGDisplay *, MHEGDisplayStats *);
 
-/* convert PNG and MPEG I-frames to internal format */
-MHEGBitmap *MHEGDisplay_newPNGBitmap(MHEGDisplay *, OctetString *);
-MHEGBitmap *MHEGDisplay_newMPEGBitmap(MHEGDisplay *, OctetString *);
+/* convert decoded PNG and MPEG I-frames to internal format */
+void MHEGDisplay_convertRGBA(MHEGDisplay *, unsigned char *, unsigned int, unsigned int, MHEGPixels *);
+void MHEGDisplay_newBitmap(MHEGDisplay *, MHEGPixels *, MHEGBitmap *);
 void MHEGDisplay_freeBitmap(MHEGDisplay *, MHEGBitmap *);
 
-MHEGBitmap *MHEGBitmap_fromRGBA(MHEGDisplay *, unsigned char *, unsigned int, unsigned int);
+/* fonts */
+void MHEGDisplay_openFont(MHEGDisplay *, MHEGFont *, double, double);
+void MHEGDisplay_closeFont(MHEGDisplay *, MHEGFont *);
+FT_Face MHEGDisplay_lockFace(MHEGDisplay *, MHEGFont *);
+void MHEGDisplay_unlockFace(MHEGDisplay *, MHEGFont *);
+bool MHEGDisplay_fontExists(MHEGDisplay *, char *);
+
+/* save frames as PNG files */
+bool MHEGDisplay_savePNG(MHEGDisplay *, char *);
+void MHEGDisplay_dumpFrames(MHEGDisplay *, char *);
 
 /* utils */
 bool intersects(XYPosition *, OriginalBoxSize *, XYPosition *, OriginalBoxSize *, XYPosition *, OriginalBoxSize *);
@@ -7,10 +7,16 @@
 #include <string.h>
 #include <limits.h>
 #include <errno.h>
+#include <unistd.h>
+#include <poll.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <time.h>
 #include <png.h>
 
 #include "MHEGEngine.h"
+#include "MHEGTimer.h"
 #include "RootClass.h"
 #include "LinkClass.h"
 #include "EventType.h"
@@ -18,20 +24,27 @@
 #include "ExternalReference.h"
 #include "ObjectReference.h"
 #include "GenericObjectReference.h"
+#include "GroupClass.h"
 #include "GroupItem.h"
 #include "ApplicationClass.h"
 #include "SceneClass.h"
 #include "VisibleClass.h"
+#include "ResidentProgramClass.h"
+#include "MHEGPrefetch.h"
 #include "si.h"
 #include "clone.h"
 #include "rtti.h"
 #include "utils.h"
 
+/* internal functions */
+static int64_t monotonic_usecs(void);
+static void arm_content_timer(int64_t);
+static void wait_for_content(ContentReference *, int64_t);
+
 LIST_TYPE(MissingContent) *
 new_MissingContentListItem(RootClass *obj, OctetString *file)
 {
 	LIST_TYPE(MissingContent) *missing;
-	struct timeval now;
 
 	missing = safe_malloc(sizeof(LIST_TYPE(MissingContent)));
 	bzero(missing, sizeof(LIST_TYPE(MissingContent)));
@@ -42,8 +55,7 @@ new_MissingContentListItem(RootClass *obj, OctetString *file)
 	OctetString_dup(&missing->item.file, file);
 
 	/* current time */
-	gettimeofday(&now, NULL);
-	missing->item.requested = now.tv_sec;
+	missing->item.requested = monotonic_usecs();
 
 	return missing;
 }
@@ -171,15 +183,40 @@ MHEGEngine_init(MHEGEngineOptions *opts)
 	engine.verbose = opts->verbose;
 	engine.timeout = opts->timeout;
 
-	MHEGDisplay_init(&engine.display, opts->fullscreen, opts->keymap);
+	MHEGTimer_init();
+
+	/* goes off when we next need to check for missing content */
+	if((engine.content_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+		fatal("Unable to create timerfd: %s", strerror(errno));
+	engine.content_due = -1;
+	engine.content_poll_ms = MISSING_CONTENT_POLL_MIN;
+
+	MHEGDisplay_init(&engine.display, MHEGDisplayMethod_fromString(opts->display_method), opts->fullscreen, opts->keymap);
+
+	if(opts->dump_prefix != NULL)
+		MHEGDisplay_dumpFrames(&engine.display, opts->dump_prefix);
+
+	MHEGBitmap_initCache();
 
 	engine.vo_method = MHEGVideoOutputMethod_fromString(opts->vo_method);
 	engine.av_disabled = opts->av_disabled;
 
+	/* the video output methods all need an X server */
+	if(engine.display.dpy == NULL && !engine.av_disabled)
+	{
+		verbose("No X server, disabling audio and video output");
+		engine.av_disabled = true;
+	}
+
 	MHEGBackend_init(&engine.backend, opts->remote, opts->srg_loc);
 
+	MHEGPrefetch_init(&engine.backend);
+
 	MHEGApp_init(&engine.active_app);
 
+	if(opts->replay != NULL)
+		engine.replay = MHEGReplay_new(opts->replay, opts->replay_json);
+
 	return;
 }
 
@@ -192,8 +229,7 @@ MHEGEngine_run(void)
 	bool block;
 	unsigned int i;
 	bool found;
-	struct timeval start;
-	struct timeval now;
+	int64_t start;
 	/* search order for the app to boot in the Service Gateway dir */
 	char *boot_order[] = { "~//a", "~//startup", NULL };
 
@@ -203,7 +239,8 @@ MHEGEngine_run(void)
 		MHEGDisplay_clearScreen(&engine.display);
 		/* search for the boot object for timeout seconds */
 		found = false;
-		gettimeofday(&start, NULL);
+		start = monotonic_usecs();
+		engine.content_poll_ms = MISSING_CONTENT_POLL_MIN;
 		do
 		{
 			for(i=0; !found && boot_order[i] != NULL; i++)
@@ -212,9 +249,11 @@ MHEGEngine_run(void)
 				boot_obj.data = boot_order[i];
 				found = MHEGEngine_checkContentRef(&boot_obj);
 			}
-			gettimeofday(&now, NULL);
+			/* sleep until it may have arrived, rather than spinning */
+			if(!found)
+				wait_for_content(&boot_obj, start + (engine.timeout * 1000000LL));
 		}
-		while(!found && now.tv_sec <= (start.tv_sec + engine.timeout));
+		while(!found && monotonic_usecs() <= start + (engine.timeout * 1000000LL));
 		if(!found)
 		{
 			error("Unable to find boot object in service gateway");
@@ -231,22 +270,37 @@ MHEGEngine_run(void)
 			/* start it up */
 			ApplicationClass_Preparation(app);
 			ApplicationClass_Activation(app);
+			/* start fetching anything it may need next */
+			MHEGPrefetch_scanItems(app->items);
 			/* main loop */
 			while(engine.quit_reason == QuitReason_DontQuit)
 			{
 				/* poll for files we are waiting for */
 				MHEGEngine_pollMissingContent();
+				/* generate TimerFired events for any timers that have gone off */
+				MHEGTimer_fireExpired();
+				/* finish off any forked ResidentPrograms whose worker threads are done */
+				ResidentProgramClass_forksFinished();
 				/* process any async events */
 				MHEGEngine_processMHEGEvents();
 				/*
-				 * if we are polling for missing content,
-				 * or if we need to quit the current app
-				 * don't block waiting for the next GUI event
+				 * if we need to quit the current app, don't block waiting for the next GUI event
+				 * otherwise the display backend sleeps in MHEGEngine_wait until a GUI event,
+				 * a timer, or something we are waiting for in missing_content wakes it
 				 */
-				block = (engine.missing_content == NULL && engine.quit_reason == QuitReason_DontQuit);
+				block = (engine.quit_reason == QuitReason_DontQuit);
 				/* process any GUI events */
-				if(MHEGDisplay_processEvents(&engine.display, block))
+				if(engine.replay != NULL)
+				{
+					/* don't wait for anything (not even missing content), just do the next thing in the script */
+					if(MHEGDisplay_processEvents(&engine.display, false)
+					|| (engine.quit_reason == QuitReason_DontQuit && MHEGReplay_nextEvent(engine.replay)))
+						engine.quit_reason = QuitReason_GUIQuit;
+				}
+				else if(MHEGDisplay_processEvents(&engine.display, block))
+				{
 					engine.quit_reason = QuitReason_GUIQuit;
+				}
 			}
 			/* do Destruction of Application and Scene */
 			if((scene = MHEGEngine_getActiveScene()) != NULL)
@@ -260,6 +314,10 @@ MHEGEngine_run(void)
 			MHEGApp_fini(&engine.active_app);
 			LIST_FREE(&engine.objects, RootClassPtr, safe_free);
 			LIST_FREE(&engine.missing_content, MissingContent, free_MissingContentListItem);
+			arm_content_timer(-1);
+			pthread_mutex_lock(&engine.backend.lock);
+			(*(engine.backend.fns->unwatchContent))(&engine.backend);
+			pthread_mutex_unlock(&engine.backend.lock);
 			LIST_FREE(&engine.active_links, LinkClassPtr, safe_free);
 			LIST_FREE(&engine.async_eventq, MHEGAsyncEvent, free_MHEGAsyncEventListItem);
 			LIST_FREE(&engine.main_actionq, MHEGAction, free_MHEGActionListItem);
@@ -302,16 +360,48 @@ printf("TODO: Spawn '%.*s'; doing Launch instead\n", engine.quit_data.size, engi
 void
 MHEGEngine_fini(void)
 {
+	struct rusage usage;
+
+	if(engine.replay != NULL)
+	{
+		MHEGReplay_report(engine.replay);
+		MHEGReplay_free(engine.replay);
+	}
+
+	MHEGTimer_fini();
+
+	/* they may be using the backend */
+	ResidentProgramClass_finiForks();
+
+	close(engine.content_fd);
+
+	/* how much CPU we used, most useful when the engine has been sat waiting for content */
+	if(getrusage(RUSAGE_SELF, &usage) == 0)
+		verbose("Main loop woke up %lu times, checked for missing content %lu times, used %ld.%03ld user %ld.%03ld system CPU secs",
+			engine.stats.nwakeups, engine.stats.ncontent_checks,
+			(long) usage.ru_utime.tv_sec, (long) usage.ru_utime.tv_usec / 1000,
+			(long) usage.ru_stime.tv_sec, (long) usage.ru_stime.tv_usec / 1000);
+
+	MHEGBitmap_freeCache();
+
 	MHEGDisplay_fini(&engine.display);
 
+	MHEGFont_freeCache();
+
 	LIST_FREE(&engine.persistent, PersistentData, free_PersistentDataListItem);
+	intern_map_free(&engine.persistent_files);
 
 	si_free();
 
+	MHEGPrefetch_fini();
+
 	MHEGBackend_fini(&engine.backend);
 
 	free_OctetString(&engine.quit_data);
 
+	/* nothing should have an interned ID now */
+	intern_free();
+
 	return;
 }
 
@@ -333,6 +423,24 @@ MHEGEngine_avDisabled(void)
 	return engine.av_disabled;
 }
 
+/*
+ * returns NULL if we are not running a replay script
+ */
+
+MHEGReplay *
+MHEGEngine_getReplay(void)
+{
+	return engine.replay;
+}
+
+void
+MHEGEngine_getStats(MHEGEngineStats *stats)
+{
+	*stats = engine.stats;
+
+	return;
+}
+
 /*
  * according to the ISO MHEG spec this should be part of the SceneClass
  * but we need info about the current app etc too
@@ -351,6 +459,8 @@ MHEGEngine_TransitionTo(TransitionTo *to, OctetString *caller_gid)
 	LIST_TYPE(MHEGAction) *act, *next_act;
 	LIST_TYPE(GroupItem) *gi;
 	LIST_TYPE(GroupItem) *gi_tail;
+	struct timespec start, end;
+	uint64_t usecs;
 
 	/* check we can find an ExternalReference for the new scene */
 	if(((ref = GenericObjectReference_getObjectReference(&to->target, caller_gid)) == NULL)
@@ -393,6 +503,8 @@ MHEGEngine_TransitionTo(TransitionTo *to, OctetString *caller_gid)
 			safe_free(scene_id.data);
 			return;
 		}
+		/* time how long the transition takes */
+		clock_gettime(CLOCK_MONOTONIC, &start);
 		/*
 		 * do Deactivation of all Ingredients in the current app that are not shared
 		 * in the reverse order they appear in the items list
@@ -459,9 +571,23 @@ MHEGEngine_TransitionTo(TransitionTo *to, OctetString *caller_gid)
 		/* load the new scene (also free's the old one if we have one) */
 		if((current_scene = MHEGApp_loadScene(&engine.active_app, &scene_id)) != NULL)
 		{
+			/* start fetching the scene's content before Preparation asks for it */
+			MHEGPrefetch_sceneLoaded(&scene_id, current_scene);
 			/* do Preparation and Activation */
 			SceneClass_Preparation(current_scene);
 			SceneClass_Activation(current_scene);
+			/* update the stats */
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			usecs = ((end.tv_sec - start.tv_sec) * 1000000LL) + ((end.tv_nsec - start.tv_nsec) / 1000);
+			engine.stats.ntransitions ++;
+			if(engine.active_app.scene_cached)
+				engine.stats.nscene_cache_hits ++;
+			engine.stats.transition_usecs += usecs;
+			engine.stats.transition_max_usecs = MAX(engine.stats.transition_max_usecs, usecs);
+			verbose("TransitionTo: took %.3f ms", usecs / 1000.0);
+			/* start fetching anything we may need next */
+			MHEGPrefetch_scanItems(current_app->items);
+			MHEGPrefetch_scanItems(current_scene->items);
 		}
 	}
 
@@ -731,6 +857,9 @@ MHEGEngine_redrawArea(XYPosition *pos, OriginalBoxSize *box)
 	if(app->inst.LockCount > 0)
 		return;
 
+	engine.stats.nredraws ++;
+	engine.stats.redraw_area += box->x_length * box->y_length;
+
 	/* any undrawn on background is black */
 	MHEGColour_black(&black);
 	MHEGDisplay_fillRectangle(&engine.display, pos, box, &black);
@@ -867,14 +996,17 @@ MHEGEngine_keyPressed(unsigned int key)
 PersistentData *
 MHEGEngine_findPersistentData(OctetString *filename, bool create)
 {
-	LIST_TYPE(PersistentData) *p = engine.persistent;
+	LIST_TYPE(PersistentData) *p;
+	unsigned int id;
 
-	while(p)
-	{
-		if(OctetString_cmp(&p->item.filename, filename) == 0)
-			return &p->item;
-		p = p->next;
-	}
+	/* if no one has used the name yet, it can't be in the store */
+	if(create)
+		id = intern_id(filename);
+	else if((id = intern_find(filename)) == 0)
+		return NULL;
+
+	if((p = intern_map_get(&engine.persistent_files, id)) != NULL)
+		return &p->item;
 
 	/* not found, create it */
 	if(create)
@@ -882,6 +1014,7 @@ MHEGEngine_findPersistentData(OctetString *filename, bool create)
 		/* add it to the list */
 		p = new_PersistentDataListItem(filename);
 		LIST_APPEND(&engine.persistent, p);
+		intern_map_put(&engine.persistent_files, id, p);
 	}
 
 	return (p != NULL) ? &p->item : NULL;
@@ -965,6 +1098,7 @@ MHEGEngine_processMHEGEvents(void)
 	{
 		/* adds any resulting actions to temp_actionq */
 		MHEGEngine_processNextAsyncEvent();
+		engine.stats.nevents ++;
 		/* process MHEG event queue as described in UK MHEG Profile */
 		engine.main_actionq = engine.temp_actionq;
 		engine.temp_actionq = NULL;
@@ -972,6 +1106,7 @@ MHEGEngine_processMHEGEvents(void)
 		{
 			/* execute the action - adds any resulting actions to temp_actionq */
 			ElementaryAction_execute(engine.main_actionq->item.action, engine.main_actionq->item.group_id);
+			engine.stats.nactions ++;
 			/* remove the action we just executed from the main_actionq */
 			LIST_FREE_HEAD(&engine.main_actionq, MHEGAction, free_MHEGActionListItem);
 			/* prepend any temp_actionq actions it generated to the main_actionq */
@@ -1129,6 +1264,7 @@ MHEGEngine_findObjectReference(ObjectReference *ref, OctetString *caller_gid)
 	unsigned int num = 0;		/* keep the compiler happy */
 	char *fullname;
 	OctetString absolute;
+	unsigned int gid_id;
 	RootClass *obj;
 
 	/* find the group id we need */
@@ -1155,14 +1291,15 @@ MHEGEngine_findObjectReference(ObjectReference *ref, OctetString *caller_gid)
 	absolute.data = fullname;
 	gid = &absolute;
 
+	/* if the group ID has not been interned, no objects have been registered in it */
+	if((gid_id = intern_find(gid)) == 0)
+		list = NULL;
+
 	while(list)
 	{
 		obj = list->item;
-		if(OctetString_cmp(gid, &obj->inst.ref.group_identifier) == 0
-		&& num == obj->inst.ref.object_number)
-		{
+		if(num == obj->inst.ref.object_number && gid_id == obj->inst.gid)
 			return list->item;
-		}
 		list = list->next;
 	}
 
@@ -1182,19 +1319,24 @@ MHEGEngine_findGroupObject(OctetString *gid)
 {
 	ApplicationClass *app;
 	SceneClass *scene;
+	unsigned int gid_id;
 
 	/* assert */
 	if(gid->size < 3 || strncmp(gid->data, "~//", 3) != 0)
 		fatal("MHEGEngine_findGroupObject: group ID '%.*s' is not absolute", gid->size, gid->data);
 
+	/* the app and scene have both been interned when they were registered */
+	if((gid_id = intern_find(gid)) == 0)
+		return NULL;
+
 	/* is it the app */
 	app = MHEGEngine_getActiveApplication();
-	if(OctetString_cmp(&app->rootClass.inst.ref.group_identifier, gid) == 0)
+	if(app->rootClass.inst.gid == gid_id)
 		return &app->rootClass;
 
 	/* is it the scene */
 	scene = MHEGEngine_getActiveScene();
-	if(scene != NULL && OctetString_cmp(&scene->rootClass.inst.ref.group_identifier, gid) == 0)
+	if(scene != NULL && scene->rootClass.inst.gid == gid_id)
 		return &scene->rootClass;
 
 	return NULL;
@@ -1204,15 +1346,16 @@ MHEGEngine_findGroupObject(OctetString *gid)
  * returns an object number which is not used in the given GroupClass
  * group should be either an ApplicationClass or a SceneClass object
  * returns 0 if group is NULL or there are no free object numbers left (very unlikely)
+ * next_clone only ever goes up, so the numbers we hand out can never clash with each other
+ * the only numbers that can clash are ones the app was authored with, those are in the group's used_numbers set
  */
 
 unsigned int
 MHEGEngine_getUnusedObjectNumber(RootClass *group)
 {
-	LIST_TYPE(GroupItem) *items, *gi;
-	unsigned int next_clone;
-	bool unused;
-	RootClass *r;
+	LIST_OF(GroupItem) *items;
+	unsigned int *next_clone;
+	ObjectNumberSet *used;
 
 	if(group == NULL)
 		return 0;
@@ -1221,51 +1364,43 @@ MHEGEngine_getUnusedObjectNumber(RootClass *group)
 	if(group->inst.rtti == RTTI_ApplicationClass)
 	{
 		items = ((ApplicationClass *) group)->items;
-		next_clone = ((ApplicationClass *) group)->inst.next_clone;
+		next_clone = &((ApplicationClass *) group)->inst.next_clone;
+		used = &((ApplicationClass *) group)->inst.used_numbers;
 	}
 	else if(group->inst.rtti == RTTI_SceneClass)
 	{
 		items = ((SceneClass *) group)->items;
-		next_clone = ((SceneClass *) group)->inst.next_clone;
+		next_clone = &((SceneClass *) group)->inst.next_clone;
+		used = &((SceneClass *) group)->inst.used_numbers;
 	}
 	else
 	{
 		return 0;
 	}
 
-	/* find the next unused object number starting at next_clone */
-	unused = false;
-	while(!unused)
+	/* first clone in this group, find the object numbers that are already taken */
+	if(used->slots == NULL)
+		GroupClass_initObjectNumbers(used, items);
+
+	/* find the next unused object number after next_clone */
+	do
 	{
-		next_clone ++;
+		(*next_clone) ++;
 		/* stop infinite loops */
-		if(next_clone == 0)
+		if(*next_clone == 0)
 			return 0;
-		/* do any of the existing objects use this number */
-		unused = true;
-		gi = items;
-		while(unused && gi)
-		{
-			if((r = GroupItem_rootClass(&gi->item)) != NULL)
-				unused = (r->inst.ref.object_number != next_clone);
-			gi = gi->next;
-		}
 	}
+	while(GroupClass_objectNumberUsed(used, *next_clone));
 
-	/* save the object number search point for next time */
-	if(group->inst.rtti == RTTI_ApplicationClass)
-		((ApplicationClass *) group)->inst.next_clone = next_clone;
-	else
-		((SceneClass *) group)->inst.next_clone = next_clone;
-
-	return next_clone;
+	return *next_clone;
 }
 
 /*
  * add the given file to the missing_content list
  * removes any previous missing content entry for this object
  * sets the objects need_content flag to true
- * the event loop polls for all the files in the missing_content list
+ * the event loop checks for all the files in the missing_content list
+ * when the backend tells us something has changed, or on a timer if it can't tell us
  * when a file appears, the associated objects' contentAvailable() method is called
  * and a ContentAvailable event is generated
  * takes a copy of the file OctetString so it doesn't need to remain valid
@@ -1287,6 +1422,10 @@ MHEGEngine_addMissingContent(RootClass *obj, OctetString *file)
 	missing = new_MissingContentListItem(obj, file);
 	LIST_APPEND(&engine.missing_content, missing);
 
+	/* check for it on the next time round the main loop, and start asking the backend often again */
+	engine.check_content = true;
+	engine.content_poll_ms = MISSING_CONTENT_POLL_MIN;
+
 	return;
 }
 
@@ -1316,13 +1455,41 @@ MHEGEngine_removeMissingContent(RootClass *obj)
 	return;
 }
 
+/*
+ * check for the files in the missing_content list
+ * does nothing unless something may have arrived, or content_fd says one of them has timed out or needs checking again
+ * arms content_fd for the next time we need to check, and asks the backend to tell us if any arrive before then
+ */
+
 void
 MHEGEngine_pollMissingContent(void)
 {
 	ApplicationClass *app = MHEGEngine_getActiveApplication();
 	LIST_TYPE(MissingContent) *missing, *next;
 	bool remove;
-	struct timeval now;
+	bool unwatched = false;
+	int64_t now = monotonic_usecs();
+	int64_t timeout = engine.timeout * 1000000LL;
+	int64_t due = -1;
+
+	/* if we are replaying a script, keep checking, we never sleep in MHEGEngine_wait */
+	if(!engine.check_content
+	&& engine.replay == NULL
+	&& (engine.content_due == -1 || now < engine.content_due))
+		return;
+
+	engine.check_content = false;
+
+	if(engine.missing_content == NULL)
+	{
+		arm_content_timer(-1);
+		pthread_mutex_lock(&engine.backend.lock);
+		(*(engine.backend.fns->unwatchContent))(&engine.backend);
+		pthread_mutex_unlock(&engine.backend.lock);
+		return;
+	}
+
+	engine.stats.ncontent_checks ++;
 
 	missing = engine.missing_content;
 	while(missing)
@@ -1334,23 +1501,29 @@ MHEGEngine_pollMissingContent(void)
 			/* remove it from the list */
 			remove = true;
 		}
+		/* has it timed out, <= means timeout=0 generates a ContentRefError immediately */
+		else if(missing->item.requested + timeout <= now)
+		{
+			/* generate a ContentRefError EngineEvent */
+			EventData event_tag;
+			event_tag.choice = EventData_integer;
+			event_tag.u.integer = EngineEvent_ContentRefError;
+			MHEGEngine_generateAsyncEvent(&app->rootClass.inst.ref, EventType_engine_event, &event_tag);
+			/* clear the need_content flag */
+			missing->item.obj->inst.need_content = false;
+			/* remove it from the list */
+			remove = true;
+		}
 		else
 		{
-			/* has it timed out */
-			gettimeofday(&now, NULL);
-			/* <= means timeout=0 generates a ContentRefError immediately */
-			if(missing->item.requested + engine.timeout <= now.tv_sec)
-			{
-				/* generate a ContentRefError EngineEvent */
-				EventData event_tag;
-				event_tag.choice = EventData_integer;
-				event_tag.u.integer = EngineEvent_ContentRefError;
-				MHEGEngine_generateAsyncEvent(&app->rootClass.inst.ref, EventType_engine_event, &event_tag);
-				/* clear the need_content flag */
-				missing->item.obj->inst.need_content = false;
-				/* remove it from the list */
-				remove = true;
-			}
+			/* wake up when it times out */
+			if(due == -1 || missing->item.requested + timeout < due)
+				due = missing->item.requested + timeout;
+			/* or when the backend thinks it may have arrived */
+			pthread_mutex_lock(&engine.backend.lock);
+			if(!(*(engine.backend.fns->watchContentRef))(&engine.backend, &missing->item.file))
+				unwatched = true;
+			pthread_mutex_unlock(&engine.backend.lock);
 		}
 		/* do we need to remove it */
 		if(remove)
@@ -1366,9 +1539,182 @@ MHEGEngine_pollMissingContent(void)
 		}
 	}
 
+	/* the backend can't tell us about some of them, so we will have to ask it again */
+	if(unwatched)
+	{
+		if(due == -1 || now + (engine.content_poll_ms * 1000LL) < due)
+			due = now + (engine.content_poll_ms * 1000LL);
+		engine.content_poll_ms = MIN(engine.content_poll_ms * 2, MISSING_CONTENT_POLL_MAX);
+	}
+
+	arm_content_timer(due);
+
 	return;
 }
 
+/*
+ * block until either fd is readable, a timer is due, a forked ResidentProgram finishes,
+ * or something in missing_content may have arrived
+ * fd may be -1 if the display has nothing to wait for
+ * if block is false, just see what is ready
+ * returns true if fd is readable
+ */
+
+bool
+MHEGEngine_wait(int fd, bool block)
+{
+	struct pollfd pfd[5];
+	nfds_t nfds = 0;
+	int fd_pos = -1;
+	int content_pos;
+	int notify_pos = -1;
+	uint64_t expirations;
+	bool changed;
+
+	if(fd != -1)
+	{
+		fd_pos = nfds;
+		pfd[nfds].fd = fd;
+		pfd[nfds].events = POLLIN;
+		nfds ++;
+	}
+
+	pfd[nfds].fd = MHEGTimer_getFd();
+	pfd[nfds].events = POLLIN;
+	nfds ++;
+
+	content_pos = nfds;
+	pfd[nfds].fd = engine.content_fd;
+	pfd[nfds].events = POLLIN;
+	nfds ++;
+
+	/* ResidentPrograms running on worker threads */
+	if(ResidentProgramClass_getForkFd() != -1)
+	{
+		pfd[nfds].fd = ResidentProgramClass_getForkFd();
+		pfd[nfds].events = POLLIN;
+		nfds ++;
+	}
+
+	/* the backend will only tell us about files we have asked it to watch */
+	if(engine.backend.notify_fd != -1)
+	{
+		notify_pos = nfds;
+		pfd[nfds].fd = engine.backend.notify_fd;
+		pfd[nfds].events = POLLIN;
+		nfds ++;
+	}
+
+	if(poll(pfd, nfds, block ? -1 : 0) < 0)
+	{
+		if(errno != EINTR)
+			error("poll: %s", strerror(errno));
+		return false;
+	}
+
+	if(block)
+		engine.stats.nwakeups ++;
+
+	/* time to check the missing content again */
+	if(pfd[content_pos].revents & POLLIN)
+	{
+		if(read(engine.content_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+			error("Unable to read timerfd: %s", strerror(errno));
+		engine.check_content = true;
+	}
+
+	/* the backend thinks something may have arrived */
+	if(notify_pos != -1 && (pfd[notify_pos].revents & POLLIN))
+	{
+		pthread_mutex_lock(&engine.backend.lock);
+		changed = (*(engine.backend.fns->readNotify))(&engine.backend);
+		pthread_mutex_unlock(&engine.backend.lock);
+		if(changed)
+			engine.check_content = true;
+	}
+
+	return (fd_pos != -1 && (pfd[fd_pos].revents & (POLLIN | POLLHUP | POLLERR)) != 0);
+}
+
+/*
+ * set content_fd to go off at the given CLOCK_MONOTONIC time
+ * -1 means disarm it
+ */
+
+static void
+arm_content_timer(int64_t due)
+{
+	struct itimerspec its;
+
+	if(due == engine.content_due)
+		return;
+
+	bzero(&its, sizeof(its));
+	if(due != -1)
+	{
+		/* 0 would disarm it */
+		due = MAX(due, 1);
+		its.it_value.tv_sec = due / 1000000;
+		its.it_value.tv_nsec = (due % 1000000) * 1000;
+	}
+
+	if(timerfd_settime(engine.content_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+		error("Unable to set timerfd: %s", strerror(errno));
+
+	engine.content_due = due;
+
+	return;
+}
+
+/*
+ * used while we look for the boot object
+ * sleep until the backend thinks the file may have arrived, we need to ask it again, or the deadline
+ */
+
+static void
+wait_for_content(ContentReference *name, int64_t deadline)
+{
+	int64_t due = deadline;
+	bool watched;
+
+	pthread_mutex_lock(&engine.backend.lock);
+	watched = (*(engine.backend.fns->watchContentRef))(&engine.backend, name);
+	pthread_mutex_unlock(&engine.backend.lock);
+
+	if(!watched)
+	{
+		due = MIN(due, monotonic_usecs() + (engine.content_poll_ms * 1000LL));
+		engine.content_poll_ms = MIN(engine.content_poll_ms * 2, MISSING_CONTENT_POLL_MAX);
+	}
+
+	arm_content_timer(due);
+
+	MHEGEngine_wait(-1, true);
+
+	/* we will watch it again if it is still not there */
+	pthread_mutex_lock(&engine.backend.lock);
+	(*(engine.backend.fns->unwatchContent))(&engine.backend);
+	pthread_mutex_unlock(&engine.backend.lock);
+	arm_content_timer(-1);
+	engine.check_content = false;
+
+	return;
+}
+
+/*
+ * CLOCK_MONOTONIC in micro seconds, so missing content times out properly even if someone changes the clock
+ */
+
+static int64_t
+monotonic_usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000000LL) + (ts.tv_nsec / 1000);
+}
+
 /*
  * returns true if the file exists on the carousel
  */
@@ -1376,7 +1722,17 @@ MHEGEngine_pollMissingContent(void)
 bool
 MHEGEngine_checkContentRef(ContentReference *name)
 {
-	return (*(engine.backend.fns->checkContentRef))(&engine.backend, name);
+	bool found;
+
+	/* have we already prefetched it */
+	if(MHEGPrefetch_checkContentRef(name))
+		return true;
+
+	pthread_mutex_lock(&engine.backend.lock);
+	found = (*(engine.backend.fns->checkContentRef))(&engine.backend, name);
+	pthread_mutex_unlock(&engine.backend.lock);
+
+	return found;
 }
 
 /*
@@ -1388,6 +1744,8 @@ MHEGEngine_checkContentRef(ContentReference *name)
 bool
 MHEGEngine_loadFile(OctetString *name, OctetString *out)
 {
+	bool rc;
+
 	/* in case it fails */
 	out->size = 0;
 	out->data = NULL;
@@ -1399,7 +1757,15 @@ MHEGEngine_loadFile(OctetString *name, OctetString *out)
 		return false;
 	}
 
-	return (*(engine.backend.fns->loadFile))(&engine.backend, name, out);
+	/* have we already prefetched it */
+	if(MHEGPrefetch_loadFile(name, out))
+		return true;
+
+	pthread_mutex_lock(&engine.backend.lock);
+	rc = (*(engine.backend.fns->loadFile))(&engine.backend, name, out);
+	pthread_mutex_unlock(&engine.backend.lock);
+
+	return rc;
 }
 
 /*
@@ -1410,7 +1776,13 @@ MHEGEngine_loadFile(OctetString *name, OctetString *out)
 FILE *
 MHEGEngine_openFile(OctetString *name)
 {
-	return (*(engine.backend.fns->openFile))(&engine.backend, name);
+	FILE *file;
+
+	pthread_mutex_lock(&engine.backend.lock);
+	file = (*(engine.backend.fns->openFile))(&engine.backend, name);
+	pthread_mutex_unlock(&engine.backend.lock);
+
+	return file;
 }
 
 /*
@@ -1445,7 +1817,15 @@ MHEGEngine_closeStream(MHEGStream *stream)
 void
 MHEGEngine_retune(OctetString *service)
 {
-	return (*(engine.backend.fns->retune))(&engine.backend, service);
+	/* anything we have prefetched or decoded came from the old service */
+	MHEGPrefetch_flush();
+	MHEGApp_flushSceneCache(&engine.active_app);
+
+	pthread_mutex_lock(&engine.backend.lock);
+	(*(engine.backend.fns->retune))(&engine.backend, service);
+	pthread_mutex_unlock(&engine.backend.lock);
+
+	return;
 }
 
 /*
@@ -1483,8 +1863,14 @@ return (*(engine.backend.fns->getServiceURL))(&engine.backend);
 bool
 MHEGEngine_isServiceAvailable(OctetString *service)
 {
+	bool available;
+
 	/* ask the backend */
-	return (*(engine.backend.fns->isServiceAvailable))(&engine.backend, service);
+	pthread_mutex_lock(&engine.backend.lock);
+	available = (*(engine.backend.fns->isServiceAvailable))(&engine.backend, service);
+	pthread_mutex_unlock(&engine.backend.lock);
+
+	return available;
 }
 
 /*
@@ -1497,7 +1883,8 @@ MHEGEngine_isServiceAvailable(OctetString *service)
 
 static char *active_app_path(void);
 
-static char _absolute[PATH_MAX];
+/* the prefetch thread also calls this */
+static __thread char _absolute[PATH_MAX];
 
 char *
 MHEGEngine_absoluteFilename(OctetString *name)
@@ -1573,29 +1960,57 @@ active_app_path(void)
  * if have_hook is true, hook should be either ContentHook_Bitmap_MPEG or ContentHook_Bitmap_PNG
  * if have_hook is false, default hook is ContentHook_Bitmap_PNG
  * Channel 4 sometimes has the wrong content hook, so if the data has a PNG signature treat it as PNG
+ * returns false if the hook is unknown
  */
 
-MHEGBitmap *
-MHEGEngine_newBitmap(OctetString *data, bool have_hook, int hook)
+static bool
+bitmap_is_mpeg(OctetString *data, bool have_hook, int hook, bool *mpeg)
 {
-	MHEGBitmap *bitmap = NULL;
-
 	if(have_hook == false
 	|| (have_hook == true && hook == ContentHook_Bitmap_PNG)
 	|| (data->size >= 8 && png_check_sig(data->data, 8)))
-		bitmap = MHEGDisplay_newPNGBitmap(&engine.display, data);
+		*mpeg = false;
 	else if(have_hook == true && hook == ContentHook_Bitmap_MPEG)
-		bitmap = MHEGDisplay_newMPEGBitmap(&engine.display, data);
+		*mpeg = true;
+	else
+		return false;
+
+	return true;
+}
+
+MHEGBitmap *
+MHEGEngine_newBitmap(OctetString *data, bool have_hook, int hook)
+{
+	MHEGBitmap *bitmap = NULL;
+	bool mpeg;
+
+	if(bitmap_is_mpeg(data, have_hook, hook, &mpeg))
+		bitmap = MHEGBitmap_get(data, mpeg);
 	else
 		error("Unknown BitmapClass content hook: %d,%d", have_hook, hook);
 
 	return bitmap;
 }
 
+/*
+ * start decoding the bitmap in the background, so it is ready by the time MHEGEngine_newBitmap() is called
+ */
+
+void
+MHEGEngine_prefetchBitmap(OctetString *data, bool have_hook, int hook)
+{
+	bool mpeg;
+
+	if(bitmap_is_mpeg(data, have_hook, hook, &mpeg))
+		MHEGBitmap_prefetch(data, mpeg);
+
+	return;
+}
+
 void
 MHEGEngine_freeBitmap(MHEGBitmap *bitmap)
 {
-	MHEGDisplay_freeBitmap(&engine.display, bitmap);
+	MHEGBitmap_release(bitmap);
 
 	return;
 }
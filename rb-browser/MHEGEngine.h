@@ -7,6 +7,7 @@
 
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 
 #include "ISO13522-MHEG-5.h"
@@ -14,12 +15,21 @@
 #include "MHEGVideoOutput.h"
 #include "MHEGBackend.h"
 #include "MHEGApp.h"
+#include "MHEGReplay.h"
 #include "der_decode.h"
 #include "listof.h"
+#include "intern.h"
 
 /* default time to poll for missing content before generating a ContentRefError (seconds) */
 #define MISSING_CONTENT_TIMEOUT		10
 
+/*
+ * how long to wait before checking again for missing content the backend can't tell us about (milli seconds)
+ * doubles each time we don't find anything, up to the max
+ */
+#define MISSING_CONTENT_POLL_MIN	100
+#define MISSING_CONTENT_POLL_MAX	1000
+
 /* where to start searching for unused object numbers for clones */
 #define FIRST_CLONED_OBJ_NUM		(1<<16)
 
@@ -88,9 +98,13 @@ typedef struct
 	int verbose;		/* -v flag */
 	unsigned int timeout;	/* seconds to poll for missing content before generating a ContentRefError */
 	bool fullscreen;	/* scale to fullscreen? */
+	char *display_method;	/* MHEGDisplayMethod name (NULL for default) */
+	char *dump_prefix;	/* save each frame as a PNG file starting with this (NULL => don't save them) */
 	char *vo_method;	/* MHEGVideoOutputMethod name (NULL for default) */
 	bool av_disabled;	/* true => audio and video output totally disabled */
 	char *keymap;		/* keymap config file to use (NULL for default) */
+	char *replay;		/* script to run instead of taking key presses from the display (NULL => don't replay) */
+	char *replay_json;	/* file to save the replay results in (NULL => don't save them) */
 } MHEGEngineOptions;
 
 /* a list of files we are waiting for, and the objects that want them */
@@ -98,7 +112,7 @@ typedef struct
 {
 	RootClass *obj;
 	OctetString file;
-	time_t requested;	/* when we first asked for the file (used to timeout requests) */
+	int64_t requested;	/* when we first asked for the file, CLOCK_MONOTONIC micro seconds (used to timeout requests) */
 } MissingContent;
 
 DEFINE_LIST_OF(MissingContent);
@@ -165,6 +179,21 @@ typedef enum
 	QuitReason_Retune	/* SI_TuneIndex programme called, channel URL is in engine.quit_data */
 } QuitReason;
 
+/* counters for benchmarking */
+typedef struct
+{
+	unsigned long nevents;		/* async events processed */
+	unsigned long nactions;		/* ElementaryActions executed */
+	unsigned long nredraws;		/* calls to MHEGEngine_redrawArea that drew something */
+	uint64_t redraw_area;		/* MHEG pixels redrawn */
+	unsigned long ntransitions;	/* TransitionTo's that loaded a new scene */
+	uint64_t transition_usecs;	/* total time from Deactivation of the old scene to Activation of the new one */
+	uint64_t transition_max_usecs;
+	unsigned long nscene_cache_hits;	/* transitions that copied the scene from the cache rather than decoding it */
+	unsigned long nwakeups;		/* times the main loop woke up after blocking in MHEGEngine_wait */
+	unsigned long ncontent_checks;	/* times we asked the backend about the files in missing_content */
+} MHEGEngineStats;
+
 /* global engine state */
 typedef struct
 {
@@ -180,11 +209,18 @@ typedef struct
 	OctetString *der_object;			/* DER object we are currently decoding */
 	LIST_OF(RootClassPtr) *objects;			/* all currently loaded MHEG objects */
 	LIST_OF(MissingContent) *missing_content;	/* files we are waiting for */
+	int content_fd;					/* timerfd that goes off when we next need to check missing_content */
+	int64_t content_due;				/* when content_fd is set to go off (CLOCK_MONOTONIC micro seconds), -1 if not set */
+	unsigned int content_poll_ms;			/* how long until we check again for files the backend can't watch */
+	bool check_content;				/* true => something may have arrived, check missing_content now */
 	LIST_OF(LinkClassPtr) *active_links;		/* currently active LinkClass objects */
 	LIST_OF(MHEGAsyncEvent) *async_eventq;		/* asynchronous events that need processing */
 	LIST_OF(MHEGAction) *main_actionq;		/* UK MHEG Profile event processing method */
 	LIST_OF(MHEGAction) *temp_actionq;		/* UK MHEG Profile event processing method */
 	LIST_OF(PersistentData) *persistent;		/* persistent files */
+	InternMap persistent_files;			/* intern_id() of each persistent filename -> its PersistentData */
+	MHEGReplay *replay;				/* script we are running (NULL if we are taking key presses from the display) */
+	MHEGEngineStats stats;				/* what we have done so far */
 } MHEGEngine;
 
 /* prototypes */
@@ -195,6 +231,8 @@ void MHEGEngine_fini(void);
 MHEGDisplay *MHEGEngine_getDisplay(void);
 MHEGVideoOutputMethod *MHEGEngine_getVideoOutputMethod(void);
 bool MHEGEngine_avDisabled(void);
+MHEGReplay *MHEGEngine_getReplay(void);
+void MHEGEngine_getStats(MHEGEngineStats *);
 
 void MHEGEngine_TransitionTo(TransitionTo *, OctetString *);
 
@@ -238,6 +276,7 @@ unsigned int MHEGEngine_getUnusedObjectNumber(RootClass *);
 void MHEGEngine_addMissingContent(RootClass *, OctetString *);
 void MHEGEngine_removeMissingContent(RootClass *);
 void MHEGEngine_pollMissingContent(void);
+bool MHEGEngine_wait(int, bool);
 
 bool MHEGEngine_checkContentRef(ContentReference *);
 bool MHEGEngine_loadFile(OctetString *, OctetString *);
@@ -255,6 +294,7 @@ char *MHEGEngine_absoluteFilename(OctetString *);
 
 /* convert PNG to internal format */
 MHEGBitmap *MHEGEngine_newBitmap(OctetString *, bool, int);
+void MHEGEngine_prefetchBitmap(OctetString *, bool, int);
 void MHEGEngine_freeBitmap(MHEGBitmap *);
 
 void verbose(char *, ...);
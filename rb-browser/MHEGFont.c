@@ -7,6 +7,7 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <math.h>
 #include <X11/Xlib.h>
 #include <X11/extensions/Xrender.h>
@@ -22,8 +23,13 @@ typedef struct
 	int xOff;
 } GlyphExtents;
 
+static void open_font(MHEGFont *);
 static void close_font(MHEGFont *);
 
+static MHEGFontCache *find_cache(MHEGFont *);
+static void free_cache(MHEGFontCache *);
+static void grow_kern_table(MHEGFontCache *);
+
 static bool get_font_attr(char **, unsigned int *, char *, unsigned int);
 
 static LIST_OF(MHEGTextElement) *split_text(MHEGFont *, MHEGColour *, OctetString *, bool, int, Justification);
@@ -49,10 +55,33 @@ static void
 close_font(MHEGFont *f)
 {
 	if(f->font != NULL)
-	{
-		XftFontClose(MHEGEngine_getDisplay()->dpy, f->font);
-		f->font = NULL;
-	}
+		MHEGDisplay_closeFont(MHEGEngine_getDisplay(), f);
+
+	/* the cache itself is shared with other fonts using the same face */
+	f->cache = NULL;
+
+	return;
+}
+
+/*
+ * the font is opened at the size it will need to be output on the screen
+ * but all the layout calculations are done using the unscaled font metrics
+ */
+
+static void
+open_font(MHEGFont *f)
+{
+	MHEGDisplay *d = MHEGEngine_getDisplay();
+	/* UK MHEG Profile says 1 point = 1 pixel vertically */
+	double pixel_size = (double) (f->size * d->yres) / (double) MHEG_YRES;
+	/* UK MHEG Profile says use a fixed aspect ratio of 45/56 */
+	double aspect = (45.0 * d->xres / MHEG_XRES) / (56.0 * d->yres / MHEG_YRES);
+
+	MHEGDisplay_openFont(d, f, pixel_size, aspect);
+	if(f->font == NULL)
+		fatal("Font '%s' does not exist", f->name);
+
+	f->cache = find_cache(f);
 
 	return;
 }
@@ -108,7 +137,7 @@ MHEGFont_setName(MHEGFont *font, FontBody *body)
  * alternatively, you can download Nebula DigiTV iTuner from http://www.nebula-electronics.com/
  * install it on a Windows box and copy C:\Windows\Fonts\tt7268m_802.ttf to your Linux box
  * if you don't have Tiresias Screenfont, we try FreeSans instead
- * if FreeSANS is not available either, we use whatever Xft returns for 'sans'
+ * if FreeSANS is not available either, we use whatever fontconfig returns for 'sans'
  */
 
 static char *_default_font_name = NULL;
@@ -119,21 +148,17 @@ static char *_font_name_sans = "sans";
 void
 MHEGFont_defaultName(MHEGFont *font)
 {
-	Display *dpy = MHEGEngine_getDisplay()->dpy;
-	char *xlfd_tiresias = "-*-TiresiasScreenfont-medium-r-normal-*";
-	char *xlfd_freesans = "-*-freesans-medium-r-normal-*";
-	char **names = NULL;
-	int count;
+	MHEGDisplay *d = MHEGEngine_getDisplay();
 
 	/* first time */
 	if(_default_font_name == NULL)
 	{
 		/* do we have Tiresias */
-		if((names = XListFonts(dpy, xlfd_tiresias, 1, &count)) != NULL)
+		if(MHEGDisplay_fontExists(d, _font_name_tiresias))
 		{
 			_default_font_name = _font_name_tiresias;
 		}
-		else if((names = XListFonts(dpy, xlfd_freesans, 1, &count)) != NULL)
+		else if(MHEGDisplay_fontExists(d, _font_name_freesans))
 		{
 			_default_font_name = _font_name_freesans;
 			error("Font '%s' not available; using '%s' for 'rec://font/uk1'", _font_name_tiresias, _font_name_freesans);
@@ -143,9 +168,6 @@ MHEGFont_defaultName(MHEGFont *font)
 			_default_font_name = _font_name_sans;
 			error("Font '%s' not available; using '%s' for 'rec://font/uk1'", _font_name_tiresias, _font_name_sans);
 		}
-		/* clean up */
-		if(names != NULL)
-			XFreeFontNames(names);
 	}
 
 	font->name = _default_font_name;
@@ -291,7 +313,8 @@ MHEGFont_layoutText(MHEGFont *f, MHEGColour *col, OctetString *text, OriginalBox
 {
 	LIST_OF(MHEGTextElement) *elem_list = NULL;
 	LIST_TYPE(MHEGTextElement) *elem;
-	FT_Face face;
+	FT_UShort units_per_EM;
+	FT_BBox *bbox;
 	int yOffsetTop, yOffsetBottom, xOffsetLeft;
 	int num_lines;
 	int available_width;
@@ -304,48 +327,19 @@ MHEGFont_layoutText(MHEGFont *f, MHEGColour *col, OctetString *text, OriginalBox
 
 	/* do we have the font metrics yet */
 	if(f->font == NULL)
-	{
-		/*
-		 * the font is opened at the size it will need to be output on the screen
-		 * but all the layout calculations are done using the unscaled font metrics
-		 */
-		MHEGDisplay *d = MHEGEngine_getDisplay();
-		/* UK MHEG Profile says 1 point = 1 pixel vertically */
-		double pixel_size = (double) (f->size * d->yres) / (double) MHEG_YRES;
-		/* UK MHEG Profile says use a fixed aspect ratio of 45/56 */
-		double aspect = (45.0 * d->xres / MHEG_XRES) / (56.0 * d->yres / MHEG_YRES);
-		f->font = XftFontOpen(d->dpy, DefaultScreen(d->dpy),
-				      FC_FAMILY, FcTypeString, f->name,
-				      FC_PIXEL_SIZE, FcTypeDouble, pixel_size,
-				      FC_ASPECT, FcTypeDouble, aspect,
-				      /* may not give us a scalable font */
-				      FC_SCALABLE, FcTypeBool, FcTrue,
-				      0);
-		if(f->font == NULL)
-			fatal("Font '%s' does not exist", f->name);
-	}
-
-	face = XftLockFace(f->font);
-
-	/*
-	 * make sure we got a scalable font
-	 * if the font is not scalable the aspect ratio won't work
-	 * and we can't use its outline metrics to do layout calculations
-	 */
-	if(!FT_IS_SCALABLE(face))
-		fatal("Unable to find a scalable font for '%s'", f->name);
+		open_font(f);
 
 	/* UK MHEG Profile tells us to do layout like this (need some constants first): */
-	yOffsetTop = face->bbox.yMax <= 0 ? 0 : ceil((double) (face->bbox.yMax * f->size) / (double) face->units_per_EM);
-	yOffsetBottom = face->bbox.yMin >= 0 ? 0 : ceil((double) (- face->bbox.yMin * f->size) / (double) face->units_per_EM);
+	units_per_EM = f->cache->units_per_EM;
+	bbox = &f->cache->bbox;
+	yOffsetTop = bbox->yMax <= 0 ? 0 : ceil((double) (bbox->yMax * f->size) / (double) units_per_EM);
+	yOffsetBottom = bbox->yMin >= 0 ? 0 : ceil((double) (- bbox->yMin * f->size) / (double) units_per_EM);
 	/* take the 45/56 aspect ratio into account */
-	xOffsetLeft = face->bbox.xMin >= 0 ? 0 : ceil((- face->bbox.xMin * f->size * 45.0) / (face->units_per_EM * 56.0));
+	xOffsetLeft = bbox->xMin >= 0 ? 0 : ceil((- bbox->xMin * f->size * 45.0) / (units_per_EM * 56.0));
 
 	/* remember xOffsetLeft as this is the min amount a tab should advance the x pos */
 	f->xOffsetLeft = xOffsetLeft;
 
-	XftUnlockFace(f->font);
-
 	/* 1a - find the max number of lines that can be rendered in the given area */
 	if(box->y_length < (yOffsetBottom + yOffsetTop))
 		num_lines = 1;
@@ -444,6 +438,159 @@ MHEGFont_layoutText(MHEGFont *f, MHEGColour *col, OctetString *text, OriginalBox
 	return elem_list;
 }
 
+/*
+ * returns a layout of the given text in the given box
+ * apps often switch between the same few strings (clocks, tickers, paged text, etc)
+ * so we keep the most recently used layouts and share them between objects
+ * call MHEGFont_releaseLayout() when you have finished with it
+ */
+
+DEFINE_LIST_OF(MHEGTextLayout);
+
+/* most recently used at the head */
+static LIST_OF(MHEGTextLayout) *_layouts = NULL;
+static unsigned int _nlayouts = 0;
+
+/* for verbose stats */
+static unsigned int _layout_hits = 0;
+static unsigned int _layout_misses = 0;
+
+static void free_layout(MHEGTextLayout *);
+
+MHEGTextLayout *
+MHEGFont_getLayout(MHEGFont *f, MHEGColour *col, OctetString *text, OriginalBoxSize *box,
+		   Justification hori, Justification vert, LineOrientation orient, StartCorner corner, bool wrap)
+{
+	LIST_TYPE(MHEGTextLayout) *item;
+	MHEGTextLayout *l;
+	uint32_t hash;
+	bool hit;
+
+	hash = OctetString_hash(text);
+
+	/* have we already laid it out */
+	for(item=_layouts; item; item=item->next)
+	{
+		l = &item->item;
+		if(l->hash == hash
+		&& l->size == f->size
+		&& l->line_spc == f->line_spc
+		&& l->letter_spc == f->letter_spc
+		&& l->style == f->style
+		&& l->box.x_length == box->x_length
+		&& l->box.y_length == box->y_length
+		&& l->hori == hori
+		&& l->vert == vert
+		&& l->orient == orient
+		&& l->corner == corner
+		&& l->wrap == wrap
+		&& memcmp(&l->col, col, sizeof(MHEGColour)) == 0
+		&& strcmp(l->name, f->name) == 0
+		&& OctetString_cmp(&l->text, text) == 0)
+			break;
+	}
+
+	hit = (item != NULL);
+	if(hit)
+	{
+		_layout_hits ++;
+		/* move it to the head of the list */
+		LIST_REMOVE(&_layouts, item);
+		LIST_PREPEND(&_layouts, item);
+		/* drawing needs the font to be open and xOffsetLeft to be set */
+		if(f->font == NULL)
+			open_font(f);
+		f->xOffsetLeft = item->item.xOffsetLeft;
+	}
+	else
+	{
+		_layout_misses ++;
+		/* make room for it */
+		if(_nlayouts >= MHEGFONT_LAYOUT_CACHE_SIZE)
+		{
+			item = _layouts->prev;
+			LIST_REMOVE(&_layouts, item);
+			_nlayouts --;
+			/* objects still using it keep it alive until they release it */
+			item->item.cached = false;
+			if(item->item.refs == 0)
+			{
+				free_layout(&item->item);
+				safe_free(item);
+			}
+		}
+		item = safe_mallocz(sizeof(LIST_TYPE(MHEGTextLayout)));
+		l = &item->item;
+		l->cached = true;
+		l->hash = hash;
+		OctetString_dup(&l->text, text);
+		l->name = safe_strdup(f->name);
+		l->style = f->style;
+		l->size = f->size;
+		l->line_spc = f->line_spc;
+		l->letter_spc = f->letter_spc;
+		memcpy(&l->col, col, sizeof(MHEGColour));
+		memcpy(&l->box, box, sizeof(OriginalBoxSize));
+		l->hori = hori;
+		l->vert = vert;
+		l->orient = orient;
+		l->corner = corner;
+		l->wrap = wrap;
+		/* the elements point into our copy of the text */
+		l->element = MHEGFont_layoutText(f, col, &l->text, box, hori, vert, orient, corner, wrap);
+		l->xOffsetLeft = f->xOffsetLeft;
+		LIST_PREPEND(&_layouts, item);
+		_nlayouts ++;
+	}
+
+	verbose("MHEGFont: layout cache %s (hits=%u misses=%u; %u%%)", hit ? "hit" : "miss",
+		_layout_hits, _layout_misses, (100 * _layout_hits) / (_layout_hits + _layout_misses));
+
+	item->item.refs ++;
+
+	return &item->item;
+}
+/*
+ * stop using the given layout and set *layout to NULL
+ * safe to call if *layout is already NULL
+ */
+
+void
+MHEGFont_releaseLayout(MHEGTextLayout **layout)
+{
+	MHEGTextLayout *l = *layout;
+	LIST_TYPE(MHEGTextLayout) *item;
+
+	if(l == NULL)
+		return;
+
+	*layout = NULL;
+
+	l->refs --;
+
+	/* has it been evicted from the cache while we were using it */
+	if(l->refs == 0 && !l->cached)
+	{
+		/* the layout is embedded in its cache list item */
+		item = (LIST_TYPE(MHEGTextLayout) *) (((char *) l) - offsetof(LIST_TYPE(MHEGTextLayout), item));
+		free_layout(l);
+		safe_free(item);
+	}
+
+	return;
+}
+
+static void
+free_layout(MHEGTextLayout *l)
+{
+	LIST_FREE(&l->element, MHEGTextElement, safe_free);
+
+	free_OctetString(&l->text);
+	safe_free(l->name);
+
+	return;
+}
+
 /*
  * LIST_OF(MHEGTextElement) *
  * split_text(MHEGFont *f, MHEGColour *col, OctetString *text, bool wrap, int available_width, Justification hori)
@@ -504,7 +651,6 @@ split_text(MHEGFont *f, MHEGColour *col, OctetString *text, bool wrap, int avail
 	MHEGColour colour_stack[COLOUR_STACK_MAX];
 	int colour_stack_depth;
 	MHEGColour *current_colour;
-	FT_Face face;
 	FT_UShort units_per_EM;
 	int xpos, ypos;
 	char *data;
@@ -519,9 +665,7 @@ split_text(MHEGFont *f, MHEGColour *col, OctetString *text, bool wrap, int avail
 	int break_colour_stack;
 	int previous;
 
-	face = XftLockFace(f->font);
-	units_per_EM = face->units_per_EM;
-	XftUnlockFace(f->font);
+	units_per_EM = f->cache->units_per_EM;
 
 	/* remember the current colour */
 	INIT_COLOUR_STACK(col);
@@ -805,25 +949,19 @@ static GlyphExtents _ext;
 static GlyphExtents *
 char_extents(MHEGFont *f, int xpos, Justification hori, int previous, int measure)
 {
-	FT_Face face;
-	FT_GlyphSlot slot;
-	FT_UInt previous_glyph;
-	FT_UInt measure_glyph;
-	FT_Error err;
-	FT_Vector kern;
+	MHEGFontCache *cache = f->cache;
+	MHEGGlyph *glyph;
 	int ntabs;
 
 	/* easy case, just advance to next tab stop */
 	if(measure == 0x09 && hori == Justification_start)
 	{
-		face = XftLockFace(f->font);
 		_ext.width = 0;
 		/* min amount a tab should advance the text pos */
-		ntabs = xpos + (f->xOffsetLeft * face->units_per_EM);
+		ntabs = xpos + (f->xOffsetLeft * cache->units_per_EM);
 		/* move to the next tab stop */
-		ntabs /= (MHEG_TAB_WIDTH * face->units_per_EM);
-		_ext.xOff = ((ntabs + 1) * MHEG_TAB_WIDTH * face->units_per_EM) - xpos;
-		XftUnlockFace(f->font);
+		ntabs /= (MHEG_TAB_WIDTH * cache->units_per_EM);
+		_ext.xOff = ((ntabs + 1) * MHEG_TAB_WIDTH * cache->units_per_EM) - xpos;
 		return &_ext;
 	}
 
@@ -835,40 +973,25 @@ char_extents(MHEGFont *f, int xpos, Justification hori, int previous, int measur
 	}
 
 	/* get the metrics for measure */
-	face = XftLockFace(f->font);
-	slot = face->glyph;
-
-	measure_glyph = FT_Get_Char_Index(face, measure);
-	err = FT_Load_Glyph(face, measure_glyph, FT_LOAD_NO_SCALE);
-	if(err)
-	{
-		_ext.width = 0;
-		_ext.xOff = 0;
-	}
-	else
-	{
-		_ext.width = (slot->metrics.horiBearingX + slot->metrics.width) * f->size;
-		_ext.xOff = slot->advance.x * f->size;
-	}
+	glyph = MHEGFont_getGlyph(f, measure);
+	_ext.width = glyph->width * f->size;
+	_ext.xOff = glyph->advance * f->size;
 
 	/* take any kerning into account */
-	if(previous != -1 && previous != 0x09 && FT_HAS_KERNING(face))
+	if(previous != -1 && previous != 0x09 && cache->has_kerning)
 	{
-		previous_glyph = FT_Get_Char_Index(face, previous);
-		FT_Get_Kerning(face, previous_glyph, measure_glyph, FT_KERNING_UNSCALED, &kern);
-		_ext.width += kern.x * f->size;
-		_ext.xOff += kern.x * f->size;
+		int kern = MHEGFont_getKerning(f, MHEGFont_getGlyph(f, previous)->glyph, glyph->glyph);
+		_ext.width += kern * f->size;
+		_ext.xOff += kern * f->size;
 	}
 
 	/* add on (letter spacing / 256) * units_per_EM */
-	_ext.xOff += (face->units_per_EM * f->letter_spc) / 256;
+	_ext.xOff += (cache->units_per_EM * f->letter_spc) / 256;
 
 	/* take aspect ratio into account */
 	_ext.width = (_ext.width * 45) / 56;
 	_ext.xOff = (_ext.xOff * 45) / 56;
 
-	XftUnlockFace(f->font);
-
 	return &_ext;
 }
 
@@ -882,3 +1005,226 @@ is_breakable(int letter)
 	return (letter == 0x09 || letter == 0x20);
 }
 
+
+/*
+ * returns the unscaled metrics for the given character
+ * looks them up in the face the first time each character is used
+ * the font must already be open
+ */
+
+MHEGGlyph *
+MHEGFont_getGlyph(MHEGFont *f, int c)
+{
+	MHEGFontCache *cache = f->cache;
+	MHEGGlyph **page;
+	MHEGGlyph *glyph;
+	FT_Face face;
+
+	/* next_utf8() never gives us more than 21 bits */
+	c &= 0x1fffff;
+
+	page = &cache->page[c / MHEGFONT_PAGE_SIZE];
+	if(*page == NULL)
+		*page = safe_mallocz(MHEGFONT_PAGE_SIZE * sizeof(MHEGGlyph));
+
+	glyph = &(*page)[c % MHEGFONT_PAGE_SIZE];
+	if(!glyph->loaded)
+	{
+		face = MHEGDisplay_lockFace(MHEGEngine_getDisplay(), f);
+		glyph->glyph = FT_Get_Char_Index(face, c);
+		if(FT_Load_Glyph(face, glyph->glyph, FT_LOAD_NO_SCALE) == 0)
+		{
+			glyph->valid = true;
+			glyph->width = face->glyph->metrics.horiBearingX + face->glyph->metrics.width;
+			glyph->advance = face->glyph->advance.x;
+		}
+		else
+		{
+			glyph->valid = false;
+			glyph->width = 0;
+			glyph->advance = 0;
+		}
+		MHEGDisplay_unlockFace(MHEGEngine_getDisplay(), f);
+		glyph->loaded = true;
+	}
+
+	return glyph;
+}
+
+/*
+ * returns the unscaled horizontal kerning between the two glyphs
+ * the font must already be open
+ */
+
+/* hash a glyph pair into the kerning table, size must be a power of 2 */
+#define KERN_HASH(L, R, SIZE)	((((L) * 31) + (R)) & ((SIZE) - 1))
+
+/* initial number of slots in the kerning table */
+#define INIT_KERN_SIZE	256
+
+int
+MHEGFont_getKerning(MHEGFont *f, FT_UInt left, FT_UInt right)
+{
+	MHEGFontCache *cache = f->cache;
+	MHEGKernPair *pair;
+	unsigned int i;
+	FT_Face face;
+	FT_Vector kern;
+
+	if(!cache->has_kerning)
+		return 0;
+
+	/* keep the table at most half full */
+	if((cache->kern_used + 1) * 2 > cache->kern_size)
+		grow_kern_table(cache);
+
+	/* linear probing */
+	i = KERN_HASH(left, right, cache->kern_size);
+	pair = &cache->kern[i];
+	while(pair->used)
+	{
+		if(pair->left == left && pair->right == right)
+			return pair->kern;
+		i = (i + 1) & (cache->kern_size - 1);
+		pair = &cache->kern[i];
+	}
+
+	/* not seen this pair before */
+	face = MHEGDisplay_lockFace(MHEGEngine_getDisplay(), f);
+	if(FT_Get_Kerning(face, left, right, FT_KERNING_UNSCALED, &kern) != 0)
+		kern.x = 0;
+	MHEGDisplay_unlockFace(MHEGEngine_getDisplay(), f);
+
+	pair->used = true;
+	pair->left = left;
+	pair->right = right;
+	pair->kern = kern.x;
+	cache->kern_used ++;
+
+	return pair->kern;
+}
+
+static void
+grow_kern_table(MHEGFontCache *cache)
+{
+	MHEGKernPair *old_kern = cache->kern;
+	unsigned int old_size = cache->kern_size;
+	unsigned int i, j;
+
+	cache->kern_size = (old_size == 0) ? INIT_KERN_SIZE : old_size * 2;
+	cache->kern = safe_mallocz(cache->kern_size * sizeof(MHEGKernPair));
+
+	/* rehash the existing pairs */
+	for(i=0; i<old_size; i++)
+	{
+		if(!old_kern[i].used)
+			continue;
+		j = KERN_HASH(old_kern[i].left, old_kern[i].right, cache->kern_size);
+		while(cache->kern[j].used)
+			j = (j + 1) & (cache->kern_size - 1);
+		cache->kern[j] = old_kern[i];
+	}
+
+	safe_free(old_kern);
+
+	return;
+}
+
+/*
+ * there are only a few possible font names, so a list is fine
+ */
+
+DEFINE_LIST_OF(MHEGFontCache);
+
+static LIST_OF(MHEGFontCache) *_caches = NULL;
+
+/*
+ * returns the metrics cache for the face used by f
+ * creates a new one if this is the first time we have used the face
+ * f->font must already be open
+ */
+
+static MHEGFontCache *
+find_cache(MHEGFont *f)
+{
+	LIST_TYPE(MHEGFontCache) *item;
+	MHEGFontCache *cache;
+	FT_Face face;
+
+	for(item=_caches; item; item=item->next)
+	{
+		if(strcmp(item->item.name, f->name) == 0)
+			return &item->item;
+	}
+
+	item = safe_mallocz(sizeof(LIST_TYPE(MHEGFontCache)));
+	cache = &item->item;
+
+	cache->name = safe_strdup(f->name);
+
+	face = MHEGDisplay_lockFace(MHEGEngine_getDisplay(), f);
+	/*
+	 * make sure we got a scalable font
+	 * if the font is not scalable the aspect ratio won't work
+	 * and we can't use its outline metrics to do layout calculations
+	 */
+	if(!FT_IS_SCALABLE(face))
+		fatal("Unable to find a scalable font for '%s'", f->name);
+	cache->units_per_EM = face->units_per_EM;
+	cache->bbox = face->bbox;
+	cache->has_kerning = FT_HAS_KERNING(face);
+	MHEGDisplay_unlockFace(MHEGEngine_getDisplay(), f);
+
+	/* glyph pages and the kerning table are filled in as we need them */
+	cache->kern = NULL;
+	cache->kern_size = 0;
+	cache->kern_used = 0;
+
+	LIST_APPEND(&_caches, item);
+
+	return cache;
+}
+
+static void
+free_cache(MHEGFontCache *cache)
+{
+	unsigned int i;
+
+	safe_free(cache->name);
+
+	for(i=0; i<MHEGFONT_NPAGES; i++)
+		safe_free(cache->page[i]);
+
+	safe_free(cache->kern);
+
+	return;
+}
+
+/*
+ * free all the cached font metrics and text layouts
+ * call this when all the MHEGFont's have been freed
+ */
+
+void
+MHEGFont_freeCache(void)
+{
+	LIST_TYPE(MHEGTextLayout) *item;
+
+	LIST_FREE_ITEMS(&_caches, MHEGFontCache, free_cache, safe_free);
+
+	/* layouts still in use get freed when they are released */
+	while(_layouts != NULL)
+	{
+		item = _layouts;
+		LIST_REMOVE(&_layouts, item);
+		item->item.cached = false;
+		if(item->item.refs == 0)
+		{
+			free_layout(&item->item);
+			safe_free(item);
+		}
+	}
+	_nlayouts = 0;
+
+	return;
+}
@@ -5,6 +5,8 @@
 #ifndef __MHEGFONT_H__
 #define __MHEGFONT_H__
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <X11/Xft/Xft.h>
 
 #include "der_decode.h"
@@ -16,6 +18,48 @@ typedef enum
 	MHEGFontStyle_plain
 } MHEGFontStyle;
 
+/*
+ * unscaled metrics for one character, in font units
+ * loaded from the face the first time the character is used
+ */
+typedef struct
+{
+	bool loaded;		/* false => not looked up yet */
+	bool valid;		/* false => FT_Load_Glyph failed */
+	FT_UInt glyph;		/* glyph index in the face */
+	int width;		/* horiBearingX + width */
+	int advance;		/* advance.x */
+} MHEGGlyph;
+
+/* characters are stored in pages of 256, indexed by (char >> 8) */
+#define MHEGFONT_PAGE_SIZE	256
+#define MHEGFONT_NPAGES		((0x1fffff / MHEGFONT_PAGE_SIZE) + 1)
+
+/* kerning between two glyphs, in font units */
+typedef struct
+{
+	bool used;		/* false => empty slot */
+	FT_UInt left;
+	FT_UInt right;
+	int kern;
+} MHEGKernPair;
+
+/*
+ * metrics cache shared by all MHEGFont's using the same face
+ * we only ever use unscaled metrics, so the size the font is opened at does not matter
+ */
+typedef struct
+{
+	char *name;				/* font family */
+	FT_UShort units_per_EM;
+	FT_BBox bbox;
+	bool has_kerning;
+	MHEGGlyph *page[MHEGFONT_NPAGES];	/* NULL until we use a char on that page */
+	MHEGKernPair *kern;			/* open addressed hash table */
+	unsigned int kern_size;			/* number of slots in kern (power of 2) */
+	unsigned int kern_used;			/* number of slots filled */
+} MHEGFontCache;
+
 typedef struct
 {
 	/* FontBody */
@@ -26,7 +70,8 @@ typedef struct
 	int line_spc;
 	int letter_spc;
 	/* internal stuff */
-	XftFont *font;		/* scaled up if fullscreen mode */
+	void *font;		/* display backend font handle, scaled up if fullscreen mode */
+	MHEGFontCache *cache;	/* glyph metrics for font's face */
 	int xOffsetLeft;	/* minimum amount tab should advance (pixels) */
 } MHEGFont;
 
@@ -45,6 +90,39 @@ typedef struct
 
 DEFINE_LIST_OF(MHEGTextElement);
 
+/*
+ * a laid out piece of text
+ * these are cached and shared between all the objects displaying the same text in the same way
+ * the key is everything that was passed to MHEGFont_layoutText()
+ */
+typedef struct
+{
+	unsigned int refs;			/* number of objects using it */
+	bool cached;				/* false => not in the cache, free it when refs gets to 0 */
+	uint32_t hash;				/* hash of text */
+	OctetString text;			/* our own copy, element data points into this */
+	/* font */
+	char *name;
+	MHEGFontStyle style;
+	int size;
+	int line_spc;
+	int letter_spc;
+	/* layout params */
+	MHEGColour col;
+	OriginalBoxSize box;
+	Justification hori;
+	Justification vert;
+	LineOrientation orient;
+	StartCorner corner;
+	bool wrap;
+	/* result */
+	int xOffsetLeft;			/* MHEGFont.xOffsetLeft for this font */
+	LIST_OF(MHEGTextElement) *element;
+} MHEGTextLayout;
+
+/* max number of layouts we keep in the cache */
+#define MHEGFONT_LAYOUT_CACHE_SIZE	64
+
 /* functions */
 void free_MHEGFont(MHEGFont *);
 
@@ -56,6 +134,15 @@ void MHEGFont_defaultName(MHEGFont *);
 void MHEGFont_setAttributes(MHEGFont *, OctetString *);
 void MHEGFont_defaultAttributes(MHEGFont *);
 
+MHEGTextLayout *MHEGFont_getLayout(MHEGFont *, MHEGColour *, OctetString *, OriginalBoxSize *,
+				   Justification, Justification, LineOrientation, StartCorner, bool);
+void MHEGFont_releaseLayout(MHEGTextLayout **);
+
+MHEGGlyph *MHEGFont_getGlyph(MHEGFont *, int);
+int MHEGFont_getKerning(MHEGFont *, FT_UInt, FT_UInt);
+
+void MHEGFont_freeCache(void);
+
 LIST_OF(MHEGTextElement) *MHEGFont_layoutText(MHEGFont *, MHEGColour *, OctetString *, OriginalBoxSize *,
 					      Justification, Justification, LineOrientation, StartCorner, bool);
 
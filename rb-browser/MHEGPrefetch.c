@@ -0,0 +1,706 @@
+/*
+ * MHEGPrefetch.c
+ *
+ * fetches carousel files in the background before the engine asks for them
+ * after each scene is activated, its Links are scanned for TransitionTo and SetData targets
+ * we also remember the content each scene used, so we can fetch it when the scene becomes a TransitionTo target
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "MHEGEngine.h"
+#include "MHEGPrefetch.h"
+#include "intern.h"
+#include "listof.h"
+#include "utils.h"
+
+/* where a file has got to */
+typedef enum
+{
+	PrefetchState_queued,		/* waiting to be fetched */
+	PrefetchState_loading,		/* being fetched */
+	PrefetchState_loaded,		/* data is valid */
+	PrefetchState_failed		/* file is not available */
+} PrefetchState;
+
+typedef struct
+{
+	OctetString name;		/* absolute name, ie starts with ~// */
+	unsigned int id;		/* intern_id() of name */
+	unsigned int priority;		/* MHEGPREFETCH_xxx */
+	PrefetchState state;
+	unsigned int waiting;		/* number of threads waiting for it to be fetched */
+	OctetString data;		/* file contents */
+} PrefetchFile;
+
+DEFINE_LIST_OF(PrefetchFile);
+
+/* the content used by a scene */
+typedef struct
+{
+	OctetString scene;		/* absolute name of the scene */
+	unsigned int id;		/* intern_id() of scene */
+	unsigned int nfiles;
+	OctetString *files;		/* absolute names of its referenced content */
+} PrefetchScene;
+
+DEFINE_LIST_OF(PrefetchScene);
+
+/* internal functions */
+static void request_file(OctetString *, unsigned int);
+static void request_content(ContentReference *, unsigned int);
+static LIST_TYPE(PrefetchFile) *find_file(unsigned int);
+static LIST_TYPE(PrefetchFile) *next_queued(void);
+static void free_file(LIST_TYPE(PrefetchFile) *);
+static void evict_files(void);
+static void free_scene(LIST_TYPE(PrefetchScene) *);
+
+static ContentBody *item_content(GroupItem *, bool *);
+static void scan_actions(ActionClass *, unsigned int);
+
+static void *prefetch_thread(void *);
+
+/*
+ * files we have fetched or are about to fetch, most recently requested first
+ * _prefetch_lock protects everything here
+ * names are interned, so we can find files and scenes by comparing IDs
+ */
+static LIST_OF(PrefetchFile) *_files = NULL;
+static unsigned int _nfiles = 0;
+static size_t _bytes = 0;
+static LIST_OF(PrefetchScene) *_scenes = NULL;
+static unsigned int _nscenes = 0;
+static pthread_mutex_t _prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _work_cond = PTHREAD_COND_INITIALIZER;	/* signalled when a file is requested */
+static pthread_cond_t _done_cond = PTHREAD_COND_INITIALIZER;	/* signalled when a file has been fetched */
+static unsigned int _hits = 0;
+static unsigned int _misses = 0;
+
+/* the prefetch thread */
+static MHEGBackend *_backend = NULL;
+static bool _running = false;
+static bool _stop = false;
+static pthread_t _prefetch_tid;
+
+void
+MHEGPrefetch_init(MHEGBackend *b)
+{
+	_backend = b;
+	_stop = false;
+
+	if(pthread_create(&_prefetch_tid, NULL, prefetch_thread, NULL) != 0)
+		fatal("Unable to create prefetch thread");
+	_running = true;
+
+	return;
+}
+
+void
+MHEGPrefetch_fini(void)
+{
+	if(!_running)
+		return;
+
+	/* stop the prefetch thread */
+	pthread_mutex_lock(&_prefetch_lock);
+	_stop = true;
+	pthread_cond_signal(&_work_cond);
+	pthread_mutex_unlock(&_prefetch_lock);
+
+	pthread_join(_prefetch_tid, NULL);
+	_running = false;
+
+	MHEGPrefetch_flush();
+
+	return;
+}
+
+/*
+ * forget everything we have fetched
+ * eg when we retune, the files on the new service will be different
+ */
+
+void
+MHEGPrefetch_flush(void)
+{
+	LIST_TYPE(PrefetchFile) *file, *next;
+
+	pthread_mutex_lock(&_prefetch_lock);
+
+	/* wait for the prefetch thread to finish with the file it is fetching */
+	do
+	{
+		file = _files;
+		while(file && file->item.state != PrefetchState_loading)
+			file = file->next;
+		if(file != NULL)
+			pthread_cond_wait(&_done_cond, &_prefetch_lock);
+	}
+	while(file != NULL);
+
+	file = _files;
+	while(file)
+	{
+		next = file->next;
+		LIST_REMOVE(&_files, file);
+		free_file(file);
+		file = next;
+	}
+
+	while(_scenes)
+	{
+		LIST_TYPE(PrefetchScene) *scene = _scenes;
+		LIST_REMOVE(&_scenes, scene);
+		free_scene(scene);
+	}
+
+	pthread_mutex_unlock(&_prefetch_lock);
+
+	return;
+}
+
+/*
+ * fetch the given file in the background
+ * name should be an absolute group ID, ie start with ~//
+ * if name is a scene we have seen before, the content it used is also fetched
+ */
+
+void
+MHEGPrefetch_request(char *name, unsigned int priority)
+{
+	LIST_TYPE(PrefetchScene) *scene;
+	OctetString oname;
+	unsigned int id;
+	unsigned int i;
+
+	if(!_running)
+		return;
+
+	/* assert */
+	if(strncmp(name, "~//", 3) != 0)
+		fatal("MHEGPrefetch_request: group ID '%s' is not absolute", name);
+
+	oname.size = strlen(name);
+	oname.data = name;
+	id = intern_id(&oname);
+
+	pthread_mutex_lock(&_prefetch_lock);
+
+	request_file(&oname, priority);
+
+	/* do we know what content it needs */
+	scene = _scenes;
+	while(scene && scene->item.id != id)
+		scene = scene->next;
+	if(scene != NULL)
+	{
+		for(i=0; i<scene->item.nfiles; i++)
+			request_file(&scene->item.files[i], MHEGPREFETCH_LOW);
+	}
+
+	/* get rid of the least recently requested files if we have too many */
+	evict_files();
+
+	pthread_mutex_unlock(&_prefetch_lock);
+
+	return;
+}
+
+/*
+ * returns true if we have already fetched the file
+ */
+
+bool
+MHEGPrefetch_checkContentRef(ContentReference *name)
+{
+	OctetString absolute;
+	LIST_TYPE(PrefetchFile) *file;
+	bool found;
+
+	absolute.data = MHEGEngine_absoluteFilename(name);
+	absolute.size = strlen(absolute.data);
+
+	/* if the name has not been interned, we have not been asked to fetch it */
+	pthread_mutex_lock(&_prefetch_lock);
+	found = ((file = find_file(intern_find(&absolute))) != NULL && file->item.state == PrefetchState_loaded);
+	pthread_mutex_unlock(&_prefetch_lock);
+
+	return found;
+}
+
+/*
+ * if we have fetched the file (or are fetching it now), return its contents in out
+ * out->data will need to be free'd
+ * each prefetched copy is only returned once, after that it is forgotten
+ * returns false if the caller needs to fetch it itself
+ */
+
+bool
+MHEGPrefetch_loadFile(OctetString *name, OctetString *out)
+{
+	OctetString absolute;
+	LIST_TYPE(PrefetchFile) *file;
+	bool loaded = false;
+
+	absolute.data = MHEGEngine_absoluteFilename(name);
+	absolute.size = strlen(absolute.data);
+
+	pthread_mutex_lock(&_prefetch_lock);
+
+	if((file = find_file(intern_find(&absolute))) != NULL)
+	{
+		if(file->item.state == PrefetchState_queued)
+		{
+			/* we need it now, so the caller may as well fetch it */
+			LIST_REMOVE(&_files, file);
+			free_file(file);
+			file = NULL;
+		}
+		else
+		{
+			/* wait for the prefetch thread to finish fetching it */
+			file->item.waiting ++;
+			while(file->item.state == PrefetchState_loading)
+				pthread_cond_wait(&_done_cond, &_prefetch_lock);
+			file->item.waiting --;
+			if(file->item.state == PrefetchState_loaded)
+			{
+				OctetString_dup(out, &file->item.data);
+				loaded = true;
+			}
+			/*
+			 * don't keep failed files, they may be available next time
+			 * and don't keep loaded files once they have been used
+			 * the carousel may be updated, so next time the caller needs to get the current version
+			 */
+			if(file->item.waiting == 0)
+			{
+				LIST_REMOVE(&_files, file);
+				free_file(file);
+			}
+		}
+	}
+
+	if(loaded)
+		_hits ++;
+	else
+		_misses ++;
+
+	verbose("MHEGPrefetch: '%.*s' %s (hits=%u misses=%u; %u%%)", absolute.size, absolute.data,
+		loaded ? "prefetched" : "not prefetched", _hits, _misses, (_hits * 100) / (_hits + _misses));
+
+	pthread_mutex_unlock(&_prefetch_lock);
+
+	return loaded;
+}
+
+/*
+ * call when a new scene has been loaded, but before its Preparation
+ * scene_id should be the absolute group ID of the scene
+ * remembers the content the scene uses and starts fetching it
+ */
+
+void
+MHEGPrefetch_sceneLoaded(OctetString *scene_id, SceneClass *scene)
+{
+	LIST_TYPE(PrefetchScene) *known;
+	LIST_TYPE(GroupItem) *gi;
+	ContentBody *content;
+	OctetString *files;
+	unsigned int nfiles;
+	char *absolute;
+	bool active;
+	unsigned int id;
+
+	if(!_running)
+		return;
+
+	id = intern_id(scene_id);
+
+	/* find the absolute names of all the content the scene uses */
+	nfiles = 0;
+	files = NULL;
+	for(gi=scene->items; gi; gi=gi->next)
+	{
+		if((content = item_content(&gi->item, &active)) != NULL
+		&& content->choice == ContentBody_referenced_content)
+		{
+			absolute = MHEGEngine_absoluteFilename(&content->u.referenced_content.content_reference);
+			files = safe_realloc(files, (nfiles + 1) * sizeof(OctetString));
+			files[nfiles].size = strlen(absolute);
+			files[nfiles].data = safe_malloc(files[nfiles].size);
+			memcpy(files[nfiles].data, absolute, files[nfiles].size);
+			nfiles ++;
+		}
+	}
+
+	pthread_mutex_lock(&_prefetch_lock);
+
+	/* replace anything we already know about the scene */
+	known = _scenes;
+	while(known && known->item.id != id)
+		known = known->next;
+	if(known != NULL)
+	{
+		LIST_REMOVE(&_scenes, known);
+		free_scene(known);
+	}
+
+	known = safe_malloc(sizeof(LIST_TYPE(PrefetchScene)));
+	OctetString_dup(&known->item.scene, scene_id);
+	known->item.id = id;
+	known->item.nfiles = nfiles;
+	known->item.files = files;
+	LIST_PREPEND(&_scenes, known);
+	_nscenes ++;
+
+	/* forget the least recently loaded scene if we know too many */
+	if(_nscenes > MHEGPREFETCH_MAX_SCENES)
+	{
+		known = _scenes->prev;
+		LIST_REMOVE(&_scenes, known);
+		free_scene(known);
+	}
+
+	/* fetch the content in the order Preparation will ask for it */
+	for(; nfiles>0; nfiles--, files++)
+		request_file(files, MHEGPREFETCH_URGENT);
+
+	evict_files();
+
+	pthread_mutex_unlock(&_prefetch_lock);
+
+	return;
+}
+
+/*
+ * prefetch anything the given items may need next
+ * ie the targets of TransitionTo and SetData actions in Links
+ * and the content of objects that are not active yet
+ */
+
+void
+MHEGPrefetch_scanItems(LIST_OF(GroupItem) *items)
+{
+	LIST_TYPE(GroupItem) *gi;
+	LinkClass *link;
+	ContentBody *content;
+	unsigned int priority;
+	bool active;
+
+	if(!_running)
+		return;
+
+	for(gi=items; gi; gi=gi->next)
+	{
+		if(gi->item.choice == GroupItem_link)
+		{
+			/* Links that fire on a key press are the most likely to be triggered */
+			link = &gi->item.u.link;
+			if(link->initially_active && link->link_condition.event_type == EventType_user_input)
+				priority = MHEGPREFETCH_HIGH;
+			else
+				priority = MHEGPREFETCH_NORMAL;
+			scan_actions(&link->link_effect, priority);
+		}
+		else if((content = item_content(&gi->item, &active)) != NULL
+		     && !active
+		     && content->choice == ContentBody_referenced_content)
+		{
+			request_content(&content->u.referenced_content.content_reference, MHEGPREFETCH_LOW);
+		}
+	}
+
+	return;
+}
+
+/*
+ * only handles direct references, indirect references depend on variables that may change before the action runs
+ */
+
+static void
+scan_actions(ActionClass *actions, unsigned int priority)
+{
+	LIST_TYPE(ElementaryAction) *action;
+	GenericObjectReference *target;
+	NewContent *new_content;
+	GenericContentReference *ref;
+
+	for(action=*actions; action; action=action->next)
+	{
+		switch(action->item.choice)
+		{
+		case ElementaryAction_transition_to:
+			target = &action->item.u.transition_to.target;
+			if(target->choice == GenericObjectReference_direct_reference
+			&& target->u.direct_reference.choice == ObjectReference_external_reference)
+				request_content(&target->u.direct_reference.u.external_reference.group_identifier, priority);
+			break;
+
+		case ElementaryAction_set_data:
+			new_content = &action->item.u.set_data.new_content;
+			if(new_content->choice == NewContent_new_referenced_content)
+			{
+				ref = &new_content->u.new_referenced_content.generic_content_reference;
+				if(ref->choice == GenericContentReference_content_reference)
+					request_content(&ref->u.content_reference, priority);
+			}
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	return;
+}
+
+/*
+ * returns the original content of the object, or NULL if it does not have any
+ * sets *initially_active to the object's InitiallyActive attribute
+ */
+
+static ContentBody *
+item_content(GroupItem *g, bool *initially_active)
+{
+	switch(g->choice)
+	{
+	case GroupItem_bitmap:
+		*initially_active = g->u.bitmap.initially_active;
+		return g->u.bitmap.have_original_content ? &g->u.bitmap.original_content : NULL;
+
+	case GroupItem_text:
+		*initially_active = g->u.text.initially_active;
+		return g->u.text.have_original_content ? &g->u.text.original_content : NULL;
+
+	case GroupItem_entry_field:
+		*initially_active = g->u.entry_field.initially_active;
+		return g->u.entry_field.have_original_content ? &g->u.entry_field.original_content : NULL;
+
+	case GroupItem_hyper_text:
+		*initially_active = g->u.hyper_text.initially_active;
+		return g->u.hyper_text.have_original_content ? &g->u.hyper_text.original_content : NULL;
+
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * name may be relative to the active application
+ */
+
+static void
+request_content(ContentReference *name, unsigned int priority)
+{
+	MHEGPrefetch_request(MHEGEngine_absoluteFilename(name), priority);
+
+	return;
+}
+
+/*
+ * _prefetch_lock must be held by the caller
+ */
+
+static void
+request_file(OctetString *name, unsigned int priority)
+{
+	LIST_TYPE(PrefetchFile) *file;
+	unsigned int id = intern_id(name);
+
+	if((file = find_file(id)) != NULL)
+	{
+		/* move it to the front */
+		LIST_REMOVE(&_files, file);
+		LIST_PREPEND(&_files, file);
+		if(file->item.state == PrefetchState_queued && priority > file->item.priority)
+			file->item.priority = priority;
+		return;
+	}
+
+	verbose("MHEGPrefetch: request '%.*s' (priority %u)", name->size, name->data, priority);
+
+	file = safe_mallocz(sizeof(LIST_TYPE(PrefetchFile)));
+	OctetString_dup(&file->item.name, name);
+	file->item.id = id;
+	file->item.priority = priority;
+	file->item.state = PrefetchState_queued;
+	file->item.waiting = 0;
+	file->item.data.size = 0;
+	file->item.data.data = NULL;
+
+	LIST_PREPEND(&_files, file);
+	_nfiles ++;
+
+	pthread_cond_signal(&_work_cond);
+
+	return;
+}
+
+/*
+ * id is the intern_id() of the file's name, returns NULL if id is 0
+ * _prefetch_lock must be held by the caller
+ */
+
+static LIST_TYPE(PrefetchFile) *
+find_file(unsigned int id)
+{
+	LIST_TYPE(PrefetchFile) *file = _files;
+
+	while(file && file->item.id != id)
+		file = file->next;
+
+	return file;
+}
+
+/*
+ * returns the highest priority file waiting to be fetched
+ * files with the same priority are fetched in the order they were requested
+ * _prefetch_lock must be held by the caller
+ */
+
+static LIST_TYPE(PrefetchFile) *
+next_queued(void)
+{
+	LIST_TYPE(PrefetchFile) *file;
+	LIST_TYPE(PrefetchFile) *best = NULL;
+
+	for(file=_files; file; file=file->next)
+	{
+		if(file->item.state == PrefetchState_queued
+		&& (best == NULL || file->item.priority >= best->item.priority))
+			best = file;
+	}
+
+	return best;
+}
+
+/*
+ * file must already be removed from the list
+ * _prefetch_lock must be held by the caller
+ */
+
+static void
+free_file(LIST_TYPE(PrefetchFile) *file)
+{
+	_nfiles --;
+	_bytes -= file->item.data.size;
+
+	free_OctetString(&file->item.name);
+	free_OctetString(&file->item.data);
+	safe_free(file);
+
+	return;
+}
+
+/*
+ * remove the least recently requested files until we are within MHEGPREFETCH_CACHE_SIZE and MHEGPREFETCH_MAX_FILES
+ * _prefetch_lock must be held by the caller
+ */
+
+static void
+evict_files(void)
+{
+	LIST_TYPE(PrefetchFile) *file;
+	LIST_TYPE(PrefetchFile) *prev;
+
+	if(_files == NULL)
+		return;
+
+	/* start at the tail */
+	file = _files->prev;
+	while(file && (_bytes > MHEGPREFETCH_CACHE_SIZE || _nfiles > MHEGPREFETCH_MAX_FILES))
+	{
+		/* the head's prev is the tail */
+		prev = (file == _files) ? NULL : file->prev;
+		if(file->item.state != PrefetchState_loading && file->item.waiting == 0)
+		{
+			LIST_REMOVE(&_files, file);
+			free_file(file);
+		}
+		file = prev;
+	}
+
+	return;
+}
+
+/*
+ * scene must already be removed from the list
+ * _prefetch_lock must be held by the caller
+ */
+
+static void
+free_scene(LIST_TYPE(PrefetchScene) *scene)
+{
+	unsigned int i;
+
+	_nscenes --;
+
+	free_OctetString(&scene->item.scene);
+	for(i=0; i<scene->item.nfiles; i++)
+		free_OctetString(&scene->item.files[i]);
+	safe_free(scene->item.files);
+	safe_free(scene);
+
+	return;
+}
+
+/*
+ * fetches queued files one at a time, highest priority first
+ * the backend lock is only held while fetching, so the engine can still use the backend in between
+ */
+
+static void *
+prefetch_thread(void *arg)
+{
+	LIST_TYPE(PrefetchFile) *file;
+	OctetString data;
+	bool ok;
+
+	pthread_mutex_lock(&_prefetch_lock);
+	while(!_stop)
+	{
+		if((file = next_queued()) == NULL)
+		{
+			pthread_cond_wait(&_work_cond, &_prefetch_lock);
+			continue;
+		}
+		/* it won't get free'd while it is loading */
+		file->item.state = PrefetchState_loading;
+		pthread_mutex_unlock(&_prefetch_lock);
+
+		/* check it exists first, so we don't report errors for files that are not on the carousel yet */
+		data.size = 0;
+		data.data = NULL;
+		pthread_mutex_lock(&_backend->lock);
+		ok = (*(_backend->fns->checkContentRef))(_backend, &file->item.name)
+		  && (*(_backend->fns->loadFile))(_backend, &file->item.name, &data);
+		pthread_mutex_unlock(&_backend->lock);
+
+		pthread_mutex_lock(&_prefetch_lock);
+		if(ok)
+		{
+			file->item.data = data;
+			file->item.state = PrefetchState_loaded;
+			_bytes += data.size;
+		}
+		else
+		{
+			file->item.state = PrefetchState_failed;
+		}
+		pthread_cond_broadcast(&_done_cond);
+		/* no one is waiting for failed files */
+		if(!ok && file->item.waiting == 0)
+		{
+			LIST_REMOVE(&_files, file);
+			free_file(file);
+		}
+		evict_files();
+	}
+	pthread_mutex_unlock(&_prefetch_lock);
+
+	return NULL;
+}
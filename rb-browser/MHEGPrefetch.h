@@ -0,0 +1,38 @@
+/*
+ * MHEGPrefetch.h
+ */
+
+#ifndef __MHEGPREFETCH_H__
+#define __MHEGPREFETCH_H__
+
+#include <stdbool.h>
+
+#include "ISO13522-MHEG-5.h"
+#include "MHEGBackend.h"
+
+/* prefetch priorities, highest first */
+#define MHEGPREFETCH_URGENT	3	/* content of the scene that is being loaded now */
+#define MHEGPREFETCH_HIGH	2	/* targets of active Links that fire on a key press */
+#define MHEGPREFETCH_NORMAL	1	/* targets of other Links */
+#define MHEGPREFETCH_LOW	0	/* content of inactive objects and of scenes we may transition to */
+
+/* max bytes of prefetched files to keep */
+#define MHEGPREFETCH_CACHE_SIZE		(4 * 1024 * 1024)
+/* max number of files we remember, prefetched or waiting to be fetched */
+#define MHEGPREFETCH_MAX_FILES		256
+/* max number of scenes we remember the content of */
+#define MHEGPREFETCH_MAX_SCENES		64
+
+void MHEGPrefetch_init(MHEGBackend *);
+void MHEGPrefetch_fini(void);
+void MHEGPrefetch_flush(void);
+
+void MHEGPrefetch_request(char *, unsigned int);
+
+bool MHEGPrefetch_checkContentRef(OctetString *);
+bool MHEGPrefetch_loadFile(OctetString *, OctetString *);
+
+void MHEGPrefetch_sceneLoaded(OctetString *, SceneClass *);
+void MHEGPrefetch_scanItems(LIST_OF(GroupItem) *);
+
+#endif	/* __MHEGPREFETCH_H__ */
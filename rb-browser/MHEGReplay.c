@@ -0,0 +1,535 @@
+/*
+ * MHEGReplay.c
+ *
+ * runs an app from a script rather than from the remote control, for benchmarking
+ * the script is a text file with one command per line:
+ * key <name>	- press a key, <name> is eg up, select, red, 0-9 (or an MHEGKey_xxx number)
+ * wait <ms>	- advance the clock, firing any timers that go off
+ * anything after a # is a comment
+ * MHEGTimer uses the script clock, so a replay takes as long as the engine needs to process it, not as long as the app says
+ * we measure how long the engine takes to process each key press and timer
+ * and how many actions it executes and how much it redraws as a result
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <malloc.h>
+
+#include "MHEGEngine.h"
+#include "MHEGTimer.h"
+#include "MHEGReplay.h"
+#include "display_soft.h"
+#include "utils.h"
+
+/* mallinfo2() was added in glibc 2.33 */
+#if defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 33)
+#define HAVE_MALLINFO2
+#endif
+#endif
+
+/* key names for the script */
+static struct
+{
+	char *name;
+	unsigned int key;
+} key_names[] =
+{
+	{ "up",		MHEGKey_Up },
+	{ "down",	MHEGKey_Down },
+	{ "left",	MHEGKey_Left },
+	{ "right",	MHEGKey_Right },
+	{ "0",		MHEGKey_0 },
+	{ "1",		MHEGKey_1 },
+	{ "2",		MHEGKey_2 },
+	{ "3",		MHEGKey_3 },
+	{ "4",		MHEGKey_4 },
+	{ "5",		MHEGKey_5 },
+	{ "6",		MHEGKey_6 },
+	{ "7",		MHEGKey_7 },
+	{ "8",		MHEGKey_8 },
+	{ "9",		MHEGKey_9 },
+	{ "select",	MHEGKey_Select },
+	{ "cancel",	MHEGKey_Cancel },
+	{ "red",	MHEGKey_Red },
+	{ "green",	MHEGKey_Green },
+	{ "yellow",	MHEGKey_Yellow },
+	{ "blue",	MHEGKey_Blue },
+	{ "text",	MHEGKey_Text },
+	{ "epg",	MHEGKey_EPG },
+	{ NULL,		0 }
+};
+
+/* internal functions */
+static void load_script(MHEGReplay *);
+static bool parse_key(char *, unsigned int *);
+static void start_event(MHEGReplay *, ReplayEventType, unsigned int);
+static void end_event(MHEGReplay *);
+static void write_json(MHEGReplay *, int64_t, int64_t, int64_t);
+static char *event_name(ReplayEventType);
+static int cmp_usecs(const void *, const void *);
+static int64_t now_usecs(void);
+static int64_t rusage_usecs(struct timeval *);
+
+/*
+ * script is the file name of the script to run
+ * json is the file to write the results to when we have finished, NULL if you don't want them
+ * starts timing the app booting straight away
+ */
+
+MHEGReplay *
+MHEGReplay_new(char *script, char *json)
+{
+	MHEGReplay *r = safe_mallocz(sizeof(MHEGReplay));
+
+	r->script = script;
+	r->json = json;
+
+	load_script(r);
+
+	r->next_cmd = 0;
+	r->waiting = false;
+	r->now = 0;
+
+	r->nevents = 0;
+	r->events_size = 0;
+	r->events = NULL;
+	r->measuring = false;
+
+	gettimeofday(&r->start_time, NULL);
+	getrusage(RUSAGE_SELF, &r->usage_start);
+	r->wall_start = now_usecs();
+
+	start_event(r, ReplayEvent_boot, 0);
+
+	return r;
+}
+
+void
+MHEGReplay_free(MHEGReplay *r)
+{
+	safe_free(r->cmds);
+	safe_free(r->events);
+
+	safe_free(r);
+
+	return;
+}
+
+/*
+ * call this when the engine has processed everything from the last event
+ * does the next thing in the script
+ * returns true when we have got to the end of the script
+ */
+
+bool
+MHEGReplay_nextEvent(MHEGReplay *r)
+{
+	ReplayCmd *cmd;
+	int64_t start;			/* script time 0 on the MHEGTimer clock */
+	int64_t due;
+	int timer_id;
+
+	/* the engine has finished with the last event */
+	end_event(r);
+
+	while(r->next_cmd < r->ncmds)
+	{
+		cmd = &r->cmds[r->next_cmd];
+		if(cmd->type == ReplayCmd_key)
+		{
+			r->next_cmd ++;
+			verbose("Replay: %u: key %u", r->now, cmd->value);
+			start_event(r, ReplayEvent_key, cmd->value);
+			MHEGEngine_keyPressed(cmd->value);
+			return false;
+		}
+		/* wait command */
+		if(!r->waiting)
+		{
+			r->waiting = true;
+			r->wait_until = r->now + cmd->value;
+		}
+		/* fire the next timer that goes off before the end of the wait */
+		start = (r->start_time.tv_sec * 1000000LL) + r->start_time.tv_usec;
+		if(MHEGTimer_nextDue(&due, &timer_id)
+		&& due <= start + (r->wait_until * 1000LL))
+		{
+			r->now = (due - start) / 1000;
+			verbose("Replay: %u: timer %d", r->now, timer_id);
+			start_event(r, ReplayEvent_timer, timer_id);
+			/* the engine will process the event this generates before it calls us again */
+			MHEGTimer_fireNext(due);
+			return false;
+		}
+		/* no more timers in this wait */
+		r->now = r->wait_until;
+		r->waiting = false;
+		r->next_cmd ++;
+	}
+
+	return true;
+}
+
+/*
+ * the current script time as a real time
+ * so absolute timers etc agree with the script clock
+ */
+
+void
+MHEGReplay_getTime(MHEGReplay *r, struct timeval *tv)
+{
+	tv->tv_sec = r->start_time.tv_sec + (r->now / 1000);
+	tv->tv_usec = r->start_time.tv_usec + ((r->now % 1000) * 1000);
+	if(tv->tv_usec >= 1000000)
+	{
+		tv->tv_sec ++;
+		tv->tv_usec -= 1000000;
+	}
+
+	return;
+}
+
+/*
+ * print a summary of what we measured
+ * and write the JSON file if we were asked to
+ */
+
+void
+MHEGReplay_report(MHEGReplay *r)
+{
+	struct rusage usage;
+	int64_t wall_usecs;
+	int64_t user_usecs;
+	int64_t sys_usecs;
+	int64_t *usecs;
+	int64_t total_usecs;
+	unsigned long nactions;
+	unsigned long nredraws;
+	uint64_t redraw_area;
+	unsigned int nkeys;
+	unsigned int ntimers;
+	MHEGDisplay *d = MHEGEngine_getDisplay();
+	soft_stats display_stats;
+	MHEGDisplayStats overlay_stats;
+	MHEGTimerStats timer_stats;
+	MHEGEngineStats engine_stats;
+#ifdef HAVE_MALLINFO2
+	struct mallinfo2 heap;
+#else
+	/* the fields are ints, so they will be wrong if we use more than 2GB */
+	struct mallinfo heap;
+#endif
+	unsigned int i;
+
+	/* in case we stopped part way through something */
+	end_event(r);
+
+	wall_usecs = now_usecs() - r->wall_start;
+	getrusage(RUSAGE_SELF, &usage);
+	user_usecs = rusage_usecs(&usage.ru_utime) - rusage_usecs(&r->usage_start.ru_utime);
+	sys_usecs = rusage_usecs(&usage.ru_stime) - rusage_usecs(&r->usage_start.ru_stime);
+
+	total_usecs = 0;
+	nactions = 0;
+	nredraws = 0;
+	redraw_area = 0;
+	nkeys = 0;
+	ntimers = 0;
+	usecs = safe_malloc(MAX(r->nevents, 1) * sizeof(int64_t));
+	for(i=0; i<r->nevents; i++)
+	{
+		total_usecs += r->events[i].usecs;
+		nactions += r->events[i].nactions;
+		nredraws += r->events[i].nredraws;
+		redraw_area += r->events[i].redraw_area;
+		if(r->events[i].type == ReplayEvent_key)
+			nkeys ++;
+		else if(r->events[i].type == ReplayEvent_timer)
+			ntimers ++;
+		usecs[i] = r->events[i].usecs;
+	}
+	qsort(usecs, r->nevents, sizeof(int64_t), cmp_usecs);
+
+	printf("replay %s: %u events (%u keys, %u timers) over %u.%03u secs of script time\n",
+		r->script, r->nevents, nkeys, ntimers, r->now / 1000, r->now % 1000);
+	printf("wall %.3f secs, CPU %.3f secs (user %.3f, sys %.3f)\n",
+		wall_usecs / 1000000.0, (user_usecs + sys_usecs) / 1000000.0, user_usecs / 1000000.0, sys_usecs / 1000000.0);
+	if(r->nevents > 0)
+		printf("event time: mean %.3f ms, median %.3f ms, 95%% %.3f ms, max %.3f ms\n",
+			(total_usecs / r->nevents) / 1000.0,
+			usecs[r->nevents / 2] / 1000.0,
+			usecs[(r->nevents * 95) / 100] / 1000.0,
+			usecs[r->nevents - 1] / 1000.0);
+	printf("%lu actions, %lu redraws, %llu pixels redrawn\n", nactions, nredraws, (unsigned long long) redraw_area);
+	MHEGEngine_getStats(&engine_stats);
+	if(engine_stats.ntransitions > 0)
+		printf("%lu scene transitions (%lu from the scene cache): mean %.3f ms, max %.3f ms\n",
+			engine_stats.ntransitions, engine_stats.nscene_cache_hits,
+			(engine_stats.transition_usecs / engine_stats.ntransitions) / 1000.0, engine_stats.transition_max_usecs / 1000.0);
+#ifdef HAVE_MALLINFO2
+	heap = mallinfo2();
+#else
+	heap = mallinfo();
+#endif
+	printf("heap: %lu KB in use, %lu KB free in %lu fragments\n",
+		(unsigned long) (heap.uordblks / 1024), (unsigned long) (heap.fordblks / 1024), (unsigned long) heap.ordblks);
+	MHEGTimer_getStats(&timer_stats);
+	printf("timers: %lu started, %lu stopped, %lu fired (%lu out of order), max %u waiting\n",
+		timer_stats.nadded, timer_stats.nremoved, timer_stats.nfired, timer_stats.nout_of_order, timer_stats.max_pending);
+	if(d->fns == &display_soft_fns)
+	{
+		display_soft_getStats(d, &display_stats);
+		printf("display: %u frames, %u drawing ops, %llu pixels drawn in %.3f secs\n",
+			display_stats.nframes, display_stats.nops, (unsigned long long) display_stats.npixels, display_stats.total_usecs / 1000000.0);
+	}
+	MHEGDisplay_getStats(d, &overlay_stats);
+	printf("overlay: %lu transfers, %lu rectangles, %.1f MB copied (%.1f MB for whole overlays), %.1f MB per wall second\n",
+		overlay_stats.noverlays, overlay_stats.nrects,
+		overlay_stats.overlay_bytes / 1000000.0, overlay_stats.full_bytes / 1000000.0,
+		(wall_usecs > 0) ? overlay_stats.overlay_bytes / (double) wall_usecs : 0.0);
+
+	safe_free(usecs);
+
+	if(r->json != NULL)
+		write_json(r, wall_usecs, user_usecs, sys_usecs);
+
+	return;
+}
+
+static void
+load_script(MHEGReplay *r)
+{
+	FILE *script;
+	char line[256];
+	char *cmd;
+	char *arg;
+	char *end;
+	unsigned int lineno;
+	size_t size;
+	ReplayCmd *c;
+
+	if((script = fopen(r->script, "r")) == NULL)
+		fatal("Unable to open replay script '%s': %s", r->script, strerror(errno));
+
+	r->ncmds = 0;
+	r->cmds = NULL;
+	size = 0;
+	lineno = 0;
+	while(fgets(line, sizeof(line), script) != NULL)
+	{
+		lineno ++;
+		/* chop off any comment */
+		if((end = strchr(line, '#')) != NULL)
+			*end = '\0';
+		/* ignore blank lines */
+		if((cmd = strtok(line, " \t\r\n")) == NULL)
+			continue;
+		if((arg = strtok(NULL, " \t\r\n")) == NULL)
+			fatal("%s:%u: '%s' needs an argument", r->script, lineno, cmd);
+		r->cmds = safe_fast_realloc(r->cmds, &size, (r->ncmds + 1) * sizeof(ReplayCmd));
+		c = &r->cmds[r->ncmds];
+		c->line = lineno;
+		if(strcasecmp(cmd, "key") == 0)
+		{
+			c->type = ReplayCmd_key;
+			if(!parse_key(arg, &c->value))
+				fatal("%s:%u: unknown key '%s'", r->script, lineno, arg);
+		}
+		else if(strcasecmp(cmd, "wait") == 0)
+		{
+			c->type = ReplayCmd_wait;
+			c->value = strtoul(arg, &end, 0);
+			if(*end != '\0')
+				fatal("%s:%u: invalid wait time '%s'", r->script, lineno, arg);
+		}
+		else
+		{
+			fatal("%s:%u: unknown command '%s'", r->script, lineno, cmd);
+		}
+		r->ncmds ++;
+	}
+
+	fclose(script);
+
+	verbose("Replay: %u commands in '%s'", r->ncmds, r->script);
+
+	return;
+}
+
+static bool
+parse_key(char *name, unsigned int *key)
+{
+	unsigned int i;
+	char *end;
+
+	for(i=0; key_names[i].name != NULL; i++)
+	{
+		if(strcasecmp(name, key_names[i].name) == 0)
+		{
+			*key = key_names[i].key;
+			return true;
+		}
+	}
+
+	/* allow MHEGKey_xxx numbers too */
+	if(isdigit(name[0]) && name[1] != '\0')
+	{
+		*key = strtoul(name, &end, 0);
+		return (*end == '\0');
+	}
+
+	return false;
+}
+
+static void
+start_event(MHEGReplay *r, ReplayEventType type, unsigned int value)
+{
+	ReplayEvent *e;
+	MHEGEngineStats stats;
+
+	/* add it to the end of the list, double the size of the list if it is full */
+	if((r->nevents + 1) * sizeof(ReplayEvent) > r->events_size)
+		r->events = safe_fast_realloc(r->events, &r->events_size, (r->nevents + 1) * 2 * sizeof(ReplayEvent));
+	e = &r->events[r->nevents];
+
+	/* store the current counters in the event, end_event() turns them into the differences */
+	MHEGEngine_getStats(&stats);
+	e->type = type;
+	e->value = value;
+	e->time = r->now;
+	e->nevents = stats.nevents;
+	e->nactions = stats.nactions;
+	e->nredraws = stats.nredraws;
+	e->redraw_area = stats.redraw_area;
+
+	r->measuring = true;
+	r->event_start = now_usecs();
+
+	return;
+}
+
+static void
+end_event(MHEGReplay *r)
+{
+	ReplayEvent *e;
+	MHEGEngineStats stats;
+
+	if(!r->measuring)
+		return;
+
+	e = &r->events[r->nevents];
+	e->usecs = now_usecs() - r->event_start;
+
+	MHEGEngine_getStats(&stats);
+	e->nevents = stats.nevents - e->nevents;
+	e->nactions = stats.nactions - e->nactions;
+	e->nredraws = stats.nredraws - e->nredraws;
+	e->redraw_area = stats.redraw_area - e->redraw_area;
+
+	r->nevents ++;
+	r->measuring = false;
+
+	return;
+}
+
+static void
+write_json(MHEGReplay *r, int64_t wall_usecs, int64_t user_usecs, int64_t sys_usecs)
+{
+	FILE *out;
+	ReplayEvent *e;
+	MHEGTimerStats timer_stats;
+	MHEGEngineStats engine_stats;
+	MHEGDisplayStats overlay_stats;
+	unsigned int i;
+
+	if((out = fopen(r->json, "w")) == NULL)
+	{
+		error("Unable to create '%s': %s", r->json, strerror(errno));
+		return;
+	}
+
+	/* script name may need escaping, but we are not expecting quotes or backslashes in it */
+	fprintf(out, "{\n");
+	fprintf(out, "\t\"script\": \"%s\",\n", r->script);
+	fprintf(out, "\t\"script_msecs\": %u,\n", r->now);
+	fprintf(out, "\t\"wall_usecs\": %lld,\n", (long long) wall_usecs);
+	fprintf(out, "\t\"user_usecs\": %lld,\n", (long long) user_usecs);
+	fprintf(out, "\t\"sys_usecs\": %lld,\n", (long long) sys_usecs);
+	MHEGTimer_getStats(&timer_stats);
+	fprintf(out, "\t\"timers\": { \"started\": %lu, \"stopped\": %lu, \"fired\": %lu, \"out_of_order\": %lu, \"max_waiting\": %u },\n",
+		timer_stats.nadded, timer_stats.nremoved, timer_stats.nfired, timer_stats.nout_of_order, timer_stats.max_pending);
+	MHEGEngine_getStats(&engine_stats);
+	fprintf(out, "\t\"transitions\": { \"count\": %lu, \"cache_hits\": %lu, \"total_usecs\": %llu, \"max_usecs\": %llu },\n",
+		engine_stats.ntransitions, engine_stats.nscene_cache_hits,
+		(unsigned long long) engine_stats.transition_usecs, (unsigned long long) engine_stats.transition_max_usecs);
+	MHEGDisplay_getStats(MHEGEngine_getDisplay(), &overlay_stats);
+	fprintf(out, "\t\"overlay\": { \"transfers\": %lu, \"rectangles\": %lu, \"bytes\": %llu, \"full_bytes\": %llu },\n",
+		overlay_stats.noverlays, overlay_stats.nrects,
+		(unsigned long long) overlay_stats.overlay_bytes, (unsigned long long) overlay_stats.full_bytes);
+	fprintf(out, "\t\"events\": [\n");
+	for(i=0; i<r->nevents; i++)
+	{
+		e = &r->events[i];
+		fprintf(out, "\t\t{ \"type\": \"%s\", \"value\": %u, \"time\": %u, \"usecs\": %lld, "
+			     "\"async_events\": %lu, \"actions\": %lu, \"redraws\": %lu, \"redraw_area\": %llu }%s\n",
+			event_name(e->type), e->value, e->time, (long long) e->usecs,
+			e->nevents, e->nactions, e->nredraws, (unsigned long long) e->redraw_area,
+			(i == r->nevents - 1) ? "" : ",");
+	}
+	fprintf(out, "\t]\n");
+	fprintf(out, "}\n");
+
+	if(fclose(out) != 0)
+		error("Unable to write '%s': %s", r->json, strerror(errno));
+
+	return;
+}
+
+static char *
+event_name(ReplayEventType type)
+{
+	switch(type)
+	{
+	case ReplayEvent_boot:
+		return "boot";
+
+	case ReplayEvent_key:
+		return "key";
+
+	case ReplayEvent_timer:
+		return "timer";
+
+	default:
+		return "unknown";
+	}
+}
+
+static int
+cmp_usecs(const void *a, const void *b)
+{
+	int64_t ua = *((int64_t *) a);
+	int64_t ub = *((int64_t *) b);
+
+	return (ua > ub) - (ua < ub);
+}
+
+static int64_t
+now_usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000000LL) + (ts.tv_nsec / 1000);
+}
+
+static int64_t
+rusage_usecs(struct timeval *tv)
+{
+	return (tv->tv_sec * 1000000LL) + tv->tv_usec;
+}
@@ -0,0 +1,77 @@
+/*
+ * MHEGReplay.h
+ */
+
+#ifndef __MHEGREPLAY_H__
+#define __MHEGREPLAY_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/* script commands */
+typedef enum
+{
+	ReplayCmd_key,			/* press a key, value is an MHEGKey_xxx number */
+	ReplayCmd_wait			/* advance the clock, value is in milliseconds */
+} ReplayCmdType;
+
+typedef struct
+{
+	ReplayCmdType type;
+	unsigned int value;
+	unsigned int line;		/* line number in the script, for error messages */
+} ReplayCmd;
+
+/* things we measure */
+typedef enum
+{
+	ReplayEvent_boot,		/* loading the app and running it until the first script command */
+	ReplayEvent_key,		/* value is the MHEGKey_xxx number */
+	ReplayEvent_timer		/* value is the MHEG timer ID */
+} ReplayEventType;
+
+typedef struct
+{
+	ReplayEventType type;
+	unsigned int value;
+	unsigned int time;		/* script time (milliseconds) */
+	int64_t usecs;			/* how long the engine took to process it */
+	unsigned long nevents;		/* async events processed */
+	unsigned long nactions;		/* ElementaryActions executed */
+	unsigned long nredraws;		/* calls to MHEGEngine_redrawArea */
+	uint64_t redraw_area;		/* MHEG pixels redrawn */
+} ReplayEvent;
+
+typedef struct
+{
+	char *script;			/* script file name */
+	char *json;			/* file to write the results to (NULL => don't) */
+	unsigned int ncmds;
+	ReplayCmd *cmds;
+	unsigned int next_cmd;		/* index into cmds */
+	bool waiting;			/* true if we are part way through a wait command */
+	unsigned int wait_until;	/* script time the wait ends */
+	unsigned int now;		/* script time (milliseconds since we started) */
+	struct timeval start_time;	/* real time when we started, script time 0 */
+	unsigned int nevents;		/* events we have measured */
+	size_t events_size;		/* bytes allocated for events */
+	ReplayEvent *events;
+	bool measuring;			/* is events[nevents] being measured */
+	int64_t event_start;		/* real time the current event started */
+	int64_t wall_start;		/* real time the whole replay started */
+	struct rusage usage_start;	/* CPU used before we started */
+} MHEGReplay;
+
+MHEGReplay *MHEGReplay_new(char *, char *);
+void MHEGReplay_free(MHEGReplay *);
+
+bool MHEGReplay_nextEvent(MHEGReplay *);
+
+void MHEGReplay_getTime(MHEGReplay *, struct timeval *);
+
+void MHEGReplay_report(MHEGReplay *);
+
+#endif	/* __MHEGREPLAY_H__ */
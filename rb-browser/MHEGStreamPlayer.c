@@ -4,21 +4,28 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <time.h>
 #include <X11/Xlib.h>
 
 #include "MHEGEngine.h"
 #include "MHEGStreamPlayer.h"
-#include "MHEGVideoOutput.h"
 #include "MHEGAudioOutput.h"
 #include "mpegts.h"
 #include "utils.h"
 
 /* internal routines */
 static void *decode_thread(void *);
+static void *convert_thread(void *);
 static void *video_thread(void *);
 static void *audio_thread(void *);
 
 static void set_avsync_base(MHEGStreamPlayer *, double, int64_t);
+static void wait_base(MHEGStreamPlayer *, unsigned int);
+
+static void report_pool_stats(MHEGStreamPlayer *);
+static void add_stage_time(StageStats *, int64_t);
+static void report_stage_stats(char *, StageStats *);
 
 static void thread_usleep(unsigned long);
 static enum CodecID find_av_codec_id(int);
@@ -27,11 +34,17 @@ static enum CodecID find_av_codec_id(int);
 LIST_OF(VideoFrame) *free_vframes = NULL;
 pthread_mutex_t free_vframes_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+ * if direct is true, the decoder rendered the frame into one of our framepool buffers
+ * and we just take a reference to it
+ * otherwise we take a copy of the frame
+ */
+
 LIST_TYPE(VideoFrame) *
-new_VideoFrameListItem(double pts, enum PixelFormat pix_fmt, unsigned int width, unsigned int height, AVFrame *frame)
+new_VideoFrameListItem(double pts, enum PixelFormat pix_fmt, unsigned int width, unsigned int height, AVFrame *frame, bool direct)
 {
 	LIST_TYPE(VideoFrame) *vf;
-	int frame_size;
+	unsigned int i;
 
 	/* do we have a spare frame we can use */
 	pthread_mutex_lock(&free_vframes_lock);
@@ -43,8 +56,6 @@ new_VideoFrameListItem(double pts, enum PixelFormat pix_fmt, unsigned int width,
 	else
 	{
 		vf = safe_malloc(sizeof(LIST_TYPE(VideoFrame)));
-		vf->item.frame_data = NULL;
-		vf->item.nalloced = 0;
 	}
 	pthread_mutex_unlock(&free_vframes_lock);
 
@@ -54,15 +65,30 @@ new_VideoFrameListItem(double pts, enum PixelFormat pix_fmt, unsigned int width,
 	vf->item.width = width;
 	vf->item.height = height;
 
-	/*
-	 * take a copy of the frame,
-	 * the actual data is inside the video codec somewhere and will be overwritten by the next frame we decode
-	 */
-	if((frame_size = avpicture_get_size(pix_fmt, width, height)) < 0)
-		fatal("Invalid frame_size");
-	vf->item.frame_data = safe_fast_realloc(vf->item.frame_data, &vf->item.nalloced, frame_size);
-	avpicture_fill(&vf->item.frame, vf->item.frame_data, pix_fmt, width, height);
-	img_copy(&vf->item.frame, (AVPicture*) frame, pix_fmt, width, height);
+	/* not converted yet */
+	vf->item.output = NULL;
+
+	if(direct)
+	{
+		/* the decoder won't write to this buffer again, but may still use it as a reference frame */
+		vf->item.buffer = (VideoBuffer *) frame->opaque;
+		framepool_refVideo(vf->item.buffer);
+		for(i=0; i<4; i++)
+		{
+			vf->item.frame.data[i] = frame->data[i];
+			vf->item.frame.linesize[i] = frame->linesize[i];
+		}
+	}
+	else
+	{
+		/*
+		 * take a copy of the frame,
+		 * the actual data is inside the video codec somewhere and will be overwritten by the next frame we decode
+		 */
+		vf->item.buffer = framepool_getVideo(pix_fmt, width, height);
+		vf->item.frame = vf->item.buffer->pic;
+		img_copy(&vf->item.frame, (AVPicture*) frame, pix_fmt, width, height);
+	}
 
 	return vf;
 }
@@ -70,6 +96,10 @@ new_VideoFrameListItem(double pts, enum PixelFormat pix_fmt, unsigned int width,
 void
 free_VideoFrameListItem(LIST_TYPE(VideoFrame) *vf)
 {
+	/* give the picture data back to the pool */
+	framepool_releaseVideo(vf->item.buffer);
+	vf->item.buffer = NULL;
+
 	/* add it to the free list */
 	pthread_mutex_lock(&free_vframes_lock);
 	LIST_APPEND(&free_vframes, vf);
@@ -103,6 +133,7 @@ new_AudioFrameListItem(void)
 	af->item.pts = AV_NOPTS_VALUE;
 
 	af->item.size = 0;
+	af->item.data = NULL;
 
 	return af;
 }
@@ -110,6 +141,11 @@ new_AudioFrameListItem(void)
 void
 free_AudioFrameListItem(LIST_TYPE(AudioFrame) *af)
 {
+	/* give the samples back to the pool */
+	if(af->item.data != NULL)
+		framepool_freeAudio(af->item.data);
+	af->item.data = NULL;
+
 	/* add it to the free list */
 	pthread_mutex_lock(&free_aframes_lock);
 	LIST_APPEND(&free_aframes, af);
@@ -140,11 +176,11 @@ MHEGStreamPlayer_init(MHEGStreamPlayer *p)
 	pthread_mutex_init(&p->base_lock, NULL);
 	pthread_cond_init(&p->base_cond, NULL);
 
-	pthread_mutex_init(&p->videoq_lock, NULL);
-	p->videoq = NULL;
+	avclock_init(&p->clock);
 
-	pthread_mutex_init(&p->audioq_lock, NULL);
-	p->audioq = NULL;
+	frameq_init(&p->videoq, VIDEOQ_SIZE);
+	frameq_init(&p->outq, OUTQ_SIZE);
+	frameq_init(&p->audioq, AUDIOQ_SIZE);
 
 	return;
 }
@@ -157,8 +193,11 @@ MHEGStreamPlayer_fini(MHEGStreamPlayer *p)
 	pthread_mutex_destroy(&p->base_lock);
 	pthread_cond_destroy(&p->base_cond);
 
-	pthread_mutex_destroy(&p->videoq_lock);
-	pthread_mutex_destroy(&p->audioq_lock);
+	avclock_fini(&p->clock);
+
+	frameq_fini(&p->videoq);
+	frameq_fini(&p->outq);
+	frameq_fini(&p->audioq);
 
 	return;
 }
@@ -283,6 +322,19 @@ MHEGStreamPlayer_play(MHEGStreamPlayer *p)
 	p->playing = true;
 	p->stop = false;
 
+	/* the video thread has not shown any frames yet */
+	p->base_set = false;
+
+	avclock_reset(&p->clock);
+
+	bzero(&p->decode_stats, sizeof(StageStats));
+	bzero(&p->convert_stats, sizeof(StageStats));
+	bzero(&p->present_stats, sizeof(StageStats));
+
+	/* so we can see how the frame pools were used while we were playing */
+	p->start_time = av_gettime();
+	framepool_getStats(&p->start_stats);
+
 	/*
 	 * the MPEG type for some streams is set to 6 (STREAM_TYPE_PRIVATE_DATA)
 	 * eg the streams for BBC News Multiscreen
@@ -294,15 +346,24 @@ MHEGStreamPlayer_play(MHEGStreamPlayer *p)
 	if(p->have_audio && p->audio_type == STREAM_TYPE_PRIVATE_DATA)
 		p->audio_type = STREAM_TYPE_AUDIO_MPEG2;
 
+	/* the convert and video threads share the video output method */
+	if(p->have_video)
+		MHEGVideoOutput_init(&p->vo, MHEGEngine_getVideoOutputMethod());
+
 	/*
-	 * we have three threads:
+	 * we have four threads:
 	 * decode_thread reads MPEG data from the TS and decodes it into YUV video frames and audio samples
-	 * video_thread takes YUV frames off the videoq list, converts them to RGB and displays them on the screen
-	 * audio_thread takes audio samples off the audioq list and feeds them into the sound card
+	 * convert_thread takes YUV frames off the videoq, scales them, converts them to RGB and puts them on the outq
+	 * video_thread takes RGB frames off the outq and displays them on the screen at the right time
+	 * audio_thread takes audio samples off the audioq and feeds them into the sound card
+	 * the queues are bounded, so the earlier stages block when they get too far ahead
 	 */
 	if(pthread_create(&p->decode_tid, NULL, decode_thread, p) != 0)
 		fatal("Unable to create MPEG decoder thread");
 
+	if(pthread_create(&p->convert_tid, NULL, convert_thread, p) != 0)
+		fatal("Unable to create video conversion thread");
+
 	if(pthread_create(&p->video_tid, NULL, video_thread, p) != 0)
 		fatal("Unable to create video output thread");
 
@@ -322,6 +383,9 @@ MHEGStreamPlayer_play(MHEGStreamPlayer *p)
 void
 MHEGStreamPlayer_stop(MHEGStreamPlayer *p)
 {
+	LIST_TYPE(VideoFrame) *vf;
+	LIST_TYPE(AudioFrame) *af;
+
 	verbose("MHEGStreamPlayer_stop");
 
 	/* are we playing */
@@ -331,14 +395,42 @@ MHEGStreamPlayer_stop(MHEGStreamPlayer *p)
 	/* signal the threads to stop */
 	p->stop = true;
 
+	/* wake up any threads that are blocked on the queues */
+	frameq_abort(&p->videoq);
+	frameq_abort(&p->outq);
+	frameq_abort(&p->audioq);
+
 	/* wait for them to finish */
 	pthread_join(p->decode_tid, NULL);
+	pthread_join(p->convert_tid, NULL);
 	pthread_join(p->video_tid, NULL);
 	pthread_join(p->audio_tid, NULL);
 
 	/* clean up */
-	LIST_FREE(&p->videoq, VideoFrame, free_VideoFrameListItem);
-	LIST_FREE(&p->audioq, AudioFrame, free_AudioFrameListItem);
+	while((vf = frameq_drain(&p->videoq)) != NULL)
+		free_VideoFrameListItem(vf);
+	while((vf = frameq_drain(&p->outq)) != NULL)
+	{
+		MHEGVideoOutput_releaseFrame(&p->vo, &vf->item);
+		free_VideoFrameListItem(vf);
+	}
+	while((af = frameq_drain(&p->audioq)) != NULL)
+		free_AudioFrameListItem(af);
+	frameq_reset(&p->videoq);
+	frameq_reset(&p->outq);
+	frameq_reset(&p->audioq);
+
+	if(p->have_video)
+	{
+		MHEGVideoOutput_fini(&p->vo);
+		report_stage_stats("decode", &p->decode_stats);
+		report_stage_stats("convert", &p->convert_stats);
+		report_stage_stats("present", &p->present_stats);
+	}
+
+	avclock_report(&p->clock);
+
+	report_pool_stats(p);
 
 	if(p->ts != NULL)
 	{
@@ -355,7 +447,8 @@ MHEGStreamPlayer_stop(MHEGStreamPlayer *p)
  * decode_thread
  * reads the MPEG TS file
  * decodes the data into YUV video frames and audio samples
- * adds them to the tail of the videoq and audioq lists
+ * adds them to the tail of the videoq and audioq
+ * blocks while either queue is full
  */
 
 static void *
@@ -370,17 +463,22 @@ decode_thread(void *arg)
 	AVCodecContext *video_codec_ctx = NULL;
 	enum CodecID codec_id;
 	AVCodec *codec = NULL;
-	double video_time_base = 90000.0;
-	double audio_time_base = 90000.0;
+	PTSTimeline video_timeline;
+	PTSTimeline audio_timeline;
 	double pts;
 	AVFrame *frame;
 	LIST_TYPE(VideoFrame) *video_frame;
 	int got_picture;
+	bool direct = false;
 	LIST_TYPE(AudioFrame) *audio_frame;
 	AudioFrame *af;
+	int16_t *samples = NULL;
+	int nbytes;
 	int used;
 	unsigned char *data;
 	int size;
+	long ncpus;
+	int64_t start;
 
 	verbose("MHEGStreamPlayer: decode thread started");
 
@@ -391,9 +489,16 @@ decode_thread(void *arg)
 		if((codec_id = find_av_codec_id(p->video_type)) == CODEC_ID_NONE
 		|| (codec = avcodec_find_decoder(codec_id)) == NULL)
 			fatal("Unsupported video codec");
+		/* try to decode straight into the frame pool */
+		direct = framepool_setDecoder(video_codec_ctx, codec);
+		/* let the decoder use all the CPUs (codecs that can't do threading just ignore it) */
+		if((ncpus = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+			ncpus = 1;
+		if(ncpus > 1 && avcodec_thread_init(video_codec_ctx, ncpus) < 0)
+			error("MHEGStreamPlayer: unable to use %ld threads for video decoding", ncpus);
 		if(avcodec_open(video_codec_ctx, codec) < 0)
 			fatal("Unable to open video codec");
-		verbose("MHEGStreamPlayer: Video: stream type=%d codec=%s", p->video_type, codec->name);
+		verbose("MHEGStreamPlayer: Video: stream type=%d codec=%s direct rendering=%s threads=%d", p->video_type, codec->name, direct ? "yes" : "no", video_codec_ctx->thread_count);
 	}
 
 	if(p->have_audio && p->audio_pid != -1)
@@ -406,6 +511,8 @@ decode_thread(void *arg)
 		if(avcodec_open(audio_codec_ctx, codec) < 0)
 			fatal("Unable to open audio codec");
 		verbose("MHEGStreamPlayer: Audio: stream type=%d codec=%s", p->audio_type, codec->name);
+		/* the decoder needs a big buffer to decode into, but we only keep what it actually uses */
+		samples = safe_malloc(AVCODEC_MAX_AUDIO_FRAME_SIZE * sizeof(int16_t));
 		/* let the audio ouput thread know what the sample rate, etc are */
 		p->audio_codec = audio_codec_ctx;
 	}
@@ -413,12 +520,15 @@ decode_thread(void *arg)
 	if((frame = avcodec_alloc_frame()) == NULL)
 		fatal("Out of memory");
 
+	avclock_initTimeline(&video_timeline);
+	avclock_initTimeline(&audio_timeline);
+
 	demux_apid = p->have_audio ? p->audio_pid : -1;
 	demux_vpid = p->have_video ? p->video_pid : -1;
 	if((tsdemux = mpegts_open(p->ts->ts, demux_apid, demux_vpid)) == NULL)
 		fatal("Out of memory");
 
-	while(!p->stop && !feof(p->ts->ts))
+	while(!p->stop && !mpegts_eof(tsdemux))
 	{
 		/* get the next complete packet for one of the streams */
 		if(mpegts_demux_frame(tsdemux, &pkt) < 0)
@@ -426,18 +536,24 @@ decode_thread(void *arg)
 		/* see what stream we got a packet for */
 		if(p->have_audio && pkt.stream_index == p->audio_pid && pkt.pts != AV_NOPTS_VALUE)
 		{
-			pts = pkt.pts / audio_time_base;
+			pts = avclock_unwrap(&p->clock, &audio_timeline, pkt.pts);
 			data = pkt.data;
 			size = pkt.size;
 			while(size > 0)
 			{
-				audio_frame = new_AudioFrameListItem();
-				af = &audio_frame->item;
-				used = avcodec_decode_audio(audio_codec_ctx, af->data, &af->size, data, size);
+				used = avcodec_decode_audio(audio_codec_ctx, samples, &nbytes, data, size);
+				/* skip the rest of the packet if it is corrupt */
+				if(used < 0)
+					break;
 				data += used;
 				size -= used;
-				if(af->size > 0)
+				if(nbytes > 0)
 				{
+					audio_frame = new_AudioFrameListItem();
+					af = &audio_frame->item;
+					af->size = nbytes;
+					af->data = framepool_allocAudio(nbytes);
+					memcpy(af->data, samples, nbytes);
 					af->pts = pts;
 					/* 16 or 32-bit samples, but af->size is in bytes */
 					if(audio_codec_ctx->sample_fmt == SAMPLE_FMT_S16)
@@ -446,30 +562,24 @@ decode_thread(void *arg)
 						pts += (af->size / 4.0) / (audio_codec_ctx->channels * audio_codec_ctx->sample_rate);
 					else
 						fatal("Unsupported audio sample format (%d)", audio_codec_ctx->sample_fmt);
-					pthread_mutex_lock(&p->audioq_lock);
-					LIST_APPEND(&p->audioq, audio_frame);
-					pthread_mutex_unlock(&p->audioq_lock);
-				}
-				else
-				{
-					free_AudioFrameListItem(audio_frame);
+					/* blocks until the audio thread has room for it */
+					if(!frameq_put(&p->audioq, audio_frame))
+						free_AudioFrameListItem(audio_frame);
 				}
 			}
-			/* don't want one thread hogging the CPU time */
-			pthread_yield();
 		}
 		else if(p->have_video && pkt.stream_index == p->video_pid && pkt.dts != AV_NOPTS_VALUE)
 		{
+			start = av_gettime();
 			(void) avcodec_decode_video(video_codec_ctx, frame, &got_picture, pkt.data, pkt.size);
 			if(got_picture)
 			{
-				pts = pkt.dts / video_time_base;
-				video_frame = new_VideoFrameListItem(pts, video_codec_ctx->pix_fmt, video_codec_ctx->width, video_codec_ctx->height, frame);
-				pthread_mutex_lock(&p->videoq_lock);
-				LIST_APPEND(&p->videoq, video_frame);
-				pthread_mutex_unlock(&p->videoq_lock);
-				/* don't want one thread hogging the CPU time */
-				pthread_yield();
+				add_stage_time(&p->decode_stats, av_gettime() - start);
+				pts = avclock_unwrap(&p->clock, &video_timeline, pkt.dts);
+				video_frame = new_VideoFrameListItem(pts, video_codec_ctx->pix_fmt, video_codec_ctx->width, video_codec_ctx->height, frame, direct && frame->opaque != NULL);
+				/* blocks until the video thread has room for it */
+				if(!frameq_put(&p->videoq, video_frame))
+					free_VideoFrameListItem(video_frame);
 			}
 		}
 		else
@@ -484,215 +594,258 @@ decode_thread(void *arg)
 
 	av_free(frame);
 
+	/* this gives any buffers the video decoder is still holding back to the frame pool */
 	if(video_codec_ctx != NULL)
 		avcodec_close(video_codec_ctx);
 	if(audio_codec_ctx != NULL)
 		avcodec_close(audio_codec_ctx);
 
+	safe_free(samples);
+
 	verbose("MHEGStreamPlayer: decode thread stopped");
 
 	return NULL;
 }
 
 /*
- * video_thread
- * takes YUV frames off the videoq list
+ * convert_thread
+ * takes YUV frames off the videoq
+ * drops them if we are already too late to display them
  * scales them (if necessary) to fit the output size
  * converts them to RGB
- * waits for the correct time, then displays them on the screen
+ * adds them to the tail of the outq
  */
 
 static void *
-video_thread(void *arg)
+convert_thread(void *arg)
 {
 	MHEGStreamPlayer *p = (MHEGStreamPlayer *) arg;
 	MHEGDisplay *d = MHEGEngine_getDisplay();
-	MHEGVideoOutput vo;
-	int out_x;
-	int out_y;
-	int off_x;
-	int off_y;
 	unsigned int out_width;
 	unsigned int out_height;
-	unsigned int vid_width;
-	unsigned int vid_height;
+	LIST_TYPE(VideoFrame) *video_frame;
 	VideoFrame *vf;
 	double buffered;
 	double last_buffered;
-	double last_pts;
-	int64_t last_time, this_time, now;
-	int usecs;
-	bool drop_frame;
-	unsigned int nframes = 0;
+	double now_pts;
+	int64_t start, now;
 
 	if(!p->have_video)
 		return NULL;
 
-	verbose("MHEGStreamPlayer: video thread started");
+	verbose("MHEGStreamPlayer: convert thread started");
 
 	/* assert */
 	if(p->video == NULL)
-		fatal("video_thread: VideoClass is NULL");
+		fatal("convert_thread: VideoClass is NULL");
 
 	/* wait until we have some frames buffered up */
 	last_buffered = -1.0;
-	do
+	while(!p->stop)
 	{
-		pthread_mutex_lock(&p->videoq_lock);
-		if(p->videoq != NULL)
-			buffered = p->videoq->prev->item.pts - p->videoq->item.pts;
+		if((video_frame = frameq_head(&p->videoq)) != NULL)
+			buffered = ((LIST_TYPE(VideoFrame) *) frameq_tail(&p->videoq))->item.pts - video_frame->item.pts;
 		else
 			buffered = 0.0;
-		pthread_mutex_unlock(&p->videoq_lock);
 		if(buffered != last_buffered)
 			verbose("MHEGStreamPlayer: buffered %f seconds of video", buffered);
 		last_buffered = buffered;
-		/* let the decoder have a go */
-		if(buffered < INIT_VIDEO_BUFFER_WAIT)
-			pthread_yield();
+		/*
+		 * the decoder blocks if either queue is full
+		 * the audio thread does not take anything off the audioq until we start playing
+		 * so don't wait any longer if either queue fills up
+		 */
+		if(buffered >= INIT_VIDEO_BUFFER_WAIT
+		|| frameq_full(&p->videoq)
+		|| frameq_full(&p->audioq))
+			break;
+		/* wait for the decoder to give us another frame, but keep an eye on the audioq too */
+		(void) frameq_wait(&p->videoq, frameq_count(&p->videoq), BUFFER_WAIT_USECS);
 	}
-	while(!p->stop && buffered < INIT_VIDEO_BUFFER_WAIT);
 
-	/* do we need to bomb out early */
-	if(p->stop)
+	/* until we are told to stop... */
+	while(!p->stop)
 	{
-		/* wake up the audio thread */
-		if(p->have_audio)
-			set_avsync_base(p, 0.0, 0);
-		verbose("MHEGStreamPlayer: video thread stopped before any output");
-		return NULL;
+		/* get the next frame, waits for the decoder if the videoq is empty */
+		if((video_frame = frameq_get(&p->videoq)) == NULL)
+			continue;
+		/* take it off the videoq now, this wakes up the decoder if it was blocked */
+		frameq_pop(&p->videoq);
+		vf = &video_frame->item;
+		start = av_gettime();
+		/*
+		 * once the clock has started, we know when the frame is due
+		 * we've still got to scale it and convert it to RGB
+		 * so don't bother allowing any error here
+		 */
+		if(avclock_get(&p->clock, start, &now_pts) && vf->pts < now_pts)
+		{
+			p->convert_stats.ndropped ++;
+			verbose("MHEGStreamPlayer: dropped video frame %u (%f secs late)", p->convert_stats.nframes + p->convert_stats.ndropped, now_pts - vf->pts);
+			free_VideoFrameListItem(video_frame);
+			continue;
+		}
+		/* scale the frame if necessary */
+		pthread_mutex_lock(&p->video->inst.scaled_lock);
+		/* use scaled values if ScaleVideo has been called */
+		if(p->video->inst.scaled)
+		{
+			out_width = p->video->inst.scaled_width;
+			out_height = p->video->inst.scaled_height;
+		}
+		else
+		{
+			out_width = vf->width;
+			out_height = vf->height;
+		}
+		pthread_mutex_unlock(&p->video->inst.scaled_lock);
+		/* scale up if fullscreen */
+		out_width = MHEGDisplay_scaleX(d, out_width);
+		out_height = MHEGDisplay_scaleY(d, out_height);
+		MHEGVideoOutput_prepareFrame(&p->vo, vf, out_width, out_height);
+		now = av_gettime();
+		add_stage_time(&p->convert_stats, now - start);
+		/* blocks until the video thread has room for it */
+		if(!frameq_put(&p->outq, video_frame))
+		{
+			MHEGVideoOutput_releaseFrame(&p->vo, vf);
+			free_VideoFrameListItem(video_frame);
+		}
 	}
 
-	/* assert */
-	if(p->videoq == NULL)
-		fatal("video_thread: no frames!");
+	verbose("MHEGStreamPlayer: convert thread stopped");
+
+	return NULL;
+}
+
+/*
+ * video_thread
+ * takes RGB frames off the outq
+ * waits for the A/V clock to reach their PTS, then displays them on the screen
+ */
+
+static void *
+video_thread(void *arg)
+{
+	MHEGStreamPlayer *p = (MHEGStreamPlayer *) arg;
+	MHEGDisplay *d = MHEGEngine_getDisplay();
+	int out_x;
+	int out_y;
+	int off_x;
+	int off_y;
+	unsigned int vid_width;
+	unsigned int vid_height;
+	LIST_TYPE(VideoFrame) *video_frame;
+	VideoFrame *vf;
+	double last_pts;
+	double now_pts;
+	int64_t now;
+	int usecs;
+	unsigned int nshown;
 
-	/* initialise the video output method */
-	MHEGVideoOutput_init(&vo, MHEGEngine_getVideoOutputMethod());
+	if(!p->have_video)
+		return NULL;
 
-	/* the time that we displayed the previous frame */
-	last_time = 0;
+	verbose("MHEGStreamPlayer: video thread started");
+
+	/* assert */
+	if(p->video == NULL)
+		fatal("video_thread: VideoClass is NULL");
+
+	/* PTS of the previous frame we displayed */
 	last_pts = 0;
+	nshown = 0;
 
 	/* until we are told to stop... */
 	while(!p->stop)
 	{
-		/* get the next frame */
-		pthread_mutex_lock(&p->videoq_lock);
-		vf = (p->videoq != NULL) ? &p->videoq->item : NULL;
-		/* only we delete items from the videoq, so vf will stay valid */
-		pthread_mutex_unlock(&p->videoq_lock);
-		if(vf == NULL)
-		{
-			verbose("MHEGStreamPlayer: videoq is empty");
-			/* give the decoder a bit of time to catch up */
-			pthread_yield();
+		/* get the next frame, waits for the convert thread if the outq is empty */
+		if(frameq_head(&p->outq) == NULL && nshown != 0)
+			verbose("MHEGStreamPlayer: outq is empty");
+		/* only we delete items from the outq, so vf will stay valid */
+		if((video_frame = frameq_get(&p->outq)) == NULL)
 			continue;
-		}
-		/*
-		 * keep track of how many frames we've played
-		 * just so the dropped frame verbose message below is more useful
-		 * don't care if it wraps back to 0 again
-		 */
-		nframes ++;
-		/* see if we should drop this frame or not */
+		vf = &video_frame->item;
+		/* wait until the clock reaches this frame */
 		now = av_gettime();
-		/* work out when this frame should be displayed based on when the last one was */
-		if(last_time != 0)
-			this_time = last_time + ((vf->pts - last_pts) * 1000000.0);
-		else
-			this_time = now;
-		/* how many usecs do we need to wait */
-		usecs = this_time - now;
-		/*
-		 * we've still got to convert it to RGB and maybe scale it too
-		 * so don't bother allowing any error here
-		 */
-		drop_frame = (usecs < 0);
-		if(drop_frame)
-		{
-			verbose("MHEGStreamPlayer: dropped video frame %u (usecs=%d)", nframes, usecs);
-		}
-		else
+		if(avclock_get(&p->clock, now, &now_pts))
 		{
-			/* scale the next frame if necessary */
-			pthread_mutex_lock(&p->video->inst.scaled_lock);
-			/* use scaled values if ScaleVideo has been called */
-			if(p->video->inst.scaled)
-			{
-				out_width = p->video->inst.scaled_width;
-				out_height = p->video->inst.scaled_height;
-			}
-			else
-			{
-				out_width = vf->width;
-				out_height = vf->height;
-			}
-			pthread_mutex_unlock(&p->video->inst.scaled_lock);
-			/* scale up if fullscreen */
-			out_width = MHEGDisplay_scaleX(d, out_width);
-			out_height = MHEGDisplay_scaleY(d, out_height);
-			MHEGVideoOutput_prepareFrame(&vo, vf, out_width, out_height);
-			/* remember the PTS for this frame */
-			last_pts = vf->pts;
-			/* wait until it's time to display the frame */
-			now = av_gettime();
-			/* don't wait if this is the first frame */
-			if(last_time != 0)
+			/* if we are too far behind, skip it and try to catch up with the next one */
+			if(vf->pts < now_pts - AVSYNC_DROP_LATE)
 			{
-				/* how many usecs do we need to wait */
-				usecs = this_time - now;
-				if(usecs > 0)
-					thread_usleep(usecs);
-				/* remember when we should have displayed this frame */
-				last_time = this_time;
+				p->present_stats.ndropped ++;
+				verbose("MHEGStreamPlayer: dropped video frame (%f secs behind the clock)", now_pts - vf->pts);
+				frameq_pop(&p->outq);
+				MHEGVideoOutput_releaseFrame(&p->vo, vf);
+				free_VideoFrameListItem(video_frame);
+				continue;
 			}
-			else	/* first frame */
+			/* how many usecs do we need to wait */
+			usecs = (vf->pts - now_pts) * 1000000.0;
+			if(usecs > 0)
 			{
-				/* remember when we displayed this frame */
-				last_time = now;
-				/* tell the audio thread what the PTS and real time are for the first video frame */
-				if(p->have_audio)
-					set_avsync_base(p, last_pts, last_time);
+				/* if the video is ahead of the clock, the previous frame stays on the screen for longer */
+				if(nshown != 0 && usecs > (vf->pts - last_pts) * 1000000.0)
+					p->present_stats.nrepeated ++;
+				/* in case the clock jumped back */
+				thread_usleep(MIN(usecs, AVSYNC_MAX_WAIT_USECS));
 			}
-			/* origin and size of VideoClass */
-			pthread_mutex_lock(&p->video->inst.bbox_lock);
-			out_x = p->video->inst.Position.x_position;
-			out_y = p->video->inst.Position.y_position;
-			vid_width = p->video->inst.BoxSize.x_length;
-			vid_height = p->video->inst.BoxSize.y_length;
-			/* VideoDecodeOffset position */
-			off_x = p->video->inst.VideoDecodeOffset.x_position;
-			off_y = p->video->inst.VideoDecodeOffset.y_position;
-			pthread_mutex_unlock(&p->video->inst.bbox_lock);
-			/* scale if fullscreen */
-			out_x = MHEGDisplay_scaleX(d, out_x);
-			out_y = MHEGDisplay_scaleY(d, out_y);
-			vid_width = MHEGDisplay_scaleX(d, vid_width);
-			vid_height = MHEGDisplay_scaleY(d, vid_height);
-			off_x = MHEGDisplay_scaleX(d, off_x);
-			off_y = MHEGDisplay_scaleY(d, off_y);
-			/* if the frame is smaller or larger than the VideoClass, centre it */
-			out_x += (vid_width - out_width) / 2;
-			out_y += (vid_height - out_height) / 2;
-			/* draw the current frame */
-			MHEGVideoOutput_drawFrame(&vo, out_x + off_x, out_y + off_y);
-			/* redraw objects above the video */
-			pthread_mutex_lock(&p->video->inst.bbox_lock);
-			MHEGDisplay_refresh(d, &p->video->inst.Position, &p->video->inst.BoxSize);
-			pthread_mutex_unlock(&p->video->inst.bbox_lock);
-			/* get it drawn straight away */
-			XFlush(d->dpy);
 		}
-		/* we can delete the frame from the queue now */
-		pthread_mutex_lock(&p->videoq_lock);
-		LIST_FREE_HEAD(&p->videoq, VideoFrame, free_VideoFrameListItem);
-		pthread_mutex_unlock(&p->videoq_lock);
-		/* don't want one thread hogging the CPU time */
-		pthread_yield();
+		else	/* first frame */
+		{
+			/* the clock runs from here until the audio thread takes it over */
+			avclock_start(&p->clock, vf->pts, now);
+			/* tell the audio thread what the PTS and real time are for the first video frame */
+			set_avsync_base(p, vf->pts, now);
+		}
+		/* remember the PTS for this frame */
+		last_pts = vf->pts;
+		nshown ++;
+		now = av_gettime();
+		/* origin and size of VideoClass */
+		pthread_mutex_lock(&p->video->inst.bbox_lock);
+		out_x = p->video->inst.Position.x_position;
+		out_y = p->video->inst.Position.y_position;
+		vid_width = p->video->inst.BoxSize.x_length;
+		vid_height = p->video->inst.BoxSize.y_length;
+		/* VideoDecodeOffset position */
+		off_x = p->video->inst.VideoDecodeOffset.x_position;
+		off_y = p->video->inst.VideoDecodeOffset.y_position;
+		pthread_mutex_unlock(&p->video->inst.bbox_lock);
+		/* scale if fullscreen */
+		out_x = MHEGDisplay_scaleX(d, out_x);
+		out_y = MHEGDisplay_scaleY(d, out_y);
+		vid_width = MHEGDisplay_scaleX(d, vid_width);
+		vid_height = MHEGDisplay_scaleY(d, vid_height);
+		off_x = MHEGDisplay_scaleX(d, off_x);
+		off_y = MHEGDisplay_scaleY(d, off_y);
+		/* if the frame is smaller or larger than the VideoClass, centre it */
+		out_x += (vid_width - vf->out_width) / 2;
+		out_y += (vid_height - vf->out_height) / 2;
+		/* draw the current frame */
+		MHEGVideoOutput_drawFrame(&p->vo, vf, out_x + off_x, out_y + off_y);
+		/* redraw objects above the video */
+		pthread_mutex_lock(&p->video->inst.bbox_lock);
+		MHEGDisplay_refresh(d, &p->video->inst.Position, &p->video->inst.BoxSize);
+		pthread_mutex_unlock(&p->video->inst.bbox_lock);
+		/* get it drawn straight away */
+		XFlush(d->dpy);
+		add_stage_time(&p->present_stats, av_gettime() - now);
+		avclock_videoShown(&p->clock, vf->pts, av_gettime());
+		/* we can delete the frame from the queue now, this wakes up the convert thread if it was blocked */
+		frameq_pop(&p->outq);
+		MHEGVideoOutput_releaseFrame(&p->vo, vf);
+		free_VideoFrameListItem(video_frame);
 	}
 
-	MHEGVideoOutput_fini(&vo);
+	/* if we never displayed anything, wake up the audio thread */
+	if(nshown == 0)
+	{
+		if(p->have_audio)
+			set_avsync_base(p, 0.0, 0);
+		verbose("MHEGStreamPlayer: video thread stopped before any output");
+		return NULL;
+	}
 
 	verbose("MHEGStreamPlayer: video thread stopped");
 
@@ -703,6 +856,7 @@ video_thread(void *arg)
  * audio thread
  * takes audio samples off the audioq and feeds them into the sound card as fast as possible
  * MHEGAudioOuput_addSamples() will block while the sound card buffer is full
+ * updates the A/V clock from what the sound card is actually playing
  */
 
 static void *
@@ -710,6 +864,7 @@ audio_thread(void *arg)
 {
 	MHEGStreamPlayer *p = (MHEGStreamPlayer *) arg;
 	MHEGAudioOutput ao;
+	LIST_TYPE(AudioFrame) *audio_frame;
 	AudioFrame *af;
 	double buffered;
 	double base_pts;
@@ -721,7 +876,8 @@ audio_thread(void *arg)
 	int64_t now_time, next_time;
 	double now_pts, next_pts;
 	int usecs;
-	double vpts = 0.0;
+	double bytes_per_sec;
+	double delay;
 
 	if(!p->have_audio)
 		return NULL;
@@ -737,11 +893,27 @@ audio_thread(void *arg)
 	{
 		/* wait until the video thread tells us it has some frames buffered up */
 		pthread_mutex_lock(&p->base_lock);
-		pthread_cond_wait(&p->base_cond, &p->base_lock);
-		pthread_mutex_unlock(&p->base_lock);
+		while(!p->base_set)
+		{
+			if(p->stop)
+			{
+				pthread_mutex_unlock(&p->base_lock);
+				verbose("MHEGStreamPlayer: audio thread stopped before any output");
+				return NULL;
+			}
+			/* don't let the decoder block on a full audioq before the video has started (see AUDIOQ_SIZE) */
+			if(frameq_full(&p->audioq))
+			{
+				audio_frame = frameq_head(&p->audioq);
+				frameq_pop(&p->audioq);
+				free_AudioFrameListItem(audio_frame);
+			}
+			wait_base(p, BASE_WAIT_USECS);
+		}
 		/* video thread sets base_pts and base_time from the values for the first frame it displays */
 		base_time = p->base_time;
 		base_pts = p->base_pts;
+		pthread_mutex_unlock(&p->base_lock);
 		/* get rid of audio frames that we should have played already */
 		done = false;
 		while(!done)
@@ -756,19 +928,19 @@ audio_thread(void *arg)
 			now_time = av_gettime();
 			now_pts = base_pts + ((now_time - base_time) / 1000000.0);
 			/* remove frames we should have played already */
-			pthread_mutex_lock(&p->audioq_lock);
-			while(p->audioq && p->audioq->item.pts < now_pts)
-				LIST_FREE_HEAD(&p->audioq, AudioFrame, free_AudioFrameListItem);
+			while((audio_frame = frameq_head(&p->audioq)) != NULL && audio_frame->item.pts < now_pts)
+			{
+				frameq_pop(&p->audioq);
+				free_AudioFrameListItem(audio_frame);
+			}
 			/* have we got the first audio sample to play yet */
-			done = (p->audioq != NULL);
-			pthread_mutex_unlock(&p->audioq_lock);
+			done = (audio_frame != NULL);
+			/* if not, wait for the decoder */
 			if(!done)
-				pthread_yield();
+				(void) frameq_wait(&p->audioq, 0, 0);
 		}
 		/* wait until it's time to play the first sample */
-		pthread_mutex_lock(&p->audioq_lock);
-		next_pts = p->audioq->item.pts;
-		pthread_mutex_unlock(&p->audioq_lock);
+		next_pts = audio_frame->item.pts;
 		next_time = base_time + ((next_pts - base_pts) * 1000000.0);
 		now_time = av_gettime();
 		usecs = next_time - now_time;
@@ -787,23 +959,21 @@ audio_thread(void *arg)
 				return NULL;
 			}
 			/* see how many frames we have buffered so far */
-			pthread_mutex_lock(&p->audioq_lock);
-			if(p->audioq != NULL)
-				buffered = p->audioq->prev->item.pts - p->audioq->item.pts;
+			if((audio_frame = frameq_head(&p->audioq)) != NULL)
+				buffered = ((LIST_TYPE(AudioFrame) *) frameq_tail(&p->audioq))->item.pts - audio_frame->item.pts;
 			else
 				buffered = 0.0;
-			pthread_mutex_unlock(&p->audioq_lock);
 			verbose("MHEGStreamPlayer: buffered %f seconds of audio", buffered);
-			/* let the decoder have a go */
-			if(buffered < INIT_AUDIO_BUFFER_WAIT)
-				pthread_yield();
+			/* the decoder can't give us any more if the queue is full */
+			done = (buffered >= INIT_AUDIO_BUFFER_WAIT || frameq_full(&p->audioq));
+			/* wait for the decoder to give us another frame */
+			if(!done)
+				(void) frameq_wait(&p->audioq, frameq_count(&p->audioq), 0);
 		}
-		while(buffered < INIT_AUDIO_BUFFER_WAIT);
+		while(!done);
 		/* the time that we played the first frame */
 		base_time = av_gettime();
-		pthread_mutex_lock(&p->audioq_lock);
-		base_pts = p->audioq->item.pts;
-		pthread_mutex_unlock(&p->audioq_lock);
+		base_pts = audio_frame->item.pts;
 	}
 
 	/* in case the flag got set since we last checked */
@@ -833,45 +1003,33 @@ audio_thread(void *arg)
 
 	verbose("MHEGStreamPlayer: audio params: format=%d rate=%d channels=%d", format, rate, channels);
 
+	/* so we can work out how long each frame is */
+	bytes_per_sec = (double) rate * channels * ((format == SND_PCM_FORMAT_S16_LE) ? 2 : 4);
+
 	(void) MHEGAudioOutput_setParams(&ao, format, rate, channels);
 
 	/* until we are told to stop */
 	while(!p->stop)
 	{
-		/* get the next audio frame */
-		pthread_mutex_lock(&p->audioq_lock);
-		af = (p->audioq != NULL) ? &p->audioq->item : NULL;
+		/* get the next audio frame, waits for the decoder if the audioq is empty */
 		/* only we delete items from the audioq, so af will stay valid */
-		pthread_mutex_unlock(&p->audioq_lock);
-		if(af == NULL)
-		{
-			/* if audio init failed, we will get this a lot */
-//			verbose("MHEGStreamPlayer: audioq is empty");
-			/* give the decoder a bit of time to catch up */
-			pthread_yield();
+		if((audio_frame = frameq_get(&p->audioq)) == NULL)
 			continue;
-		}
+		af = &audio_frame->item;
 /* TODO */
 /* need to make sure pts is what we expect */
 /* if we missed decoding a sample, play silence */
-		/* if the audio is getting ahead, don't play this sample */
-		pthread_mutex_lock(&p->videoq_lock);
-		vpts = p->videoq ? p->videoq->item.pts : vpts;
-		pthread_mutex_unlock(&p->videoq_lock);
-		if(vpts <= af->pts)
-		{
-			/* this will block until the sound card can take the data */
-			MHEGAudioOutput_addSamples(&ao, af->data, af->size);
-		}
-		else
-		{
-			verbose("MHEGStreamPlayer: dropped audio frame (%f ahead)", vpts - af->pts);
-		}
-/* TODO handle case when video is ahead */
-		/* we can delete the frame from the queue now */
-		pthread_mutex_lock(&p->audioq_lock);
-		LIST_FREE_HEAD(&p->audioq, AudioFrame, free_AudioFrameListItem);
-		pthread_mutex_unlock(&p->audioq_lock);
+		/* this will block until the sound card can take the data */
+		MHEGAudioOutput_addSamples(&ao, af->data, af->size);
+		/*
+		 * the sound card is the master clock, the video thread keeps in step with it
+		 * the sample being played now is delay seconds before the end of this frame
+		 */
+		if(MHEGAudioOutput_getDelay(&ao, &delay))
+			avclock_update(&p->clock, af->pts + (af->size / bytes_per_sec) - delay, av_gettime());
+		/* we can delete the frame from the queue now, this wakes up the decoder if it was blocked */
+		frameq_pop(&p->audioq);
+		free_AudioFrameListItem(audio_frame);
 	}
 
 	MHEGAudioOutput_fini(&ao);
@@ -893,6 +1051,7 @@ set_avsync_base(MHEGStreamPlayer *p, double pts, int64_t realtime)
 
 	p->base_pts = pts;
 	p->base_time = realtime;
+	p->base_set = true;
 
 	/* tell the audio thread we have set the values */
 	pthread_cond_signal(&p->base_cond);
@@ -902,6 +1061,87 @@ set_avsync_base(MHEGStreamPlayer *p, double pts, int64_t realtime)
 	return;
 }
 
+/*
+ * wait for set_avsync_base() to be called, or for usecs to pass
+ * base_lock must be held by the caller
+ */
+
+static void
+wait_base(MHEGStreamPlayer *p, unsigned int usecs)
+{
+	struct timespec abstime;
+
+	clock_gettime(CLOCK_REALTIME, &abstime);
+	abstime.tv_sec += usecs / 1000000;
+	abstime.tv_nsec += (usecs % 1000000) * 1000;
+	if(abstime.tv_nsec >= 1000000000)
+	{
+		abstime.tv_sec ++;
+		abstime.tv_nsec -= 1000000000;
+	}
+
+	(void) pthread_cond_timedwait(&p->base_cond, &p->base_lock, &abstime);
+
+	return;
+}
+
+/*
+ * say how much memory the frame pools are using
+ * and how often they had to allocate more while we were playing
+ */
+
+static void
+report_pool_stats(MHEGStreamPlayer *p)
+{
+	FramePoolStats now;
+	double secs;
+
+	framepool_getStats(&now);
+
+	secs = (av_gettime() - p->start_time) / 1000000.0;
+	if(secs <= 0.0)
+		secs = 1.0;
+
+	verbose("MHEGStreamPlayer: video pool: %u buffers (%u KB), %u in use; %u new buffers for %u frames (%.2f allocs/sec)",
+		now.video_buffers, (unsigned int) (now.video_bytes / 1024), now.video_in_use,
+		now.video_allocs - p->start_stats.video_allocs,
+		now.video_requests - p->start_stats.video_requests,
+		(now.video_allocs - p->start_stats.video_allocs) / secs);
+	verbose("MHEGStreamPlayer: audio pool: %u chunks (%u KB), %u in use; %u new chunks for %u frames (%.2f allocs/sec)",
+		now.audio_chunks, (unsigned int) (now.audio_bytes / 1024), now.audio_in_use,
+		now.audio_allocs - p->start_stats.audio_allocs,
+		now.audio_requests - p->start_stats.audio_requests,
+		(now.audio_allocs - p->start_stats.audio_allocs) / secs);
+
+	return;
+}
+
+/*
+ * add the time one frame spent in a stage of the video pipeline
+ */
+
+static void
+add_stage_time(StageStats *stats, int64_t usecs)
+{
+	stats->nframes ++;
+	stats->total_usecs += usecs;
+	if(usecs > stats->max_usecs)
+		stats->max_usecs = usecs;
+
+	return;
+}
+
+static void
+report_stage_stats(char *stage, StageStats *stats)
+{
+	double avg = (stats->nframes > 0) ? ((double) stats->total_usecs / stats->nframes) : 0.0;
+
+	verbose("MHEGStreamPlayer: %s: %u frames, %u dropped, %u repeated; average %.0f usecs/frame, max %lld usecs",
+		stage, stats->nframes, stats->ndropped, stats->nrepeated, avg, (long long) stats->max_usecs);
+
+	return;
+}
+
 /*
  * usleep(usecs)
  * need to make sure the other threads get a go while we are sleeping
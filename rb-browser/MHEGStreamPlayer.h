@@ -13,6 +13,9 @@
 
 #include "ISO13522-MHEG-5.h"
 #include "MHEGBackend.h"
+#include "frameq.h"
+#include "framepool.h"
+#include "avclock.h"
 
 /* seconds of video to buffer before we start playing it */
 #define INIT_VIDEO_BUFFER_WAIT	1.0
@@ -20,6 +23,38 @@
 /* seconds of audio to buffer before we start playing it (only used if we have no video) */
 #define INIT_AUDIO_BUFFER_WAIT	1.0
 
+/*
+ * max number of decoded frames waiting to be displayed/played
+ * the decoder blocks when a queue is full
+ * must hold at least INIT_VIDEO_BUFFER_WAIT/INIT_AUDIO_BUFFER_WAIT seconds worth
+ * AUDIOQ_SIZE is about 1.5 seconds of MP2 audio
+ * the audio thread does not start playing until the video thread has shown its first frame
+ * if audioq fills up before then (eg audio is muxed ahead of the video, or we start mid-GOP)
+ * the decoder would block and the video thread would never get its first frame
+ * so until the A/V sync base is set, the audio thread throws away the oldest frame whenever audioq is full
+ * (it would throw most of them away anyway, as they are before the first video frame)
+ */
+#define VIDEOQ_SIZE	64
+#define AUDIOQ_SIZE	64
+
+/*
+ * max number of frames converted to RGB and waiting to be displayed
+ * the video output method must be able to have OUTQ_SIZE + 2 frames prepared at once
+ */
+#define OUTQ_SIZE	4
+
+/* drop a video frame if it is this many seconds behind the audio clock when we come to show it */
+#define AVSYNC_DROP_LATE	0.1
+
+/* never wait longer than this (in micro seconds) for the clock to reach a video frame */
+#define AVSYNC_MAX_WAIT_USECS	1000000
+
+/* how often (in micro seconds) the convert thread checks the audioq is not full while it is buffering */
+#define BUFFER_WAIT_USECS	100000
+
+/* how often (in micro seconds) the audio thread checks the audioq is not full while it waits for the first video frame */
+#define BASE_WAIT_USECS		10000
+
 /* list of decoded video frames to be displayed */
 typedef struct
 {
@@ -27,14 +62,19 @@ typedef struct
 	enum PixelFormat pix_fmt;
 	unsigned int width;
 	unsigned int height;
-	AVPicture frame;
-	unsigned char *frame_data;
-	size_t nalloced;		/* number of bytes malloc'ed to frame_data */
+	AVPicture frame;		/* points into buffer */
+	VideoBuffer *buffer;		/* pooled picture data, shared with the decoder */
+	void *output;			/* set up by MHEGVideoOutput_prepareFrame, NULL until then */
+	unsigned int out_width;		/* size we prepared it at */
+	unsigned int out_height;
 } VideoFrame;
 
 DEFINE_LIST_OF(VideoFrame);
 
-LIST_TYPE(VideoFrame) *new_VideoFrameListItem(double, enum PixelFormat, unsigned int, unsigned int, AVFrame *);
+/* needs VideoFrame */
+#include "MHEGVideoOutput.h"
+
+LIST_TYPE(VideoFrame) *new_VideoFrameListItem(double, enum PixelFormat, unsigned int, unsigned int, AVFrame *, bool);
 void free_VideoFrameListItem(LIST_TYPE(VideoFrame) *);
 
 /* list of decoded audio samples to play */
@@ -42,7 +82,7 @@ typedef struct
 {
 	double pts;			/* presentation time stamp */
 	unsigned int size;		/* size of data in bytes (not uint16_t's) */
-	uint16_t data[AVCODEC_MAX_AUDIO_FRAME_SIZE];
+	uint16_t *data;			/* from the framepool audio slabs */
 } AudioFrame;
 
 DEFINE_LIST_OF(AudioFrame);
@@ -50,6 +90,16 @@ DEFINE_LIST_OF(AudioFrame);
 LIST_TYPE(AudioFrame) *new_AudioFrameListItem(void);
 void free_AudioFrameListItem(LIST_TYPE(AudioFrame) *);
 
+/* how long each stage of the video pipeline takes */
+typedef struct
+{
+	unsigned int nframes;		/* frames that went through this stage */
+	unsigned int ndropped;		/* frames we gave up on */
+	unsigned int nrepeated;		/* frames left on the screen for longer than one frame time */
+	int64_t total_usecs;		/* time spent on the nframes */
+	int64_t max_usecs;		/* slowest frame */
+} StageStats;
+
 /* player state */
 typedef struct
 {
@@ -69,16 +119,24 @@ typedef struct
 	AVCodecContext *audio_codec;	/* audio ouput params */
 	MHEGStream *ts;			/* MPEG Transport Stream */
 	pthread_t decode_tid;		/* thread decoding the MPEG stream into audio/video frames */
+	pthread_t convert_tid;		/* thread scaling video frames and converting them to RGB */
 	pthread_t video_tid;		/* thread displaying video frames on the screen */
 	pthread_t audio_tid;		/* thread feeding audio frames into the sound card */
 	pthread_mutex_t base_lock;	/* used to sync audio and video */
 	pthread_cond_t base_cond;	/* the video thread tells the audio thread: */
+	bool base_set;			/* - that it has set these */
 	double base_pts;		/* - the PTS of the first video frame */
 	int64_t base_time;		/* - the time the first video frame was displayed */
-	pthread_mutex_t videoq_lock;	/* list of decoded video frames */
-	LIST_OF(VideoFrame) *videoq;	/* head of list is next to be displayed */
-	pthread_mutex_t audioq_lock;	/* list of decoded audio frames */
-	LIST_OF(AudioFrame) *audioq;	/* head of list is next to be played */
+	AVClock clock;			/* audio master clock, the video follows it */
+	MHEGVideoOutput vo;		/* converts and draws video frames */
+	FrameQueue videoq;		/* decoded LIST_TYPE(VideoFrame)'s, head is next to be converted */
+	FrameQueue outq;		/* converted LIST_TYPE(VideoFrame)'s, head is next to be displayed */
+	FrameQueue audioq;		/* decoded LIST_TYPE(AudioFrame)'s, head is next to be played */
+	StageStats decode_stats;	/* only touched by the thread doing that stage */
+	StageStats convert_stats;
+	StageStats present_stats;
+	int64_t start_time;		/* when we started playing */
+	FramePoolStats start_stats;	/* framepool counters when we started playing */
 } MHEGStreamPlayer;
 
 void MHEGStreamPlayer_init(MHEGStreamPlayer *);
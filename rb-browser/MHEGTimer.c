@@ -1,56 +1,91 @@
 /*
  * MHEGTimer.c
+ *
+ * the engine keeps all the GroupClass timers in a min-heap ordered by the time they are due
+ * a timerfd is set to go off when the timer at the top of the heap is due
+ * the main loop polls it alongside the display and content fds, so a timer wakes it without a trip to the X server
+ * if we are replaying a script, the timers run off the script clock and the timerfd is not used
  */
 
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
 #include "MHEGEngine.h"
 #include "MHEGTimer.h"
 #include "GroupClass.h"
+#include "utils.h"
 
-/*
- * timer callback
- */
-
+/* a timer in the heap */
 typedef struct
 {
+	MHEGTimer id;			/* 0 => this slot is not in use */
+	int64_t due;			/* when it goes off (micro seconds on the MHEGTimer_now() clock) */
+	uint64_t order;			/* timers that are due at the same time go off in the order they were added */
+	unsigned int heap_pos;		/* index into timers.heap */
 	ExternalReference *ref;		/* object that contains the timer */
-	int id;				/* timer ID */
+	int timer_id;			/* timer ID */
 	void *fired_data;		/* passed onto GroupClass_timerFired after the event has been generated */
-} TimerCBData;
+} TimerSlot;
 
-static void
-timer_cb(XtPointer usr_data, XtIntervalId *id)
+static struct
 {
-	TimerCBData *data = (TimerCBData *) usr_data;
-	EventData event_data;
-	XEvent ev;
-	MHEGDisplay *d = MHEGEngine_getDisplay();
+	unsigned int nslots;		/* number of TimerSlots allocated */
+	TimerSlot *slots;
+	unsigned int nfree;		/* number of unused slots */
+	unsigned int *free_slots;	/* indexes of the unused slots */
+	unsigned int nheap;		/* number of timers waiting to go off */
+	unsigned int *heap;		/* slot indexes, heap[0] is the next to go off */
+	uint64_t next_order;
+	int fd;				/* timerfd, MHEGTimer_init() is fatal if we can't create it */
+	int64_t armed;			/* due time the timerfd is set to, -1 => not set */
+	int64_t last_due;		/* due time of the last timer that went off */
+	MHEGTimerStats stats;
+} timers;
 
-	/* generate a TimerFired event */
-	event_data.choice = EventData_integer;
-	event_data.u.integer = data->id;
-	MHEGEngine_generateAsyncEvent(data->ref, EventType_timer_fired, &event_data);
+/* internal functions */
+static void grow_slots(void);
+static void heap_insert(unsigned int);
+static void heap_remove(unsigned int);
+static void heap_up(unsigned int);
+static void heap_down(unsigned int);
+static bool slot_before(unsigned int, unsigned int);
+static void heap_swap(unsigned int, unsigned int);
+static void arm_timerfd(void);
+static void fire_slot(unsigned int, int64_t);
+static int64_t monotonic_usecs(void);
 
-	/* let the object do any additional cleaning up */
-	GroupClass_timerFired(data->ref, data->id, *id, data->fired_data);
-
-	safe_free(data);
-
-	/*
-	 * a timer going off does not get us out of a block in XtAppNextEvent
-	 * but we need to process the async event we just generated
-	 * we could just call MHEGEngine_processMHEGEvents() here
-	 * but if processing that means we want to Launch, Retune etc we will not be able to do it until XtAppNextEvent exits
-	 * so generate a fake event here, just to end XtAppNextEvent and get back to the engine main loop
-	 */
-	ev.xexpose.type = Expose;
-	ev.xexpose.display = d->dpy;
-	ev.xexpose.window = d->win;
-	ev.xexpose.x = 0;
-	ev.xexpose.y = 0;
-	ev.xexpose.width = 0;
-	ev.xexpose.height = 0;
-	ev.xexpose.count = 0;
-	XSendEvent(d->dpy, d->win, False, 0, &ev);
+void
+MHEGTimer_init(void)
+{
+	bzero(&timers, sizeof(timers));
+
+	/* we set it to absolute CLOCK_MONOTONIC times, so it goes off at the right time even if we are slow to set it */
+	if((timers.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+		fatal("Unable to create timerfd: %s", strerror(errno));
+
+	timers.armed = -1;
+	timers.last_due = 0;
+	timers.next_order = 0;
+
+	grow_slots();
+
+	return;
+}
+
+void
+MHEGTimer_fini(void)
+{
+	MHEGTimer_report();
+
+	close(timers.fd);
+
+	safe_free(timers.slots);
+	safe_free(timers.free_slots);
+	safe_free(timers.heap);
 
 	return;
 }
@@ -65,22 +100,201 @@ timer_cb(XtPointer usr_data, XtIntervalId *id)
 MHEGTimer
 MHEGTimer_addGroupClassTimer(unsigned int interval, ExternalReference *ref, int id, void *fired_data)
 {
-	MHEGTimer xtid;
-	TimerCBData *data = safe_malloc(sizeof(TimerCBData));
+	unsigned int slot;
+	TimerSlot *t;
+
+	if(timers.nfree == 0)
+		grow_slots();
+
+	slot = timers.free_slots[-- timers.nfree];
+	t = &timers.slots[slot];
+
+	t->order = timers.next_order ++;
+	t->id = ((t->order + 1) << 32) | slot;
+	t->due = MHEGTimer_now() + (interval * 1000LL);
+	t->ref = ref;
+	t->timer_id = id;
+	t->fired_data = fired_data;
 
-	data->ref = ref;
-	data->id = id;
-	data->fired_data = fired_data;
+	heap_insert(slot);
 
-	xtid = XtAppAddTimeOut(MHEGEngine_getDisplay()->app, interval, timer_cb, (XtPointer) data);
+	timers.stats.nadded ++;
+	if(timers.nheap > timers.stats.max_pending)
+		timers.stats.max_pending = timers.nheap;
 
-	return xtid;
+	/* do we need to go off sooner */
+	if(t->heap_pos == 0)
+		arm_timerfd();
+
+	return t->id;
 }
 
+/*
+ * the timer may have already gone off, in which case this does nothing
+ */
+
 void
 MHEGTimer_removeGroupClassTimer(MHEGTimer id)
 {
-	XtRemoveTimeOut(id);
+	unsigned int slot = id & 0xffffffff;
+	bool was_next;
+
+	if(slot >= timers.nslots || timers.slots[slot].id != id)
+		return;
+
+	was_next = (timers.slots[slot].heap_pos == 0);
+
+	heap_remove(slot);
+	timers.slots[slot].id = 0;
+	timers.free_slots[timers.nfree ++] = slot;
+
+	timers.stats.nremoved ++;
+
+	if(was_next)
+		arm_timerfd();
+
+	return;
+}
+
+/*
+ * returns false if there are no timers waiting
+ * otherwise sets *due to the time the next one goes off, and *timer_id to its MHEG timer ID
+ */
+
+bool
+MHEGTimer_nextDue(int64_t *due, int *timer_id)
+{
+	TimerSlot *t;
+
+	if(timers.nheap == 0)
+		return false;
+
+	t = &timers.slots[timers.heap[0]];
+	*due = t->due;
+	*timer_id = t->timer_id;
+
+	return true;
+}
+
+/*
+ * if the next timer is due at or before the given time, fire it and return true
+ */
+
+bool
+MHEGTimer_fireNext(int64_t now)
+{
+	unsigned int slot;
+
+	if(timers.nheap == 0)
+		return false;
+
+	slot = timers.heap[0];
+	if(timers.slots[slot].due > now)
+		return false;
+
+	fire_slot(slot, now);
+
+	arm_timerfd();
+
+	return true;
+}
+
+/*
+ * fire all the timers that are due
+ * returns the number that went off
+ */
+
+unsigned int
+MHEGTimer_fireExpired(void)
+{
+	uint64_t expirations;
+	unsigned int nfired = 0;
+	int64_t now = MHEGTimer_now();
+
+	/* clear the timerfd */
+	if(read(timers.fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+		error("Unable to read timerfd: %s", strerror(errno));
+
+	while(timers.nheap > 0 && timers.slots[timers.heap[0]].due <= now)
+	{
+		fire_slot(timers.heap[0], now);
+		nfired ++;
+	}
+
+	arm_timerfd();
+
+	return nfired;
+}
+
+/*
+ * the timerfd that goes off when the next timer is due
+ * MHEGEngine_wait polls it along with everything else the main loop is waiting for
+ */
+
+int
+MHEGTimer_getFd(void)
+{
+	return timers.fd;
+}
+
+/*
+ * the clock the timers use, in micro seconds
+ * CLOCK_MONOTONIC, unless we are replaying a script
+ */
+
+int64_t
+MHEGTimer_now(void)
+{
+	MHEGReplay *replay;
+	struct timeval tv;
+
+	if((replay = MHEGEngine_getReplay()) != NULL)
+	{
+		MHEGReplay_getTime(replay, &tv);
+		return (tv.tv_sec * 1000000LL) + tv.tv_usec;
+	}
+
+	return monotonic_usecs();
+}
+
+/*
+ * the time the timers are using, as a time of day
+ * this is the real time, unless we are replaying a script
+ */
+
+void
+MHEGTimer_getTime(struct timeval *now)
+{
+	MHEGReplay *replay;
+
+	if((replay = MHEGEngine_getReplay()) != NULL)
+		MHEGReplay_getTime(replay, now);
+	else
+		gettimeofday(now, NULL);
+
+	return;
+}
+
+void
+MHEGTimer_getStats(MHEGTimerStats *stats)
+{
+	*stats = timers.stats;
+
+	return;
+}
+
+void
+MHEGTimer_report(void)
+{
+	MHEGTimerStats *s = &timers.stats;
+
+	verbose("Timers: %lu started, %lu stopped, %lu fired (%lu out of order), max %u waiting",
+		s->nadded, s->nremoved, s->nfired, s->nout_of_order, s->max_pending);
+	verbose("Timers: average %.3f ms late, max %.3f ms, %lu more than %.1f ms late",
+		(s->nfired > 0) ? (s->late_total_usecs / 1000.0) / s->nfired : 0.0, s->late_max_usecs / 1000.0,
+		s->nlate, MHEGTIMER_LATE_USECS / 1000.0);
+
+	return;
 }
 
 /*
@@ -93,3 +307,208 @@ time_diff(struct timeval *t1, struct timeval *t0)
 	return ((t1->tv_sec - t0->tv_sec) * 1000) + ((t1->tv_usec - t0->tv_usec) / 1000);
 }
 
+/*
+ * double the number of slots (start with 16)
+ */
+
+static void
+grow_slots(void)
+{
+	unsigned int old = timers.nslots;
+	unsigned int i;
+
+	timers.nslots = (old == 0) ? 16 : old * 2;
+
+	timers.slots = safe_realloc(timers.slots, timers.nslots * sizeof(TimerSlot));
+	timers.free_slots = safe_realloc(timers.free_slots, timers.nslots * sizeof(unsigned int));
+	timers.heap = safe_realloc(timers.heap, timers.nslots * sizeof(unsigned int));
+
+	/* use the lowest numbered ones first */
+	for(i=timers.nslots; i>old; i--)
+	{
+		timers.slots[i - 1].id = 0;
+		timers.free_slots[timers.nfree ++] = i - 1;
+	}
+
+	return;
+}
+
+static void
+heap_insert(unsigned int slot)
+{
+	unsigned int pos = timers.nheap ++;
+
+	timers.heap[pos] = slot;
+	timers.slots[slot].heap_pos = pos;
+
+	heap_up(pos);
+
+	return;
+}
+
+static void
+heap_remove(unsigned int slot)
+{
+	unsigned int pos = timers.slots[slot].heap_pos;
+	unsigned int last = -- timers.nheap;
+
+	if(pos == last)
+		return;
+
+	/* move the last one into the hole and put it in the right place */
+	heap_swap(pos, last);
+	heap_down(pos);
+	heap_up(pos);
+
+	return;
+}
+
+static void
+heap_up(unsigned int pos)
+{
+	unsigned int parent;
+
+	while(pos > 0)
+	{
+		parent = (pos - 1) / 2;
+		if(!slot_before(timers.heap[pos], timers.heap[parent]))
+			break;
+		heap_swap(pos, parent);
+		pos = parent;
+	}
+
+	return;
+}
+
+static void
+heap_down(unsigned int pos)
+{
+	unsigned int child;
+
+	while((child = (pos * 2) + 1) < timers.nheap)
+	{
+		/* pick the earlier child */
+		if(child + 1 < timers.nheap
+		&& slot_before(timers.heap[child + 1], timers.heap[child]))
+			child ++;
+		if(!slot_before(timers.heap[child], timers.heap[pos]))
+			break;
+		heap_swap(pos, child);
+		pos = child;
+	}
+
+	return;
+}
+
+/*
+ * returns true if the timer in slot a should go off before the one in slot b
+ */
+
+static bool
+slot_before(unsigned int a, unsigned int b)
+{
+	TimerSlot *ta = &timers.slots[a];
+	TimerSlot *tb = &timers.slots[b];
+
+	return (ta->due < tb->due) || (ta->due == tb->due && ta->order < tb->order);
+}
+
+static void
+heap_swap(unsigned int p1, unsigned int p2)
+{
+	unsigned int s1 = timers.heap[p1];
+	unsigned int s2 = timers.heap[p2];
+
+	timers.heap[p1] = s2;
+	timers.slots[s2].heap_pos = p1;
+	timers.heap[p2] = s1;
+	timers.slots[s1].heap_pos = p2;
+
+	return;
+}
+
+/*
+ * set the timerfd to go off when the next timer is due
+ */
+
+static void
+arm_timerfd(void)
+{
+	struct itimerspec its;
+	int64_t due;
+
+	/* the replay code fires the timers itself */
+	if(MHEGEngine_getReplay() != NULL)
+		return;
+
+	due = (timers.nheap > 0) ? timers.slots[timers.heap[0]].due : -1;
+	if(due == timers.armed)
+		return;
+
+	/* all zeros disarms it */
+	bzero(&its, sizeof(its));
+	if(due != -1)
+	{
+		its.it_value.tv_sec = due / 1000000;
+		its.it_value.tv_nsec = (due % 1000000) * 1000;
+	}
+
+	if(timerfd_settime(timers.fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+		error("Unable to set timerfd: %s", strerror(errno));
+
+	timers.armed = due;
+
+	return;
+}
+
+/*
+ * take the timer out of the heap and generate its TimerFired event
+ */
+
+static void
+fire_slot(unsigned int slot, int64_t now)
+{
+	TimerSlot *t = &timers.slots[slot];
+	ExternalReference *ref = t->ref;
+	int timer_id = t->timer_id;
+	void *fired_data = t->fired_data;
+	MHEGTimer id = t->id;
+	int64_t late = now - t->due;
+	EventData event_data;
+
+	/* stats */
+	timers.stats.nfired ++;
+	timers.stats.late_total_usecs += late;
+	if(late > timers.stats.late_max_usecs)
+		timers.stats.late_max_usecs = late;
+	if(late > MHEGTIMER_LATE_USECS)
+		timers.stats.nlate ++;
+	if(t->due < timers.last_due)
+		timers.stats.nout_of_order ++;
+	timers.last_due = t->due;
+
+	/* free the slot before we generate the event, in case the object starts a new timer */
+	heap_remove(slot);
+	t->id = 0;
+	timers.free_slots[timers.nfree ++] = slot;
+
+	/* generate a TimerFired event */
+	event_data.choice = EventData_integer;
+	event_data.u.integer = timer_id;
+	MHEGEngine_generateAsyncEvent(ref, EventType_timer_fired, &event_data);
+
+	/* let the object do any additional cleaning up */
+	GroupClass_timerFired(ref, timer_id, id, fired_data);
+
+	return;
+}
+
+static int64_t
+monotonic_usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000000LL) + (ts.tv_nsec / 1000);
+}
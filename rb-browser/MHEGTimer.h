@@ -5,17 +5,47 @@
 #ifndef __MHEGTIMER_H__
 #define __MHEGTIMER_H__
 
+#include <stdint.h>
+#include <stdbool.h>
 #include <sys/time.h>
-#include <X11/Intrinsic.h>
 
-typedef XtIntervalId MHEGTimer;
+/* slot number in the low 32 bits, a sequence number in the high 32 bits, 0 is never a valid timer */
+typedef uint64_t MHEGTimer;
 
 DEFINE_LIST_OF(MHEGTimer);
 
+/* a timer that goes off more than this many micro seconds late is counted as late */
+#define MHEGTIMER_LATE_USECS	2000
+
+typedef struct
+{
+	unsigned long nadded;		/* timers started */
+	unsigned long nremoved;		/* timers stopped before they went off */
+	unsigned long nfired;		/* timers that went off */
+	unsigned long nlate;		/* went off more than MHEGTIMER_LATE_USECS late */
+	unsigned long nout_of_order;	/* went off before a timer that was due earlier (should always be 0) */
+	unsigned int max_pending;	/* most timers waiting at once */
+	int64_t late_total_usecs;	/* sum of how late each timer went off */
+	int64_t late_max_usecs;
+} MHEGTimerStats;
+
+void MHEGTimer_init(void);
+void MHEGTimer_fini(void);
+
 MHEGTimer MHEGTimer_addGroupClassTimer(unsigned int, ExternalReference *, int, void *);
 void MHEGTimer_removeGroupClassTimer(MHEGTimer);
 
+bool MHEGTimer_nextDue(int64_t *, int *);
+bool MHEGTimer_fireNext(int64_t);
+unsigned int MHEGTimer_fireExpired(void);
+int MHEGTimer_getFd(void);
+
+int64_t MHEGTimer_now(void);
+void MHEGTimer_getTime(struct timeval *);
+
+void MHEGTimer_getStats(MHEGTimerStats *);
+void MHEGTimer_report(void);
+
 int time_diff(struct timeval *, struct timeval *);
 
 #endif	/* __MHEGTIMER_H__ */
-
@@ -9,6 +9,7 @@
 #include "MHEGVideoOutput.h"
 #include "videoout_null.h"
 #include "videoout_xshm.h"
+#include "videoout_xv.h"
 #include "utils.h"
 
 static struct
@@ -20,10 +21,11 @@ static struct
 {
 	{ "null", "No video output", &vo_null_fns},
 	{ "xshm", "Uses X11 Shared Memory", &vo_xshm_fns},
+	{ "xv", "Uses XVideo, falls back to xshm if Xv is not available", &vo_xv_fns},
 	{ NULL, NULL}
 };
 
-#define DEFAULT_VO_METHOD	&vo_xshm_fns
+#define DEFAULT_VO_METHOD	&vo_xv_fns
 
 /*
  * pass NULL to use the default
@@ -90,21 +92,40 @@ MHEGVideoOutput_fini(MHEGVideoOutput *v)
 
 /*
  * get ready to draw the given frame at the given output size
+ * the output method keeps what it needs to draw the frame in f->output
+ * you can prepare the next frame while the previous one is being drawn
  */
 
 void
 MHEGVideoOutput_prepareFrame(MHEGVideoOutput *v, VideoFrame *f, unsigned int out_width, unsigned int out_height)
 {
+	f->out_width = out_width;
+	f->out_height = out_height;
+
 	return (*(v->fns->prepareFrame))(v->ctx, f, out_width, out_height);
 }
 
 /*
- * draw the frame set up by MHEGVideoOutput_prepareFrame() at the given position on the contents Pixmap
+ * draw a frame set up by MHEGVideoOutput_prepareFrame() at the given position on the contents Pixmap
  */
 
 void
-MHEGVideoOutput_drawFrame(MHEGVideoOutput *v, int x, int y)
+MHEGVideoOutput_drawFrame(MHEGVideoOutput *v, VideoFrame *f, int x, int y)
 {
-	return (*(v->fns->drawFrame))(v->ctx, x, y);
+	return (*(v->fns->drawFrame))(v->ctx, f, x, y);
+}
+
+/*
+ * call this when you have finished with a frame set up by MHEGVideoOutput_prepareFrame()
+ */
+
+void
+MHEGVideoOutput_releaseFrame(MHEGVideoOutput *v, VideoFrame *f)
+{
+	(*(v->fns->releaseFrame))(v->ctx, f);
+
+	f->output = NULL;
+
+	return;
 }
 
@@ -14,10 +14,12 @@ typedef struct
 		void *(*init)(void);
 		/* free the given ctx */
 		void (*fini)(void *);
-		/* get ready to draw the given YUV frame at the given size */
+		/* get ready to draw the given YUV frame at the given size, called from the convert thread */
 		void (*prepareFrame)(void *, VideoFrame *, unsigned int, unsigned int);
-		/* draw the frame setup by prepareFrame at the given location */
-		void (*drawFrame)(void *, int, int);
+		/* draw a frame setup by prepareFrame at the given location, called from the video thread */
+		void (*drawFrame)(void *, VideoFrame *, int, int);
+		/* free anything prepareFrame set up for the frame */
+		void (*releaseFrame)(void *, VideoFrame *);
 	} *fns;
 } MHEGVideoOutput;
 
@@ -30,7 +32,8 @@ void MHEGVideoOutput_init(MHEGVideoOutput *, MHEGVideoOutputMethod *);
 void MHEGVideoOutput_fini(MHEGVideoOutput *);
 
 void MHEGVideoOutput_prepareFrame(MHEGVideoOutput *, VideoFrame *, unsigned int, unsigned int);
-void MHEGVideoOutput_drawFrame(MHEGVideoOutput *, int, int);
+void MHEGVideoOutput_drawFrame(MHEGVideoOutput *, VideoFrame *, int, int);
+void MHEGVideoOutput_releaseFrame(MHEGVideoOutput *, VideoFrame *);
 
 #endif 	/* __MHEGVIDEOOUTPUT_H__ */
 
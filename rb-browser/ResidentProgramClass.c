@@ -2,11 +2,15 @@
  * ResidentProgramClass.c
  */
 
-#include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
 #include <time.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 
 #include "MHEGEngine.h"
 #include "ResidentProgramClass.h"
@@ -22,11 +26,70 @@
 #include "BooleanVariableClass.h"
 #include "rtti.h"
 #include "si.h"
+#include "utils.h"
+
+/* most parameters any resident program takes */
+#define MAX_RESIDENT_PROG_PARAMS	5
+
+/*
+ * the resident programs we know about
+ * each ResidentProgramClass finds its entry once, at Preparation
+ * run_program checks the parameters against param_types before calling func, so the programs don't need to
+ * the ones that may block on the backend also have start, run and finish parts
+ * so Fork can do run on a worker thread
+ */
+struct resident_prog
+{
+	char *short_name;
+	char *long_name;
+	bool (*func)(LIST_OF(Parameter) *, OctetString *);
+	int nparams;						/* -1 => any number of any type */
+	unsigned int param_types[MAX_RESIDENT_PROG_PARAMS];	/* Parameter_xxx choice of each one */
+	/* engine thread: copy the input run needs */
+	bool (*start)(LIST_OF(Parameter) *, OctetString *, OctetString *);
+	/* worker thread: the part that may block, must not touch any MHEG objects */
+	bool (*run)(OctetString *);
+	/* engine thread: set the output parameters from the result of run */
+	bool (*finish)(LIST_OF(Parameter) *, OctetString *, OctetString *, bool);
+};
+
+/*
+ * a forked program whose blocking part is running on a worker thread
+ * the worker only sees the copied input and sets out, everything else is done on the engine thread
+ */
+typedef struct ForkedProgram
+{
+	ResidentProgramClass *p;	/* NULL if it was stopped before it finished */
+	struct resident_prog *prog;	/* what it is running */
+	Fork params;			/* our copy, the Fork action may be freed before the program finishes */
+	OctetString caller_gid;		/* our copy */
+	OctetString in;			/* input for the worker, resolved on the engine thread */
+	bool out;			/* result from the worker */
+} ForkedProgram;
+
+DEFINE_LIST_OF(ForkedProgram);
+
+/*
+ * forked programs that have finished, waiting for the engine thread to set their outputs
+ * _fork_fd is an eventfd that becomes readable when something is added to the list
+ * _fork_lock protects everything here
+ */
+static LIST_OF(ForkedProgram) *_finished = NULL;
+static unsigned int _nrunning = 0;
+static int _fork_fd = -1;
+static pthread_mutex_t _fork_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _fork_cond = PTHREAD_COND_INITIALIZER;	/* signalled when _nrunning drops */
 
 /* internal functions */
+struct resident_prog *find_program(ResidentProgramClass *);
 bool run_program(ResidentProgramClass *, LIST_OF(Parameter) *, OctetString *, bool);
-bool check_parameters(LIST_OF(Parameter) *, unsigned int, ...);
+bool fork_program(ResidentProgramClass *, Fork *, OctetString *);
+void fork_succeeded(ResidentProgramClass *, Fork *, OctetString *, bool);
+void *fork_thread(void *);
+void free_ForkedProgramListItem(LIST_TYPE(ForkedProgram) *);
+bool check_parameters(LIST_OF(Parameter) *, struct resident_prog *);
 Parameter *get_parameter(LIST_OF(Parameter) *, unsigned int);
+void set_substring(GenericOctetString *, OctetString *, OctetString *);
 
 /* resident programs */
 bool prog_GetCurrentDate(LIST_OF(Parameter) *, OctetString *);
@@ -54,6 +117,14 @@ bool prog_SetSubtitleMode(LIST_OF(Parameter) *, OctetString *);
 bool prog_WhoAmI(LIST_OF(Parameter) *, OctetString *);
 bool prog_Debug(LIST_OF(Parameter) *, OctetString *);
 
+/* the resident programs that may block on the backend, split up so Fork can run the blocking part on a worker thread */
+bool start_SI_GetServiceIndex(LIST_OF(Parameter) *, OctetString *, OctetString *);
+bool run_SI_GetServiceIndex(OctetString *);
+bool finish_SI_GetServiceIndex(LIST_OF(Parameter) *, OctetString *, OctetString *, bool);
+bool start_CheckContentRef(LIST_OF(Parameter) *, OctetString *, OctetString *);
+bool run_CheckContentRef(OctetString *);
+bool finish_CheckContentRef(LIST_OF(Parameter) *, OctetString *, OctetString *, bool);
+
 void
 ResidentProgramClass_Preparation(ResidentProgramClass *t)
 {
@@ -63,6 +134,11 @@ ResidentProgramClass_Preparation(ResidentProgramClass *t)
 		return;
 
 	t->inst.forked = false;
+	t->inst.fork = NULL;
+
+	/* find the program now, rather than every time it is called */
+	if((t->inst.prog = find_program(t)) == NULL)
+		error("Unknown ResidentProgram: '%.*s'", t->name.size, t->name.data);
 
 	return;
 }
@@ -97,10 +173,16 @@ ResidentProgramClass_Deactivation(ResidentProgramClass *t)
 	/* stop any forked program */
 	if(t->inst.forked)
 	{
-/******************************************************************************************/
-/* TODO */
-printf("TODO: ResidentProgramClass_Deactivation stop forked program\n");
-/******************************************************************************************/
+		/*
+		 * we can't interrupt the worker thread while it is talking to the backend
+		 * so just forget about it, its results will be thrown away when it finishes
+		 */
+		if(t->inst.fork != NULL)
+		{
+			verbose("ResidentProgramClass: %s; stopping forked program", ExternalReference_name(&t->rootClass.inst.ref));
+			t->inst.fork->p = NULL;
+			t->inst.fork = NULL;
+		}
 		t->inst.forked = false;
 	}
 
@@ -187,7 +269,6 @@ void
 ResidentProgramClass_Fork(ResidentProgramClass *p, Fork *params, OctetString *caller_gid)
 {
 	bool rc;
-	VariableClass *var;
 
 	/* has it been prepared yet */
 	if(!p->rootClass.inst.AvailabilityStatus)
@@ -199,18 +280,174 @@ ResidentProgramClass_Fork(ResidentProgramClass *p, Fork *params, OctetString *ca
 
 	verbose("ResidentProgramClass: %s; Fork '%.*s'", ExternalReference_name(&p->rootClass.inst.ref), p->name.size, p->name.data);
 
-	/* run it in the background */
-/******************************************************************************************/
-/* TODO */
-printf("TODO: ResidentProgramClass_Fork not yet implemented - running in foreground\n");
 	ResidentProgramClass_Activation(p);
+
+	/* run it in the background, ResidentProgramClass_forksFinished will do the rest when it is done */
+	if(fork_program(p, params, caller_gid))
+		return;
+
+	/* it can't block, so just run it now */
 	rc = run_program(p, params->parameters, caller_gid, true);
-/* return immediately */
-/******************************************************************************************/
 
-/******************************************************************************************/
-/* when the program ends */
-/******************************************************************************************/
+	fork_succeeded(p, params, caller_gid, rc);
+
+	return;
+}
+
+/*
+ * eventfd that becomes readable when a forked program has finished
+ * returns -1 if nothing has been forked yet
+ */
+
+int
+ResidentProgramClass_getForkFd(void)
+{
+	return _fork_fd;
+}
+
+/*
+ * called on the engine thread to finish off any forked programs whose worker threads are done
+ * sets their output parameters and fork_succeeded, and generates their AsynchStopped events
+ */
+
+void
+ResidentProgramClass_forksFinished(void)
+{
+	LIST_OF(ForkedProgram) *finished;
+	LIST_TYPE(ForkedProgram) *job;
+	ForkedProgram *f;
+	uint64_t count;
+	bool rc;
+
+	if(_fork_fd == -1)
+		return;
+
+	pthread_mutex_lock(&_fork_lock);
+	if(read(_fork_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		error("Unable to read eventfd: %s", strerror(errno));
+	finished = _finished;
+	_finished = NULL;
+	pthread_mutex_unlock(&_fork_lock);
+
+	while(finished)
+	{
+		job = finished;
+		f = &job->item;
+		/* has it been stopped while it was running */
+		if(f->p != NULL)
+		{
+			f->p->inst.fork = NULL;
+			rc = (*(f->prog->finish))(f->params.parameters, &f->caller_gid, &f->in, f->out);
+			fork_succeeded(f->p, &f->params, &f->caller_gid, rc);
+		}
+		LIST_REMOVE(&finished, job);
+		free_ForkedProgramListItem(job);
+	}
+
+	return;
+}
+
+/*
+ * wait for any worker threads that are still running
+ * they may be using the backend, so call this before the backend is shut down
+ */
+
+void
+ResidentProgramClass_finiForks(void)
+{
+	pthread_mutex_lock(&_fork_lock);
+	while(_nrunning > 0)
+		pthread_cond_wait(&_fork_cond, &_fork_lock);
+	LIST_FREE(&_finished, ForkedProgram, free_ForkedProgramListItem);
+	pthread_mutex_unlock(&_fork_lock);
+
+	if(_fork_fd != -1)
+	{
+		close(_fork_fd);
+		_fork_fd = -1;
+	}
+
+	return;
+}
+
+/*
+ * if the program can block, start its blocking part on a worker thread
+ * returns false if it should just be run on the engine thread
+ * if it fails to start, fork_succeeded is set to false and we return true
+ */
+
+bool
+fork_program(ResidentProgramClass *p, Fork *params, OctetString *caller_gid)
+{
+	struct resident_prog *prog;
+	LIST_TYPE(ForkedProgram) *job;
+	pthread_t tid;
+	pthread_attr_t attr;
+	int err;
+
+	if((prog = p->inst.prog) == NULL
+	|| prog->run == NULL)
+		return false;
+
+	/* remember we were forked */
+	p->inst.forked = true;
+
+	/* create the eventfd the first time we need it */
+	if(_fork_fd == -1
+	&& (_fork_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+		fatal("Unable to create eventfd: %s", strerror(errno));
+
+	job = safe_malloc(sizeof(LIST_TYPE(ForkedProgram)));
+	bzero(job, sizeof(LIST_TYPE(ForkedProgram)));
+	job->item.p = p;
+	job->item.prog = prog;
+
+	/* check the parameters and get the input values while we are on the engine thread */
+	if(!check_parameters(params->parameters, prog)
+	|| !(*(prog->start))(params->parameters, caller_gid, &job->item.in))
+	{
+		free_ForkedProgramListItem(job);
+		fork_succeeded(p, params, caller_gid, false);
+		return true;
+	}
+
+	/* the Fork action belongs to the app or scene, which may be freed before the program finishes */
+	dup_Fork(&job->item.params, params);
+	OctetString_dup(&job->item.caller_gid, caller_gid);
+
+	p->inst.fork = &job->item;
+
+	pthread_mutex_lock(&_fork_lock);
+	_nrunning ++;
+	pthread_mutex_unlock(&_fork_lock);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if((err = pthread_create(&tid, &attr, fork_thread, job)) != 0)
+	{
+		/* just run it here */
+		error("Unable to create thread for forked program: %s", strerror(err));
+		job->item.out = (*(prog->run))(&job->item.in);
+		pthread_mutex_lock(&_fork_lock);
+		_nrunning --;
+		LIST_APPEND(&_finished, job);
+		pthread_mutex_unlock(&_fork_lock);
+		ResidentProgramClass_forksFinished();
+	}
+	pthread_attr_destroy(&attr);
+
+	return true;
+}
+
+/*
+ * store the return value and generate the AsynchStopped event
+ */
+
+void
+fork_succeeded(ResidentProgramClass *p, Fork *params, OctetString *caller_gid, bool rc)
+{
+	VariableClass *var;
+
 	/* store the return value */
 	if((var = (VariableClass *) MHEGEngine_findObjectReference(&params->fork_succeeded, caller_gid)) != NULL)
 	{
@@ -234,106 +471,203 @@ printf("TODO: ResidentProgramClass_Fork not yet implemented - running in foregro
 }
 
 /*
- * run the given program (identified by the name field in the ResidentProgramClass)
- * returns true if the program succeeds
- * sets the parameters to the values described by the UK MHEG Profile
- * caller_gid is used to resolve Generic variables in the parameters
- * if forked is true, return immediately and run the program in the background
+ * worker thread
+ * must not touch any MHEG objects or engine state, it only has job->in to work with
  */
 
-struct
+void *
+fork_thread(void *arg)
 {
-	char *short_name;
-	char *long_name;
-	bool (*func)(LIST_OF(Parameter) *, OctetString *);
-} resident_progs[] =
+	LIST_TYPE(ForkedProgram) *job = (LIST_TYPE(ForkedProgram) *) arg;
+	uint64_t one = 1;
+
+	job->item.out = (*(job->item.prog->run))(&job->item.in);
+
+	/* hand it back to the engine thread */
+	pthread_mutex_lock(&_fork_lock);
+	LIST_APPEND(&_finished, job);
+	if(write(_fork_fd, &one, sizeof(one)) < 0)
+		error("Unable to write eventfd: %s", strerror(errno));
+	_nrunning --;
+	pthread_cond_signal(&_fork_cond);
+	pthread_mutex_unlock(&_fork_lock);
+
+	return NULL;
+}
+
+void
+free_ForkedProgramListItem(LIST_TYPE(ForkedProgram) *job)
+{
+	free_Fork(&job->item.params);
+	safe_free(job->item.caller_gid.data);
+	safe_free(job->item.in.data);
+
+	safe_free(job);
+
+	return;
+}
+
+struct resident_prog resident_progs[] =
 {
-	{ "GCD", "GetCurrentDate",		prog_GetCurrentDate },
-	{ "FDa", "FormatDate",			prog_FormatDate },
-	{ "GDW", "GetDayOfWeek",		prog_GetDayOfWeek },
-	{ "Rnd", "Random",			prog_Random },
-	{ "CTC", "CastToContentRef",		prog_CastToContentRef },
-	{ "CTO", "CastToObjectRef",		prog_CastToObjectRef },
-	{ "GSL", "GetStringLength",		prog_GetStringLength },
-	{ "GSS", "GetSubString",		prog_GetSubString },
-	{ "SSS", "SearchSubString",		prog_SearchSubString },
-	{ "SES", "SearchAndExtractSubString",	prog_SearchAndExtractSubString },
-	{ "GSI", "SI_GetServiceIndex",		prog_SI_GetServiceIndex },
-	{ "TIn", "SI_TuneIndex",		prog_SI_TuneIndex },
-	{ "TII", "SI_TuneIndexInfo",		prog_SI_TuneIndexInfo },
-	{ "BSI", "SI_GetBasicSI",		prog_SI_GetBasicSI },
-	{ "GBI", "GetBootInfo",			prog_GetBootInfo },
-	{ "CCR", "CheckContentRef",		prog_CheckContentRef },
-	{ "CGR", "CheckGroupIDRef",		prog_CheckGroupIDRef },
-	{ "VTG", "VideoToGraphics",		prog_VideoToGraphics },
-	{ "SWA", "SetWidescreenAlignment",	prog_SetWidescreenAlignment },
-	{ "GDA", "GetDisplayAspectRatio",	prog_GetDisplayAspectRatio },
-	{ "CIS", "CI_SendMessage",		prog_CI_SendMessage },
-	{ "SSM", "SetSubtitleMode",		prog_SetSubtitleMode },
-	{ "WAI", "WhoAmI",			prog_WhoAmI },
-	{ "DBG", "Debug",			prog_Debug },
+	{ "GCD", "GetCurrentDate",		prog_GetCurrentDate,			2,
+	  { Parameter_new_generic_integer,			/* out: date */
+	    Parameter_new_generic_integer } },			/* out: time */
+	{ "FDa", "FormatDate",			prog_FormatDate,			4,
+	  { Parameter_new_generic_octetstring,			/* in: dateFormat */
+	    Parameter_new_generic_integer,			/* in: date */
+	    Parameter_new_generic_integer,			/* in: time */
+	    Parameter_new_generic_octetstring } },		/* out: dateString */
+	{ "GDW", "GetDayOfWeek",		prog_GetDayOfWeek,			2,
+	  { Parameter_new_generic_integer,			/* in: date */
+	    Parameter_new_generic_integer } },			/* out: dayOfWeek */
+	{ "Rnd", "Random",			prog_Random,				2,
+	  { Parameter_new_generic_integer,			/* in: num */
+	    Parameter_new_generic_integer } },			/* out: random */
+	{ "CTC", "CastToContentRef",		prog_CastToContentRef,			2,
+	  { Parameter_new_generic_octetstring,			/* in: string */
+	    Parameter_new_generic_content_reference } },	/* out: contentRef */
+	{ "CTO", "CastToObjectRef",		prog_CastToObjectRef,			3,
+	  { Parameter_new_generic_octetstring,			/* in: string (gid) */
+	    Parameter_new_generic_integer,			/* in: objectId */
+	    Parameter_new_generic_object_reference } },		/* out: objectRef */
+	{ "GSL", "GetStringLength",		prog_GetStringLength,			2,
+	  { Parameter_new_generic_octetstring,			/* in: string */
+	    Parameter_new_generic_integer } },			/* out: length */
+	{ "GSS", "GetSubString",		prog_GetSubString,			4,
+	  { Parameter_new_generic_octetstring,			/* in: string */
+	    Parameter_new_generic_integer,			/* in: beginExtract */
+	    Parameter_new_generic_integer,			/* in: endExtract */
+	    Parameter_new_generic_octetstring } },		/* out: stringResult */
+	{ "SSS", "SearchSubString",		prog_SearchSubString,			4,
+	  { Parameter_new_generic_octetstring,			/* in: string */
+	    Parameter_new_generic_integer,			/* in: startIndex */
+	    Parameter_new_generic_octetstring,			/* in: searchString */
+	    Parameter_new_generic_integer } },			/* out: stringPosition */
+	{ "SES", "SearchAndExtractSubString",	prog_SearchAndExtractSubString,		5,
+	  { Parameter_new_generic_octetstring,			/* in: string */
+	    Parameter_new_generic_integer,			/* in: startIndex */
+	    Parameter_new_generic_octetstring,			/* in: searchString */
+	    Parameter_new_generic_octetstring,			/* out: stringResult */
+	    Parameter_new_generic_integer } },			/* out: stringPosition */
+	{ "GSI", "SI_GetServiceIndex",		prog_SI_GetServiceIndex,		2,
+	  { Parameter_new_generic_octetstring,			/* in: serviceReference */
+	    Parameter_new_generic_integer },			/* out: serviceIndex */
+	  start_SI_GetServiceIndex, run_SI_GetServiceIndex, finish_SI_GetServiceIndex },
+	{ "TIn", "SI_TuneIndex",		prog_SI_TuneIndex,			1,
+	  { Parameter_new_generic_integer } },			/* in: serviceIndex */
+	{ "TII", "SI_TuneIndexInfo",		prog_SI_TuneIndexInfo,			1,
+	  { Parameter_new_generic_integer } },			/* in: tuneinfo */
+	{ "BSI", "SI_GetBasicSI",		prog_SI_GetBasicSI,			5,
+	  { Parameter_new_generic_integer,			/* in: serviceIndex */
+	    Parameter_new_generic_integer,			/* out: networkId */
+	    Parameter_new_generic_integer,			/* out: origNetworkId */
+	    Parameter_new_generic_integer,			/* out: transportStreamId */
+	    Parameter_new_generic_integer } },			/* out: serviceId */
+	{ "GBI", "GetBootInfo",			prog_GetBootInfo,			2,
+	  { Parameter_new_generic_boolean,			/* out: infoResult */
+	    Parameter_new_generic_octetstring } },		/* out: bootInfo */
+	{ "CCR", "CheckContentRef",		prog_CheckContentRef,			3,
+	  { Parameter_new_generic_content_reference,		/* in: ref-to-check */
+	    Parameter_new_generic_boolean,			/* out: ref-valid-var */
+	    Parameter_new_generic_content_reference },		/* out: ref-checked-var */
+	  start_CheckContentRef, run_CheckContentRef, finish_CheckContentRef },
+	{ "CGR", "CheckGroupIDRef",		prog_CheckGroupIDRef,			3,
+	  { Parameter_new_generic_object_reference,		/* in: ref-to-check */
+	    Parameter_new_generic_boolean,			/* out: ref-valid-var */
+	    Parameter_new_generic_object_reference } },		/* out: ref-checked-var */
+	{ "VTG", "VideoToGraphics",		prog_VideoToGraphics,			4,
+	  { Parameter_new_generic_integer,			/* in: videoX */
+	    Parameter_new_generic_integer,			/* in: videoY */
+	    Parameter_new_generic_integer,			/* out: graphicsX */
+	    Parameter_new_generic_integer } },			/* out: graphicsY */
+	{ "SWA", "SetWidescreenAlignment",	prog_SetWidescreenAlignment,		1,
+	  { Parameter_new_generic_integer } },			/* in: mode */
+	{ "GDA", "GetDisplayAspectRatio",	prog_GetDisplayAspectRatio,		1,
+	  { Parameter_new_generic_integer } },			/* out: aspectratio */
+	{ "CIS", "CI_SendMessage",		prog_CI_SendMessage,			2,
+	  { Parameter_new_generic_octetstring,			/* in: message */
+	    Parameter_new_generic_octetstring } },		/* out: response */
+	{ "SSM", "SetSubtitleMode",		prog_SetSubtitleMode,			1,
+	  { Parameter_new_generic_boolean } },			/* in: on */
+	{ "WAI", "WhoAmI",			prog_WhoAmI,				1,
+	  { Parameter_new_generic_octetstring } },		/* out: ident */
+	{ "DBG", "Debug",			prog_Debug,				-1 },	/* 0 or more params of any type */
 	{ "", "", NULL }
 };
 
-bool
-run_program(ResidentProgramClass *p, LIST_OF(Parameter) *params, OctetString *caller_gid, bool forked)
+/*
+ * find the given program (identified by the name field in the ResidentProgramClass)
+ * returns NULL if we don't know about it
+ */
+
+struct resident_prog *
+find_program(ResidentProgramClass *p)
 {
-	bool rc;
 	unsigned int i;
 
-	/* remember if we were forked or not */
-	p->inst.forked = forked;
-
-	/* find it */
 	for(i=0; resident_progs[i].func!=NULL; i++)
 	{
 		if(OctetString_strcmp(&p->name, resident_progs[i].short_name) == 0
 		|| OctetString_strcmp(&p->name, resident_progs[i].long_name) == 0)
-			break;
+			return &resident_progs[i];
 	}
 
-	/* run it */
-	if(resident_progs[i].func)
-	{
-		rc = (*(resident_progs[i].func))(params, caller_gid);
-	}
-	else
-	{
-		error("Unknown ResidentProgram: '%.*s'", p->name.size, p->name.data);
-		rc = false;
-	}
+	return NULL;
+}
 
-	return rc;
+/*
+ * run the given program on the engine thread
+ * returns true if the program succeeds
+ * sets the parameters to the values described by the UK MHEG Profile
+ * caller_gid is used to resolve Generic variables in the parameters
+ * forked says if it was started by Fork or Call
+ */
+
+bool
+run_program(ResidentProgramClass *p, LIST_OF(Parameter) *params, OctetString *caller_gid, bool forked)
+{
+	struct resident_prog *prog = p->inst.prog;
+
+	/* remember if we were forked or not */
+	p->inst.forked = forked;
+
+	/* Preparation will have complained if we don't know about it */
+	if(prog == NULL
+	|| !check_parameters(params, prog))
+		return false;
+
+	return (*(prog->func))(params, caller_gid);
 }
 
 /*
- * check the list of parameters is the correct length and match the given types
+ * check the list of parameters is the correct length and match the types the program expects
  * returns true if the parameters are valid
  */
 
 bool
-check_parameters(LIST_OF(Parameter) *params, unsigned int nparams, ...)
+check_parameters(LIST_OF(Parameter) *params, struct resident_prog *prog)
 {
-	va_list ap;
+	int i;
 
-	va_start(ap, nparams);
+	/* any number of any type */
+	if(prog->nparams < 0)
+		return true;
 
-	/* check each param in the list matches the vararg types */
-	while(nparams != 0)
+	/* check each param in the list matches the types in the table */
+	for(i=0; i<prog->nparams; i++)
 	{
 		if(params == NULL
-		|| params->item.choice != va_arg(ap, unsigned int))
-			return false;
-		/* move on */
+		|| params->item.choice != prog->param_types[i])
+			break;
 		params = params->next;
-		nparams --;
 	}
 
-	va_end(ap);
-
 	/* make sure no params are left */
-	if(params != NULL)
+	if(i != prog->nparams || params != NULL)
+	{
+		error("ResidentProgram: %s (%s): wrong number or type of parameters", prog->long_name, prog->short_name);
 		return false;
+	}
 
 	return true;
 }
@@ -373,13 +707,6 @@ prog_GetCurrentDate(LIST_OF(Parameter) *params, OctetString *caller_gid)
 	struct timeval now;
 	struct timezone zone;
 
-	if(!check_parameters(params, 2, Parameter_new_generic_integer,	/* out: date */
-					Parameter_new_generic_integer))	/* out: time */
-	{
-		error("ResidentProgram: GetCurrentDate (GCD): wrong number or type of parameters");
-		return false;
-	}
-
 	date_par = &(get_parameter(params, 1)->u.new_generic_integer);
 	time_par = &(get_parameter(params, 2)->u.new_generic_integer);
 
@@ -420,15 +747,6 @@ prog_FormatDate(LIST_OF(Parameter) *params, OctetString *caller_gid)
 	struct tm *tm;
 	unsigned int year, month, hour;
 
-	if(!check_parameters(params, 4, Parameter_new_generic_octetstring,	/* in: dateFormat */
-					Parameter_new_generic_integer,		/* in: date */
-					Parameter_new_generic_integer,		/* in: time */
-					Parameter_new_generic_octetstring))	/* out: dateString */
-	{
-		error("ResidentProgram: FormatDate (FDa): wrong number or type of parameters");
-		return false;
-	}
-
 	dateFormat_par = &(get_parameter(params, 1)->u.new_generic_octetstring);
 	date_par = &(get_parameter(params, 2)->u.new_generic_integer);
 	time_par = &(get_parameter(params, 3)->u.new_generic_integer);
@@ -598,13 +916,6 @@ prog_GetDayOfWeek(LIST_OF(Parameter) *params, OctetString *caller_gid)
 	unsigned int mheg_date;
 	unsigned int dayOfWeek;
 
-	if(!check_parameters(params, 2, Parameter_new_generic_integer,	/* in: date */
-					Parameter_new_generic_integer))	/* out: dayOfWeek */
-	{
-		error("ResidentProgram: GetDayOfWeek (GDW): wrong number or type of parameters");
-		return false;
-	}
-
 	date_par = &(get_parameter(params, 1)->u.new_generic_integer);
 	dayOfWeek_par = &(get_parameter(params, 2)->u.new_generic_integer);
 
@@ -627,13 +938,6 @@ prog_Random(LIST_OF(Parameter) *params, OctetString *caller_gid)
 	unsigned int num;
 	unsigned int rnd;
 
-	if(!check_parameters(params, 2, Parameter_new_generic_integer,	/* in: num */
-					Parameter_new_generic_integer))	/* out: random */
-	{
-		error("ResidentProgram: Random (Rnd): wrong number or type of parameters");
-		return false;
-	}
-
 	num_par = &(get_parameter(params, 1)->u.new_generic_integer);
 	random_par = &(get_parameter(params, 2)->u.new_generic_integer);
 
@@ -659,13 +963,6 @@ prog_CastToContentRef(LIST_OF(Parameter) *params, OctetString *caller_gid)
 	OctetString *string;
 	ContentReference ref;
 
-	if(!check_parameters(params, 2, Parameter_new_generic_octetstring,		/* in: string */
-					Parameter_new_generic_content_reference))	/* out: contentRef */
-	{
-		error("ResidentProgram: CastToContentRef (CTC): wrong number or type of parameters");
-		return false;
-	}
-
 	string_par = &(get_parameter(params, 1)->u.new_generic_octetstring);
 	contentRef_par = &(get_parameter(params, 2)->u.new_generic_content_reference);
 
@@ -690,14 +987,6 @@ prog_CastToObjectRef(LIST_OF(Parameter) *params, OctetString *caller_gid)
 	int objectId;
 	ObjectReference ref;
 
-	if(!check_parameters(params, 3, Parameter_new_generic_octetstring,		/* in: string (gid) */
-					Parameter_new_generic_integer,			/* in: objectId */
-					Parameter_new_generic_object_reference))	/* out: objectRef */
-	{
-		error("ResidentProgram: CastToObjectRef (CTO): wrong number or type of parameters");
-		return false;
-	}
-
 	groupId_par = &(get_parameter(params, 1)->u.new_generic_octetstring);
 	objectId_par = &(get_parameter(params, 2)->u.new_generic_integer);
 	objectRef_par = &(get_parameter(params, 3)->u.new_generic_object_reference);
@@ -725,13 +1014,6 @@ prog_GetStringLength(LIST_OF(Parameter) *params, OctetString *caller_gid)
 	GenericInteger *length_par;
 	OctetString *string;
 
-	if(!check_parameters(params, 2, Parameter_new_generic_octetstring,	/* in: string */
-					Parameter_new_generic_integer))		/* out: length */
-	{
-		error("ResidentProgram: GetStringLength (GSL): wrong number or type of parameters");
-		return false;
-	}
-
 	string_par = &(get_parameter(params, 1)->u.new_generic_octetstring);
 	length_par = &(get_parameter(params, 2)->u.new_generic_integer);
 
@@ -756,15 +1038,6 @@ prog_GetSubString(LIST_OF(Parameter) *params, OctetString *caller_gid)
 	int endExtract;
 	OctetString stringResult;
 
-	if(!check_parameters(params, 4, Parameter_new_generic_octetstring,	/* in: string */
-					Parameter_new_generic_integer,		/* in: beginExtract */
-					Parameter_new_generic_integer,		/* in: endExtract */
-					Parameter_new_generic_octetstring))	/* out: stringResult */
-	{
-		error("ResidentProgram: GetSubString (GSS): wrong number or type of parameters");
-		return false;
-	}
-
 	string_par = &(get_parameter(params, 1)->u.new_generic_octetstring);
 	beginExtract_par = &(get_parameter(params, 2)->u.new_generic_integer);
 	endExtract_par = &(get_parameter(params, 3)->u.new_generic_integer);
@@ -788,15 +1061,50 @@ prog_GetSubString(LIST_OF(Parameter) *params, OctetString *caller_gid)
 		stringResult.size = (endExtract - beginExtract) + 1;	/* inclusive */
 		stringResult.data = &string->data[beginExtract - 1];
 	}
-	GenericOctetString_setOctetString(stringResult_par, caller_gid, &stringResult);
 
+	/* before we set the result, it may overwrite string */
 	verbose("ResidentProgram: GetSubString(\"%.*s\", %d, %d, \"%.*s\")", string->size, string->data,
 									     beginExtract, endExtract,
 									     stringResult.size, stringResult.data);
 
+	set_substring(stringResult_par, caller_gid, &stringResult);
+
 	return true;
 }
 
+/*
+ * set the GenericOctetString to sub, which points into one of the program's input strings
+ * apps call the string programs in tight loops, often storing the result back in the variable the input came from
+ * so if the result fits in what is already there, overwrite it in place rather than reallocating and copying it
+ * (this also copes with sub being part of the variable we are writing to)
+ */
+
+void
+set_substring(GenericOctetString *g, OctetString *caller_gid, OctetString *sub)
+{
+	OctetString *dst;
+
+	/* error already reported if it is not an OctetString */
+	if((dst = GenericOctetString_getOctetString(g, caller_gid)) == NULL)
+		return;
+
+	if(sub->size == 0)
+	{
+		OctetString_copy(dst, NULL);
+	}
+	else if(sub->size <= dst->size)
+	{
+		memmove(dst->data, sub->data, sub->size);
+		dst->size = sub->size;
+	}
+	else
+	{
+		OctetString_copy(dst, sub);
+	}
+
+	return;
+}
+
 /*
  * does the searching for SearchSubString and SearchAndExtractSubString
  * start counts from 1
@@ -839,15 +1147,6 @@ prog_SearchSubString(LIST_OF(Parameter) *params, OctetString *caller_gid)
 	OctetString *searchString;
 	int stringPosition;
 
-	if(!check_parameters(params, 4, Parameter_new_generic_octetstring,	/* in: string */
-					Parameter_new_generic_integer,		/* in: startIndex */
-					Parameter_new_generic_octetstring,	/* in: searchString */
-					Parameter_new_generic_integer))		/* out: stringPosition */
-	{
-		error("ResidentProgram: SearchSubString (SSS): wrong number or type of parameters");
-		return false;
-	}
-
 	string_par = &(get_parameter(params, 1)->u.new_generic_octetstring);
 	startIndex_par = &(get_parameter(params, 2)->u.new_generic_integer);
 	searchString_par = &(get_parameter(params, 3)->u.new_generic_octetstring);
@@ -886,16 +1185,6 @@ prog_SearchAndExtractSubString(LIST_OF(Parameter) *params, OctetString *caller_g
 	int stringPosition;
 	int search_pos;
 
-	if(!check_parameters(params, 5, Parameter_new_generic_octetstring,	/* in: string */
-					Parameter_new_generic_integer,		/* in: startIndex */
-					Parameter_new_generic_octetstring,	/* in: searchString */
-					Parameter_new_generic_octetstring,	/* out: stringResult */
-					Parameter_new_generic_integer))		/* out: stringPosition */
-	{
-		error("ResidentProgram: SearchAndExtractSubString (SES): wrong number or type of parameters");
-		return false;
-	}
-
 	string_par = &(get_parameter(params, 1)->u.new_generic_octetstring);
 	startIndex_par = &(get_parameter(params, 2)->u.new_generic_integer);
 	searchString_par = &(get_parameter(params, 3)->u.new_generic_octetstring);
@@ -923,9 +1212,7 @@ prog_SearchAndExtractSubString(LIST_OF(Parameter) *params, OctetString *caller_g
 		stringPosition = -1;
 	}
 
-	GenericOctetString_setOctetString(stringResult_par, caller_gid, &stringResult);
-	GenericInteger_setInteger(stringPosition_par, caller_gid, stringPosition);
-
+	/* before we set the result, it may overwrite string */
 	verbose("ResidentProgram: SearchAndExtractSubString(\"%.*s\", %d, \"%.*s\", \"%.*s\", %d)",
 								string->size, string->data,
 								startIndex,
@@ -933,33 +1220,72 @@ prog_SearchAndExtractSubString(LIST_OF(Parameter) *params, OctetString *caller_g
 								stringResult.size, stringResult.data,
 								stringPosition);
 
+	set_substring(stringResult_par, caller_gid, &stringResult);
+	GenericInteger_setInteger(stringPosition_par, caller_gid, stringPosition);
+
 	return true;
 }
 
 bool
 prog_SI_GetServiceIndex(LIST_OF(Parameter) *params, OctetString *caller_gid)
 {
-	GenericOctetString *serviceReference_par;
-	GenericInteger *serviceIndex_par;
-	OctetString *serviceReference;
-	int serviceIndex;
+	OctetString url;
+	bool available;
+	bool rc;
 
-	if(!check_parameters(params, 2, Parameter_new_generic_octetstring,	/* in: serviceReference */
-					Parameter_new_generic_integer))		/* out: serviceIndex */
-	{
-		error("ResidentProgram: SI_GetServiceIndex (GSI): wrong number or type of parameters");
+	if(!start_SI_GetServiceIndex(params, caller_gid, &url))
 		return false;
-	}
+
+	/* only ask the backend if we have not already assigned it an index */
+	available = (si_find_index(&url) != -1) || run_SI_GetServiceIndex(&url);
+
+	rc = finish_SI_GetServiceIndex(params, caller_gid, &url, available);
+
+	safe_free(url.data);
+
+	return rc;
+}
+
+/*
+ * url is set to a copy of the dvb:// URL of the service, it will need to be free'd
+ */
+
+bool
+start_SI_GetServiceIndex(LIST_OF(Parameter) *params, OctetString *caller_gid, OctetString *url)
+{
+	GenericOctetString *serviceReference_par;
+	OctetString *serviceReference;
 
 	serviceReference_par = &(get_parameter(params, 1)->u.new_generic_octetstring);
-	serviceIndex_par = &(get_parameter(params, 2)->u.new_generic_integer);
 
+	/* resolve it to dvb:// format */
 	serviceReference = GenericOctetString_getOctetString(serviceReference_par, caller_gid);
-	serviceIndex = si_get_index(serviceReference);
+	OctetString_dup(url, si_resolve(serviceReference));
+
+	return true;
+}
+
+bool
+run_SI_GetServiceIndex(OctetString *url)
+{
+	/* does the backend say it is available */
+	return MHEGEngine_isServiceAvailable(url);
+}
+
+bool
+finish_SI_GetServiceIndex(LIST_OF(Parameter) *params, OctetString *caller_gid, OctetString *url, bool available)
+{
+	GenericInteger *serviceIndex_par;
+	int serviceIndex;
+
+	serviceIndex_par = &(get_parameter(params, 2)->u.new_generic_integer);
+
+	if((serviceIndex = si_find_index(url)) == -1 && available)
+		serviceIndex = si_add_index(url);
 
 	GenericInteger_setInteger(serviceIndex_par, caller_gid, serviceIndex);
 
-	verbose("ResidentProgram: SI_GetServiceIndex(\"%.*s\", %d)", serviceReference->size, serviceReference->data, serviceIndex);
+	verbose("ResidentProgram: SI_GetServiceIndex(\"%.*s\", %d)", url->size, url->data, serviceIndex);
 
 	return true;
 }
@@ -970,12 +1296,6 @@ prog_SI_TuneIndex(LIST_OF(Parameter) *params, OctetString *caller_gid)
 	GenericInteger *serviceIndex_par;
 	int serviceIndex;
 
-	if(!check_parameters(params, 1, Parameter_new_generic_integer))	/* in: serviceIndex */
-	{
-		error("ResidentProgram: SI_TuneIndex (TIn): wrong number or type of parameters");
-		return false;
-	}
-
 	serviceIndex_par = &(get_parameter(params, 1)->u.new_generic_integer);
 	serviceIndex = GenericInteger_getInteger(serviceIndex_par, caller_gid);
 
@@ -987,11 +1307,6 @@ prog_SI_TuneIndex(LIST_OF(Parameter) *params, OctetString *caller_gid)
 bool
 prog_SI_TuneIndexInfo(LIST_OF(Parameter) *params, OctetString *caller_gid)
 {
-	if(!check_parameters(params, 1, Parameter_new_generic_integer))	/* in: tuneinfo */
-	{
-		error("ResidentProgram: SI_TuneIndexInfo (TII): wrong number or type of parameters");
-		return false;
-	}
 /* TODO */
 printf("TODO: program TII SI_TuneIndexInfo\n");
 	return true;
@@ -1011,16 +1326,6 @@ prog_SI_GetBasicSI(LIST_OF(Parameter) *params, OctetString *caller_gid)
 	unsigned int transport_id;
 	unsigned int service_id;
 
-	if(!check_parameters(params, 5, Parameter_new_generic_integer,	/* in: serviceIndex */
-					Parameter_new_generic_integer,	/* out: networkId */
-					Parameter_new_generic_integer,	/* out: origNetworkId */
-					Parameter_new_generic_integer,	/* out: transportStreamId */
-					Parameter_new_generic_integer))	/* out: serviceId */
-	{
-		error("ResidentProgram: SI_GetBasicSI (BSI): wrong number or type of parameters");
-		return false;
-	}
-
 	serviceIndex_par = &(get_parameter(params, 1)->u.new_generic_integer);
 	networkId_par = &(get_parameter(params, 2)->u.new_generic_integer);
 	origNetworkId_par = &(get_parameter(params, 3)->u.new_generic_integer);
@@ -1048,12 +1353,6 @@ prog_SI_GetBasicSI(LIST_OF(Parameter) *params, OctetString *caller_gid)
 bool
 prog_GetBootInfo(LIST_OF(Parameter) *params, OctetString *caller_gid)
 {
-	if(!check_parameters(params, 2, Parameter_new_generic_boolean,		/* out: infoResult */
-					Parameter_new_generic_octetstring))	/* out: bootInfo */
-	{
-		error("ResidentProgram: GetBootInfo (GBI): wrong number or type of parameters");
-		return false;
-	}
 /* TODO */
 printf("TODO: program GBI GetBootInfo\n");
 	return true;
@@ -1061,20 +1360,59 @@ printf("TODO: program GBI GetBootInfo\n");
 
 bool
 prog_CheckContentRef(LIST_OF(Parameter) *params, OctetString *caller_gid)
+{
+	OctetString absolute;
+	bool valid;
+	bool rc;
+
+	if(!start_CheckContentRef(params, caller_gid, &absolute))
+		return false;
+
+	valid = run_CheckContentRef(&absolute);
+
+	rc = finish_CheckContentRef(params, caller_gid, &absolute, valid);
+
+	safe_free(absolute.data);
+
+	return rc;
+}
+
+/*
+ * absolute is set to a copy of the absolute name of the file to check, it will need to be free'd
+ * we resolve it here because the worker thread can't look at the active app to find the current path
+ */
+
+bool
+start_CheckContentRef(LIST_OF(Parameter) *params, OctetString *caller_gid, OctetString *absolute)
+{
+	GenericContentReference *refToCheck_par;
+	ContentReference *ref;
+	OctetString name;
+
+	refToCheck_par = &(get_parameter(params, 1)->u.new_generic_content_reference);
+
+	ref = GenericContentReference_getContentReference(refToCheck_par, caller_gid);
+
+	name.data = MHEGEngine_absoluteFilename(ref);
+	name.size = strlen(name.data);
+	OctetString_dup(absolute, &name);
+
+	return true;
+}
+
+bool
+run_CheckContentRef(OctetString *absolute)
+{
+	return MHEGEngine_checkContentRef(absolute);
+}
+
+bool
+finish_CheckContentRef(LIST_OF(Parameter) *params, OctetString *caller_gid, OctetString *absolute, bool valid)
 {
 	GenericContentReference *refToCheck_par;
 	GenericBoolean *refValid_par;
 	GenericContentReference *refChecked_par;
 	ContentReference *ref;
-	bool valid;
-
-	if(!check_parameters(params, 3, Parameter_new_generic_content_reference,	/* in: ref-to-check */
-					Parameter_new_generic_boolean,			/* out: ref-valid-var */
-					Parameter_new_generic_content_reference))	/* out: ref-checked-var */
-	{
-		error("ResidentProgram: CheckContentRef (CCR): wrong number or type of parameters");
-		return false;
-	}
 
 	refToCheck_par = &(get_parameter(params, 1)->u.new_generic_content_reference);
 	refValid_par = &(get_parameter(params, 2)->u.new_generic_boolean);
@@ -1082,8 +1420,6 @@ prog_CheckContentRef(LIST_OF(Parameter) *params, OctetString *caller_gid)
 
 	ref = GenericContentReference_getContentReference(refToCheck_par, caller_gid);
 
-	valid = MHEGEngine_checkContentRef(ref);
-
 	/* output values */
 	GenericBoolean_setBoolean(refValid_par, caller_gid, valid);
 	GenericContentReference_setContentReference(refChecked_par, caller_gid, ref);
@@ -1096,13 +1432,6 @@ prog_CheckContentRef(LIST_OF(Parameter) *params, OctetString *caller_gid)
 bool
 prog_CheckGroupIDRef(LIST_OF(Parameter) *params, OctetString *caller_gid)
 {
-	if(!check_parameters(params, 3, Parameter_new_generic_object_reference,		/* in: ref-to-check */
-					Parameter_new_generic_boolean,			/* out: ref-valid-var */
-					Parameter_new_generic_object_reference))	/* out: ref-checked-var */
-	{
-		error("ResidentProgram: CheckGroupIDRef (CGR): wrong number or type of parameters");
-		return false;
-	}
 /* TODO */
 printf("TODO: program CGR CheckGroupIDRef\n");
 	return true;
@@ -1111,14 +1440,6 @@ printf("TODO: program CGR CheckGroupIDRef\n");
 bool
 prog_VideoToGraphics(LIST_OF(Parameter) *params, OctetString *caller_gid)
 {
-	if(!check_parameters(params, 4, Parameter_new_generic_integer,	/* in: videoX */
-					Parameter_new_generic_integer,	/* in: videoY */
-					Parameter_new_generic_integer,	/* out: graphicsX */
-					Parameter_new_generic_integer))	/* out: graphicsY */
-	{
-		error("ResidentProgram: VideoToGraphics (VTG): wrong number or type of parameters");
-		return false;
-	}
 /* TODO */
 printf("TODO: program VTG VideoToGraphics\n");
 	return true;
@@ -1127,11 +1448,6 @@ printf("TODO: program VTG VideoToGraphics\n");
 bool
 prog_SetWidescreenAlignment(LIST_OF(Parameter) *params, OctetString *caller_gid)
 {
-	if(!check_parameters(params, 1, Parameter_new_generic_integer))	/* in: mode */
-	{
-		error("ResidentProgram: SetWidescreenAlignment (SWA): wrong number or type of parameters");
-		return false;
-	}
 /* TODO */
 printf("TODO: program SWA SetWidescreenAlignment\n");
 	return true;
@@ -1140,11 +1456,6 @@ printf("TODO: program SWA SetWidescreenAlignment\n");
 bool
 prog_GetDisplayAspectRatio(LIST_OF(Parameter) *params, OctetString *caller_gid)
 {
-	if(!check_parameters(params, 1, Parameter_new_generic_integer))	/* out: aspectratio */
-	{
-		error("ResidentProgram: GetDisplayAspectRatio (GDA): wrong number or type of parameters");
-		return false;
-	}
 /* TODO */
 printf("TODO: program GDA GetDisplayAspectRatio\n");
 	return true;
@@ -1153,12 +1464,6 @@ printf("TODO: program GDA GetDisplayAspectRatio\n");
 bool
 prog_CI_SendMessage(LIST_OF(Parameter) *params, OctetString *caller_gid)
 {
-	if(!check_parameters(params, 2, Parameter_new_generic_octetstring,	/* in: message */
-					Parameter_new_generic_octetstring))	/* out: response */
-	{
-		error("ResidentProgram: CI_SendMessage (CIS): wrong number or type of parameters");
-		return false;
-	}
 /* TODO */
 printf("TODO: program CIS CI_SendMessage\n");
 	return true;
@@ -1167,11 +1472,6 @@ printf("TODO: program CIS CI_SendMessage\n");
 bool
 prog_SetSubtitleMode(LIST_OF(Parameter) *params, OctetString *caller_gid)
 {
-	if(!check_parameters(params, 1, Parameter_new_generic_boolean))	/* in: on */
-	{
-		error("ResidentProgram: SetSubtitleMode (SSM): wrong number or type of parameters");
-		return false;
-	}
 /* TODO */
 printf("TODO: program SSM SetSubtitleMode\n");
 	return true;
@@ -1184,12 +1484,6 @@ prog_WhoAmI(LIST_OF(Parameter) *params, OctetString *caller_gid)
 	OctetString ident;
 	char ident_str[] = MHEG_RECEIVER_ID " " MHEG_ENGINE_ID " " MHEG_DSMCC_ID;
 
-	if(!check_parameters(params, 1, Parameter_new_generic_octetstring))	/* out: ident */
-	{
-		error("ResidentProgram: WhoAmI (WAI): wrong number or type of parameters");
-		return false;
-	}
-
 	ident_par = &(get_parameter(params, 1)->u.new_generic_octetstring);
 
 	ident.size = strlen(ident_str);
@@ -16,5 +16,9 @@ void ResidentProgramClass_Clone(ResidentProgramClass *, Clone *, OctetString *);
 void ResidentProgramClass_Call(ResidentProgramClass *, Call *, OctetString *);
 void ResidentProgramClass_Fork(ResidentProgramClass *, Fork *, OctetString *);
 
+int ResidentProgramClass_getForkFd(void);
+void ResidentProgramClass_forksFinished(void);
+void ResidentProgramClass_finiForks(void);
+
 #endif	/* __RESIDENTPROGRAMCLASS_H__ */
 
@@ -16,6 +16,7 @@
 #include "BooleanVariableClass.h"
 #include "clone.h"
 #include "rtti.h"
+#include "intern.h"
 
 /*
  * any existing data is dst will be lost
@@ -51,6 +52,7 @@ RootClass_registerObject(RootClass *t)
 	 * this means we don't need a ptr to the enclosing app/scene in every object
 	 */
 	MHEGEngine_resolveDERObjectReference(&t->ObjectReference, &t->inst.ref);
+	t->inst.gid = intern_id(&t->inst.ref.group_identifier);
 
 	/* remember it */
 	MHEGEngine_addObjectReference(t);
@@ -93,6 +95,7 @@ RootClass_registerClonedObject(LIST_TYPE(GroupItem) *gi, RootClass *group, unsig
 	 */
 	OctetString_dup(&r->inst.ref.group_identifier, &group->inst.ref.group_identifier);
 	r->inst.ref.object_number = object_num;
+	r->inst.gid = group->inst.gid;
 
 	/* remember the object */
 	MHEGEngine_addObjectReference(r);
@@ -35,6 +35,8 @@ free_SceneClassInstanceVars(SceneClassInstanceVars *v)
 {
 	GroupClass_freeTimers(&v->Timers, &v->removed_timers);
 
+	GroupClass_freeObjectNumbers(&v->used_numbers);
+
 	return;
 }
 
@@ -113,7 +115,7 @@ printf("TODO: SceneClass: %s; aspect_ratio=%d:%d\n", ExternalReference_name(&s->
 	MHEGEngine_generateEvent(&s->rootClass.inst.ref, EventType_is_running, NULL);
 
 	/* time base for absolute timers */
-	gettimeofday(&s->inst.start_time, NULL);
+	MHEGTimer_getTime(&s->inst.start_time);
 
 	return;
 }
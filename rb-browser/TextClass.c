@@ -111,7 +111,7 @@ default_TextClassInstanceVars(TextClass *t, TextClassInstanceVars *v)
 			MHEGFont_defaultAttributes(&v->Font);
 	}
 
-	v->element = NULL;
+	v->layout = NULL;
 
 	return;
 }
@@ -126,7 +126,7 @@ free_TextClassInstanceVars(TextClassInstanceVars *v)
 
 	free_MHEGFont(&v->Font);
 
-	LIST_FREE(&v->element, MHEGTextElement, safe_free);
+	MHEGFont_releaseLayout(&v->layout);
 
 	return;
 }
@@ -235,7 +235,7 @@ TextClass_SetData(TextClass *t, SetData *set, OctetString *caller_gid)
 
 	/* get rid of any existing content */
 	free_OctetString(&t->inst.TextData);
-	LIST_FREE(&t->inst.element, MHEGTextElement, safe_free);
+	MHEGFont_releaseLayout(&t->inst.layout);
 
 	/*
 	 * the content may need to be loaded from an external file
@@ -336,7 +336,7 @@ TextClass_SetBoxSize(TextClass *t, SetBoxSize *params, OctetString *caller_gid)
 	t->inst.BoxSize.y_length = GenericInteger_getInteger(&params->y_new_box_size, caller_gid);
 
 	/* remove the previous layout info, gets recalculated when we redraw it */
-	LIST_FREE(&t->inst.element, MHEGTextElement, safe_free);
+	MHEGFont_releaseLayout(&t->inst.layout);
 
 	/* if it is active, redraw it */
 	if(t->rootClass.inst.RunningStatus)
@@ -483,7 +483,7 @@ TextClass_SetTextColour(TextClass *t, SetTextColour *params, OctetString *caller
 	MHEGColour_fromNewColour(&t->inst.TextColour, &params->new_text_colour, caller_gid);
 
 	/* remove the previous layout info, colours get recalculated when we redraw it */
-	LIST_FREE(&t->inst.element, MHEGTextElement, safe_free);
+	MHEGFont_releaseLayout(&t->inst.layout);
 
 	/* if it is active, redraw it */
 	if(t->rootClass.inst.RunningStatus)
@@ -504,7 +504,7 @@ TextClass_SetFontAttributes(TextClass *t, SetFontAttributes *params, OctetString
 	MHEGFont_setAttributes(&t->inst.Font, attr);
 
 	/* remove the previous layout info, gets recalculated when we redraw it */
-	LIST_FREE(&t->inst.element, MHEGTextElement, safe_free);
+	MHEGFont_releaseLayout(&t->inst.layout);
 
 	/* if it is active, redraw it */
 	if(t->rootClass.inst.RunningStatus)
@@ -568,7 +568,7 @@ TextClass_contentAvailable(TextClass *t, OctetString *file)
 {
 	/* get rid of any existing content */
 	free_OctetString(&t->inst.TextData);
-	LIST_FREE(&t->inst.element, MHEGTextElement, safe_free);
+	MHEGFont_releaseLayout(&t->inst.layout);
 
 	/* load the new content */
 	MHEGEngine_loadFile(file, &t->inst.TextData);
@@ -599,18 +599,18 @@ TextClass_render(TextClass *t, MHEGDisplay *d, XYPosition *pos, OriginalBoxSize
 	MHEGDisplay_fillRectangle(d, &ins_pos, &ins_box, &t->inst.BackgroundColour);
 
 	/* layout the text if not already done */
-	if(t->inst.element == NULL)
+	if(t->inst.layout == NULL)
 	{
-		t->inst.element = MHEGFont_layoutText(&t->inst.Font, &t->inst.TextColour, &t->inst.TextData, &t->inst.BoxSize,
-						      t->horizontal_justification, t->vertical_justification,
-						      t->line_orientation, t->start_corner, t->text_wrapping);
+		t->inst.layout = MHEGFont_getLayout(&t->inst.Font, &t->inst.TextColour, &t->inst.TextData, &t->inst.BoxSize,
+						    t->horizontal_justification, t->vertical_justification,
+						    t->line_orientation, t->start_corner, t->text_wrapping);
 	}
 
 	/* tabs are treated as spaces if horizontal justification is not Justification_start */
 	tabs = (t->horizontal_justification == Justification_start);
 
 	/* draw each text element */
-	element = t->inst.element;
+	element = t->inst.layout->element;
 	while(element)
 	{
 		MHEGDisplay_drawTextElement(d, &t->inst.Position, &t->inst.Font, &element->item, tabs);
@@ -0,0 +1,282 @@
+/*
+ * avclock.c
+ *
+ * audio master clock for the stream player
+ *
+ * the audio thread tells us which PTS the sound card is playing right now
+ * (the PTS at the end of the data it has written, less snd_pcm_delay)
+ * between updates we extrapolate from the system time
+ * the video thread waits for the clock to reach each frame's PTS
+ * so the video follows the sound card, rather than the system clock, and doesn't drift
+ */
+
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "MHEGEngine.h"
+#include "avclock.h"
+#include "utils.h"
+
+void
+avclock_init(AVClock *c)
+{
+	pthread_mutex_init(&c->lock, NULL);
+
+	avclock_reset(c);
+
+	return;
+}
+
+void
+avclock_fini(AVClock *c)
+{
+	pthread_mutex_destroy(&c->lock);
+
+	return;
+}
+
+/*
+ * call this before you start playing
+ */
+
+void
+avclock_reset(AVClock *c)
+{
+	pthread_mutex_lock(&c->lock);
+
+	c->valid = false;
+	c->audio_master = false;
+	c->pts = 0.0;
+	c->time = 0;
+	c->first_pts = 0.0;
+	c->first_time = 0;
+	c->last_report = 0;
+
+	bzero(&c->stats, sizeof(AVClockStats));
+
+	pthread_mutex_unlock(&c->lock);
+
+	return;
+}
+
+/*
+ * the first video frame with the given PTS was shown at the given system time
+ * ignored if the audio thread has already started the clock
+ */
+
+void
+avclock_start(AVClock *c, double pts, int64_t now)
+{
+	pthread_mutex_lock(&c->lock);
+
+	if(!c->valid)
+	{
+		c->pts = pts;
+		c->time = now;
+		c->valid = true;
+	}
+
+	pthread_mutex_unlock(&c->lock);
+
+	return;
+}
+
+/*
+ * the audio thread says the sound card is playing the given PTS at the given system time
+ */
+
+void
+avclock_update(AVClock *c, double pts, int64_t now)
+{
+	double estimate;
+	double error;
+	bool report;
+
+	pthread_mutex_lock(&c->lock);
+
+	if(!c->audio_master)
+	{
+		/* first update, take the audio clock as it is */
+		c->pts = pts;
+		c->time = now;
+		c->valid = true;
+		c->audio_master = true;
+		c->first_pts = pts;
+		c->first_time = now;
+		c->last_report = now;
+	}
+	else
+	{
+		/* where did we think we would be */
+		estimate = c->pts + ((now - c->time) / 1000000.0);
+		error = pts - estimate;
+		if(fabs(error) > c->stats.max_correction)
+			c->stats.max_correction = fabs(error);
+		if(fabs(error) > AVCLOCK_RESYNC)
+		{
+			c->stats.nresyncs ++;
+			c->pts = pts;
+		}
+		else
+		{
+			c->pts = estimate + (error * AVCLOCK_SMOOTH);
+		}
+		c->time = now;
+	}
+
+	c->stats.nupdates ++;
+	c->stats.audio_secs = pts - c->first_pts;
+	c->stats.system_secs = (now - c->first_time) / 1000000.0;
+
+	report = (now - c->last_report) >= AVCLOCK_REPORT_USECS;
+	if(report)
+		c->last_report = now;
+
+	pthread_mutex_unlock(&c->lock);
+
+	if(report)
+		avclock_report(c);
+
+	return;
+}
+
+/*
+ * sets *pts to the stream time at the given system time
+ * returns false if the clock has not been started yet
+ */
+
+bool
+avclock_get(AVClock *c, int64_t now, double *pts)
+{
+	bool valid;
+
+	pthread_mutex_lock(&c->lock);
+
+	if((valid = c->valid))
+		*pts = c->pts + ((now - c->time) / 1000000.0);
+
+	pthread_mutex_unlock(&c->lock);
+
+	return valid;
+}
+
+/*
+ * the video thread showed the frame with the given PTS at the given system time
+ * keeps track of how far the video is from the clock
+ */
+
+void
+avclock_videoShown(AVClock *c, double pts, int64_t now)
+{
+	double error;
+
+	pthread_mutex_lock(&c->lock);
+
+	if(c->valid)
+	{
+		error = fabs(pts - (c->pts + ((now - c->time) / 1000000.0)));
+		c->stats.nvideo ++;
+		c->stats.av_error_total += error;
+		if(error > c->stats.av_error_max)
+			c->stats.av_error_max = error;
+	}
+
+	pthread_mutex_unlock(&c->lock);
+
+	return;
+}
+
+void
+avclock_getStats(AVClock *c, AVClockStats *stats)
+{
+	pthread_mutex_lock(&c->lock);
+	memcpy(stats, &c->stats, sizeof(AVClockStats));
+	pthread_mutex_unlock(&c->lock);
+
+	return;
+}
+
+void
+avclock_report(AVClock *c)
+{
+	AVClockStats s;
+	double drift;
+
+	avclock_getStats(c, &s);
+
+	/* how fast the sound card clock is compared to the system clock, in parts per million */
+	drift = (s.system_secs > 0.0) ? ((s.audio_secs - s.system_secs) / s.system_secs) * 1000000.0 : 0.0;
+
+	verbose("avclock: %u audio updates, %u resyncs, max correction %.3f secs; audio clock drift %.1f ppm over %.0f secs",
+		s.nupdates, s.nresyncs, s.max_correction, drift, s.system_secs);
+	verbose("avclock: %u PTS discontinuities, %u PTS wraps; video %u frames, A/V error average %.3f secs, max %.3f secs",
+		s.ndiscontinuities, s.nwraps, s.nvideo, (s.nvideo > 0) ? (s.av_error_total / s.nvideo) : 0.0, s.av_error_max);
+
+	return;
+}
+
+void
+avclock_initTimeline(PTSTimeline *t)
+{
+	t->valid = false;
+	t->last_raw = 0;
+	t->last = 0.0;
+	t->step = 0.0;
+
+	return;
+}
+
+/*
+ * returns the time in seconds for the given PTS in the stream t
+ * the result carries on increasing when the 33-bit PTS wraps round
+ * if the PTS jumps (eg the broadcaster splices in a new programme), we carry on from where we were
+ * so audio and video stay in step with each other and with the clock
+ */
+
+double
+avclock_unwrap(AVClock *c, PTSTimeline *t, int64_t raw)
+{
+	int64_t delta;
+	double secs;
+
+	if(!t->valid)
+	{
+		t->valid = true;
+		t->last_raw = raw;
+		t->last = raw / AVCLOCK_PTS_HZ;
+		return t->last;
+	}
+
+	delta = raw - t->last_raw;
+
+	/* did it wrap round */
+	if(delta < -(AVCLOCK_PTS_WRAP / 2) || delta > (AVCLOCK_PTS_WRAP / 2))
+	{
+		delta += (delta < 0) ? AVCLOCK_PTS_WRAP : -AVCLOCK_PTS_WRAP;
+		pthread_mutex_lock(&c->lock);
+		c->stats.nwraps ++;
+		pthread_mutex_unlock(&c->lock);
+	}
+
+	secs = delta / AVCLOCK_PTS_HZ;
+
+	if(fabs(secs) > AVCLOCK_MAX_PTS_JUMP)
+	{
+		verbose("avclock: PTS discontinuity (%f secs)", secs);
+		/* assume it follows on from the last one */
+		secs = t->step;
+		pthread_mutex_lock(&c->lock);
+		c->stats.ndiscontinuities ++;
+		pthread_mutex_unlock(&c->lock);
+	}
+	else if(secs > 0.0)
+	{
+		t->step = secs;
+	}
+
+	t->last_raw = raw;
+	t->last += secs;
+
+	return t->last;
+}
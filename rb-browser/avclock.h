@@ -0,0 +1,85 @@
+/*
+ * avclock.h
+ */
+
+#ifndef __AVCLOCK_H__
+#define __AVCLOCK_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/* PTS/DTS values are 33 bits at 90kHz */
+#define AVCLOCK_PTS_HZ		90000.0
+#define AVCLOCK_PTS_WRAP	(((int64_t) 1) << 33)
+
+/* a jump bigger than this (in seconds) between timestamps in a stream is a discontinuity */
+#define AVCLOCK_MAX_PTS_JUMP	2.0
+
+/* if the audio clock is further than this (in seconds) from where we thought it was, jump straight to it */
+#define AVCLOCK_RESYNC		0.1
+
+/* otherwise, move this fraction of the way towards it each time, to smooth out jitter in snd_pcm_delay */
+#define AVCLOCK_SMOOTH		0.1
+
+/* how often (in micro seconds) to report the drift statistics */
+#define AVCLOCK_REPORT_USECS	(60 * 1000000LL)
+
+/* turns the PTS values in one stream into a continuous time line */
+typedef struct
+{
+	bool valid;		/* false until we have seen the first PTS */
+	int64_t last_raw;	/* last PTS from the stream */
+	double last;		/* what we turned it into, in seconds */
+	double step;		/* last normal gap between timestamps, in seconds */
+} PTSTimeline;
+
+typedef struct
+{
+	unsigned int nupdates;		/* times the audio thread has read the sound card position */
+	unsigned int nresyncs;		/* times the clock was too far out to smooth */
+	unsigned int ndiscontinuities;	/* PTS jumps we have smoothed over */
+	unsigned int nwraps;		/* times a PTS wrapped round */
+	double max_correction;		/* biggest (absolute) difference between the audio clock and our estimate */
+	double audio_secs;		/* audio clock time since the first update */
+	double system_secs;		/* system time since the first update */
+	unsigned int nvideo;		/* video frames shown */
+	double av_error_total;		/* sum of |video PTS - clock| when each frame was shown */
+	double av_error_max;
+} AVClockStats;
+
+/*
+ * the master clock for a stream player
+ * the audio thread keeps it in step with what the sound card is actually playing
+ * if there is no audio, it runs from the system time the first video frame was shown
+ */
+typedef struct
+{
+	pthread_mutex_t lock;
+	bool valid;			/* false until it has been started */
+	bool audio_master;		/* true once the audio thread has updated it */
+	double pts;			/* stream time ... */
+	int64_t time;			/* ... at this system time */
+	double first_pts;		/* values from the first audio update, for the drift stats */
+	int64_t first_time;
+	int64_t last_report;		/* when we last reported the stats */
+	AVClockStats stats;
+} AVClock;
+
+void avclock_init(AVClock *);
+void avclock_fini(AVClock *);
+void avclock_reset(AVClock *);
+
+void avclock_start(AVClock *, double, int64_t);
+void avclock_update(AVClock *, double, int64_t);
+bool avclock_get(AVClock *, int64_t, double *);
+
+void avclock_videoShown(AVClock *, double, int64_t);
+
+void avclock_getStats(AVClock *, AVClockStats *);
+void avclock_report(AVClock *);
+
+void avclock_initTimeline(PTSTimeline *);
+double avclock_unwrap(AVClock *, PTSTimeline *, int64_t);
+
+#endif	/* __AVCLOCK_H__ */
@@ -0,0 +1,299 @@
+/*
+ * canvasbench.c
+ *
+ * draw the same chart over and over, like an animated DynamicLineArt does
+ * reports how long each frame takes with the rasteriser MHEGCanvas uses, including uploading the changed pixels to the X server
+ * and how long it takes with one X request per shape, the way MHEGCanvas used to draw
+ * if there is no X server, only the rasteriser is timed
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <sys/time.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+#include "raster.h"
+#include "utils.h"
+
+#define CANVAS_WIDTH	400
+#define CANVAS_HEIGHT	300
+
+/* what is in each frame */
+#define NSECTORS	12
+#define NBARS		40
+#define NPOINTS		200
+#define NGRIDLINES	10
+
+void usage(char *);
+double now(void);
+void raster_frame(Raster *, unsigned int, int);
+void x11_frame(Display *, Pixmap, GC, unsigned int);
+int point_y(unsigned int, unsigned int);
+
+int
+main(int argc, char *argv[])
+{
+	char *prog = argv[0];
+	int arg;
+	unsigned int repeat = 1000;
+	int style = RASTER_SOLID;
+	uint32_t *pixels;
+	Raster r;
+	Display *dpy;
+	Window win = None;
+	Pixmap pixmap = None;
+	GC gc = None;
+	XImage *ximg = NULL;
+	unsigned int i;
+	double start, secs;
+	unsigned long nuploaded = 0;
+
+	while((arg = getopt(argc, argv, "dn:")) != EOF)
+	{
+		switch(arg)
+		{
+		case 'd':
+			style = RASTER_DASHED;
+			break;
+
+		case 'n':
+			repeat = strtoul(optarg, NULL, 0);
+			break;
+
+		default:
+			usage(prog);
+			break;
+		}
+	}
+
+	if(optind != argc || repeat == 0)
+		usage(prog);
+
+	pixels = safe_mallocz(CANVAS_WIDTH * CANVAS_HEIGHT * sizeof(uint32_t));
+	raster_init(&r, pixels, CANVAS_WIDTH, CANVAS_HEIGHT);
+
+	if((dpy = XOpenDisplay(NULL)) != NULL)
+	{
+		win = XCreateSimpleWindow(dpy, DefaultRootWindow(dpy), 0, 0, CANVAS_WIDTH, CANVAS_HEIGHT, 0, 0, 0);
+		pixmap = XCreatePixmap(dpy, win, CANVAS_WIDTH, CANVAS_HEIGHT, 32);
+		gc = XCreateGC(dpy, pixmap, 0, NULL);
+		if((ximg = XCreateImage(dpy, NULL, 32, ZPixmap, 0, (char *) pixels, CANVAS_WIDTH, CANVAS_HEIGHT, 32, 0)) == NULL)
+			fatal("XCreateImage failed");
+	}
+
+	printf("%u frames of %d sectors, %d bars, %d point line, %d %s grid lines\n",
+		repeat, NSECTORS, NBARS, NPOINTS, NGRIDLINES, (style == RASTER_DASHED) ? "dashed" : "solid");
+
+	/* rasteriser, then upload what changed */
+	start = now();
+	for(i=0; i<repeat; i++)
+	{
+		raster_frame(&r, i, style);
+		if(dpy != NULL)
+		{
+			XPutImage(dpy, pixmap, gc, ximg, r.damage_x0, r.damage_y0, r.damage_x0, r.damage_y0,
+				  r.damage_x1 - r.damage_x0, r.damage_y1 - r.damage_y0);
+			XSync(dpy, False);
+		}
+		nuploaded += (r.damage_x1 - r.damage_x0) * (r.damage_y1 - r.damage_y0);
+		raster_resetDamage(&r);
+	}
+	secs = now() - start;
+	printf("rasteriser: %.1f us per frame, %lu pixels changed per frame\n", (secs * 1e6) / repeat, nuploaded / repeat);
+
+	if(dpy == NULL)
+	{
+		printf("no X server, can't time drawing with X requests\n");
+		return EXIT_SUCCESS;
+	}
+
+	/* one X request per shape */
+	start = now();
+	for(i=0; i<repeat; i++)
+	{
+		x11_frame(dpy, pixmap, gc, i);
+		XSync(dpy, False);
+	}
+	secs = now() - start;
+	printf("X requests: %.1f us per frame\n", (secs * 1e6) / repeat);
+
+	/* we own the XImage data */
+	ximg->data = NULL;
+	XDestroyImage(ximg);
+	XFreeGC(dpy, gc);
+	XFreePixmap(dpy, pixmap);
+	XDestroyWindow(dpy, win);
+	XCloseDisplay(dpy);
+
+	raster_fini(&r);
+	safe_free(pixels);
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * frame is used to animate the chart
+ */
+
+void
+raster_frame(Raster *r, unsigned int frame, int style)
+{
+	RasterPoint line[NPOINTS];
+	RasterPoint box[4];
+	RasterPoint *pts;
+	unsigned int npts;
+	double start, arc;
+	unsigned int i;
+	int x, h;
+
+	/* background */
+	box[0].x = 0;
+	box[0].y = 0;
+	box[1].x = CANVAS_WIDTH;
+	box[1].y = 0;
+	box[2].x = CANVAS_WIDTH;
+	box[2].y = CANVAS_HEIGHT;
+	box[3].x = 0;
+	box[3].y = CANVAS_HEIGHT;
+	raster_fillPolygon(r, box, 4, 0xff202020);
+
+	/* grid */
+	for(i=0; i<NGRIDLINES; i++)
+	{
+		line[0].x = 0.5;
+		line[0].y = (i * CANVAS_HEIGHT) / NGRIDLINES + 0.5;
+		line[1].x = CANVAS_WIDTH - 0.5;
+		line[1].y = line[0].y;
+		raster_strokePath(r, line, 2, false, 1, style, 0xff808080);
+	}
+
+	/* pie chart */
+	start = (frame % 360) * M_PI / 180.0;
+	arc = (2.0 * M_PI) / NSECTORS;
+	for(i=0; i<NSECTORS; i++)
+	{
+		npts = raster_arcPoints(r, &pts, 100, 100, 80, 80, start + (i * arc), arc, true);
+		raster_fillPolygon(r, pts, npts, 0xff000000 | (i * 0x151515));
+		npts = raster_arcPoints(r, &pts, 100.5, 100.5, 80, 80, start + (i * arc), arc, true);
+		raster_strokePath(r, pts, npts, true, 1, RASTER_SOLID, 0xffffffff);
+	}
+
+	/* bar chart */
+	for(i=0; i<NBARS; i++)
+	{
+		x = 200 + (i * 5);
+		h = point_y(i * 5, frame) / 2;
+		box[0].x = x;
+		box[0].y = CANVAS_HEIGHT - h;
+		box[1].x = x + 4;
+		box[1].y = CANVAS_HEIGHT - h;
+		box[2].x = x + 4;
+		box[2].y = CANVAS_HEIGHT;
+		box[3].x = x;
+		box[3].y = CANVAS_HEIGHT;
+		raster_fillPolygon(r, box, 4, 0xff2060c0);
+	}
+
+	/* line chart */
+	for(i=0; i<NPOINTS; i++)
+	{
+		line[i].x = ((i * CANVAS_WIDTH) / NPOINTS) + 0.5;
+		line[i].y = point_y(i, frame) + 0.5;
+	}
+	raster_strokePath(r, line, NPOINTS, false, 3, RASTER_SOLID, 0xffff4000);
+
+	return;
+}
+
+/*
+ * the same chart, drawn the way MHEGCanvas used to
+ */
+
+void
+x11_frame(Display *dpy, Pixmap pixmap, GC gc, unsigned int frame)
+{
+	XGCValues gcvals;
+	XPoint line[NPOINTS];
+	int start, arc;
+	unsigned int i;
+	int x, h;
+
+	gcvals.foreground = 0xff202020;
+	XChangeGC(dpy, gc, GCForeground, &gcvals);
+	XFillRectangle(dpy, pixmap, gc, 0, 0, CANVAS_WIDTH, CANVAS_HEIGHT);
+
+	for(i=0; i<NGRIDLINES; i++)
+	{
+		gcvals.foreground = 0xff808080;
+		gcvals.line_width = 1;
+		XChangeGC(dpy, gc, GCForeground | GCLineWidth, &gcvals);
+		XDrawLine(dpy, pixmap, gc, 0, (i * CANVAS_HEIGHT) / NGRIDLINES, CANVAS_WIDTH - 1, (i * CANVAS_HEIGHT) / NGRIDLINES);
+	}
+
+	start = (frame % 360) * 64;
+	arc = (360 * 64) / NSECTORS;
+	for(i=0; i<NSECTORS; i++)
+	{
+		gcvals.foreground = 0xff000000 | (i * 0x151515);
+		gcvals.arc_mode = ArcPieSlice;
+		XChangeGC(dpy, gc, GCForeground | GCArcMode, &gcvals);
+		XFillArc(dpy, pixmap, gc, 20, 20, 160, 160, start + (i * arc), arc);
+		gcvals.foreground = 0xffffffff;
+		gcvals.line_width = 1;
+		XChangeGC(dpy, gc, GCForeground | GCLineWidth, &gcvals);
+		XDrawArc(dpy, pixmap, gc, 20, 20, 160, 160, start + (i * arc), arc);
+		XDrawLine(dpy, pixmap, gc, 100, 100,
+			  100 + 80 * cos((start + (i * arc)) * M_PI / (180 * 64)), 100 - 80 * sin((start + (i * arc)) * M_PI / (180 * 64)));
+		XDrawLine(dpy, pixmap, gc, 100, 100,
+			  100 + 80 * cos((start + ((i + 1) * arc)) * M_PI / (180 * 64)), 100 - 80 * sin((start + ((i + 1) * arc)) * M_PI / (180 * 64)));
+	}
+
+	for(i=0; i<NBARS; i++)
+	{
+		x = 200 + (i * 5);
+		h = point_y(i * 5, frame) / 2;
+		gcvals.foreground = 0xff2060c0;
+		XChangeGC(dpy, gc, GCForeground, &gcvals);
+		XFillRectangle(dpy, pixmap, gc, x, CANVAS_HEIGHT - h, 4, h);
+	}
+
+	for(i=0; i<NPOINTS; i++)
+	{
+		line[i].x = (i * CANVAS_WIDTH) / NPOINTS;
+		line[i].y = point_y(i, frame);
+	}
+	gcvals.foreground = 0xffff4000;
+	gcvals.line_width = 3;
+	XChangeGC(dpy, gc, GCForeground | GCLineWidth, &gcvals);
+	XDrawLines(dpy, pixmap, gc, line, NPOINTS, CoordModeOrigin);
+
+	return;
+}
+
+int
+point_y(unsigned int i, unsigned int frame)
+{
+	return (CANVAS_HEIGHT / 2) + (CANVAS_HEIGHT / 3) * sin((i + frame) * 0.1);
+}
+
+double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+void
+usage(char *prog)
+{
+	fprintf(stderr, "Syntax: %s [-d] [-n <repeat>]\n", prog);
+
+	exit(EXIT_FAILURE);
+}
@@ -0,0 +1,153 @@
+/*
+ * clonebench.c
+ *
+ * Clone an IntegerVariable over and over, like apps do when they build up lists of things
+ * reports how long it takes to find an unused object number and add each clone to the scene
+ * links against the engine, but doesn't start it up, so the clones are not prepared
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "MHEGEngine.h"
+#include "RootClass.h"
+#include "GroupClass.h"
+#include "clone.h"
+#include "rtti.h"
+#include "intern.h"
+#include "utils.h"
+
+void usage(char *);
+double now(void);
+void add_variable(SceneClass *, unsigned int);
+
+/* all our objects are in this group */
+static OctetString bench_gid = { 8, "~//bench" };
+
+int
+main(int argc, char *argv[])
+{
+	char *prog = argv[0];
+	int arg;
+	unsigned int nclones = 5000;
+	unsigned int nitems = 200;
+	unsigned int report = 1000;
+	SceneClass scene;
+	VariableClass *orig;
+	LIST_TYPE(GroupItem) *clone;
+	unsigned int obj_num;
+	unsigned int i;
+	double start, lap, secs;
+
+	while((arg = getopt(argc, argv, "i:n:")) != EOF)
+	{
+		switch(arg)
+		{
+		case 'i':
+			nitems = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'n':
+			nclones = strtoul(optarg, NULL, 0);
+			break;
+
+		default:
+			usage(prog);
+			break;
+		}
+	}
+
+	if(optind != argc || nitems == 0 || nclones == 0)
+		usage(prog);
+
+	/* a scene with nitems IntegerVariables, as if it had been loaded from the carousel */
+	bzero(&scene, sizeof(SceneClass));
+	scene.rootClass.inst.ref.group_identifier = bench_gid;
+	scene.rootClass.inst.ref.object_number = 0;
+	scene.rootClass.inst.gid = intern_id(&bench_gid);
+	scene.rootClass.inst.rtti = RTTI_SceneClass;
+	scene.inst.next_clone = FIRST_CLONED_OBJ_NUM;
+	for(i=1; i<=nitems; i++)
+		add_variable(&scene, i);
+
+	/* some authoring tools number objects in the range we use for clones */
+	add_variable(&scene, FIRST_CLONED_OBJ_NUM + 1);
+	add_variable(&scene, FIRST_CLONED_OBJ_NUM + 3);
+
+	orig = &scene.items->item.u.integer_variable;
+
+	printf("%u clones in a scene with %u objects\n", nclones, nitems + 2);
+
+	start = now();
+	lap = start;
+
+	/* what the Clone action does, apart from Preparation */
+	for(i=1; i<=nclones; i++)
+	{
+		if((obj_num = MHEGEngine_getUnusedObjectNumber(&scene.rootClass)) == 0)
+		{
+			fprintf(stderr, "Unable to get an unused object number\n");
+			exit(EXIT_FAILURE);
+		}
+		clone = safe_malloc(sizeof(LIST_TYPE(GroupItem)));
+		bzero(clone, sizeof(LIST_TYPE(GroupItem)));
+		clone->item.choice = GroupItem_integer_variable;
+		VariableClass_dup(&clone->item.u.integer_variable, orig);
+		RootClass_registerClonedObject(clone, &scene.rootClass, obj_num, RTTI_VariableClass);
+		if((i % report) == 0)
+		{
+			secs = now();
+			printf("clones %u-%u: %.2f us per clone\n", i - report + 1, i, ((secs - lap) * 1e6) / report);
+			lap = secs;
+		}
+	}
+
+	secs = now() - start;
+
+	printf("total: %.3f secs, %.2f us per clone, last object number %u\n", secs, (secs * 1e6) / nclones, obj_num);
+
+	return EXIT_SUCCESS;
+}
+
+void
+add_variable(SceneClass *s, unsigned int num)
+{
+	LIST_TYPE(GroupItem) *gi = safe_malloc(sizeof(LIST_TYPE(GroupItem)));
+	VariableClass *v = &gi->item.u.integer_variable;
+
+	bzero(gi, sizeof(LIST_TYPE(GroupItem)));
+	gi->item.choice = GroupItem_integer_variable;
+
+	v->rootClass.inst.ref.group_identifier = bench_gid;
+	v->rootClass.inst.ref.object_number = num;
+	v->rootClass.inst.gid = s->rootClass.inst.gid;
+	v->rootClass.inst.rtti = RTTI_VariableClass;
+	v->initially_active = true;
+	v->original_value.choice = OriginalValue_integer;
+	v->original_value.u.integer = num;
+
+	LIST_APPEND(&s->items, gi);
+
+	return;
+}
+
+double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+void
+usage(char *prog)
+{
+	fprintf(stderr, "Syntax: %s [-i <items>] [-n <clones>]\n", prog);
+
+	exit(EXIT_FAILURE);
+}
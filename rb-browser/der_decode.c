@@ -8,92 +8,261 @@
 
 #include "der_decode.h"
 
-/* DER does not allow indefinite lengths */
+#ifdef DER_COUNT_ALLOCS
+unsigned long der_nallocs = 0;
+#endif
 
-int
-der_decode_Tag(FILE *der, der_tag *tag)
+/* a piece of memory an arena hands out, the data follows the header */
+typedef struct der_chunk
 {
-	unsigned int type;
-	unsigned int len;
-	unsigned char byte;
-	unsigned int longtype;
-	int nlens;
-	int nbytes = 0;
-
-	/* type */
-	if(der_read_file(der, 1, &byte) != 1)
-		return der_error("DER tag");
-	nbytes ++;
-	type = byte;
-	longtype = 0;
-	if((type & 0x1f) == 0x1f)
+	struct der_chunk *next;
+	unsigned char *free;	/* next unused byte */
+	unsigned char *end;	/* first byte after the chunk */
+} der_chunk;
+
+/* everything der_alloc returns from an arena is aligned to this */
+#define DER_ARENA_ALIGN		16
+#define DER_CHUNK_HEADER	((sizeof(der_chunk) + DER_ARENA_ALIGN - 1) & ~(DER_ARENA_ALIGN - 1))
+
+/* biggest chunk we ask for, unless a single allocation needs more */
+#define DER_ARENA_MAX_CHUNK	(1024 * 1024)
+
+/*
+ * arenas are only used by the thread that decodes the objects
+ * the prefetch thread's der_free() calls never see them
+ */
+static __thread der_arena *_active_arena = NULL;	/* der_alloc uses this */
+static __thread der_arena *_live_arenas = NULL;		/* der_free checks these */
+
+/* internal functions */
+static der_chunk *arena_chunk(der_arena *, void *);
+static der_chunk *find_chunk(void *);
+
+/*
+ * the first chunk will be chunk_size bytes (0 => use a default)
+ * eg, give it a guess based on the size of the DER data
+ */
+
+void
+der_arena_init(der_arena *a, size_t chunk_size)
+{
+	bzero(a, sizeof(der_arena));
+
+	a->chunk_size = (chunk_size != 0) ? chunk_size : DER_ARENA_CHUNK_SIZE;
+
+	return;
+}
+
+/*
+ * der_alloc() allocates from this arena until der_arena_end() is called
+ * der_free() will ignore memory in this arena until der_arena_release() is called
+ */
+
+void
+der_arena_begin(der_arena *a)
+{
+	if(!a->live)
 	{
-		/* multi byte type */
-		do
-		{
-			if(der_read_file(der, 1, &byte) != 1)
-				return der_error("DER tag");
-			nbytes ++;
-			longtype <<= 7;
-			longtype += byte & 0x7f;
-		}
-		while((byte & 0x80) != 0);
+		a->next = _live_arenas;
+		_live_arenas = a;
+		a->live = true;
+	}
+
+	_active_arena = a;
+
+	return;
+}
+
+void
+der_arena_end(der_arena *a)
+{
+	if(_active_arena == a)
+		_active_arena = NULL;
+
+	return;
+}
+
+/*
+ * free all the memory in the arena
+ * any pointers into the arena are now invalid
+ * the arena can be used again, the chunk size we have grown to is kept
+ */
+
+void
+der_arena_release(der_arena *a)
+{
+	der_arena **prev;
+	der_chunk *chunk;
+
+	der_arena_end(a);
+
+	if(a->live)
+	{
+		prev = &_live_arenas;
+		while(*prev != a)
+			prev = &(*prev)->next;
+		*prev = a->next;
+		a->live = false;
 	}
-	tag->class = type & 0xc0;
-	tag->number = ((type & 0x1f) == 0x1f) ? longtype : type & 0x1f;
-
-	/* length */
-	if(der_read_file(der, 1, &byte) != 1)
-		return der_error("DER tag");
-	nbytes ++;
-	len = byte;
-	if(len == 0 && type == 0)
+
+	while(a->chunks != NULL)
 	{
-		return der_error("Found EOC; indefinite lengths not allowed in DER");
+		chunk = a->chunks;
+		a->chunks = chunk->next;
+		safe_free(chunk);
 	}
-	else if(len == 0x80)
+
+	a->nchunks = 0;
+	a->size = 0;
+	a->used = 0;
+	a->nallocs = 0;
+
+	return;
+}
+
+bool
+der_arena_owns(der_arena *a, void *p)
+{
+	return (arena_chunk(a, p) != NULL);
+}
+
+void *
+der_mem_alloc(size_t nbytes)
+{
+	der_arena *a = _active_arena;
+	der_chunk *chunk;
+	size_t size;
+	void *p;
+
+	if(a == NULL)
 	{
-		return der_error("Indefinite lengths not allowed in DER");
+#ifdef DER_COUNT_ALLOCS
+		der_nallocs ++;
+#endif
+		return safe_malloc(nbytes);
 	}
-	else if((len & 0x80) == 0x80)
+
+	nbytes = (nbytes + DER_ARENA_ALIGN - 1) & ~(DER_ARENA_ALIGN - 1);
+
+	/* need a new chunk */
+	if(a->chunks == NULL || (size_t) (a->chunks->end - a->chunks->free) < nbytes)
 	{
-		/* multibyte length field */
-		nlens = len & 0x7f;
-		len = 0;
-		while(nlens > 0)
-		{
-			if(der_read_file(der, 1, &byte) != 1)
-				return der_error("DER tag");
-			nbytes ++;
-			len <<= 8;
-			len += byte;
-			nlens --;
-		}
+		size = MAX(a->chunk_size, DER_CHUNK_HEADER + nbytes);
+#ifdef DER_COUNT_ALLOCS
+		der_nallocs ++;
+#endif
+		chunk = safe_malloc(size);
+		chunk->free = ((unsigned char *) chunk) + DER_CHUNK_HEADER;
+		chunk->end = ((unsigned char *) chunk) + size;
+		chunk->next = a->chunks;
+		a->chunks = chunk;
+		a->nchunks ++;
+		a->size += size;
+		/* so a big scene does not need lots of chunks */
+		a->chunk_size = MIN(a->chunk_size * 2, DER_ARENA_MAX_CHUNK);
 	}
-	tag->length = len;
 
-	return nbytes;
+	p = a->chunks->free;
+	a->chunks->free += nbytes;
+	a->used += nbytes;
+	a->nallocs ++;
+
+	return p;
 }
 
 /*
- * read the tag, but don't advance the FILE offset
+ * if p is in an arena, we don't know how big it was
+ * but it can't go past the end of its chunk, so copy up to there
  */
 
-int
-der_peek_Tag(FILE *der, der_tag *tag)
+void *
+der_mem_realloc(void *p, size_t nbytes)
 {
-	long pretag = ftell(der);
-	int length;
+	der_chunk *chunk;
+	void *newp;
+
+	if(p == NULL)
+		return der_mem_alloc(nbytes);
+
+	if((chunk = find_chunk(p)) == NULL)
+	{
+#ifdef DER_COUNT_ALLOCS
+		der_nallocs ++;
+#endif
+		return safe_realloc(p, nbytes);
+	}
 
-	length = der_decode_Tag(der, tag);
+	if(nbytes == 0)
+		return NULL;
 
-	fseek(der, pretag, SEEK_SET);
+	newp = der_mem_alloc(nbytes);
+	memcpy(newp, p, MIN(nbytes, (size_t) (chunk->end - (unsigned char *) p)));
 
-	return length;
+	return newp;
+}
+
+void
+der_mem_free(void *p)
+{
+	if(p != NULL && find_chunk(p) == NULL)
+		safe_free(p);
+
+	return;
+}
+
+/*
+ * returns the chunk in the given arena that contains p, or NULL if p is not in the arena
+ */
+
+static der_chunk *
+arena_chunk(der_arena *a, void *p)
+{
+	der_chunk *chunk;
+
+	for(chunk=a->chunks; chunk; chunk=chunk->next)
+	{
+		if((unsigned char *) p >= ((unsigned char *) chunk) + DER_CHUNK_HEADER
+		&& (unsigned char *) p < chunk->end)
+			return chunk;
+	}
+
+	return NULL;
+}
+
+/*
+ * returns the arena chunk that contains p, or NULL if it came from safe_malloc
+ */
+
+static der_chunk *
+find_chunk(void *p)
+{
+	der_arena *a;
+	der_chunk *chunk;
+
+	for(a=_live_arenas; a; a=a->next)
+	{
+		if((chunk = arena_chunk(a, p)) != NULL)
+			return chunk;
+	}
+
+	return NULL;
+}
+
+/*
+ * decode the given number of bytes starting at data
+ */
+
+void
+der_cursor_init(der_cursor *der, unsigned char *data, unsigned int length)
+{
+	der->pos = data;
+	der->end = data + length;
+
+	return;
 }
 
 int
-der_decode_Null(FILE *der, Null *type, int length)
+der_decode_Null(der_cursor *der, Null *type, int length)
 {
 	if(length != 0)
 		return der_error("Null: length=%d", length);
@@ -106,15 +275,18 @@ der_decode_Null(FILE *der, Null *type, int length)
 }
 
 int
-der_decode_Boolean(FILE *der, bool *type, int length)
+der_decode_Boolean(der_cursor *der, bool *type, int length)
 {
 	unsigned char val;
 
 	if(length != 1)
 		return der_error("Boolean: length=%d", length);
 
-	if(der_read_file(der, length, &val) < 0)
-		return der_error("Boolean");
+	if(der_read(der, length, &val) < 0)
+	{
+		der_error("Boolean");
+		return -1;
+	}
 
 	*type = (val == 0) ? false : true;
 
@@ -126,7 +298,7 @@ der_decode_Boolean(FILE *der, bool *type, int length)
 }
 
 int
-der_decode_Integer(FILE *der, int *type, int length)
+der_decode_Integer(der_cursor *der, int *type, int length)
 {
 	unsigned char byte;
 	unsigned int uval;
@@ -136,19 +308,19 @@ der_decode_Integer(FILE *der, int *type, int length)
 	if(length > sizeof(int))
 		der_error("Integer: length=%d", length);
 
-	/* is it -ve */
-	if(der_read_file(der, 1, &byte) < 0)
+	if(der->end - der->pos < MAX(length, 1))
 		return der_error("Integer");
+
+	/* is it -ve */
+	byte = *(der->pos ++);
 	negative = ((byte & 0x80) == 0x80);
 
 	/* big endian */
 	uval = byte;
 	for(i=1; i<length; i++)
 	{
-		if(der_read_file(der, 1, &byte) < 0)
-			return der_error("Integer");
 		uval <<= 8;
-		uval += byte;
+		uval += *(der->pos ++);
 	}
 
 	/* sign extend if negative */
@@ -171,7 +343,7 @@ der_decode_Integer(FILE *der, int *type, int length)
 /* DER does not allow constructed OCTET-STRINGs */
 
 int
-der_decode_OctetString(FILE *der, OctetString *type, int length)
+der_decode_OctetString(der_cursor *der, OctetString *type, int length)
 {
 	bzero(type, sizeof(OctetString));
 
@@ -185,7 +357,7 @@ der_decode_OctetString(FILE *der, OctetString *type, int length)
 	/* only set the length after we are sure the alloc worked */
 	type->size = length;
 
-	if(der_read_file(der, length, type->data) < 0)
+	if(der_read(der, length, type->data) < 0)
 		return der_error("OctetString");
 
 #ifdef DER_VERBOSE
@@ -209,6 +381,28 @@ free_OctetString(OctetString *type)
 	return;
 }
 
+/*
+ * like OctetString_dup, but uses der_alloc, so the copy goes in the active arena if there is one
+ */
+
+void
+dup_OctetString(OctetString *dst, OctetString *src)
+{
+	dst->size = src->size;
+
+	if(src->size == 0)
+	{
+		dst->data = NULL;
+	}
+	else
+	{
+		dst->data = der_alloc(src->size);
+		memcpy(dst->data, src->data, src->size);
+	}
+
+	return;
+}
+
 int
 OctetString_cmp(OctetString *o1, OctetString *o2)
 {
@@ -218,6 +412,26 @@ OctetString_cmp(OctetString *o1, OctetString *o2)
 		return memcmp(o1->data, o2->data, o1->size);
 }
 
+/*
+ * FNV-1a hash of the contents
+ * used by the caches and the intern table
+ */
+
+uint32_t
+OctetString_hash(OctetString *oct)
+{
+	uint32_t hash = 2166136261U;
+	unsigned int i;
+
+	for(i=0; i<oct->size; i++)
+	{
+		hash ^= oct->data[i];
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
 /*
  * compare the OctetString with the given \0 terminated C string
  */
@@ -263,7 +477,7 @@ OctetString_copy(OctetString *dst, OctetString *src)
 	/* special cases */
 	if(src == NULL || src->size == 0)
 	{
-		safe_free(dst->data);
+		der_free(dst->data);
 		dst->size = 0;
 		dst->data = NULL;
 		return true;
@@ -310,14 +524,51 @@ OctetString_dup(OctetString *dst, OctetString *src)
 }
 
 int
-der_read_file(FILE *in, unsigned int nbytes, void *buf)
+der_read(der_cursor *der, unsigned int nbytes, void *buf)
 {
-	int nread;
+	if(der->end - der->pos < nbytes)
+	{
+		der_error("Unexpected EOF");
+		return -1;
+	}
+
+	memcpy(buf, der->pos, nbytes);
+	der->pos += nbytes;
+
+	return nbytes;
+}
+
+/*
+ * for code that still has its DER data in a FILE
+ * reads length bytes into memory and calls decode(cursor, type, length) on them
+ * returns whatever decode returns, or -1 if it could not read length bytes
+ */
 
-	if((nread = fread(buf, 1, nbytes, in)) != nbytes)
+int
+der_decode_file(FILE *in, der_decode_fn decode, void *type, int length)
+{
+	unsigned char *data;
+	der_cursor der;
+	int rc;
+
+	if(length < 0)
+		return der_error("Invalid length %d", length);
+
+	if((data = safe_malloc(MAX(length, 1))) == NULL)
+		return der_error("Out of memory");
+
+	if(fread(data, 1, length, in) != length)
+	{
+		safe_free(data);
 		return der_error("Unexpected EOF");
+	}
+
+	der_cursor_init(&der, data, length);
+	rc = (*decode)(&der, type, length);
+
+	safe_free(data);
 
-	return nread;
+	return rc;
 }
 
 int
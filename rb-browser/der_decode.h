@@ -5,6 +5,7 @@
 #ifndef __DER_DECODE_H__
 #define __DER_DECODE_H__
 
+#include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
@@ -12,9 +13,51 @@
 
 #include "utils.h"
 
-#define der_alloc(N)		safe_malloc(N)
-#define der_realloc(P, N)	safe_realloc(P, N)
-#define der_free(P)		safe_free(P)
+/*
+ * while a der_arena is active, der_alloc() hands out memory from it by bumping a pointer
+ * der_free() ignores anything that lives in an arena, the whole arena is released in one go
+ * otherwise they are just safe_malloc() and safe_free()
+ */
+#define der_alloc(N)		der_mem_alloc(N)
+#define der_realloc(P, N)	der_mem_realloc(P, N)
+#define der_free(P)		der_mem_free(P)
+
+#ifdef DER_COUNT_ALLOCS
+/* derbench wants to know how many times decoding calls malloc */
+extern unsigned long der_nallocs;
+#endif
+
+/* size of the first chunk if we are not given a better guess */
+#define DER_ARENA_CHUNK_SIZE	(16 * 1024)
+
+typedef struct der_arena
+{
+	struct der_chunk *chunks;	/* newest first, we only allocate from the first one */
+	size_t chunk_size;		/* size of the next chunk we get */
+	unsigned int nchunks;		/* chunks we got from malloc */
+	size_t size;			/* bytes we got from malloc */
+	size_t used;			/* bytes handed out by der_alloc */
+	unsigned long nallocs;		/* number of der_alloc calls */
+	bool live;			/* on the list of arenas that der_free checks */
+	struct der_arena *next;
+} der_arena;
+
+void der_arena_init(der_arena *, size_t);
+void der_arena_begin(der_arena *);
+void der_arena_end(der_arena *);
+void der_arena_release(der_arena *);
+bool der_arena_owns(der_arena *, void *);
+
+void *der_mem_alloc(size_t);
+void *der_mem_realloc(void *, size_t);
+void der_mem_free(void *);
+
+/* the DER data we are decoding, the decoders never read past end */
+typedef struct der_cursor
+{
+	unsigned char *pos;	/* next byte to decode */
+	unsigned char *end;	/* first byte after the data */
+} der_cursor;
 
 typedef struct der_tag
 {
@@ -37,28 +80,137 @@ typedef struct OctetString
 	unsigned char *data;
 } OctetString;
 
-int der_decode_Tag(FILE *, der_tag *);
-int der_peek_Tag(FILE *, der_tag *);
+int der_error(char *, ...);
+
+void der_cursor_init(der_cursor *, unsigned char *, unsigned int);
+
+/*
+ * the generated decoders call these for every item, so they are inline
+ * DER does not allow indefinite lengths
+ * returns the number of bytes in the tag and length fields, or -1 on error
+ */
+
+static inline int
+der_decode_Tag(der_cursor *der, der_tag *tag)
+{
+	unsigned char *start = der->pos;
+	unsigned char type;
+	unsigned int len;
+	unsigned char byte;
+	unsigned int longtype;
+	int nlens;
+
+	/* type */
+	if(der->pos >= der->end)
+	{
+		der_error("DER tag");
+		return -1;
+	}
+	type = *(der->pos ++);
+	if((type & 0x1f) == 0x1f)
+	{
+		/* multi byte type */
+		longtype = 0;
+		do
+		{
+			if(der->pos >= der->end)
+			{
+				der_error("DER tag");
+				return -1;
+			}
+			byte = *(der->pos ++);
+			longtype <<= 7;
+			longtype += byte & 0x7f;
+		}
+		while((byte & 0x80) != 0);
+		tag->number = longtype;
+	}
+	else
+	{
+		tag->number = type & 0x1f;
+	}
+	tag->class = type & 0xc0;
+
+	/* length */
+	if(der->pos >= der->end)
+	{
+		der_error("DER tag");
+		return -1;
+	}
+	len = *(der->pos ++);
+	if(len == 0 && type == 0)
+	{
+		der_error("Found EOC; indefinite lengths not allowed in DER");
+		return -1;
+	}
+	else if(len == 0x80)
+	{
+		der_error("Indefinite lengths not allowed in DER");
+		return -1;
+	}
+	else if((len & 0x80) == 0x80)
+	{
+		/* multibyte length field */
+		nlens = len & 0x7f;
+		if(der->end - der->pos < nlens)
+		{
+			der_error("DER tag");
+			return -1;
+		}
+		len = 0;
+		while(nlens > 0)
+		{
+			len <<= 8;
+			len += *(der->pos ++);
+			nlens --;
+		}
+	}
+	tag->length = len;
+
+	return der->pos - start;
+}
+
+/*
+ * read the tag, but don't move the cursor
+ */
+
+static inline int
+der_peek_Tag(der_cursor *der, der_tag *tag)
+{
+	unsigned char *pretag = der->pos;
+	int length;
+
+	length = der_decode_Tag(der, tag);
 
-int der_decode_Boolean(FILE *, bool *, int);
+	der->pos = pretag;
 
-int der_decode_Integer(FILE *, int *, int);
+	return length;
+}
 
-int der_decode_Null(FILE *, Null *, int);
+int der_decode_Boolean(der_cursor *, bool *, int);
 
-int der_decode_OctetString(FILE *, OctetString *, int);
+int der_decode_Integer(der_cursor *, int *, int);
+
+int der_decode_Null(der_cursor *, Null *, int);
+
+int der_decode_OctetString(der_cursor *, OctetString *, int);
 void free_OctetString(OctetString *);
+void dup_OctetString(OctetString *, OctetString *);
+
+/* for decoding from a FILE, eg: der_decode_file(file, (der_decode_fn) der_decode_InterchangedObject, &obj, length) */
+typedef int (*der_decode_fn)(der_cursor *, void *, int);
+
+int der_decode_file(FILE *, der_decode_fn, void *, int);
 
 int OctetString_cmp(OctetString *, OctetString *);
+uint32_t OctetString_hash(OctetString *);
 int OctetString_strcmp(OctetString *, char *);
 int OctetString_strncmp(OctetString *, char *, size_t);
 
 bool OctetString_copy(OctetString *, OctetString *);
 void OctetString_dup(OctetString *, OctetString *);
 
-int der_read_file(FILE *, unsigned int, void *);
-
-int der_error(char *, ...);
+int der_read(der_cursor *, unsigned int, void *);
 
 void hexdump(unsigned char *, size_t);
 
@@ -0,0 +1,210 @@
+/*
+ * derbench.c
+ *
+ * DER decode a set of MHEG object files (eg the .mhg files from a carousel) as fast as we can
+ * reports how many MB/s the generated decoders manage and how many allocations they make
+ * -a decodes into an arena, like rb-browser does
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <malloc.h>
+
+#include "dertest-mheg.h"
+#include "utils.h"
+
+/* mallinfo2() was added in glibc 2.33 */
+#if defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 33)
+#define HAVE_MALLINFO2
+#endif
+#endif
+
+void usage(char *);
+double now(void);
+unsigned int count_items(InterchangedObject *);
+
+int
+main(int argc, char *argv[])
+{
+	char *prog = argv[0];
+	int arg;
+	unsigned int repeat = 1;
+	bool use_arena = false;
+	der_arena arena;
+	unsigned int nfiles;
+	OctetString *files;
+	FILE *in;
+	long len;
+	der_cursor der;
+	InterchangedObject obj;
+	unsigned int i, f;
+	int rc;
+	unsigned int nfailed = 0;
+	unsigned long nobjs = 0;
+	unsigned long nallocs = 0;
+	unsigned long ndecoded = 0;
+	double total = 0.0;
+	double start, secs;
+#ifdef HAVE_MALLINFO2
+	struct mallinfo2 heap;
+#else
+	/* the fields are ints, so they will be wrong if we use more than 2GB */
+	struct mallinfo heap;
+#endif
+
+	while((arg = getopt(argc, argv, "an:")) != EOF)
+	{
+		switch(arg)
+		{
+		case 'a':
+			use_arena = true;
+			break;
+
+		case 'n':
+			repeat = strtoul(optarg, NULL, 0);
+			break;
+
+		default:
+			usage(prog);
+			break;
+		}
+	}
+
+	if(optind == argc)
+		usage(prog);
+
+	/* load them all into memory first, so we only time the decoding */
+	nfiles = argc - optind;
+	files = safe_malloc(nfiles * sizeof(OctetString));
+	for(f=0; f<nfiles; f++)
+	{
+		if((in = fopen(argv[optind + f], "r")) == NULL)
+		{
+			fprintf(stderr, "Unable to open '%s': %s\n", argv[optind + f], strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		fseek(in, 0, SEEK_END);
+		len = ftell(in);
+		rewind(in);
+		files[f].size = len;
+		files[f].data = safe_malloc(MAX(len, 1));
+		if(fread(files[f].data, 1, len, in) != len)
+		{
+			fprintf(stderr, "Unable to read '%s'\n", argv[optind + f]);
+			exit(EXIT_FAILURE);
+		}
+		fclose(in);
+	}
+
+	start = now();
+
+	for(i=0; i<repeat; i++)
+	{
+		for(f=0; f<nfiles; f++)
+		{
+			der_nallocs = 0;
+			if(use_arena)
+			{
+				der_arena_init(&arena, files[f].size * 4);
+				der_arena_begin(&arena);
+			}
+			der_cursor_init(&der, files[f].data, files[f].size);
+			rc = der_decode_InterchangedObject(&der, &obj, files[f].size);
+			if(use_arena)
+				der_arena_end(&arena);
+			if(rc < 0)
+			{
+				/* only complain once */
+				if(i == 0)
+				{
+					fprintf(stderr, "Unable to decode '%s'\n", argv[optind + f]);
+					nfailed ++;
+				}
+			}
+			else
+			{
+				nallocs += der_nallocs;
+				nobjs += count_items(&obj);
+				ndecoded ++;
+			}
+			free_InterchangedObject(&obj);
+			if(use_arena)
+				der_arena_release(&arena);
+			total += files[f].size;
+		}
+	}
+
+	secs = now() - start;
+	if(secs <= 0.0)
+		secs = 1e-6;
+
+	printf("%u files (%u failed), decoded %u times\n", nfiles, nfailed, repeat);
+	printf("%.2f MB in %.3f secs = %.2f MB/s\n", total / (1024 * 1024), secs, (total / (1024 * 1024)) / secs);
+	if(ndecoded > 0)
+		printf("%.1f allocations per file, %.1f objects per file, %.1f allocations per object\n",
+			(double) nallocs / ndecoded, (double) nobjs / ndecoded, (nobjs > 0) ? (double) nallocs / nobjs : 0.0);
+
+	/* how fragmented decoding and freeing has left the heap */
+#ifdef HAVE_MALLINFO2
+	heap = mallinfo2();
+#else
+	heap = mallinfo();
+#endif
+	printf("heap: %lu KB in use, %lu KB free in %lu fragments\n",
+		(unsigned long) (heap.uordblks / 1024), (unsigned long) (heap.fordblks / 1024), (unsigned long) heap.ordblks);
+
+	for(f=0; f<nfiles; f++)
+		safe_free(files[f].data);
+	safe_free(files);
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * number of objects in the application or scene (including the application or scene itself)
+ */
+
+unsigned int
+count_items(InterchangedObject *obj)
+{
+	LIST_OF(GroupItem) *items;
+	unsigned int n = 1;
+
+	if(obj->choice == InterchangedObject_application)
+		items = obj->u.application.items;
+	else if(obj->choice == InterchangedObject_scene)
+		items = obj->u.scene.items;
+	else
+		items = NULL;
+
+	while(items)
+	{
+		n ++;
+		items = items->next;
+	}
+
+	return n;
+}
+
+double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+void
+usage(char *prog)
+{
+	fprintf(stderr, "Syntax: %s [-a] [-n <repeat>] <DER-file> ...\n", prog);
+
+	exit(EXIT_FAILURE);
+}
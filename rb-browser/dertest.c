@@ -29,7 +29,7 @@ main(int argc, char *argv[])
 	fseek(derfile, 0, SEEK_END);
 	len = ftell(derfile);
 	rewind(derfile);
-	if(der_decode_InterchangedObject(derfile, &obj, len) < 0)
+	if(der_decode_file(derfile, (der_decode_fn) der_decode_InterchangedObject, &obj, len) < 0)
 		printf("failed\n");
 
 	free_InterchangedObject(&obj);
@@ -0,0 +1,784 @@
+/*
+ * display_soft.c
+ *
+ * display backend that draws into ARGB framebuffers in memory
+ * does not need an X server, so it can be used for automated tests and for timing how long it takes to render a scene
+ * all pixels are premultiplied (A << 24) | (R << 16) | (G << 8) | B, the same as XRender's PictStandardARGB32
+ * there is no GUI, so there are no key presses; MHEGTimer runs the timers on its timerfd, so we don't need Xt either
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <png.h>
+#include <X11/Intrinsic.h>
+#include <fontconfig/fontconfig.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "MHEGEngine.h"
+#include "MHEGDisplay.h"
+#include "display_soft.h"
+#include "pixconv.h"
+#include "utils.h"
+
+static void soft_init(MHEGDisplay *);
+static void soft_fini(MHEGDisplay *);
+static bool soft_processEvents(MHEGDisplay *, bool);
+static void soft_refresh(MHEGDisplay *, int, int, unsigned int, unsigned int);
+static void soft_setClipRectangle(MHEGDisplay *, int, int, unsigned int, unsigned int);
+static void soft_unsetClipRectangle(MHEGDisplay *);
+static void soft_fillRectangle(MHEGDisplay *, int, int, unsigned int, unsigned int, MHEGColour *, bool);
+static void soft_drawBitmap(MHEGDisplay *, MHEGBitmap *, int, int, unsigned int, unsigned int, int, int);
+static void soft_drawCanvas(MHEGDisplay *, MHEGCanvas *, int, int, unsigned int, unsigned int, int, int);
+static void soft_drawGlyphs(MHEGDisplay *, MHEGFont *, MHEGColour *, XftGlyphSpec *, unsigned int);
+static void soft_useOverlay(MHEGDisplay *, int, int, unsigned int, unsigned int);
+static void soft_newBitmap(MHEGDisplay *, MHEGPixels *, MHEGBitmap *);
+static void soft_freeBitmap(MHEGDisplay *, MHEGBitmap *);
+static void soft_openFont(MHEGDisplay *, MHEGFont *, double, double);
+static void soft_closeFont(MHEGDisplay *, MHEGFont *);
+static FT_Face soft_lockFace(MHEGDisplay *, MHEGFont *);
+static void soft_unlockFace(MHEGDisplay *, MHEGFont *);
+static bool soft_fontExists(MHEGDisplay *, char *);
+static bool soft_savePNG(MHEGDisplay *, char *);
+
+static void composite(soft_ctx *, uint32_t *, unsigned int, unsigned int, int, int, int, int, int, int);
+static bool clip_rect(soft_ctx *, int *, int *, int *, int *);
+static uint32_t soft_pixel(MHEGColour *);
+
+static soft_glyph *get_glyph(soft_face *, FT_UInt);
+static void free_face(soft_face *);
+static FcPattern *match_font(char *);
+
+static int64_t now_usecs(void);
+static void end_op(soft_ctx *, int64_t, uint64_t);
+
+MHEGDisplayMethod display_soft_fns =
+{
+	soft_init,
+	soft_fini,
+	soft_processEvents,
+	soft_refresh,
+	soft_setClipRectangle,
+	soft_unsetClipRectangle,
+	soft_fillRectangle,
+	soft_drawBitmap,
+	soft_drawCanvas,
+	soft_drawGlyphs,
+	soft_useOverlay,
+	soft_newBitmap,
+	soft_freeBitmap,
+	soft_openFont,
+	soft_closeFont,
+	soft_lockFace,
+	soft_unlockFace,
+	soft_fontExists,
+	soft_savePNG
+};
+
+/* pretend we have an XRender Picture format, so MHEGDisplay_convertRGBA() and MHEGCanvas know our pixel layout */
+static XRenderPictFormat soft_format =
+{
+	0,				/* id */
+	PictTypeDirect,			/* type */
+	32,				/* depth */
+	{ 16, 0xff, 8, 0xff, 0, 0xff, 24, 0xff },	/* red, green, blue, alpha shift and mask */
+	None				/* colormap */
+};
+
+static void
+soft_init(MHEGDisplay *d)
+{
+	soft_ctx *s = safe_mallocz(sizeof(soft_ctx));
+	unsigned int npixs;
+	unsigned int i;
+
+	d->ctx = s;
+
+	/* no X server */
+	d->dpy = NULL;
+
+	/* there is no screen, so fullscreen does not mean anything */
+	if(d->fullscreen)
+		verbose("Display method does not support fullscreen mode");
+
+	d->xres = MHEG_XRES;
+	d->yres = MHEG_YRES;
+
+	d->argb_format = &soft_format;
+
+	s->width = d->xres;
+	s->height = d->yres;
+
+	/* the screen starts off black, the overlays start off transparent */
+	npixs = s->width * s->height;
+	s->contents = safe_malloc(npixs * sizeof(uint32_t));
+	for(i=0; i<npixs; i++)
+		s->contents[i] = 0xff000000;
+	s->next_overlay = safe_mallocz(npixs * sizeof(uint32_t));
+	s->used_overlay = safe_mallocz(npixs * sizeof(uint32_t));
+
+	soft_unsetClipRectangle(d);
+
+	/* we open the fonts ourselves, rather than Xft doing it for us */
+	if(!FcInit())
+		fatal("Unable to initialise fontconfig");
+	if(FT_Init_FreeType(&s->ft) != 0)
+		fatal("Unable to initialise FreeType");
+	s->faces = NULL;
+
+	/* MHEGTimer does the timers, so we don't need Xt */
+	d->app = NULL;
+
+	return;
+}
+
+static void
+soft_fini(MHEGDisplay *d)
+{
+	soft_ctx *s = (soft_ctx *) d->ctx;
+	soft_stats *st = &s->stats;
+	soft_face *face;
+
+	verbose("Software display: %u frames, %u drawing operations, %.1f Mpixels; average %.3f ms per frame, max %.3f ms",
+		st->nframes, st->nops, st->npixels / 1000000.0,
+		(st->nframes > 0) ? (st->total_usecs / 1000.0) / st->nframes : 0.0, st->max_usecs / 1000.0);
+
+	while(s->faces != NULL)
+	{
+		face = s->faces;
+		s->faces = face->next;
+		free_face(face);
+	}
+	FT_Done_FreeType(s->ft);
+
+	safe_free(s->contents);
+	safe_free(s->next_overlay);
+	safe_free(s->used_overlay);
+
+	safe_free(s);
+	d->ctx = NULL;
+
+	return;
+}
+
+/*
+ * there is no GUI, so the only events are the timers and missing content arriving
+ * if block is true, this waits until one of those happens
+ * (if there are none, nothing else can happen, so it waits forever)
+ */
+
+static bool
+soft_processEvents(MHEGDisplay *d, bool block)
+{
+	/* no input, so all we can wait for is the engine */
+	if(block)
+		MHEGEngine_wait(-1, true);
+
+	return false;
+}
+
+static void
+soft_refresh(MHEGDisplay *d, int x, int y, unsigned int w, unsigned int h)
+{
+	soft_ctx *s = (soft_ctx *) d->ctx;
+	int64_t start = now_usecs();
+	int cx0, cy0, cx1, cy1;
+	int cw, ch;
+	int row;
+
+	/* the overlay clip rectangle does not apply here */
+	cx0 = MAX(x, 0);
+	cy0 = MAX(y, 0);
+	cx1 = MIN(x + (int) w, (int) s->width);
+	cy1 = MIN(y + (int) h, (int) s->height);
+	cw = cx1 - cx0;
+	ch = cy1 - cy0;
+
+	/* put the MHEG objects on top of whatever is already there */
+	for(row=cy0; cw > 0 && row<cy1; row++)
+		pixconv_over(&s->contents[(row * s->width) + cx0], &s->used_overlay[(row * s->width) + cx0], cw);
+
+	end_op(s, start, (cw > 0 && ch > 0) ? cw * ch : 0);
+
+	/* this frame is finished */
+	s->stats.nframes ++;
+	s->stats.max_usecs = MAX(s->stats.max_usecs, s->stats.frame_usecs);
+	s->stats.frame_usecs = 0;
+
+	return;
+}
+
+static void
+soft_setClipRectangle(MHEGDisplay *d, int x, int y, unsigned int w, unsigned int h)
+{
+	soft_ctx *s = (soft_ctx *) d->ctx;
+
+	s->clip_x0 = MAX(x, 0);
+	s->clip_y0 = MAX(y, 0);
+	s->clip_x1 = MIN(x + (int) w, (int) s->width);
+	s->clip_y1 = MIN(y + (int) h, (int) s->height);
+
+	return;
+}
+
+static void
+soft_unsetClipRectangle(MHEGDisplay *d)
+{
+	soft_ctx *s = (soft_ctx *) d->ctx;
+
+	s->clip_x0 = 0;
+	s->clip_y0 = 0;
+	s->clip_x1 = s->width;
+	s->clip_y1 = s->height;
+
+	return;
+}
+
+static void
+soft_fillRectangle(MHEGDisplay *d, int x, int y, unsigned int w, unsigned int h, MHEGColour *col, bool replace)
+{
+	soft_ctx *s = (soft_ctx *) d->ctx;
+	int64_t start = now_usecs();
+	uint32_t pix = soft_pixel(col);
+	int cw = w;
+	int ch = h;
+	uint32_t *dst;
+	int row, i;
+
+	if(!clip_rect(s, &x, &y, &cw, &ch))
+		return;
+
+	for(row=0; row<ch; row++)
+	{
+		dst = &s->next_overlay[((y + row) * s->width) + x];
+		if(replace)
+		{
+			for(i=0; i<cw; i++)
+				dst[i] = pix;
+		}
+		else
+		{
+			pixconv_over_solid(dst, pix, cw);
+		}
+	}
+
+	end_op(s, start, cw * ch);
+
+	return;
+}
+
+static void
+soft_drawBitmap(MHEGDisplay *d, MHEGBitmap *bitmap, int src_x, int src_y, unsigned int w, unsigned int h, int dst_x, int dst_y)
+{
+	soft_ctx *s = (soft_ctx *) d->ctx;
+
+	composite(s, bitmap->data, bitmap->width, bitmap->height, src_x, src_y, w, h, dst_x, dst_y);
+
+	return;
+}
+
+static void
+soft_drawCanvas(MHEGDisplay *d, MHEGCanvas *canvas, int src_x, int src_y, unsigned int w, unsigned int h, int dst_x, int dst_y)
+{
+	soft_ctx *s = (soft_ctx *) d->ctx;
+
+	composite(s, canvas->pixels, canvas->width, canvas->height, src_x, src_y, w, h, dst_x, dst_y);
+
+	return;
+}
+
+static void
+soft_drawGlyphs(MHEGDisplay *d, MHEGFont *font, MHEGColour *col, XftGlyphSpec *specs, unsigned int nglyphs)
+{
+	soft_ctx *s = (soft_ctx *) d->ctx;
+	soft_face *face = (soft_face *) font->font;
+	int64_t start = now_usecs();
+	uint64_t npixels = 0;
+	uint32_t pix = soft_pixel(col);
+	soft_glyph *glyph;
+	unsigned int i;
+	int glyph_x, glyph_y;
+	int x, y, w, h;
+	uint8_t *mask;
+	int row;
+
+	for(i=0; i<nglyphs; i++)
+	{
+		if((glyph = get_glyph(face, specs[i].glyph)) == NULL
+		|| glyph->coverage == NULL)
+			continue;
+		/* top left of the glyph bitmap */
+		glyph_x = specs[i].x + glyph->left;
+		glyph_y = specs[i].y - glyph->top;
+		x = glyph_x;
+		y = glyph_y;
+		w = glyph->width;
+		h = glyph->height;
+		if(!clip_rect(s, &x, &y, &w, &h))
+			continue;
+		/* first visible coverage value */
+		mask = &glyph->coverage[((y - glyph_y) * glyph->width) + (x - glyph_x)];
+		for(row=0; row<h; row++)
+			pixconv_over_mask(&s->next_overlay[((y + row) * s->width) + x], pix, &mask[row * glyph->width], w);
+		npixels += w * h;
+	}
+
+	end_op(s, start, npixels);
+
+	return;
+}
+
+static void
+soft_useOverlay(MHEGDisplay *d, int x, int y, unsigned int w, unsigned int h)
+{
+	soft_ctx *s = (soft_ctx *) d->ctx;
+	int64_t start = now_usecs();
+	unsigned int offset;
+	unsigned int row;
+
+	/* MHEGDisplay_useOverlay() has already clipped it to the screen */
+	if(x == 0 && w == s->width)
+	{
+		/* whole rows are contiguous */
+		offset = y * s->width;
+		memcpy(&s->used_overlay[offset], &s->next_overlay[offset], w * h * sizeof(uint32_t));
+	}
+	else
+	{
+		for(row=0; row<h; row++)
+		{
+			offset = ((y + row) * s->width) + x;
+			memcpy(&s->used_overlay[offset], &s->next_overlay[offset], w * sizeof(uint32_t));
+		}
+	}
+
+	end_op(s, start, w * h);
+
+	return;
+}
+
+/*
+ * we draw straight from the pixels, so just take them over
+ */
+
+static void
+soft_newBitmap(MHEGDisplay *d, MHEGPixels *pixels, MHEGBitmap *bitmap)
+{
+	bitmap->data = (uint32_t *) pixels->data;
+	bitmap->width = pixels->width;
+	bitmap->height = pixels->height;
+
+	pixels->data = NULL;
+
+	return;
+}
+
+static void
+soft_freeBitmap(MHEGDisplay *d, MHEGBitmap *bitmap)
+{
+	safe_free(bitmap->data);
+	bitmap->data = NULL;
+
+	return;
+}
+
+/*
+ * faces are kept open until soft_fini, so we don't keep reloading them every time an object changes its font
+ */
+
+static void
+soft_openFont(MHEGDisplay *d, MHEGFont *f, double pixel_size, double aspect)
+{
+	soft_ctx *s = (soft_ctx *) d->ctx;
+	soft_face *face;
+	FcPattern *match;
+	FcChar8 *file;
+	int index;
+
+	for(face=s->faces; face; face=face->next)
+	{
+		if(strcmp(face->name, f->name) == 0
+		&& face->pixel_size == pixel_size
+		&& face->aspect == aspect)
+		{
+			f->font = face;
+			return;
+		}
+	}
+
+	if((match = match_font(f->name)) == NULL)
+		return;
+
+	if(FcPatternGetString(match, FC_FILE, 0, &file) != FcResultMatch)
+	{
+		FcPatternDestroy(match);
+		return;
+	}
+	if(FcPatternGetInteger(match, FC_INDEX, 0, &index) != FcResultMatch)
+		index = 0;
+
+	face = safe_mallocz(sizeof(soft_face));
+	if(FT_New_Face(s->ft, (char *) file, index, &face->face) != 0)
+	{
+		error("Unable to load font file '%s'", file);
+		FcPatternDestroy(match);
+		safe_free(face);
+		return;
+	}
+	FcPatternDestroy(match);
+
+	/* the same scaling Xft does for FC_PIXEL_SIZE and FC_ASPECT, 26.6 fixed point at 72 dpi => 1 point = 1 pixel */
+	FT_Set_Char_Size(face->face, (FT_F26Dot6) (pixel_size * aspect * 64.0), (FT_F26Dot6) (pixel_size * 64.0), 72, 72);
+
+	face->name = safe_strdup(f->name);
+	face->pixel_size = pixel_size;
+	face->aspect = aspect;
+	face->glyphs = safe_mallocz(face->face->num_glyphs * sizeof(soft_glyph *));
+
+	face->next = s->faces;
+	s->faces = face;
+
+	f->font = face;
+
+	return;
+}
+
+static void
+soft_closeFont(MHEGDisplay *d, MHEGFont *f)
+{
+	/* the face stays open for the next font that wants it */
+	return;
+}
+
+/*
+ * we only draw from the engine thread, so no need to lock anything
+ */
+
+static FT_Face
+soft_lockFace(MHEGDisplay *d, MHEGFont *f)
+{
+	return ((soft_face *) f->font)->face;
+}
+
+static void
+soft_unlockFace(MHEGDisplay *d, MHEGFont *f)
+{
+	return;
+}
+
+/*
+ * fontconfig will always give us something, make sure it is the family we asked for
+ */
+
+static bool
+soft_fontExists(MHEGDisplay *d, char *family)
+{
+	FcPattern *match;
+	FcChar8 *name;
+	bool found;
+
+	if((match = match_font(family)) == NULL)
+		return false;
+
+	found = (FcPatternGetString(match, FC_FAMILY, 0, &name) == FcResultMatch)
+	     && (strcasecmp((char *) name, family) == 0);
+
+	FcPatternDestroy(match);
+
+	return found;
+}
+
+/*
+ * write the contents as an 8-bit RGB PNG file
+ */
+
+static bool
+soft_savePNG(MHEGDisplay *d, char *filename)
+{
+	soft_ctx *s = (soft_ctx *) d->ctx;
+	FILE *file;
+	png_structp png;
+	png_infop info;
+	png_bytep row;
+	uint32_t *pix;
+	unsigned int x, y;
+
+	if((file = fopen(filename, "w")) == NULL)
+	{
+		error("Unable to create '%s': %s", filename, strerror(errno));
+		return false;
+	}
+
+	if((png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL)) == NULL
+	|| (info = png_create_info_struct(png)) == NULL)
+		fatal("Out of memory");
+
+	row = safe_malloc(s->width * 3);
+
+	/* libpng longjmps back here if there is an error */
+	if(setjmp(png_jmpbuf(png)))
+	{
+		error("Unable to write PNG file '%s'", filename);
+		png_destroy_write_struct(&png, &info);
+		safe_free(row);
+		fclose(file);
+		return false;
+	}
+
+	png_init_io(png, file);
+	png_set_IHDR(png, info, s->width, s->height, 8, PNG_COLOR_TYPE_RGB,
+		     PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png, info);
+
+	/* the contents are opaque, so we can ignore the alpha */
+	for(y=0; y<s->height; y++)
+	{
+		pix = &s->contents[y * s->width];
+		for(x=0; x<s->width; x++)
+		{
+			row[(x * 3) + 0] = (pix[x] >> 16) & 0xff;
+			row[(x * 3) + 1] = (pix[x] >> 8) & 0xff;
+			row[(x * 3) + 2] = pix[x] & 0xff;
+		}
+		png_write_row(png, row);
+	}
+
+	png_write_end(png, NULL);
+	png_destroy_write_struct(&png, &info);
+
+	safe_free(row);
+
+	if(fclose(file) != 0)
+	{
+		error("Unable to write '%s': %s", filename, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * blend the given part of an image onto the overlay
+ * like XRenderComposite, anything outside the src image is transparent
+ */
+
+static void
+composite(soft_ctx *s, uint32_t *img, unsigned int img_width, unsigned int img_height,
+	  int src_x, int src_y, int w, int h, int dst_x, int dst_y)
+{
+	int64_t start = now_usecs();
+	int x, y;
+	int row;
+
+	/* only the part of the src that exists */
+	if(src_x < 0)
+	{
+		dst_x -= src_x;
+		w += src_x;
+		src_x = 0;
+	}
+	if(src_y < 0)
+	{
+		dst_y -= src_y;
+		h += src_y;
+		src_y = 0;
+	}
+	w = MIN(w, (int) img_width - src_x);
+	h = MIN(h, (int) img_height - src_y);
+
+	/* and the part of the dst that is not clipped */
+	x = dst_x;
+	y = dst_y;
+	if(img == NULL || !clip_rect(s, &x, &y, &w, &h))
+		return;
+	src_x += x - dst_x;
+	src_y += y - dst_y;
+
+	for(row=0; row<h; row++)
+		pixconv_over(&s->next_overlay[((y + row) * s->width) + x], &img[((src_y + row) * img_width) + src_x], w);
+
+	end_op(s, start, w * h);
+
+	return;
+}
+
+/*
+ * clip the rectangle to the overlay clip rectangle
+ * updates x, y, w, h
+ * returns false if there is nothing left
+ */
+
+static bool
+clip_rect(soft_ctx *s, int *x, int *y, int *w, int *h)
+{
+	int x1 = MIN(*x + *w, s->clip_x1);
+	int y1 = MIN(*y + *h, s->clip_y1);
+
+	*x = MAX(*x, s->clip_x0);
+	*y = MAX(*y, s->clip_y0);
+	*w = x1 - *x;
+	*h = y1 - *y;
+
+	return (*w > 0 && *h > 0);
+}
+
+/*
+ * convert MHEGColour to a premultiplied pixel
+ */
+
+static uint32_t
+soft_pixel(MHEGColour *col)
+{
+	/* MHEGColour uses transparency, we use opacity */
+	unsigned int a = 255 - col->t;
+	unsigned int r = ((col->r * a) + 127) / 255;
+	unsigned int g = ((col->g * a) + 127) / 255;
+	unsigned int b = ((col->b * a) + 127) / 255;
+
+	return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+/*
+ * render the glyph the first time it is used
+ * returns NULL if the face does not have it
+ */
+
+static soft_glyph *
+get_glyph(soft_face *f, FT_UInt index)
+{
+	soft_glyph *g;
+	FT_Bitmap *bm;
+	unsigned int x, y;
+	unsigned char *src;
+
+	if(index >= (FT_UInt) f->face->num_glyphs)
+		return NULL;
+
+	if(f->glyphs[index] != NULL)
+		return f->glyphs[index];
+
+	g = safe_mallocz(sizeof(soft_glyph));
+	f->glyphs[index] = g;
+
+	/* anti-aliased, hinted, like Xft does by default */
+	if(FT_Load_Glyph(f->face, index, FT_LOAD_RENDER | FT_LOAD_TARGET_NORMAL) != 0)
+		return g;
+
+	bm = &f->face->glyph->bitmap;
+	g->left = f->face->glyph->bitmap_left;
+	g->top = f->face->glyph->bitmap_top;
+	g->width = bm->width;
+	g->height = bm->rows;
+
+	if(g->width == 0 || g->height == 0)
+		return g;
+
+	g->coverage = safe_malloc(g->width * g->height);
+	for(y=0; y<g->height; y++)
+	{
+		src = bm->buffer + (y * bm->pitch);
+		if(bm->pixel_mode == FT_PIXEL_MODE_MONO)
+		{
+			for(x=0; x<g->width; x++)
+				g->coverage[(y * g->width) + x] = (src[x >> 3] & (0x80 >> (x & 7))) ? 0xff : 0;
+		}
+		else
+		{
+			memcpy(&g->coverage[y * g->width], src, g->width);
+		}
+	}
+
+	return g;
+}
+
+static void
+free_face(soft_face *f)
+{
+	long i;
+
+	for(i=0; i<f->face->num_glyphs; i++)
+	{
+		if(f->glyphs[i] != NULL)
+		{
+			safe_free(f->glyphs[i]->coverage);
+			safe_free(f->glyphs[i]);
+		}
+	}
+	safe_free(f->glyphs);
+
+	FT_Done_Face(f->face);
+
+	safe_free(f->name);
+	safe_free(f);
+
+	return;
+}
+
+/*
+ * returns the scalable font fontconfig thinks is the best match for the given family, or NULL
+ * the caller should FcPatternDestroy() it
+ */
+
+static FcPattern *
+match_font(char *family)
+{
+	FcPattern *pattern;
+	FcPattern *match;
+	FcResult result;
+
+	if((pattern = FcPatternBuild(NULL,
+				     FC_FAMILY, FcTypeString, family,
+				     FC_SCALABLE, FcTypeBool, FcTrue,
+				     (char *) NULL)) == NULL)
+		return NULL;
+
+	FcConfigSubstitute(NULL, pattern, FcMatchPattern);
+	FcDefaultSubstitute(pattern);
+
+	match = FcFontMatch(NULL, pattern, &result);
+
+	FcPatternDestroy(pattern);
+
+	return match;
+}
+
+void
+display_soft_getStats(MHEGDisplay *d, soft_stats *stats)
+{
+	soft_ctx *s = (soft_ctx *) d->ctx;
+
+	memcpy(stats, &s->stats, sizeof(soft_stats));
+
+	return;
+}
+
+static int64_t
+now_usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000000LL) + (ts.tv_nsec / 1000);
+}
+
+/*
+ * add a drawing operation that started at the given time to the stats
+ */
+
+static void
+end_op(soft_ctx *s, int64_t start, uint64_t npixels)
+{
+	int64_t usecs = now_usecs() - start;
+
+	s->stats.nops ++;
+	s->stats.npixels += npixels;
+	s->stats.frame_usecs += usecs;
+	s->stats.total_usecs += usecs;
+
+	return;
+}
@@ -0,0 +1,62 @@
+/*
+ * display_soft.h
+ */
+
+#ifndef __DISPLAY_SOFT_H__
+#define __DISPLAY_SOFT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+/* a glyph rendered by FreeType */
+typedef struct
+{
+	int left;			/* offset from the pen position to the top left of the bitmap */
+	int top;			/* (up is positive) */
+	unsigned int width;
+	unsigned int height;
+	uint8_t *coverage;		/* width x height alpha values, NULL if the glyph has no pixels */
+} soft_glyph;
+
+/* a face opened at a given size, shared by all the MHEGFont's using it */
+typedef struct soft_face
+{
+	struct soft_face *next;
+	char *name;			/* font family */
+	double pixel_size;
+	double aspect;
+	FT_Face face;
+	soft_glyph **glyphs;		/* indexed by glyph number, NULL until we have rendered it */
+} soft_face;
+
+typedef struct
+{
+	unsigned int nframes;		/* number of refreshes */
+	unsigned int nops;		/* number of drawing operations */
+	uint64_t npixels;		/* pixels written by the drawing operations */
+	int64_t frame_usecs;		/* time spent drawing since the last refresh */
+	int64_t total_usecs;		/* time spent drawing altogether */
+	int64_t max_usecs;		/* longest frame */
+} soft_stats;
+
+typedef struct
+{
+	unsigned int width;		/* same as xres/yres */
+	unsigned int height;
+	uint32_t *contents;		/* the "screen" */
+	uint32_t *next_overlay;		/* same as the X11 backend Pixmaps */
+	uint32_t *used_overlay;
+	int clip_x0, clip_y0;		/* clip rectangle on next_overlay */
+	int clip_x1, clip_y1;		/* (exclusive) */
+	FT_Library ft;
+	soft_face *faces;		/* every face we have opened */
+	soft_stats stats;
+} soft_ctx;
+
+extern MHEGDisplayMethod display_soft_fns;
+
+void display_soft_getStats(MHEGDisplay *, soft_stats *);
+
+#endif	/* __DISPLAY_SOFT_H__ */
@@ -0,0 +1,586 @@
+/*
+ * display_x11.c
+ *
+ * display backend that draws on an X Window with XRender
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/Xrender.h>
+#include <X11/Xft/Xft.h>
+#include <X11/Intrinsic.h>
+#include <X11/Shell.h>
+
+#include "MHEGEngine.h"
+#include "MHEGDisplay.h"
+#include "display_x11.h"
+#include "utils.h"
+
+static void x11_init(MHEGDisplay *);
+static void x11_fini(MHEGDisplay *);
+static bool x11_processEvents(MHEGDisplay *, bool);
+static void x11_refresh(MHEGDisplay *, int, int, unsigned int, unsigned int);
+static void x11_setClipRectangle(MHEGDisplay *, int, int, unsigned int, unsigned int);
+static void x11_unsetClipRectangle(MHEGDisplay *);
+static void x11_fillRectangle(MHEGDisplay *, int, int, unsigned int, unsigned int, MHEGColour *, bool);
+static void x11_drawBitmap(MHEGDisplay *, MHEGBitmap *, int, int, unsigned int, unsigned int, int, int);
+static void x11_drawCanvas(MHEGDisplay *, MHEGCanvas *, int, int, unsigned int, unsigned int, int, int);
+static void x11_drawGlyphs(MHEGDisplay *, MHEGFont *, MHEGColour *, XftGlyphSpec *, unsigned int);
+static void x11_useOverlay(MHEGDisplay *, int, int, unsigned int, unsigned int);
+static void x11_newBitmap(MHEGDisplay *, MHEGPixels *, MHEGBitmap *);
+static void x11_freeBitmap(MHEGDisplay *, MHEGBitmap *);
+static void x11_openFont(MHEGDisplay *, MHEGFont *, double, double);
+static void x11_closeFont(MHEGDisplay *, MHEGFont *);
+static FT_Face x11_lockFace(MHEGDisplay *, MHEGFont *);
+static void x11_unlockFace(MHEGDisplay *, MHEGFont *);
+static bool x11_fontExists(MHEGDisplay *, char *);
+
+static void display_colour(XRenderColor *, MHEGColour *);
+
+MHEGDisplayMethod display_x11_fns =
+{
+	x11_init,
+	x11_fini,
+	x11_processEvents,
+	x11_refresh,
+	x11_setClipRectangle,
+	x11_unsetClipRectangle,
+	x11_fillRectangle,
+	x11_drawBitmap,
+	x11_drawCanvas,
+	x11_drawGlyphs,
+	x11_useOverlay,
+	x11_newBitmap,
+	x11_freeBitmap,
+	x11_openFont,
+	x11_closeFont,
+	x11_lockFace,
+	x11_unlockFace,
+	x11_fontExists,
+	NULL			/* savePNG */
+};
+
+/* from GDK MwmUtils.h */
+#define MWM_HINTS_DECORATIONS	(1L << 1)
+typedef struct
+{
+	unsigned long flags;
+	unsigned long functions;
+	unsigned long decorations;
+	long input_mode;
+	unsigned long status;
+} MotifWmHints;
+
+static void
+x11_init(MHEGDisplay *d)
+{
+	unsigned int xrender_major;
+	unsigned int xrender_minor;
+	int x, y;
+	XVisualInfo visinfo;
+	unsigned long mask;
+	XSetWindowAttributes attr;
+	Atom wm_delete_window;
+	XSizeHints hint;
+	unsigned long gcmask;
+	XGCValues gcvals;
+	XRenderPictFormat *pic_format;
+	XRenderPictureAttributes pa;
+	Pixmap textfg;
+	/* fake argc, argv for XtDisplayInitialize */
+	int argc = 0;
+	char *argv[1] = { NULL };
+
+	/* so X requests/replies in different threads don't get interleaved */
+	XInitThreads();
+
+	if((d->dpy = XOpenDisplay(NULL)) == NULL)
+		fatal("Unable to open display");
+
+	/* check the X server supports at least XRender 0.6 (needed for Bilinear filter) */
+	xrender_major = 0;
+	xrender_minor = 10;
+	if(!XRenderQueryVersion(d->dpy, &xrender_major, &xrender_minor)
+	|| xrender_minor < 6)
+		fatal("X Server does not support XRender 0.6 or above");
+
+	/* size of the Window */
+	if(d->fullscreen)
+	{
+		d->xres = WidthOfScreen(DefaultScreenOfDisplay(d->dpy));
+		d->yres = HeightOfScreen(DefaultScreenOfDisplay(d->dpy));
+	}
+	else
+	{
+		/* resolution defined in UK MHEG Profile */
+		d->xres = MHEG_XRES;
+		d->yres = MHEG_YRES;
+	}
+
+	/* create the window */
+	x = (WidthOfScreen(DefaultScreenOfDisplay(d->dpy)) - d->xres) / 2;
+	y = (HeightOfScreen(DefaultScreenOfDisplay(d->dpy)) - d->yres) / 2;
+
+	/* remember the colour depth and Visual used by the Window */
+	d->depth = DefaultDepth(d->dpy, DefaultScreen(d->dpy));
+	if(!XMatchVisualInfo(d->dpy, DefaultScreen(d->dpy), d->depth, TrueColor, &visinfo))
+		fatal("Unable to find a TrueColour Visual");
+	d->vis = visinfo.visual;
+
+	/*
+	 * if the default Visual is not TrueColor we need to create a Colormap for our Visual
+	 * this is probably only gonna happen for 8 bit displays
+	 * you *really* want a 16 or 24 bit colour display
+	 */
+	if(DefaultVisual(d->dpy, DefaultScreen(d->dpy))->class != TrueColor)
+	{
+		d->cmap = XCreateColormap(d->dpy, DefaultRootWindow(d->dpy), d->vis, AllocNone);
+		XInstallColormap(d->dpy, d->cmap);
+		mask = CWColormap;
+		attr.colormap = d->cmap;
+	}
+	else
+	{
+		d->cmap = None;
+		mask = 0;
+	}
+
+	/* don't need any special toolkits or widgets, just a canvas to draw on */
+	d->win = XCreateWindow(d->dpy,
+			       DefaultRootWindow(d->dpy),
+			       x, y, d->xres, d->yres, 0,
+			       d->depth, InputOutput, d->vis,
+			       mask, &attr);
+
+	/* in case the WM ignored where we want it placed */
+	hint.flags = USSize | USPosition | PPosition | PSize;
+	hint.x = x;
+	hint.y = y;
+	hint.width = d->xres;
+	hint.height = d->yres;
+	XSetWMNormalHints(d->dpy, d->win, &hint);
+
+	if(d->fullscreen)
+	{
+		GC gc;
+		Pixmap no_pixmap;
+		XColor no_colour;
+		Cursor no_cursor;
+		/* this is how GDK makes Windows fullscreen */
+		XEvent xev;
+		Atom motif_wm_hints;
+		MotifWmHints mwmhints;
+		xev.xclient.type = ClientMessage;
+		xev.xclient.serial = 0;
+		xev.xclient.send_event = True;
+		xev.xclient.window = d->win;
+		xev.xclient.message_type = XInternAtom(d->dpy, "_NET_WM_STATE", False);
+		xev.xclient.format = 32;
+		xev.xclient.data.l[0] = XInternAtom(d->dpy, "_NET_WM_STATE_ADD", False);
+		xev.xclient.data.l[1] = XInternAtom(d->dpy, "_NET_WM_STATE_FULLSCREEN", False);
+		xev.xclient.data.l[2] = 0;
+		xev.xclient.data.l[3] = 0;
+		xev.xclient.data.l[4] = 0;
+		XSendEvent(d->dpy, DefaultRootWindow(d->dpy), False, SubstructureRedirectMask | SubstructureNotifyMask, &xev);
+		/* get rid of the Window decorations */
+		motif_wm_hints = XInternAtom(d->dpy, "_MOTIF_WM_HINTS", False);
+		mwmhints.flags = MWM_HINTS_DECORATIONS;
+		mwmhints.decorations = 0;
+		XChangeProperty(d->dpy, d->win,
+				motif_wm_hints, motif_wm_hints, 32, PropModeReplace,
+				(unsigned char *) &mwmhints, sizeof(MotifWmHints) / sizeof(long));
+		/*
+		 * get rid of the cursor when the mouse is over our Window
+		 * make the cursor a 1x1 Pixmap with no pixels displayed by the mask
+		 */
+		no_pixmap = XCreatePixmap(d->dpy, d->win, 1, 1, 1);
+		gcmask = GCForeground;
+		gcvals.foreground = 0;
+		gc = XCreateGC(d->dpy, no_pixmap, gcmask, &gcvals);
+		XDrawPoint(d->dpy, no_pixmap, gc, 0, 0);
+		XFreeGC(d->dpy, gc);
+		no_cursor = XCreatePixmapCursor(d->dpy, no_pixmap, no_pixmap, &no_colour, &no_colour, 0, 0);
+		XFreePixmap(d->dpy, no_pixmap);
+		XDefineCursor(d->dpy, d->win, no_cursor);
+	}
+
+	/* want to get Expose and KeyPress events */
+	mask = CWEventMask;
+	attr.event_mask = ExposureMask | KeyPressMask;
+	XChangeWindowAttributes(d->dpy, d->win, mask, &attr);
+
+	/* get a ClientMessage event when the window's close button is clicked */
+	wm_delete_window = XInternAtom(d->dpy, "WM_DELETE_WINDOW", False);
+	XSetWMProtocols(d->dpy, d->win, &wm_delete_window, 1);
+
+	/*
+	 * create an XRender Picture for the Window contents
+	 * we composite the video frame and the MHEG overlay onto this, then copy it onto the Window
+	 */
+	pic_format = XRenderFindVisualFormat(d->dpy, d->vis);
+	d->contents = XCreatePixmap(d->dpy, d->win, d->xres, d->yres, d->depth);
+	d->contents_pic = XRenderCreatePicture(d->dpy, d->contents, pic_format, 0, NULL);
+
+	/* create a 32-bit XRender Picture to draw the MHEG objects on */
+	pic_format = XRenderFindStandardFormat(d->dpy, PictStandardARGB32);
+	d->argb_format = pic_format;
+	d->next_overlay = XCreatePixmap(d->dpy, d->win, d->xres, d->yres, 32);
+	d->next_overlay_pic = XRenderCreatePicture(d->dpy, d->next_overlay, pic_format, 0, NULL);
+	d->used_overlay = XCreatePixmap(d->dpy, d->win, d->xres, d->yres, 32);
+	d->used_overlay_pic = XRenderCreatePicture(d->dpy, d->used_overlay, pic_format, 0, NULL);
+
+	/* a 1x1 Picture to hold the text foreground colour */
+	textfg = XCreatePixmap(d->dpy, d->win, 1, 1, 32);
+	pa.repeat = True;
+	d->textfg_pic = XRenderCreatePicture(d->dpy, textfg, pic_format, CPRepeat, &pa);
+
+	/* a GC to draw on the Window */
+	d->win_gc = XCreateGC(d->dpy, d->win, 0, &gcvals);
+
+	/* a GC to XCopyArea next_overlay to used_overlay (need to avoid any XRender clip mask on next_overlay) */
+	d->overlay_gc = XCreateGC(d->dpy, d->next_overlay, 0, &gcvals);
+
+	/* get the window on the screen */
+	XMapWindow(d->dpy, d->win);
+
+	/* needs to be realised before we can set the title */
+	XStoreName(d->dpy, d->win, WINDOW_TITLE);
+
+	/* rather than having to implement our own timers we use Xt, so initialise it */
+	XtToolkitInitialize();
+	d->app = XtCreateApplicationContext();
+	XtDisplayInitialize(d->app, d->dpy, APP_NAME, APP_CLASS, NULL, 0, &argc, argv);
+
+	return;
+}
+
+static void
+x11_fini(MHEGDisplay *d)
+{
+	/* calls XCloseDisplay for us which free's all our Windows, Pixmaps, etc */
+	XtDestroyApplicationContext(d->app);
+
+	return;
+}
+
+/*
+ * process the next GUI event
+ * if block is false and no events are pending, return immediately
+ * if block is true and no events are pending, wait for the next event
+ * returns true if the GUI wants us to quit
+ */
+
+static bool
+x11_processEvents(MHEGDisplay *d, bool block)
+{
+	bool quit = false;
+	XEvent event;
+	XAnyEvent *any;
+	XKeyEvent *key;
+	KeySym sym;
+	MHEGKeyMapEntry *map;
+	XExposeEvent *exp;
+	XClientMessageEvent *cm;
+	static Atom wm_protocols = 0;
+	static Atom wm_delete_window = 0;
+
+	/*
+	 * if there are no X events waiting, wait until there is one, a timer is due, or missing content arrives
+	 * none of those go through Xt, so there is no X server round trip when they happen
+	 */
+	if(XtAppPending(d->app) == 0)
+	{
+		if(!block
+		|| !MHEGEngine_wait(ConnectionNumber(d->dpy), true)
+		|| XtAppPending(d->app) == 0)
+			return false;
+	}
+
+	XtAppNextEvent(d->app, &event);
+
+	/* is it our window */
+	any = &event.xany;
+	if(any->display != d->dpy || any->window != d->win)
+	{
+		/* pass it on to Xt */
+		XtDispatchEvent(&event);
+		return false;
+	}
+
+	switch(event.type)
+	{
+	case KeyPress:
+		key = &event.xkey;
+		sym = XKeycodeToKeysym(d->dpy, key->keycode, 0);
+		/* find the KeySym in the keyboard map */
+		map = d->keymap;
+		while(map->mheg_key != 0 && map->x_key != sym)
+			map ++;
+		if(map->mheg_key != 0)
+		{
+			verbose("KeyPress: %s (%u)", XKeysymToString(sym), map->mheg_key);
+			MHEGEngine_keyPressed(map->mheg_key);
+		}
+		break;
+
+	case Expose:
+		exp = &event.xexpose;
+		XCopyArea(d->dpy, d->contents, d->win, d->win_gc, exp->x, exp->y, exp->width, exp->height, exp->x, exp->y);
+		break;
+
+	case NoExpose:
+		/* ignore it */
+		break;
+
+	case ClientMessage:
+		cm = &event.xclient;
+		/* cache these Atoms */
+		if(wm_protocols == 0)
+		{
+			wm_protocols = XInternAtom(d->dpy, "WM_PROTOCOLS", False);
+			wm_delete_window = XInternAtom(d->dpy, "WM_DELETE_WINDOW", False);
+		}
+		if(cm->message_type == wm_protocols
+		&& cm->format == 32
+		&& cm->data.l[0] == wm_delete_window)
+			quit = true;
+		else
+			verbose("Ignoring ClientMessage type %s", XGetAtomName(d->dpy, cm->message_type));
+		break;
+
+	default:
+		/* pass it on to Xt */
+		XtDispatchEvent(&event);
+		break;
+	}
+
+	return quit;
+}
+
+/*
+ * if video is being displayed, the current frame will already be in d->contents
+ * (drawn by the video thread)
+ * overlay the MHEG objects onto the video in d->contents, then copy it onto the Window
+ */
+
+static void
+x11_refresh(MHEGDisplay *d, int x, int y, unsigned int w, unsigned int h)
+{
+	XRenderComposite(d->dpy, PictOpOver, d->used_overlay_pic, None, d->contents_pic, x, y, x, y, x, y, w, h);
+
+	XCopyArea(d->dpy, d->contents, d->win, d->win_gc, x, y, w, h, x, y);
+
+	return;
+}
+
+static void
+x11_setClipRectangle(MHEGDisplay *d, int x, int y, unsigned int w, unsigned int h)
+{
+	XRectangle clip;
+
+	clip.x = x;
+	clip.y = y;
+	clip.width = w;
+	clip.height = h;
+
+	XRenderSetPictureClipRectangles(d->dpy, d->next_overlay_pic, 0, 0, &clip, 1);
+
+	return;
+}
+
+static void
+x11_unsetClipRectangle(MHEGDisplay *d)
+{
+	/*
+	 * this doesn't work...
+	 * XRenderSetPictureClipRectangles(d->dpy, d->next_overlay_pic, 0, 0, NULL, 0);
+	 */
+
+	XRenderPictureAttributes attr;
+
+	attr.clip_mask = None;
+
+	XRenderChangePicture(d->dpy, d->next_overlay_pic, CPClipMask, &attr);
+
+	return;
+}
+
+static void
+x11_fillRectangle(MHEGDisplay *d, int x, int y, unsigned int w, unsigned int h, MHEGColour *col, bool replace)
+{
+	XRenderColor rcol;
+
+	/* convert to internal colour format */
+	display_colour(&rcol, col);
+
+	XRenderFillRectangle(d->dpy, replace ? PictOpSrc : PictOpOver, d->next_overlay_pic, &rcol, x, y, w, h);
+
+	return;
+}
+
+static void
+x11_drawBitmap(MHEGDisplay *d, MHEGBitmap *bitmap, int src_x, int src_y, unsigned int w, unsigned int h, int dst_x, int dst_y)
+{
+	XRenderComposite(d->dpy, PictOpOver, bitmap->image_pic, None, d->next_overlay_pic,
+			 src_x, src_y, src_x, src_y, dst_x, dst_y, w, h);
+
+	return;
+}
+
+static void
+x11_drawCanvas(MHEGDisplay *d, MHEGCanvas *canvas, int src_x, int src_y, unsigned int w, unsigned int h, int dst_x, int dst_y)
+{
+	/* make sure the X server has the latest version of the canvas */
+	MHEGCanvas_upload(canvas);
+
+	XRenderComposite(d->dpy, PictOpOver, canvas->contents_pic, None, d->next_overlay_pic,
+			 src_x, src_y, src_x, src_y, dst_x, dst_y, w, h);
+
+	return;
+}
+
+/*
+ * render the whole run with a single request
+ */
+
+static void
+x11_drawGlyphs(MHEGDisplay *d, MHEGFont *font, MHEGColour *col, XftGlyphSpec *specs, unsigned int nglyphs)
+{
+	XRenderColor rcol;
+
+	/* convert to internal colour format */
+	display_colour(&rcol, col);
+
+	/* set the text foreground colour */
+	XRenderFillRectangle(d->dpy, PictOpSrc, d->textfg_pic, &rcol, 0, 0, 1, 1);
+
+	XftGlyphSpecRender(d->dpy, PictOpOver, d->textfg_pic, (XftFont *) font->font, d->next_overlay_pic,
+			   0, 0, specs, nglyphs);
+
+	return;
+}
+
+static void
+x11_useOverlay(MHEGDisplay *d, int x, int y, unsigned int w, unsigned int h)
+{
+	/* avoid any XRender clip mask */
+	XCopyArea(d->dpy, d->next_overlay, d->used_overlay, d->overlay_gc, x, y, w, h, x, y);
+
+	return;
+}
+
+/*
+ * upload the pixels to a Pixmap on the X server
+ */
+
+static void
+x11_newBitmap(MHEGDisplay *d, MHEGPixels *pixels, MHEGBitmap *bitmap)
+{
+	XRenderPictFormat *pic_format = d->argb_format;
+	XImage *ximg;
+	GC gc;
+
+	/* get X to draw the XImage onto a Pixmap */
+	if((ximg = XCreateImage(d->dpy, NULL, 32, ZPixmap, 0, pixels->data, pixels->width, pixels->height, 32, 0)) == NULL)
+		fatal("XCreateImage failed");
+	/* passed NULL Visual to XCreateImage, so set the rgb masks now */
+	ximg->red_mask = pic_format->direct.redMask;
+	ximg->green_mask = pic_format->direct.greenMask;
+	ximg->blue_mask = pic_format->direct.blueMask;
+	/* create the Pixmap */
+	bitmap->image = XCreatePixmap(d->dpy, d->win, pixels->width, pixels->height, 32);
+	gc = XCreateGC(d->dpy, bitmap->image, 0, NULL);
+	XPutImage(d->dpy, bitmap->image, gc, ximg, 0, 0, 0, 0, pixels->width, pixels->height);
+	XFreeGC(d->dpy, gc);
+
+	/* associate a Picture with it */
+	bitmap->image_pic = XRenderCreatePicture(d->dpy, bitmap->image, pic_format, 0, NULL);
+
+	/* the caller owns the XImage data, make sure XDestroyImage doesn't try to free it */
+	ximg->data = NULL;
+	XDestroyImage(ximg);
+
+	return;
+}
+
+static void
+x11_freeBitmap(MHEGDisplay *d, MHEGBitmap *b)
+{
+	XRenderFreePicture(d->dpy, b->image_pic);
+	XFreePixmap(d->dpy, b->image);
+
+	return;
+}
+
+static void
+x11_openFont(MHEGDisplay *d, MHEGFont *f, double pixel_size, double aspect)
+{
+	f->font = XftFontOpen(d->dpy, DefaultScreen(d->dpy),
+			      FC_FAMILY, FcTypeString, f->name,
+			      FC_PIXEL_SIZE, FcTypeDouble, pixel_size,
+			      FC_ASPECT, FcTypeDouble, aspect,
+			      /* may not give us a scalable font */
+			      FC_SCALABLE, FcTypeBool, FcTrue,
+			      0);
+
+	return;
+}
+
+static void
+x11_closeFont(MHEGDisplay *d, MHEGFont *f)
+{
+	XftFontClose(d->dpy, (XftFont *) f->font);
+
+	return;
+}
+
+static FT_Face
+x11_lockFace(MHEGDisplay *d, MHEGFont *f)
+{
+	return XftLockFace((XftFont *) f->font);
+}
+
+static void
+x11_unlockFace(MHEGDisplay *d, MHEGFont *f)
+{
+	XftUnlockFace((XftFont *) f->font);
+
+	return;
+}
+
+static bool
+x11_fontExists(MHEGDisplay *d, char *family)
+{
+	char xlfd[256];
+	char **names;
+	int count;
+
+	snprintf(xlfd, sizeof(xlfd), "-*-%s-medium-r-normal-*", family);
+
+	if((names = XListFonts(d->dpy, xlfd, 1, &count)) == NULL)
+		return false;
+
+	XFreeFontNames(names);
+
+	return true;
+}
+
+/*
+ * convert MHEGColour to internal format
+ */
+
+static void
+display_colour(XRenderColor *out, MHEGColour *in)
+{
+	/* expand to 16 bits per channel */
+	out->red = (in->r << 8) | in->r;
+	out->green = (in->g << 8) | in->g;
+	out->blue = (in->b << 8) | in->b;
+
+	/* XRender has 0 as transparent and 65535 as opaque */
+	out->alpha = ((255 - in->t) << 8) | (255 - in->t);
+
+	return;
+}
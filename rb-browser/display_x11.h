@@ -0,0 +1,10 @@
+/*
+ * display_x11.h
+ */
+
+#ifndef __DISPLAY_X11_H__
+#define __DISPLAY_X11_H__
+
+extern MHEGDisplayMethod display_x11_fns;
+
+#endif	/* __DISPLAY_X11_H__ */
@@ -0,0 +1,394 @@
+/*
+ * framepool.c
+ *
+ * pools of buffers for decoded video pictures and audio samples
+ *
+ * picture buffers are kept in size classes, one for each (pix_fmt, width, height) we have seen recently
+ * the video decoder renders straight into them via its get_buffer/release_buffer callbacks
+ * a buffer is reference counted, so it can be on the videoq after the decoder has finished with it
+ *
+ * audio samples are variable sized, they are allocated from slabs of 2^n byte chunks
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "MHEGEngine.h"
+#include "framepool.h"
+#include "utils.h"
+
+/* a chunk of audio samples, the samples come straight after the header */
+typedef union AudioChunk
+{
+	struct
+	{
+		union AudioChunk *next;		/* next on the free list */
+		unsigned int shift;		/* size of the chunk is 1 << shift */
+	} hdr;
+	unsigned char pad[FRAMEPOOL_ALIGN];
+} AudioChunk;
+
+#define NAUDIO_CLASSES	(FRAMEPOOL_MAX_AUDIO_SHIFT - FRAMEPOOL_MIN_AUDIO_SHIFT + 1)
+
+/* internal functions */
+static VideoBufferClass *find_class(enum PixelFormat, int, int);
+static void free_class(VideoBufferClass *);
+static VideoBuffer *new_buffer(VideoBufferClass *, enum PixelFormat, int, int);
+static void free_buffer(LIST_TYPE(VideoBuffer) *);
+
+static int get_buffer(AVCodecContext *, AVFrame *);
+static void release_buffer(AVCodecContext *, AVFrame *);
+
+/* both pools are shared by all stream players */
+static pthread_mutex_t _pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static VideoBufferClass _video_class[FRAMEPOOL_MAX_CLASSES];
+static AudioChunk *_audio_free[NAUDIO_CLASSES];
+static FramePoolStats _stats;
+
+#define ALIGN(X, N)	(((X) + (N) - 1) & ~((N) - 1))
+
+/*
+ * returns a picture buffer big enough for a width x height pix_fmt picture
+ * the caller has the only reference to it
+ * width and height should already be aligned as the decoder wants them
+ */
+
+VideoBuffer *
+framepool_getVideo(enum PixelFormat pix_fmt, int width, int height)
+{
+	VideoBufferClass *sclass;
+	LIST_TYPE(VideoBuffer) *buf;
+	VideoBuffer *vb;
+
+	/*
+	 * make the luma line size a multiple of 2 * FRAMEPOOL_ALIGN
+	 * so the chroma line sizes, and so the start of each plane, are also aligned
+	 */
+	width = ALIGN(width, 2 * FRAMEPOOL_ALIGN);
+	height = ALIGN(height, 2);
+
+	pthread_mutex_lock(&_pool_lock);
+
+	_stats.video_requests ++;
+	_stats.video_in_use ++;
+
+	sclass = find_class(pix_fmt, width, height);
+	if(sclass != NULL && sclass->free != NULL)
+	{
+		buf = sclass->free;
+		LIST_REMOVE(&sclass->free, buf);
+		sclass->nfree --;
+		vb = &buf->item;
+	}
+	else
+	{
+		/* sclass may be NULL if every class is in use, the buffer is freed when it is released */
+		vb = new_buffer(sclass, pix_fmt, width, height);
+	}
+	vb->refs = 1;
+
+	pthread_mutex_unlock(&_pool_lock);
+
+	return vb;
+}
+
+void
+framepool_refVideo(VideoBuffer *vb)
+{
+	pthread_mutex_lock(&_pool_lock);
+	vb->refs ++;
+	pthread_mutex_unlock(&_pool_lock);
+
+	return;
+}
+
+/*
+ * drop a reference to the buffer
+ * when the last user has released it, it goes back on its class's free list
+ */
+
+void
+framepool_releaseVideo(VideoBuffer *vb)
+{
+	LIST_TYPE(VideoBuffer) *buf;
+	VideoBufferClass *sclass;
+
+	/* the buffer is embedded in its list item */
+	buf = (LIST_TYPE(VideoBuffer) *) ((char *) vb - offsetof(LIST_TYPE(VideoBuffer), item));
+
+	pthread_mutex_lock(&_pool_lock);
+
+	/* assert */
+	if(vb->refs == 0)
+		fatal("framepool_releaseVideo: buffer is not in use");
+
+	if(--vb->refs == 0)
+	{
+		_stats.video_in_use --;
+		if((sclass = vb->sclass) != NULL)
+		{
+			LIST_APPEND(&sclass->free, buf);
+			sclass->nfree ++;
+		}
+		else
+		{
+			free_buffer(buf);
+		}
+	}
+
+	pthread_mutex_unlock(&_pool_lock);
+
+	return;
+}
+
+/*
+ * find the class for the given size, or make a new one
+ * returns NULL if we are already at FRAMEPOOL_MAX_CLASSES and they all have buffers in use
+ * call with _pool_lock held
+ */
+
+static VideoBufferClass *
+find_class(enum PixelFormat pix_fmt, int width, int height)
+{
+	VideoBufferClass *sclass;
+	VideoBufferClass *spare = NULL;
+	unsigned int i;
+
+	for(i=0; i<FRAMEPOOL_MAX_CLASSES; i++)
+	{
+		sclass = &_video_class[i];
+		if(sclass->nbuffers != 0
+		&& sclass->pix_fmt == pix_fmt && sclass->width == width && sclass->height == height)
+			return sclass;
+		/* prefer an empty slot to one with spare buffers we would have to free */
+		if(sclass->nbuffers == 0)
+			spare = sclass;
+		else if(sclass->nfree == sclass->nbuffers && (spare == NULL || spare->nbuffers != 0))
+			spare = sclass;
+	}
+
+	/* all the classes are being used */
+	if(spare == NULL)
+		return NULL;
+
+	/* get rid of any buffers left over from the last size that used this slot */
+	free_class(spare);
+
+	spare->pix_fmt = pix_fmt;
+	spare->width = width;
+	spare->height = height;
+
+	verbose("framepool: new picture size %dx%d (pix_fmt=%d)", width, height, pix_fmt);
+
+	return spare;
+}
+
+/*
+ * call with _pool_lock held
+ */
+
+static void
+free_class(VideoBufferClass *sclass)
+{
+	LIST_TYPE(VideoBuffer) *buf;
+
+	/* assert */
+	if(sclass->nfree != sclass->nbuffers)
+		fatal("framepool: freeing size class while buffers are in use");
+
+	while((buf = sclass->free) != NULL)
+	{
+		LIST_REMOVE(&sclass->free, buf);
+		free_buffer(buf);
+	}
+
+	sclass->nbuffers = 0;
+	sclass->nfree = 0;
+
+	return;
+}
+
+/*
+ * call with _pool_lock held
+ */
+
+static VideoBuffer *
+new_buffer(VideoBufferClass *sclass, enum PixelFormat pix_fmt, int width, int height)
+{
+	LIST_TYPE(VideoBuffer) *buf;
+	VideoBuffer *vb;
+	int size;
+	unsigned char *data;
+
+	if((size = avpicture_get_size(pix_fmt, width, height)) < 0)
+		fatal("framepool: invalid picture size");
+
+	buf = safe_malloc(sizeof(LIST_TYPE(VideoBuffer)));
+	vb = &buf->item;
+
+	vb->sclass = sclass;
+	vb->size = size;
+	vb->base = safe_malloc(size + FRAMEPOOL_ALIGN - 1);
+	data = (unsigned char *) ALIGN((uintptr_t) vb->base, FRAMEPOOL_ALIGN);
+	avpicture_fill(&vb->pic, data, pix_fmt, width, height);
+	vb->refs = 0;
+
+	if(sclass != NULL)
+		sclass->nbuffers ++;
+
+	_stats.video_allocs ++;
+	_stats.video_buffers ++;
+	_stats.video_bytes += size;
+
+	return vb;
+}
+
+/*
+ * call with _pool_lock held
+ */
+
+static void
+free_buffer(LIST_TYPE(VideoBuffer) *buf)
+{
+	_stats.video_buffers --;
+	_stats.video_bytes -= buf->item.size;
+
+	safe_free(buf->item.base);
+	safe_free(buf);
+
+	return;
+}
+
+/*
+ * make the decoder render into buffers from our pool, if it can
+ * call this before avcodec_open()
+ * returns false if the codec can't do direct rendering, in which case you need to copy each picture
+ */
+
+bool
+framepool_setDecoder(AVCodecContext *ctx, AVCodec *codec)
+{
+	if(!(codec->capabilities & CODEC_CAP_DR1))
+		return false;
+
+	/* we don't add a border around the picture, so the decoder has to handle motion vectors that point outside it */
+	ctx->flags |= CODEC_FLAG_EMU_EDGE;
+
+	ctx->get_buffer = get_buffer;
+	ctx->release_buffer = release_buffer;
+
+	return true;
+}
+
+static int
+get_buffer(AVCodecContext *ctx, AVFrame *pic)
+{
+	VideoBuffer *vb;
+	int width = ctx->width;
+	int height = ctx->height;
+	unsigned int i;
+
+	/* the decoder may write past width/height up to the next macroblock boundary */
+	avcodec_align_dimensions(ctx, &width, &height);
+
+	vb = framepool_getVideo(ctx->pix_fmt, width, height);
+
+	for(i=0; i<4; i++)
+	{
+		pic->base[i] = vb->pic.data[i];
+		pic->data[i] = vb->pic.data[i];
+		pic->linesize[i] = vb->pic.linesize[i];
+	}
+	pic->opaque = vb;
+	pic->type = FF_BUFFER_TYPE_USER;
+	/* we don't know what was in the buffer before, so the decoder can't skip any blocks */
+	pic->age = 256 * 256 * 256 * 64;
+
+	return 0;
+}
+
+static void
+release_buffer(AVCodecContext *ctx, AVFrame *pic)
+{
+	unsigned int i;
+
+	framepool_releaseVideo((VideoBuffer *) pic->opaque);
+
+	for(i=0; i<4; i++)
+		pic->data[i] = NULL;
+	pic->opaque = NULL;
+
+	return;
+}
+
+/*
+ * returns a buffer for nbytes of audio samples
+ */
+
+void *
+framepool_allocAudio(unsigned int nbytes)
+{
+	AudioChunk *chunk;
+	unsigned int shift;
+
+	/* find the smallest chunk size that will hold the samples */
+	shift = FRAMEPOOL_MIN_AUDIO_SHIFT;
+	while(shift < FRAMEPOOL_MAX_AUDIO_SHIFT && (1U << shift) < nbytes)
+		shift ++;
+
+	/* assert */
+	if((1U << shift) < nbytes)
+		fatal("framepool_allocAudio: %u bytes is too big", nbytes);
+
+	pthread_mutex_lock(&_pool_lock);
+
+	_stats.audio_requests ++;
+	_stats.audio_in_use ++;
+
+	if((chunk = _audio_free[shift - FRAMEPOOL_MIN_AUDIO_SHIFT]) != NULL)
+	{
+		_audio_free[shift - FRAMEPOOL_MIN_AUDIO_SHIFT] = chunk->hdr.next;
+	}
+	else
+	{
+		chunk = safe_malloc(sizeof(AudioChunk) + (1U << shift));
+		chunk->hdr.shift = shift;
+		_stats.audio_allocs ++;
+		_stats.audio_chunks ++;
+		_stats.audio_bytes += 1U << shift;
+	}
+
+	pthread_mutex_unlock(&_pool_lock);
+
+	return chunk + 1;
+}
+
+void
+framepool_freeAudio(void *samples)
+{
+	AudioChunk *chunk = ((AudioChunk *) samples) - 1;
+	unsigned int cls = chunk->hdr.shift - FRAMEPOOL_MIN_AUDIO_SHIFT;
+
+	pthread_mutex_lock(&_pool_lock);
+
+	_stats.audio_in_use --;
+
+	chunk->hdr.next = _audio_free[cls];
+	_audio_free[cls] = chunk;
+
+	pthread_mutex_unlock(&_pool_lock);
+
+	return;
+}
+
+void
+framepool_getStats(FramePoolStats *stats)
+{
+	pthread_mutex_lock(&_pool_lock);
+	memcpy(stats, &_stats, sizeof(FramePoolStats));
+	pthread_mutex_unlock(&_pool_lock);
+
+	return;
+}
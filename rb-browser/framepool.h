@@ -0,0 +1,78 @@
+/*
+ * framepool.h
+ */
+
+#ifndef __FRAMEPOOL_H__
+#define __FRAMEPOOL_H__
+
+#include <stdbool.h>
+#include <ffmpeg/avcodec.h>
+
+#include "listof.h"
+
+/* alignment of picture planes and line sizes */
+#define FRAMEPOOL_ALIGN		32
+
+/* max number of different picture sizes we keep spare buffers for */
+#define FRAMEPOOL_MAX_CLASSES	4
+
+/* audio chunks are 2^n bytes, from 1KB to 512KB, ie big enough for AVCODEC_MAX_AUDIO_FRAME_SIZE 16-bit samples */
+#define FRAMEPOOL_MIN_AUDIO_SHIFT	10
+#define FRAMEPOOL_MAX_AUDIO_SHIFT	19
+
+/*
+ * a picture buffer
+ * the decoder renders into it directly, and the VideoFrame on the videoq points at it
+ * it goes back to the pool when the decoder and all VideoFrames have released it
+ */
+typedef struct VideoBufferClass VideoBufferClass;
+
+typedef struct
+{
+	VideoBufferClass *sclass;	/* size class we belong to */
+	unsigned char *base;		/* what we malloc'ed */
+	size_t size;			/* bytes of picture data */
+	AVPicture pic;			/* aligned planes inside base */
+	unsigned int refs;		/* number of users, protected by the pool lock */
+} VideoBuffer;
+
+DEFINE_LIST_OF(VideoBuffer);
+
+/* all the buffers for one (pix_fmt, width, height) */
+struct VideoBufferClass
+{
+	enum PixelFormat pix_fmt;
+	int width;			/* aligned size we allocate buffers at */
+	int height;
+	LIST_OF(VideoBuffer) *free;	/* spare buffers */
+	unsigned int nbuffers;		/* number allocated, in use or spare */
+	unsigned int nfree;		/* number on the free list */
+};
+
+/* counters, for both pools */
+typedef struct
+{
+	unsigned int video_requests;	/* number of pictures handed out */
+	unsigned int video_allocs;	/* number of those that needed a new buffer */
+	unsigned int video_buffers;	/* buffers we have now */
+	unsigned int video_in_use;	/* buffers the decoder or videoq are using now */
+	size_t video_bytes;		/* total size of video_buffers */
+	unsigned int audio_requests;
+	unsigned int audio_allocs;
+	unsigned int audio_chunks;
+	unsigned int audio_in_use;
+	size_t audio_bytes;
+} FramePoolStats;
+
+VideoBuffer *framepool_getVideo(enum PixelFormat, int, int);
+void framepool_refVideo(VideoBuffer *);
+void framepool_releaseVideo(VideoBuffer *);
+
+bool framepool_setDecoder(AVCodecContext *, AVCodec *);
+
+void *framepool_allocAudio(unsigned int);
+void framepool_freeAudio(void *);
+
+void framepool_getStats(FramePoolStats *);
+
+#endif	/* __FRAMEPOOL_H__ */
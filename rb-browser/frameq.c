@@ -0,0 +1,285 @@
+/*
+ * frameq.c
+ *
+ * bounded single producer, single consumer queue
+ * used to pass decoded frames between the MHEGStreamPlayer threads
+ *
+ * head and tail are free running counters, head is only written by the consumer and tail only by the producer,
+ * so adding and removing items just needs the right memory ordering, not a lock
+ * a thread only takes the lock when it has to block, ie the queue is full or doesn't have enough items yet;
+ * it sets its waiting flag before it checks the queue again,
+ * and the other thread checks the flag after it moves head or tail,
+ * so one of them will always see the other's change and no wake up can be lost
+ */
+
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "frameq.h"
+#include "utils.h"
+
+/* internal functions */
+static void wakeup(FrameQueue *);
+
+#define LOAD(P)		__atomic_load_n((P), __ATOMIC_SEQ_CST)
+#define STORE(P, V)	__atomic_store_n((P), (V), __ATOMIC_SEQ_CST)
+
+void
+frameq_init(FrameQueue *q, unsigned int size)
+{
+	/* round up to a power of 2, so the counters can wrap */
+	q->size = 1;
+	while(q->size < size)
+		q->size <<= 1;
+
+	q->items = safe_malloc(q->size * sizeof(void *));
+
+	q->head = 0;
+	q->tail = 0;
+
+	q->cons_waiting = false;
+	q->prod_waiting = false;
+	q->aborted = false;
+
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->cond, NULL);
+
+	return;
+}
+
+void
+frameq_fini(FrameQueue *q)
+{
+	safe_free(q->items);
+	q->items = NULL;
+
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->cond);
+
+	return;
+}
+
+/*
+ * add an item to the tail of the queue
+ * blocks while the queue is full
+ * returns false if frameq_abort() was called while we were waiting, the item is not added
+ */
+
+bool
+frameq_put(FrameQueue *q, void *item)
+{
+	unsigned int tail = q->tail;
+	bool ok = true;
+
+	/* wait until the consumer has made some space */
+	if(tail - LOAD(&q->head) >= q->size)
+	{
+		pthread_mutex_lock(&q->lock);
+		STORE(&q->prod_waiting, true);
+		while(!q->aborted && tail - LOAD(&q->head) >= q->size)
+			pthread_cond_wait(&q->cond, &q->lock);
+		STORE(&q->prod_waiting, false);
+		ok = !q->aborted;
+		pthread_mutex_unlock(&q->lock);
+	}
+
+	if(!ok)
+		return false;
+
+	q->items[tail & (q->size - 1)] = item;
+	STORE(&q->tail, tail + 1);
+
+	/* wake up the consumer if it is waiting for this item */
+	if(LOAD(&q->cons_waiting))
+		wakeup(q);
+
+	return true;
+}
+
+/*
+ * returns the item at the head of the queue without removing it
+ * returns NULL if the queue is empty
+ * the item stays valid until the consumer calls frameq_pop()
+ */
+
+void *
+frameq_head(FrameQueue *q)
+{
+	if(LOAD(&q->tail) == q->head)
+		return NULL;
+
+	return q->items[q->head & (q->size - 1)];
+}
+
+/*
+ * returns the item most recently added to the queue without removing it
+ * returns NULL if the queue is empty
+ * only the consumer may call this
+ */
+
+void *
+frameq_tail(FrameQueue *q)
+{
+	unsigned int tail = LOAD(&q->tail);
+
+	if(tail == q->head)
+		return NULL;
+
+	return q->items[(tail - 1) & (q->size - 1)];
+}
+
+/*
+ * returns the item at the head of the queue without removing it
+ * blocks while the queue is empty
+ * returns NULL if frameq_abort() is called
+ */
+
+void *
+frameq_get(FrameQueue *q)
+{
+	if(!frameq_wait(q, 0, 0))
+		return NULL;
+
+	return frameq_head(q);
+}
+
+/*
+ * block until the queue has more than nitems in it
+ * if usecs is not 0, give up after that many micro seconds
+ * returns true if the queue has more than nitems in it
+ * returns false if we timed out, frameq_abort() was called, or the queue can never have that many items
+ */
+
+bool
+frameq_wait(FrameQueue *q, unsigned int nitems, unsigned int usecs)
+{
+	struct timespec abstime;
+	int rc = 0;
+
+	if(nitems >= q->size)
+		return false;
+
+	if(frameq_count(q) > nitems)
+		return true;
+
+	if(usecs != 0)
+	{
+		clock_gettime(CLOCK_REALTIME, &abstime);
+		abstime.tv_sec += usecs / 1000000;
+		abstime.tv_nsec += (usecs % 1000000) * 1000;
+		if(abstime.tv_nsec >= 1000000000)
+		{
+			abstime.tv_sec ++;
+			abstime.tv_nsec -= 1000000000;
+		}
+	}
+
+	pthread_mutex_lock(&q->lock);
+	STORE(&q->cons_waiting, true);
+	while(!q->aborted && rc != ETIMEDOUT && frameq_count(q) <= nitems)
+	{
+		if(usecs != 0)
+			rc = pthread_cond_timedwait(&q->cond, &q->lock, &abstime);
+		else
+			pthread_cond_wait(&q->cond, &q->lock);
+	}
+	STORE(&q->cons_waiting, false);
+	pthread_mutex_unlock(&q->lock);
+
+	return (frameq_count(q) > nitems);
+}
+
+/*
+ * remove the item at the head of the queue
+ * it is up to the caller to free the item
+ */
+
+void
+frameq_pop(FrameQueue *q)
+{
+	/* assert */
+	if(LOAD(&q->tail) == q->head)
+		fatal("frameq_pop: queue is empty");
+
+	STORE(&q->head, q->head + 1);
+
+	/* wake up the producer if it is waiting for some space */
+	if(LOAD(&q->prod_waiting))
+		wakeup(q);
+
+	return;
+}
+
+unsigned int
+frameq_count(FrameQueue *q)
+{
+	return LOAD(&q->tail) - LOAD(&q->head);
+}
+
+bool
+frameq_full(FrameQueue *q)
+{
+	return (frameq_count(q) >= q->size);
+}
+
+/*
+ * wake up any blocked threads and make any future calls return straight away
+ */
+
+void
+frameq_abort(FrameQueue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->aborted = true;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+
+	return;
+}
+
+/*
+ * remove and return the item at the head of the queue
+ * returns NULL when the queue is empty
+ * only call this when the producer and consumer threads have finished
+ */
+
+void *
+frameq_drain(FrameQueue *q)
+{
+	void *item;
+
+	if((item = frameq_head(q)) != NULL)
+		STORE(&q->head, q->head + 1);
+
+	return item;
+}
+
+/*
+ * make the queue ready to use again after frameq_abort()
+ * the queue should be empty, ie frameq_drain() has returned NULL
+ */
+
+void
+frameq_reset(FrameQueue *q)
+{
+	q->head = 0;
+	q->tail = 0;
+
+	q->cons_waiting = false;
+	q->prod_waiting = false;
+	q->aborted = false;
+
+	return;
+}
+
+static void
+wakeup(FrameQueue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+
+	return;
+}
@@ -0,0 +1,50 @@
+/*
+ * frameq.h
+ */
+
+#ifndef __FRAMEQ_H__
+#define __FRAMEQ_H__
+
+#include <stdbool.h>
+#include <pthread.h>
+
+/*
+ * bounded queue of pointers between one producer thread and one consumer thread
+ * adding and removing items does not take a lock unless the other thread is blocked
+ */
+typedef struct
+{
+	void **items;
+	unsigned int size;		/* max number of items, a power of 2 */
+	unsigned int head;		/* only changed by the consumer */
+	unsigned int tail;		/* only changed by the producer */
+	bool cons_waiting;		/* true => consumer is blocked */
+	bool prod_waiting;		/* true => producer is blocked because the queue is full */
+	bool aborted;			/* true => wake everyone up and don't block again */
+	pthread_mutex_t lock;		/* only used when a thread needs to block */
+	pthread_cond_t cond;
+} FrameQueue;
+
+void frameq_init(FrameQueue *, unsigned int);
+void frameq_fini(FrameQueue *);
+
+/* producer */
+bool frameq_put(FrameQueue *, void *);
+
+/* consumer */
+void *frameq_head(FrameQueue *);
+void *frameq_tail(FrameQueue *);
+void *frameq_get(FrameQueue *);
+bool frameq_wait(FrameQueue *, unsigned int, unsigned int);
+void frameq_pop(FrameQueue *);
+
+/* either */
+unsigned int frameq_count(FrameQueue *);
+bool frameq_full(FrameQueue *);
+
+/* controller, eg to stop playback */
+void frameq_abort(FrameQueue *);
+void *frameq_drain(FrameQueue *);
+void frameq_reset(FrameQueue *);
+
+#endif	/* __FRAMEQ_H__ */
@@ -0,0 +1,313 @@
+/*
+ * intern.c
+ *
+ * a table of the strings the engine compares a lot, ie group IDs, content references and service URLs
+ * each different string is stored once and given an ID
+ * once you have the IDs, checking two strings are equal is just comparing two unsigned ints
+ * strings stay in the table until intern_free() is called, we only see a few hundred different ones
+ * the table can be used from any thread (Fork'ed ResidentPrograms look up content references)
+ * an InternMap is not locked, only use each map from one thread
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "intern.h"
+#include "utils.h"
+
+#define INTERN_TABLE_MIN	64
+#define INTERN_MAP_MIN		16
+
+/* Knuth's multiplicative hash, size is always a power of 2 */
+#define INTERN_ID_HASH(MAP, ID)		(((ID) * 2654435761U) & ((MAP)->size - 1))
+
+typedef struct
+{
+	OctetString str;
+	uint32_t hash;
+} InternString;
+
+/* internal functions */
+static unsigned int find_slot(OctetString *, uint32_t);
+static void grow_table(void);
+
+/*
+ * _strings[id - 1] is the string with the given ID
+ * each string is allocated separately, so intern_string() can return a ptr that will stay valid
+ * _slots is an open addressed hash table of IDs, 0 marks an empty slot
+ * _intern_lock protects everything here
+ */
+static InternString **_strings = NULL;
+static unsigned int _nstrings = 0;
+static unsigned int _strings_size = 0;
+static unsigned int *_slots = NULL;
+static unsigned int _nslots = 0;
+static pthread_mutex_t _intern_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * returns the ID of the given string
+ * adds it to the table if it is not already there
+ */
+
+unsigned int
+intern_id(OctetString *str)
+{
+	uint32_t hash = OctetString_hash(str);
+	unsigned int slot;
+	unsigned int id;
+	InternString *s;
+
+	pthread_mutex_lock(&_intern_lock);
+
+	if(_slots != NULL)
+	{
+		slot = find_slot(str, hash);
+		if((id = _slots[slot]) != 0)
+		{
+			pthread_mutex_unlock(&_intern_lock);
+			return id;
+		}
+	}
+
+	/* keep the hash table at most half full so the probe sequences stay short */
+	if((_nstrings + 1) * 2 > _nslots)
+		grow_table();
+
+	if(_nstrings == _strings_size)
+	{
+		_strings_size = (_strings_size == 0) ? INTERN_TABLE_MIN : _strings_size * 2;
+		_strings = safe_realloc(_strings, _strings_size * sizeof(InternString *));
+	}
+
+	s = safe_malloc(sizeof(InternString));
+	OctetString_dup(&s->str, str);
+	s->hash = hash;
+	_strings[_nstrings ++] = s;
+
+	id = _nstrings;
+	slot = find_slot(str, hash);
+	_slots[slot] = id;
+
+	pthread_mutex_unlock(&_intern_lock);
+
+	return id;
+}
+
+/*
+ * returns the ID of the given string
+ * returns 0 if it is not in the table (ie no one has asked for its ID yet)
+ */
+
+unsigned int
+intern_find(OctetString *str)
+{
+	uint32_t hash = OctetString_hash(str);
+	unsigned int id = 0;
+
+	pthread_mutex_lock(&_intern_lock);
+	if(_slots != NULL)
+		id = _slots[find_slot(str, hash)];
+	pthread_mutex_unlock(&_intern_lock);
+
+	return id;
+}
+
+/*
+ * returns the string with the given ID
+ * the string stays valid until intern_free() is called
+ */
+
+OctetString *
+intern_string(unsigned int id)
+{
+	OctetString *str;
+
+	pthread_mutex_lock(&_intern_lock);
+
+	/* assert */
+	if(id == 0 || id > _nstrings)
+		fatal("intern_string: invalid ID %u", id);
+
+	str = &_strings[id - 1]->str;
+
+	pthread_mutex_unlock(&_intern_lock);
+
+	return str;
+}
+
+unsigned int
+intern_count(void)
+{
+	unsigned int n;
+
+	pthread_mutex_lock(&_intern_lock);
+	n = _nstrings;
+	pthread_mutex_unlock(&_intern_lock);
+
+	return n;
+}
+
+/*
+ * forget all the strings
+ * any IDs you have are no longer valid
+ */
+
+void
+intern_free(void)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&_intern_lock);
+
+	for(i=0; i<_nstrings; i++)
+	{
+		safe_free(_strings[i]->str.data);
+		safe_free(_strings[i]);
+	}
+	safe_free(_strings);
+	safe_free(_slots);
+
+	_strings = NULL;
+	_nstrings = 0;
+	_strings_size = 0;
+	_slots = NULL;
+	_nslots = 0;
+
+	pthread_mutex_unlock(&_intern_lock);
+
+	return;
+}
+
+/*
+ * returns the value added for the given ID
+ * returns NULL if nothing has been added for it
+ */
+
+void *
+intern_map_get(InternMap *map, unsigned int id)
+{
+	unsigned int i;
+
+	if(id == 0 || map->slots == NULL)
+		return NULL;
+
+	i = INTERN_ID_HASH(map, id);
+	while(map->slots[i].id != 0)
+	{
+		if(map->slots[i].id == id)
+			return map->slots[i].value;
+		i = (i + 1) & (map->size - 1);
+	}
+
+	return NULL;
+}
+
+/*
+ * replaces any existing value for the given ID
+ * the map does not own the value, you need to free it yourself
+ */
+
+void
+intern_map_put(InternMap *map, unsigned int id, void *value)
+{
+	InternMapEntry *old_slots;
+	unsigned int old_size;
+	unsigned int i;
+
+	/* assert */
+	if(id == 0)
+		fatal("intern_map_put: invalid ID");
+
+	/* keep it at most half full so the probe sequences stay short */
+	if((map->nused + 1) * 2 > map->size)
+	{
+		old_slots = map->slots;
+		old_size = map->size;
+		map->size = (old_size == 0) ? INTERN_MAP_MIN : old_size * 2;
+		map->nused = 0;
+		map->slots = safe_mallocz(map->size * sizeof(InternMapEntry));
+		for(i=0; i<old_size; i++)
+		{
+			if(old_slots[i].id != 0)
+				intern_map_put(map, old_slots[i].id, old_slots[i].value);
+		}
+		safe_free(old_slots);
+	}
+
+	i = INTERN_ID_HASH(map, id);
+	while(map->slots[i].id != 0)
+	{
+		if(map->slots[i].id == id)
+		{
+			map->slots[i].value = value;
+			return;
+		}
+		i = (i + 1) & (map->size - 1);
+	}
+	map->slots[i].id = id;
+	map->slots[i].value = value;
+	map->nused ++;
+
+	return;
+}
+
+void
+intern_map_free(InternMap *map)
+{
+	safe_free(map->slots);
+
+	map->slots = NULL;
+	map->size = 0;
+	map->nused = 0;
+
+	return;
+}
+
+/*
+ * returns the slot the string is in, or the empty slot it should go in
+ * _intern_lock must be held by the caller
+ */
+
+static unsigned int
+find_slot(OctetString *str, uint32_t hash)
+{
+	unsigned int i = hash & (_nslots - 1);
+	InternString *s;
+
+	while(_slots[i] != 0)
+	{
+		s = _strings[_slots[i] - 1];
+		if(s->hash == hash && OctetString_cmp(&s->str, str) == 0)
+			break;
+		i = (i + 1) & (_nslots - 1);
+	}
+
+	return i;
+}
+
+/*
+ * _intern_lock must be held by the caller
+ */
+
+static void
+grow_table(void)
+{
+	unsigned int i, j;
+
+	safe_free(_slots);
+
+	_nslots = (_nslots == 0) ? INTERN_TABLE_MIN * 2 : _nslots * 2;
+	_slots = safe_mallocz(_nslots * sizeof(unsigned int));
+
+	/* we already know the strings are all different, so just find an empty slot for each one */
+	for(i=0; i<_nstrings; i++)
+	{
+		j = _strings[i]->hash & (_nslots - 1);
+		while(_slots[j] != 0)
+			j = (j + 1) & (_nslots - 1);
+		_slots[j] = i + 1;
+	}
+
+	return;
+}
@@ -0,0 +1,40 @@
+/*
+ * intern.h
+ */
+
+#ifndef __INTERN_H__
+#define __INTERN_H__
+
+#include "der_decode.h"
+
+/*
+ * each different string in the intern table has its own ID
+ * IDs never change, so two strings are equal if their IDs are equal
+ * 0 is never a valid ID
+ */
+unsigned int intern_id(OctetString *);
+unsigned int intern_find(OctetString *);
+OctetString *intern_string(unsigned int);
+unsigned int intern_count(void);
+
+void intern_free(void);
+
+/* map an interned string's ID to a value */
+typedef struct
+{
+	unsigned int id;
+	void *value;
+} InternMapEntry;
+
+typedef struct
+{
+	unsigned int size;		/* always a power of 2 (or 0 if nothing has been added yet) */
+	unsigned int nused;
+	InternMapEntry *slots;		/* open addressed hash table, id 0 marks an empty slot */
+} InternMap;
+
+void *intern_map_get(InternMap *, unsigned int);
+void intern_map_put(InternMap *, unsigned int, void *);
+void intern_map_free(InternMap *);
+
+#endif	/* __INTERN_H__ */
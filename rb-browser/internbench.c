@@ -0,0 +1,271 @@
+/*
+ * internbench.c
+ *
+ * look up objects, persistent files and service indexes, the way the engine does
+ * with a working set like a real app: an app and a scene with a few hundred objects,
+ * a few dozen persistent files and the services on a multiplex or two
+ * reports how long each lookup takes comparing whole strings, like we used to
+ * and how long it takes with interned strings and hash maps
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "intern.h"
+#include "utils.h"
+
+/* the working set */
+#define APP_OBJECTS	200
+#define SCENE_OBJECTS	300
+#define NFILES		40
+#define NSERVICES	80
+
+typedef struct
+{
+	OctetString gid;
+	unsigned int gid_id;
+	unsigned int num;
+} BenchObject;
+
+void usage(char *);
+double now(void);
+void make_string(OctetString *, char *);
+BenchObject *find_object_cmp(BenchObject *, unsigned int, OctetString *, unsigned int);
+BenchObject *find_object_id(BenchObject *, unsigned int, OctetString *, unsigned int);
+int find_file_cmp(OctetString *, unsigned int, OctetString *);
+int find_file_id(InternMap *, OctetString *);
+int find_service_cmp(OctetString *, unsigned int, OctetString *);
+int find_service_id(InternMap *, OctetString *);
+
+int
+main(int argc, char *argv[])
+{
+	char *prog = argv[0];
+	int arg;
+	unsigned int repeat = 1000000;
+	OctetString app_gid, scene_gid;
+	BenchObject objects[APP_OBJECTS + SCENE_OBJECTS];
+	unsigned int nobjects;
+	OctetString files[NFILES + (NFILES / 4)];
+	OctetString services[NSERVICES];
+	InternMap file_map, service_map;
+	OctetString *gids[2];
+	char name[64];
+	unsigned int i, j;
+	unsigned int found;
+	double start, cmp_secs, id_secs;
+
+	while((arg = getopt(argc, argv, "n:")) != EOF)
+	{
+		switch(arg)
+		{
+		case 'n':
+			repeat = strtoul(optarg, NULL, 0);
+			break;
+
+		default:
+			usage(prog);
+			break;
+		}
+	}
+
+	if(optind != argc || repeat == 0)
+		usage(prog);
+
+	/* every object in the app and the scene, like engine.objects */
+	make_string(&app_gid, "~//a/startup");
+	make_string(&scene_gid, "~//scenes/sport/football_results");
+	gids[0] = &app_gid;
+	gids[1] = &scene_gid;
+	nobjects = 0;
+	for(i=1; i<=APP_OBJECTS; i++, nobjects++)
+	{
+		make_string(&objects[nobjects].gid, "~//a/startup");
+		objects[nobjects].gid_id = intern_id(&app_gid);
+		objects[nobjects].num = i;
+	}
+	for(i=1; i<=SCENE_OBJECTS; i++, nobjects++)
+	{
+		make_string(&objects[nobjects].gid, "~//scenes/sport/football_results");
+		objects[nobjects].gid_id = intern_id(&scene_gid);
+		objects[nobjects].num = i;
+	}
+
+	/* persistent files, plus some that apps look for before they have been stored */
+	bzero(&file_map, sizeof(file_map));
+	for(i=0; i<NFILES + (NFILES / 4); i++)
+	{
+		snprintf(name, sizeof(name), "~//ram/app/state/setting%u", i);
+		make_string(&files[i], name);
+		if(i < NFILES)
+			intern_map_put(&file_map, intern_id(&files[i]), (void *) (intptr_t) (i + 1));
+	}
+
+	/* the services on a couple of multiplexes */
+	bzero(&service_map, sizeof(service_map));
+	for(i=0; i<NSERVICES; i++)
+	{
+		snprintf(name, sizeof(name), "dvb://233a.%x.%x", 0x1000 + (i / 40), 0x1000 + i);
+		make_string(&services[i], name);
+		intern_map_put(&service_map, intern_id(&services[i]), (void *) (intptr_t) (i + 1));
+	}
+
+	printf("%u lookups of each type, %u objects, %u persistent files, %u services, %u interned strings\n",
+		repeat, nobjects, NFILES, NSERVICES, intern_count());
+
+	/* objects, references are spread over both groups */
+	found = 0;
+	start = now();
+	for(i=0; i<repeat; i++)
+	{
+		j = (i * 7919) % nobjects;
+		found += (find_object_cmp(objects, nobjects, gids[j < APP_OBJECTS ? 0 : 1], objects[j].num) != NULL);
+	}
+	cmp_secs = now() - start;
+	start = now();
+	for(i=0; i<repeat; i++)
+	{
+		j = (i * 7919) % nobjects;
+		found += (find_object_id(objects, nobjects, gids[j < APP_OBJECTS ? 0 : 1], objects[j].num) != NULL);
+	}
+	id_secs = now() - start;
+	printf("objects: %.1f ns per lookup comparing strings, %.1f ns interned (%u found)\n",
+		(cmp_secs * 1e9) / repeat, (id_secs * 1e9) / repeat, found);
+
+	/* persistent files */
+	found = 0;
+	start = now();
+	for(i=0; i<repeat; i++)
+		found += (find_file_cmp(files, NFILES, &files[(i * 7) % (NFILES + (NFILES / 4))]) != -1);
+	cmp_secs = now() - start;
+	start = now();
+	for(i=0; i<repeat; i++)
+		found += (find_file_id(&file_map, &files[(i * 7) % (NFILES + (NFILES / 4))]) != -1);
+	id_secs = now() - start;
+	printf("persistent files: %.1f ns per lookup comparing strings, %.1f ns hashed (%u found)\n",
+		(cmp_secs * 1e9) / repeat, (id_secs * 1e9) / repeat, found);
+
+	/* service indexes */
+	found = 0;
+	start = now();
+	for(i=0; i<repeat; i++)
+		found += (find_service_cmp(services, NSERVICES, &services[(i * 13) % NSERVICES]) != -1);
+	cmp_secs = now() - start;
+	start = now();
+	for(i=0; i<repeat; i++)
+		found += (find_service_id(&service_map, &services[(i * 13) % NSERVICES]) != -1);
+	id_secs = now() - start;
+	printf("service indexes: %.1f ns per lookup comparing strings, %.1f ns hashed (%u found)\n",
+		(cmp_secs * 1e9) / repeat, (id_secs * 1e9) / repeat, found);
+
+	intern_map_free(&file_map);
+	intern_map_free(&service_map);
+	intern_free();
+
+	return EXIT_SUCCESS;
+}
+
+BenchObject *
+find_object_cmp(BenchObject *objects, unsigned int nobjects, OctetString *gid, unsigned int num)
+{
+	unsigned int i;
+
+	for(i=0; i<nobjects; i++)
+	{
+		if(OctetString_cmp(gid, &objects[i].gid) == 0
+		&& num == objects[i].num)
+			return &objects[i];
+	}
+
+	return NULL;
+}
+
+BenchObject *
+find_object_id(BenchObject *objects, unsigned int nobjects, OctetString *gid, unsigned int num)
+{
+	unsigned int gid_id;
+	unsigned int i;
+
+	if((gid_id = intern_find(gid)) == 0)
+		return NULL;
+
+	for(i=0; i<nobjects; i++)
+	{
+		if(num == objects[i].num && gid_id == objects[i].gid_id)
+			return &objects[i];
+	}
+
+	return NULL;
+}
+
+int
+find_file_cmp(OctetString *files, unsigned int nfiles, OctetString *name)
+{
+	unsigned int i;
+
+	for(i=0; i<nfiles; i++)
+		if(OctetString_cmp(&files[i], name) == 0)
+			return i;
+
+	return -1;
+}
+
+int
+find_file_id(InternMap *map, OctetString *name)
+{
+	return ((int) (intptr_t) intern_map_get(map, intern_find(name))) - 1;
+}
+
+int
+find_service_cmp(OctetString *services, unsigned int nservices, OctetString *url)
+{
+	unsigned int i;
+
+	for(i=0; i<nservices; i++)
+		if(OctetString_cmp(url, &services[i]) == 0)
+			return i;
+
+	return -1;
+}
+
+int
+find_service_id(InternMap *map, OctetString *url)
+{
+	return ((int) (intptr_t) intern_map_get(map, intern_find(url))) - 1;
+}
+
+/*
+ * each of the engine's strings is a separate copy, so make sure we don't compare ptrs to the same data
+ */
+
+void
+make_string(OctetString *str, char *val)
+{
+	str->size = strlen(val);
+	str->data = safe_malloc(str->size);
+	memcpy(str->data, val, str->size);
+
+	return;
+}
+
+double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+void
+usage(char *prog)
+{
+	fprintf(stderr, "Syntax: %s [-n <repeat>]\n", prog);
+
+	exit(EXIT_FAILURE);
+}
@@ -276,6 +276,44 @@ do						\
 }						\
 while(0)
 
+/*
+ * sets *PDST to a new list containing a copy of each item in SRC
+ * calls ALLOC to get each LIST_TYPE()
+ * calls DUP_ITEM(&new->item, &old->item) to copy each item
+ */
+#define LIST_DUP_ITEMS(PDST, SRC, TYPE, DUP_ITEM, ALLOC)	\
+do								\
+{								\
+	LIST_TYPE(TYPE) *old, *new;				\
+	*(PDST) = NULL;						\
+	for(old=(SRC); old; old=old->next)			\
+	{							\
+		new = ALLOC(sizeof(LIST_TYPE(TYPE)));		\
+		DUP_ITEM(&new->item, &old->item);		\
+		LIST_APPEND(PDST, new);				\
+	}							\
+}								\
+while(0)
+
+/*
+ * sets *PDST to a new list containing a copy of each item in SRC
+ * the items are copied with =
+ * calls ALLOC to get each LIST_TYPE()
+ */
+#define LIST_DUP(PDST, SRC, TYPE, ALLOC)		\
+do							\
+{							\
+	LIST_TYPE(TYPE) *old, *new;			\
+	*(PDST) = NULL;					\
+	for(old=(SRC); old; old=old->next)		\
+	{						\
+		new = ALLOC(sizeof(LIST_TYPE(TYPE)));	\
+		new->item = old->item;			\
+		LIST_APPEND(PDST, new);			\
+	}						\
+}							\
+while(0)
+
 /* common lists */
 DEFINE_LIST_OF(int);
 
@@ -30,6 +30,10 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <ffmpeg/avformat.h>
 
 #include "mpegts.h"
@@ -37,8 +41,16 @@
 #include "MHEGEngine.h"
 
 #define TS_PACKET_SIZE	188
+/* read about 64KB at a time, always a whole number of packets */
+#define TS_READ_SIZE	(348 * TS_PACKET_SIZE)
+/* PIDs are 13 bits */
+#define TS_NPIDS	8192
+/* when we lose sync, we need to see this many sync bytes TS_PACKET_SIZE apart before we believe we have found it again */
+#define TS_RESYNC_PACKETS	3
 /* expands as necessary */
 #define INIT_FRAME_BUFF_SIZE	(128 * 1024)
+/* max number of spare frame buffers we keep */
+#define MAX_SPARE_FRAME_BUFFS	8
 
 /* TS stream handling */
 enum MpegTSState
@@ -67,19 +79,40 @@ struct PESContext
 	/* frame we are currently building for this stream */
 	int64_t frame_pts;
 	int64_t frame_dts;
-	uint8_t *frame_data;
-	unsigned int frame_size;	/* number of bytes of valid data in frame_data */
-	unsigned int alloc_size;	/* number of bytes malloc'ed to frame_data */
+	struct FrameBuffer *frame;	/* NULL if we could not allocate one */
+	unsigned int frame_size;	/* number of bytes of valid data in frame->data */
 };
 
 typedef struct PESContext PESContext;
 
+/*
+ * buffer we assemble the payload of a PES packet in
+ * when the frame is complete, it is given to the caller inside the AVPacket, rather than copied
+ * it comes back to the pool when the caller calls av_free_packet()
+ */
+typedef struct FrameBuffer
+{
+	struct FrameBuffer *next;	/* next spare buffer in the pool */
+	uint8_t *data;			/* has FF_INPUT_BUFFER_PADDING_SIZE bytes after alloc_size */
+	unsigned int alloc_size;	/* number of bytes available for the frame in data */
+} FrameBuffer;
+
+/* spare frame buffers, shared by all demuxers */
+static pthread_mutex_t _spare_lock = PTHREAD_MUTEX_INITIALIZER;
+static FrameBuffer *_spare_buffs = NULL;
+static unsigned int _nspare_buffs = 0;
+
 struct MpegTSContext
 {
 	FILE *ts_stream;	/* transport stream we are reading from */
+	int fd_flags;		/* fcntl flags for ts_stream, so we can restore them */
+	uint8_t *buf;		/* TS_READ_SIZE bytes read from ts_stream */
+	unsigned int buf_pos;	/* offset of the next packet in buf */
+	unsigned int buf_end;	/* number of valid bytes in buf */
+	PESContext *pids[TS_NPIDS];	/* PES context for each PID, NULL => ignore it */
 	int apid;		/* audio PID we want, -1 => no audio */
 	int vpid;		/* video PID we want, -1 => no video */
-	AVPacket *pkt;		/* packet containing av data */
+	AVPacket *pkt;		/* where we put the next complete frame */
 	int stop_parse;		/* stop parsing loop */
 	PESContext apes;	/* audio PES we are demuxing */
 	PESContext vpes;	/* video PES we are demuxing */
@@ -87,14 +120,22 @@ struct MpegTSContext
 	int last_cc;		/* last Continuity Check value we saw (<0 => none seen yet) */
 };
 
-static int read_packet(FILE *, uint8_t *);
+static int read_packet(MpegTSContext *, const uint8_t **);
+static int fill_buffer(MpegTSContext *, unsigned int);
+static int resync(MpegTSContext *);
+static int check_sync(MpegTSContext *);
 static void handle_packet(MpegTSContext *, const uint8_t *);
 static int init_pes_stream(MpegTSContext *, PESContext *, int);
 static void free_pes_stream(PESContext *);
-static PESContext *find_pes_stream(MpegTSContext *, int);
 static void mpegts_push_data(PESContext *, const uint8_t *, int, int);
+static void append_frame_data(PESContext *, const uint8_t *, int);
+static void output_frame(PESContext *);
 static int64_t get_pts(const uint8_t *);
 
+static FrameBuffer *get_frame_buffer(void);
+static void release_frame_buffer(FrameBuffer *);
+static void free_frame_packet(AVPacket *);
+
 /* my interface */
 
 /*
@@ -114,18 +155,43 @@ mpegts_open(FILE *ts, int apid, int vpid)
 	ctx->apid = apid;
 	ctx->vpid = vpid;
 
+	if((ctx->buf = av_malloc(TS_READ_SIZE)) == NULL)
+	{
+		av_free(ctx);
+		return NULL;
+	}
+	ctx->buf_pos = 0;
+	ctx->buf_end = 0;
+
 	if(init_pes_stream(ctx, &ctx->apes, apid) < 0)
 	{
+		av_free(ctx->buf);
 		av_free(ctx);
 		return NULL;
 	}
 	if(init_pes_stream(ctx, &ctx->vpes, vpid) < 0)
 	{
 		free_pes_stream(&ctx->apes);
+		av_free(ctx->buf);
 		av_free(ctx);
 		return NULL;
 	}
 
+	/* av_mallocz has set all the other PIDs to NULL */
+	if(apid >= 0 && apid < TS_NPIDS)
+		ctx->pids[apid] = &ctx->apes;
+	if(vpid >= 0 && vpid < TS_NPIDS)
+		ctx->pids[vpid] = &ctx->vpes;
+
+	/*
+	 * we read large chunks, so don't let a read block once some data is available
+	 * otherwise low bit rate streams (eg radio) would only arrive every few seconds
+	 * stdio may already have some of the stream buffered (eg remote backend), so we keep reading through it
+	 */
+	ctx->fd_flags = fcntl(fileno(ts), F_GETFL);
+	if(ctx->fd_flags != -1)
+		fcntl(fileno(ts), F_SETFL, ctx->fd_flags | O_NONBLOCK);
+
 	ctx->is_start = 0;
 
 	/* last continuity check value (-1 => CC always passes) */
@@ -134,95 +200,25 @@ mpegts_open(FILE *ts, int apid, int vpid)
 	return ctx;
 }
 
-int
-mpegts_demux_frame(MpegTSContext *ctx, AVPacket *frame)
-{
-	AVPacket packet;
-	PESContext *pes;
-	uint8_t *frame_data;
-
-	do
-	{
-		if(mpegts_demux_packet(ctx, &packet) < 0)
-		{
-			av_free_packet(&packet);
-			return -1;
-		}
-		/* find the stream */
-		if((pes = find_pes_stream(ctx, packet.stream_index)) == NULL)
-			fatal("mpegts_demux_frame: unexpected PID %d", packet.stream_index);
-		/* is it the first packet of the next frame */
-		if(ctx->is_start == 0)
-		{
-			/* not a new frame, add data to the exisiting one */
-			if((frame_data = av_fast_realloc(pes->frame_data, &pes->alloc_size, pes->frame_size + packet.size)) == NULL)
-			{
-				av_free_packet(&packet);
-				return -1;
-			}
-			pes->frame_data = frame_data;
-			memcpy(pes->frame_data + pes->frame_size, packet.data, packet.size);
-			pes->frame_size += packet.size;
-			av_free_packet(&packet);
-		}
-	}
-	while(ctx->is_start == 0);
-
-	/*
-	 * pes->frame_data contains the last frame
-	 * copy it into the output packet
-	 * packet contains the first packet of the next frame
-	 * copy it into the PES context for the stream
-	 */
-	if(av_new_packet(frame, pes->frame_size) != 0)
-	{
-		av_free_packet(&packet);
-		return -1;
-	}
-	memcpy(frame->data, pes->frame_data, pes->frame_size);
-
-	frame->stream_index = pes->pid;
-	frame->pts = pes->frame_pts;
-	frame->dts = pes->frame_dts;
-
-	/* copy the first packet of the next frame into PES context */
-	if((frame_data = av_fast_realloc(pes->frame_data, &pes->alloc_size, packet.size)) == NULL)
-	{
-		av_free_packet(&packet);
-		av_free_packet(frame);
-		return -1;
-	}
-	pes->frame_data = frame_data;
-	pes->frame_size = packet.size;
-	memcpy(pes->frame_data, packet.data, packet.size);
-
-	/* remember the new frame's PTS (or calc from the previous one) */
-	if(packet.pts == AV_NOPTS_VALUE && pes->frame_pts != AV_NOPTS_VALUE)
-		pes->frame_pts += 3600;
-	else
-		pes->frame_pts = packet.pts;
-	if(packet.dts == AV_NOPTS_VALUE && pes->frame_dts != AV_NOPTS_VALUE)
-		pes->frame_dts += 3600;
-	else
-		pes->frame_dts = packet.dts;
-
-	av_free_packet(&packet);
-
-	return 0;
-}
+/*
+ * reads TS packets until we have a complete frame for one of our PIDs
+ * frame->stream_index is set to the PID
+ * the frame data is not copied, call av_free_packet() when you have finished with it
+ * return -1 if error or EOF. Return 0 if OK.
+ */
 
 int
-mpegts_demux_packet(MpegTSContext *ctx, AVPacket *pkt)
+mpegts_demux_frame(MpegTSContext *ctx, AVPacket *frame)
 {
-	uint8_t packet[TS_PACKET_SIZE];
+	const uint8_t *packet;
 	int ret;
 
-	ctx->pkt = pkt;
+	ctx->pkt = frame;
 
 	ctx->stop_parse = 0;
 	do
 	{
-		if((ret = read_packet(ctx->ts_stream, packet)) != 0)
+		if((ret = read_packet(ctx, &packet)) != 0)
 			return ret;
 		handle_packet(ctx, packet);
 	}
@@ -231,12 +227,28 @@ mpegts_demux_packet(MpegTSContext *ctx, AVPacket *pkt)
 	return 0;
 }
 
+/*
+ * returns true if we have reached the end of the transport stream
+ * and there are no more packets left in our buffer
+ */
+
+bool
+mpegts_eof(MpegTSContext *ctx)
+{
+	return feof(ctx->ts_stream) && (ctx->buf_end - ctx->buf_pos) < TS_PACKET_SIZE;
+}
+
 void
 mpegts_close(MpegTSContext *ctx)
 {
+	/* put the stream back how we found it */
+	if(ctx->fd_flags != -1)
+		fcntl(fileno(ctx->ts_stream), F_SETFL, ctx->fd_flags);
+
 	free_pes_stream(&ctx->apes);
 	free_pes_stream(&ctx->vpes);
 
+	av_free(ctx->buf);
 	av_free(ctx);
 
 	return;
@@ -244,43 +256,137 @@ mpegts_close(MpegTSContext *ctx)
 
 /* internal functions */
 
-/* return -1 if error or EOF. Return 0 if OK. */
 #define TS_SYNC_BYTE	0x47
 
+/*
+ * sets *packet to point to the next TS packet in our buffer
+ * the packet stays valid until the next call
+ * return -1 if error or EOF. Return 0 if OK.
+ */
+
+static int
+read_packet(MpegTSContext *ctx, const uint8_t **packet)
+{
+	/* make sure we have a whole packet */
+	if(ctx->buf_end - ctx->buf_pos < TS_PACKET_SIZE
+	&& fill_buffer(ctx, TS_PACKET_SIZE) < 0)
+		return -1;
+
+	/* have we lost sync */
+	if(ctx->buf[ctx->buf_pos] != TS_SYNC_BYTE
+	&& resync(ctx) < 0)
+		return -1;
+
+	*packet = ctx->buf + ctx->buf_pos;
+	ctx->buf_pos += TS_PACKET_SIZE;
+
+	return 0;
+}
+
+/*
+ * read from the TS until we have at least nbytes in our buffer
+ * reads as much as is available, up to TS_READ_SIZE, in one go
+ * only blocks if we have less than nbytes
+ * return -1 if error or EOF before we got nbytes. Return 0 if OK.
+ */
+
 static int
-read_packet(FILE *ts, uint8_t *buf)
+fill_buffer(MpegTSContext *ctx, unsigned int nbytes)
 {
+	struct pollfd pfd;
 	size_t nread;
-	unsigned int resync;
 
-	/* find the next sync byte */
-	resync = 0;
-	nread = 0;
-	*buf = 0;
-	do
+	/* keep any data we have not used yet */
+	if(ctx->buf_pos != 0)
+	{
+		memmove(ctx->buf, ctx->buf + ctx->buf_pos, ctx->buf_end - ctx->buf_pos);
+		ctx->buf_end -= ctx->buf_pos;
+		ctx->buf_pos = 0;
+	}
+
+	while(ctx->buf_end < nbytes)
 	{
-		/* read the whole of the next packet */
-		while(nread != TS_PACKET_SIZE && !feof(ts))
-			nread += fread(buf + nread, 1, TS_PACKET_SIZE - nread, ts);
-		if(nread > 0 && *buf != TS_SYNC_BYTE && !feof(ts))
+		nread = fread(ctx->buf + ctx->buf_end, 1, TS_READ_SIZE - ctx->buf_end, ctx->ts_stream);
+		ctx->buf_end += nread;
+		if(feof(ctx->ts_stream))
+			return (ctx->buf_end >= nbytes) ? 0 : -1;
+		if(ferror(ctx->ts_stream))
 		{
-			resync ++;
-			memmove(buf, buf + 1, nread - 1);
-			buf[nread - 1] = 0;
-			nread --;
+			if(errno != EAGAIN && errno != EWOULDBLOCK)
+				return -1;
+			/* nothing more available yet, wait for some more if we need it */
+			clearerr(ctx->ts_stream);
+			if(ctx->buf_end < nbytes)
+			{
+				pfd.fd = fileno(ctx->ts_stream);
+				pfd.events = POLLIN;
+				(void) poll(&pfd, 1, -1);
+			}
 		}
 	}
-	while(nread < TS_PACKET_SIZE && *buf != TS_SYNC_BYTE && !feof(ts));
 
-	if(feof(ts))
-		return -1;
+	return 0;
+}
 
-	if(resync > 0)
-		verbose("MPEG TS demux: lost sync; skipped %u bytes", resync);
+/*
+ * skip bytes until buf_pos is at a sync byte
+ * with more sync bytes after it at TS_PACKET_SIZE intervals
+ * return -1 if error or EOF. Return 0 if OK.
+ */
+
+static int
+resync(MpegTSContext *ctx)
+{
+	unsigned int need = ((TS_RESYNC_PACKETS - 1) * TS_PACKET_SIZE) + 1;
+	unsigned int skipped = 0;
+	unsigned int next;
+	uint8_t *sync;
+	int more = 1;
+
+	while(1)
+	{
+		/* make sure we can see the sync bytes we need to check, or as many as there are before EOF */
+		if(more && ctx->buf_end - ctx->buf_pos < need)
+			more = (fill_buffer(ctx, need) == 0);
+		if(ctx->buf_end - ctx->buf_pos < TS_PACKET_SIZE)
+			return -1;
+		if(ctx->buf[ctx->buf_pos] == TS_SYNC_BYTE && check_sync(ctx))
+			break;
+		/* memchr is vectorised, so it skips the junk much faster than checking a byte at a time */
+		sync = memchr(ctx->buf + ctx->buf_pos + 1, TS_SYNC_BYTE, ctx->buf_end - ctx->buf_pos - 1);
+		next = (sync != NULL) ? (sync - ctx->buf) : ctx->buf_end;
+		skipped += next - ctx->buf_pos;
+		ctx->buf_pos = next;
+	}
+
+	verbose("MPEG TS demux: lost sync; skipped %u bytes", skipped);
 
 	return 0;
 }
 
+/*
+ * returns true if there are sync bytes at TS_PACKET_SIZE intervals after buf_pos
+ * only checks the ones we have in our buffer
+ */
+
+static int
+check_sync(MpegTSContext *ctx)
+{
+	unsigned int pos;
+	unsigned int i;
+
+	for(i=1; i<TS_RESYNC_PACKETS; i++)
+	{
+		pos = ctx->buf_pos + (i * TS_PACKET_SIZE);
+		if(pos >= ctx->buf_end)
+			break;
+		if(ctx->buf[pos] != TS_SYNC_BYTE)
+			return 0;
+	}
+
+	return 1;
+}
+
 /* handle one TS packet */
 static void
 handle_packet(MpegTSContext *ctx, const uint8_t *packet)
@@ -292,7 +398,7 @@ handle_packet(MpegTSContext *ctx, const uint8_t *packet)
 
 	pid = ((packet[1] & 0x1f) << 8) | packet[2];
 
-	if((pes = find_pes_stream(ctx, pid)) == NULL)
+	if((pes = ctx->pids[pid]) == NULL)
 	{
 		verbose("MPEG TS demux: ignoring unexpected PID %d", pid);
 		return;
@@ -325,6 +431,10 @@ handle_packet(MpegTSContext *ctx, const uint8_t *packet)
 	if(p >= p_end)
 		return;
 
+	/* the start of the next PES packet means the frame we have been building is complete */
+	if(ctx->is_start && pes->frame_size > 0)
+		output_frame(pes);
+
 	mpegts_push_data(pes, p, p_end - p, ctx->is_start);
 
 	return;
@@ -338,9 +448,9 @@ init_pes_stream(MpegTSContext *ctx, PESContext *pes, int pid)
 	pes->ts = ctx;
 	pes->pid = pid;
 
-	pes->alloc_size = INIT_FRAME_BUFF_SIZE;
-	if((pes->frame_data = av_malloc(pes->alloc_size)) == NULL)
+	if((pes->frame = get_frame_buffer()) == NULL)
 		return -1;
+	pes->frame_size = 0;
 
 	pes->frame_pts = AV_NOPTS_VALUE;
 	pes->frame_dts = AV_NOPTS_VALUE;
@@ -351,28 +461,20 @@ init_pes_stream(MpegTSContext *ctx, PESContext *pes, int pid)
 static void
 free_pes_stream(PESContext *pes)
 {
-	if(pes->frame_data)
-		av_free(pes->frame_data);
+	if(pes->frame)
+		release_frame_buffer(pes->frame);
+	pes->frame = NULL;
 
 	return;
 }
 
-static PESContext *
-find_pes_stream(MpegTSContext *ctx, int pid)
-{
-	if(pid == ctx->apid)
-		return &ctx->apes;
-	else if(pid == ctx->vpid)
-		return &ctx->vpes;
-	else
-		return NULL;
-}
+/*
+ * parse the PES header, and add the payload to the frame we are building
+ */
 
-/* return non zero if a packet could be constructed */
 static void
 mpegts_push_data(PESContext *pes, const uint8_t *buf, int buf_size, int is_start)
 {
-	MpegTSContext *ts = pes->ts;
 	const uint8_t *p;
 	int len, code;
 
@@ -454,6 +556,15 @@ mpegts_push_data(PESContext *pes, const uint8_t *buf, int buf_size, int is_start
 					pes->dts = get_pts(r);
 					r += 5;
 				}
+				/* remember the new frame's PTS (or calc from the previous one) */
+				if(pes->pts == AV_NOPTS_VALUE && pes->frame_pts != AV_NOPTS_VALUE)
+					pes->frame_pts += 3600;
+				else
+					pes->frame_pts = pes->pts;
+				if(pes->dts == AV_NOPTS_VALUE && pes->frame_dts != AV_NOPTS_VALUE)
+					pes->frame_dts += 3600;
+				else
+					pes->frame_dts = pes->dts;
 				/* we got the full header. We parse it and get the payload */
 				pes->state = MPEGTS_PAYLOAD;
 			}
@@ -472,19 +583,8 @@ mpegts_push_data(PESContext *pes, const uint8_t *buf, int buf_size, int is_start
 			}
 			if(len > 0)
 			{
-				AVPacket *pkt = ts->pkt;
-				if(av_new_packet(pkt, len) == 0)
-				{
-					memcpy(pkt->data, p, len);
-					pkt->stream_index = pes->pid;
-					pkt->pts = pes->pts;
-					pkt->dts = pes->dts;
-					/* reset pts values */
-					pes->pts = AV_NOPTS_VALUE;
-					pes->dts = AV_NOPTS_VALUE;
-					ts->stop_parse = 1;
-					return;
-				}
+				append_frame_data(pes, p, len);
+				pes->data_index += len;
 			}
 			buf_size = 0;
 			break;
@@ -498,6 +598,152 @@ mpegts_push_data(PESContext *pes, const uint8_t *buf, int buf_size, int is_start
 	return;
 }
 
+/*
+ * add the payload to the frame we are building
+ * this is the only time the payload is copied
+ */
+
+static void
+append_frame_data(PESContext *pes, const uint8_t *data, int len)
+{
+	FrameBuffer *buf;
+	unsigned int need = pes->frame_size + len;
+	unsigned int size;
+	uint8_t *bigger;
+
+	if(pes->frame == NULL && (pes->frame = get_frame_buffer()) == NULL)
+		return;
+	buf = pes->frame;
+
+	/* make sure we have room */
+	if(need > buf->alloc_size)
+	{
+		size = MAX(need, buf->alloc_size * 2);
+		if((bigger = av_realloc(buf->data, size + FF_INPUT_BUFFER_PADDING_SIZE)) == NULL)
+		{
+			/* drop the rest of this frame */
+			pes->state = MPEGTS_SKIP;
+			return;
+		}
+		buf->data = bigger;
+		buf->alloc_size = size;
+	}
+
+	memcpy(buf->data + pes->frame_size, data, len);
+	pes->frame_size += len;
+
+	return;
+}
+
+/*
+ * give the frame we have built for this PES to the caller
+ * and start building the next frame in a fresh buffer
+ */
+
+static void
+output_frame(PESContext *pes)
+{
+	MpegTSContext *ts = pes->ts;
+	AVPacket *pkt = ts->pkt;
+	FrameBuffer *buf = pes->frame;
+
+	/* the decoders may read a few bytes past the end */
+	memset(buf->data + pes->frame_size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+
+	av_init_packet(pkt);
+	pkt->data = buf->data;
+	pkt->size = pes->frame_size;
+	pkt->priv = buf;
+	pkt->destruct = free_frame_packet;
+	pkt->stream_index = pes->pid;
+	pkt->pts = pes->frame_pts;
+	pkt->dts = pes->frame_dts;
+
+	ts->stop_parse = 1;
+
+	/* if this fails, append_frame_data will try again */
+	pes->frame = get_frame_buffer();
+	pes->frame_size = 0;
+
+	return;
+}
+
+/*
+ * returns a spare frame buffer, or allocates a new one
+ * returns NULL if out of memory
+ */
+
+static FrameBuffer *
+get_frame_buffer(void)
+{
+	FrameBuffer *buf;
+
+	pthread_mutex_lock(&_spare_lock);
+	if((buf = _spare_buffs) != NULL)
+	{
+		_spare_buffs = buf->next;
+		_nspare_buffs --;
+	}
+	pthread_mutex_unlock(&_spare_lock);
+
+	if(buf != NULL)
+		return buf;
+
+	if((buf = av_malloc(sizeof(FrameBuffer))) == NULL)
+		return NULL;
+
+	buf->alloc_size = INIT_FRAME_BUFF_SIZE;
+	if((buf->data = av_malloc(buf->alloc_size + FF_INPUT_BUFFER_PADDING_SIZE)) == NULL)
+	{
+		av_free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+/*
+ * put the buffer back in the pool, or free it if we already have enough spares
+ */
+
+static void
+release_frame_buffer(FrameBuffer *buf)
+{
+	pthread_mutex_lock(&_spare_lock);
+	if(_nspare_buffs < MAX_SPARE_FRAME_BUFFS)
+	{
+		buf->next = _spare_buffs;
+		_spare_buffs = buf;
+		_nspare_buffs ++;
+		buf = NULL;
+	}
+	pthread_mutex_unlock(&_spare_lock);
+
+	if(buf != NULL)
+	{
+		av_free(buf->data);
+		av_free(buf);
+	}
+
+	return;
+}
+
+/*
+ * AVPacket destructor for frames we output
+ */
+
+static void
+free_frame_packet(AVPacket *pkt)
+{
+	release_frame_buffer((FrameBuffer *) pkt->priv);
+
+	pkt->data = NULL;
+	pkt->size = 0;
+	pkt->priv = NULL;
+
+	return;
+}
+
 static int64_t
 get_pts(const uint8_t *p)
 {
@@ -5,6 +5,9 @@
 #ifndef __MPEGTS_H__
 #define __MPEGTS_H__
 
+#include <stdio.h>
+#include <stdbool.h>
+
 /* stream types we care about */
 #define STREAM_TYPE_VIDEO_MPEG1		0x01
 #define STREAM_TYPE_VIDEO_MPEG2		0x02
@@ -21,7 +24,7 @@ typedef struct MpegTSContext MpegTSContext;
 
 MpegTSContext *mpegts_open(FILE *, int, int);
 int mpegts_demux_frame(MpegTSContext *, AVPacket *);
-int mpegts_demux_packet(MpegTSContext *, AVPacket *);
+bool mpegts_eof(MpegTSContext *);
 void mpegts_close(MpegTSContext *);
 
 #endif	/* __MPEGTS_H__ */
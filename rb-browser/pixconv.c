@@ -0,0 +1,530 @@
+/*
+ * pixconv.c
+ *
+ * pixel conversion and scaling for MHEGBitmap_fromRGBA
+ * and blending for the in memory display backend
+ * the vector versions are chosen at run time if the CPU supports them
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "pixconv.h"
+#include "utils.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PIXCONV_X86
+#include <immintrin.h>
+#endif
+
+/* internal functions */
+static void premultiply_c(uint32_t *, uint32_t *, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int);
+#ifdef PIXCONV_X86
+static void premultiply_sse2(uint32_t *, uint32_t *, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int);
+static void premultiply_avx2(uint32_t *, uint32_t *, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int);
+#endif
+
+static void over_c(uint32_t *, uint32_t *, unsigned int);
+static void over_solid_c(uint32_t *, uint32_t, unsigned int);
+static void over_mask_c(uint32_t *, uint32_t, uint8_t *, unsigned int);
+#ifdef PIXCONV_X86
+static void over_sse2(uint32_t *, uint32_t *, unsigned int);
+static void over_solid_sse2(uint32_t *, uint32_t, unsigned int);
+static void over_mask_sse2(uint32_t *, uint32_t, uint8_t *, unsigned int);
+#endif
+
+/*
+ * (c * a) / 255, rounded to the nearest integer, without a divide
+ */
+
+#define MUL_DIV255(C, A)	(((((C) * (A)) + 128) + ((((C) * (A)) + 128) >> 8)) >> 8)
+
+/*
+ * src is an array of npixs ffmpeg PIX_FMT_RGBA32 pixels, ie (A << 24) | (R << 16) | (G << 8) | B
+ * writes npixs pixels to dst with the RGB components premultiplied by alpha, as XRender expects
+ * the components in dst are shifted to the given positions
+ * dst and src may be the same
+ */
+
+void
+pixconv_premultiply(uint32_t *dst, uint32_t *src, unsigned int npixs,
+		    unsigned int ashift, unsigned int rshift, unsigned int gshift, unsigned int bshift)
+{
+#ifdef PIXCONV_X86
+	if(__builtin_cpu_supports("avx2"))
+		premultiply_avx2(dst, src, npixs, ashift, rshift, gshift, bshift);
+	else if(__builtin_cpu_supports("sse2"))
+		premultiply_sse2(dst, src, npixs, ashift, rshift, gshift, bshift);
+	else
+#endif
+		premultiply_c(dst, src, npixs, ashift, rshift, gshift, bshift);
+
+	return;
+}
+
+static void
+premultiply_c(uint32_t *dst, uint32_t *src, unsigned int npixs,
+	      unsigned int ashift, unsigned int rshift, unsigned int gshift, unsigned int bshift)
+{
+	uint32_t pix;
+	uint32_t r, g, b, a;
+	unsigned int i;
+
+	for(i=0; i<npixs; i++)
+	{
+		pix = src[i];
+		a = (pix >> 24) & 0xff;
+		r = MUL_DIV255((pix >> 16) & 0xff, a);
+		g = MUL_DIV255((pix >> 8) & 0xff, a);
+		b = MUL_DIV255(pix & 0xff, a);
+		dst[i] = (a << ashift) | (r << rshift) | (g << gshift) | (b << bshift);
+	}
+
+	return;
+}
+
+#ifdef PIXCONV_X86
+
+/*
+ * the components are at most 255, so a 16-bit multiply of the 32-bit lanes gives the full product
+ */
+
+__attribute__((target("sse2")))
+static void
+premultiply_sse2(uint32_t *dst, uint32_t *src, unsigned int npixs,
+		 unsigned int ashift, unsigned int rshift, unsigned int gshift, unsigned int bshift)
+{
+	__m128i mask = _mm_set1_epi32(0xff);
+	__m128i round = _mm_set1_epi32(128);
+	__m128i as = _mm_cvtsi32_si128(ashift);
+	__m128i rs = _mm_cvtsi32_si128(rshift);
+	__m128i gs = _mm_cvtsi32_si128(gshift);
+	__m128i bs = _mm_cvtsi32_si128(bshift);
+	__m128i pix, a, r, g, b;
+	unsigned int i;
+
+	for(i=0; i+4<=npixs; i+=4)
+	{
+		pix = _mm_loadu_si128((__m128i *) &src[i]);
+		a = _mm_srli_epi32(pix, 24);
+		r = _mm_and_si128(_mm_srli_epi32(pix, 16), mask);
+		g = _mm_and_si128(_mm_srli_epi32(pix, 8), mask);
+		b = _mm_and_si128(pix, mask);
+		r = _mm_add_epi32(_mm_mullo_epi16(r, a), round);
+		g = _mm_add_epi32(_mm_mullo_epi16(g, a), round);
+		b = _mm_add_epi32(_mm_mullo_epi16(b, a), round);
+		r = _mm_srli_epi32(_mm_add_epi32(r, _mm_srli_epi32(r, 8)), 8);
+		g = _mm_srli_epi32(_mm_add_epi32(g, _mm_srli_epi32(g, 8)), 8);
+		b = _mm_srli_epi32(_mm_add_epi32(b, _mm_srli_epi32(b, 8)), 8);
+		pix = _mm_or_si128(_mm_or_si128(_mm_sll_epi32(a, as), _mm_sll_epi32(r, rs)),
+				   _mm_or_si128(_mm_sll_epi32(g, gs), _mm_sll_epi32(b, bs)));
+		_mm_storeu_si128((__m128i *) &dst[i], pix);
+	}
+
+	/* any left over */
+	premultiply_c(&dst[i], &src[i], npixs - i, ashift, rshift, gshift, bshift);
+
+	return;
+}
+
+__attribute__((target("avx2")))
+static void
+premultiply_avx2(uint32_t *dst, uint32_t *src, unsigned int npixs,
+		 unsigned int ashift, unsigned int rshift, unsigned int gshift, unsigned int bshift)
+{
+	__m256i mask = _mm256_set1_epi32(0xff);
+	__m256i round = _mm256_set1_epi32(128);
+	__m128i as = _mm_cvtsi32_si128(ashift);
+	__m128i rs = _mm_cvtsi32_si128(rshift);
+	__m128i gs = _mm_cvtsi32_si128(gshift);
+	__m128i bs = _mm_cvtsi32_si128(bshift);
+	__m256i pix, a, r, g, b;
+	unsigned int i;
+
+	for(i=0; i+8<=npixs; i+=8)
+	{
+		pix = _mm256_loadu_si256((__m256i *) &src[i]);
+		a = _mm256_srli_epi32(pix, 24);
+		r = _mm256_and_si256(_mm256_srli_epi32(pix, 16), mask);
+		g = _mm256_and_si256(_mm256_srli_epi32(pix, 8), mask);
+		b = _mm256_and_si256(pix, mask);
+		r = _mm256_add_epi32(_mm256_mullo_epi16(r, a), round);
+		g = _mm256_add_epi32(_mm256_mullo_epi16(g, a), round);
+		b = _mm256_add_epi32(_mm256_mullo_epi16(b, a), round);
+		r = _mm256_srli_epi32(_mm256_add_epi32(r, _mm256_srli_epi32(r, 8)), 8);
+		g = _mm256_srli_epi32(_mm256_add_epi32(g, _mm256_srli_epi32(g, 8)), 8);
+		b = _mm256_srli_epi32(_mm256_add_epi32(b, _mm256_srli_epi32(b, 8)), 8);
+		pix = _mm256_or_si256(_mm256_or_si256(_mm256_sll_epi32(a, as), _mm256_sll_epi32(r, rs)),
+				      _mm256_or_si256(_mm256_sll_epi32(g, gs), _mm256_sll_epi32(b, bs)));
+		_mm256_storeu_si256((__m256i *) &dst[i], pix);
+	}
+
+	/* any left over */
+	premultiply_c(&dst[i], &src[i], npixs - i, ashift, rshift, gshift, bshift);
+
+	return;
+}
+
+#endif	/* PIXCONV_X86 */
+
+/*
+ * bilinear scale the src_width x src_height image in src to dst_width x dst_height in dst
+ * each pixel is treated as four independent 8-bit components,
+ * so the pixels should be premultiplied if they have an alpha component
+ */
+
+void
+pixconv_scale(uint32_t *dst, unsigned int dst_width, unsigned int dst_height,
+	      uint32_t *src, unsigned int src_width, unsigned int src_height)
+{
+	unsigned int *xoff;
+	unsigned int *xfrac;
+	unsigned int x, y;
+	unsigned int x0, y0, y1;
+	unsigned int fx, fy;
+	int64_t pos;
+	uint32_t *row0, *row1;
+	uint32_t p00, p01, p10, p11;
+	uint32_t top, bot, pix;
+	unsigned int shift;
+
+	if(dst_width == 0 || dst_height == 0 || src_width == 0 || src_height == 0)
+		return;
+
+	/* work out the src pixel and weight for each dst column, in 16.16 fixed point */
+	xoff = safe_malloc(dst_width * sizeof(unsigned int));
+	xfrac = safe_malloc(dst_width * sizeof(unsigned int));
+	for(x=0; x<dst_width; x++)
+	{
+		/* sample at the centre of each dst pixel */
+		pos = ((((int64_t) x << 1) + 1) * src_width << 15) / dst_width - (1 << 15);
+		if(pos < 0)
+			pos = 0;
+		x0 = pos >> 16;
+		fx = (pos >> 8) & 0xff;
+		if(x0 >= src_width - 1)
+		{
+			x0 = src_width - 1;
+			fx = 0;
+		}
+		xoff[x] = x0;
+		xfrac[x] = fx;
+	}
+
+	for(y=0; y<dst_height; y++)
+	{
+		pos = ((((int64_t) y << 1) + 1) * src_height << 15) / dst_height - (1 << 15);
+		if(pos < 0)
+			pos = 0;
+		y0 = pos >> 16;
+		fy = (pos >> 8) & 0xff;
+		if(y0 >= src_height - 1)
+		{
+			y0 = src_height - 1;
+			fy = 0;
+		}
+		y1 = (fy != 0) ? y0 + 1 : y0;
+		row0 = &src[y0 * src_width];
+		row1 = &src[y1 * src_width];
+		for(x=0; x<dst_width; x++)
+		{
+			x0 = xoff[x];
+			fx = xfrac[x];
+			p00 = row0[x0];
+			p10 = row1[x0];
+			p01 = (fx != 0) ? row0[x0 + 1] : p00;
+			p11 = (fx != 0) ? row1[x0 + 1] : p10;
+			pix = 0;
+			for(shift=0; shift<32; shift+=8)
+			{
+				top = (((p00 >> shift) & 0xff) * (256 - fx)) + (((p01 >> shift) & 0xff) * fx);
+				bot = (((p10 >> shift) & 0xff) * (256 - fx)) + (((p11 >> shift) & 0xff) * fx);
+				pix |= (((top * (256 - fy)) + (bot * fy) + 32768) >> 16) << shift;
+			}
+			*(dst++) = pix;
+		}
+	}
+
+	safe_free(xoff);
+	safe_free(xfrac);
+
+	return;
+}
+
+/*
+ * the blending functions work on premultiplied pixels with alpha in the top 8 bits
+ * the order of the other components does not matter
+ * each component in dst becomes src + (dst * (255 - src alpha)) / 255, ie XRender's PictOpOver
+ * the result is clamped, in case a component in src is bigger than its alpha
+ */
+
+/*
+ * blend npixs pixels from src onto dst
+ */
+
+void
+pixconv_over(uint32_t *dst, uint32_t *src, unsigned int npixs)
+{
+#ifdef PIXCONV_X86
+	if(__builtin_cpu_supports("sse2"))
+		over_sse2(dst, src, npixs);
+	else
+#endif
+		over_c(dst, src, npixs);
+
+	return;
+}
+
+/*
+ * blend a solid colour onto npixs pixels in dst
+ */
+
+void
+pixconv_over_solid(uint32_t *dst, uint32_t pix, unsigned int npixs)
+{
+#ifdef PIXCONV_X86
+	if(__builtin_cpu_supports("sse2"))
+		over_solid_sse2(dst, pix, npixs);
+	else
+#endif
+		over_solid_c(dst, pix, npixs);
+
+	return;
+}
+
+/*
+ * blend a solid colour onto npixs pixels in dst, through an 8-bit coverage mask (eg an anti-aliased glyph)
+ */
+
+void
+pixconv_over_mask(uint32_t *dst, uint32_t pix, uint8_t *mask, unsigned int npixs)
+{
+#ifdef PIXCONV_X86
+	if(__builtin_cpu_supports("sse2"))
+		over_mask_sse2(dst, pix, mask, npixs);
+	else
+#endif
+		over_mask_c(dst, pix, mask, npixs);
+
+	return;
+}
+
+static inline uint32_t
+over_pixel(uint32_t dst, uint32_t src)
+{
+	uint32_t ia = 255 - (src >> 24);
+	uint32_t out = 0;
+	uint32_t c;
+	unsigned int shift;
+
+	for(shift=0; shift<32; shift+=8)
+	{
+		c = ((src >> shift) & 0xff) + MUL_DIV255((dst >> shift) & 0xff, ia);
+		out |= MIN(c, 255) << shift;
+	}
+
+	return out;
+}
+
+static inline uint32_t
+mask_pixel(uint32_t pix, unsigned int m)
+{
+	uint32_t out = 0;
+	unsigned int shift;
+
+	for(shift=0; shift<32; shift+=8)
+		out |= MUL_DIV255((pix >> shift) & 0xff, m) << shift;
+
+	return out;
+}
+
+static void
+over_c(uint32_t *dst, uint32_t *src, unsigned int npixs)
+{
+	unsigned int i;
+
+	for(i=0; i<npixs; i++)
+	{
+		if(src[i] >= 0xff000000)
+			dst[i] = src[i];
+		else if(src[i] != 0)
+			dst[i] = over_pixel(dst[i], src[i]);
+	}
+
+	return;
+}
+
+static void
+over_solid_c(uint32_t *dst, uint32_t pix, unsigned int npixs)
+{
+	unsigned int i;
+
+	if(pix >= 0xff000000)
+	{
+		for(i=0; i<npixs; i++)
+			dst[i] = pix;
+	}
+	else
+	{
+		for(i=0; i<npixs; i++)
+			dst[i] = over_pixel(dst[i], pix);
+	}
+
+	return;
+}
+
+static void
+over_mask_c(uint32_t *dst, uint32_t pix, uint8_t *mask, unsigned int npixs)
+{
+	unsigned int i;
+
+	for(i=0; i<npixs; i++)
+	{
+		if(mask[i] == 0xff)
+			dst[i] = over_pixel(dst[i], pix);
+		else if(mask[i] != 0)
+			dst[i] = over_pixel(dst[i], mask_pixel(pix, mask[i]));
+	}
+
+	return;
+}
+
+#ifdef PIXCONV_X86
+
+/*
+ * (x * y) / 255 for each 16-bit lane, rounded to the nearest integer
+ */
+
+__attribute__((target("sse2")))
+static inline __m128i
+mul_div255_sse2(__m128i x, __m128i y)
+{
+	__m128i t = _mm_add_epi16(_mm_mullo_epi16(x, y), _mm_set1_epi16(128));
+
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+/*
+ * blend 4 src pixels onto 4 dst pixels
+ * ia_lo/ia_hi have (255 - src alpha) in each 16-bit component of the 2 low/high pixels
+ */
+
+__attribute__((target("sse2")))
+static inline __m128i
+over4_sse2(__m128i dst, __m128i src, __m128i ia_lo, __m128i ia_hi)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i lo, hi;
+
+	lo = mul_div255_sse2(_mm_unpacklo_epi8(dst, zero), ia_lo);
+	hi = mul_div255_sse2(_mm_unpackhi_epi8(dst, zero), ia_hi);
+
+	return _mm_adds_epu8(_mm_packus_epi16(lo, hi), src);
+}
+
+__attribute__((target("sse2")))
+static void
+over_sse2(uint32_t *dst, uint32_t *src, unsigned int npixs)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i alpha = _mm_set1_epi32(0xff000000);
+	__m128i ff = _mm_set1_epi32(0xff);
+	__m128i s, d, ia;
+	unsigned int i;
+
+	for(i=0; i+4<=npixs; i+=4)
+	{
+		s = _mm_loadu_si128((__m128i *) &src[i]);
+		/* all transparent, nothing to do */
+		if(_mm_movemask_epi8(_mm_cmpeq_epi32(s, zero)) == 0xffff)
+			continue;
+		/* all opaque, just copy them */
+		if(_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, alpha), alpha)) == 0xffff)
+		{
+			_mm_storeu_si128((__m128i *) &dst[i], s);
+			continue;
+		}
+		d = _mm_loadu_si128((__m128i *) &dst[i]);
+		/* 255 - alpha in both 16-bit halves of each 32-bit lane */
+		ia = _mm_sub_epi32(ff, _mm_srli_epi32(s, 24));
+		ia = _mm_or_si128(ia, _mm_slli_epi32(ia, 16));
+		d = over4_sse2(d, s, _mm_unpacklo_epi32(ia, ia), _mm_unpackhi_epi32(ia, ia));
+		_mm_storeu_si128((__m128i *) &dst[i], d);
+	}
+
+	/* any left over */
+	over_c(&dst[i], &src[i], npixs - i);
+
+	return;
+}
+
+__attribute__((target("sse2")))
+static void
+over_solid_sse2(uint32_t *dst, uint32_t pix, unsigned int npixs)
+{
+	__m128i s = _mm_set1_epi32(pix);
+	__m128i ia = _mm_set1_epi16(255 - (pix >> 24));
+	__m128i d;
+	unsigned int i;
+
+	for(i=0; i+4<=npixs; i+=4)
+	{
+		if(pix >= 0xff000000)
+		{
+			d = s;
+		}
+		else
+		{
+			d = _mm_loadu_si128((__m128i *) &dst[i]);
+			d = over4_sse2(d, s, ia, ia);
+		}
+		_mm_storeu_si128((__m128i *) &dst[i], d);
+	}
+
+	/* any left over */
+	over_solid_c(&dst[i], pix, npixs - i);
+
+	return;
+}
+
+__attribute__((target("sse2")))
+static void
+over_mask_sse2(uint32_t *dst, uint32_t pix, uint8_t *mask, unsigned int npixs)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i ff = _mm_set1_epi32(0xff);
+	__m128i pix16 = _mm_unpacklo_epi8(_mm_set1_epi32(pix), zero);
+	__m128i m, m_lo, m_hi;
+	__m128i s, d, ia;
+	uint32_t m4;
+	unsigned int i;
+
+	for(i=0; i+4<=npixs; i+=4)
+	{
+		memcpy(&m4, &mask[i], 4);
+		/* nothing to draw */
+		if(m4 == 0)
+			continue;
+		/* spread each mask value across the 4 16-bit components of its pixel */
+		m = _mm_unpacklo_epi8(_mm_cvtsi32_si128(m4), zero);
+		m = _mm_unpacklo_epi16(m, m);
+		m_lo = _mm_unpacklo_epi32(m, m);
+		m_hi = _mm_unpackhi_epi32(m, m);
+		/* the colour scaled by the coverage */
+		s = _mm_packus_epi16(mul_div255_sse2(pix16, m_lo), mul_div255_sse2(pix16, m_hi));
+		/* then blend it on */
+		d = _mm_loadu_si128((__m128i *) &dst[i]);
+		ia = _mm_sub_epi32(ff, _mm_srli_epi32(s, 24));
+		ia = _mm_or_si128(ia, _mm_slli_epi32(ia, 16));
+		d = over4_sse2(d, s, _mm_unpacklo_epi32(ia, ia), _mm_unpackhi_epi32(ia, ia));
+		_mm_storeu_si128((__m128i *) &dst[i], d);
+	}
+
+	/* any left over */
+	over_mask_c(&dst[i], pix, &mask[i], npixs - i);
+
+	return;
+}
+
+#endif	/* PIXCONV_X86 */
@@ -0,0 +1,17 @@
+/*
+ * pixconv.h
+ */
+
+#ifndef __PIXCONV_H__
+#define __PIXCONV_H__
+
+#include <stdint.h>
+
+void pixconv_premultiply(uint32_t *, uint32_t *, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int);
+void pixconv_scale(uint32_t *, unsigned int, unsigned int, uint32_t *, unsigned int, unsigned int);
+
+void pixconv_over(uint32_t *, uint32_t *, unsigned int);
+void pixconv_over_solid(uint32_t *, uint32_t, unsigned int);
+void pixconv_over_mask(uint32_t *, uint32_t, uint8_t *, unsigned int);
+
+#endif	/* __PIXCONV_H__ */
@@ -0,0 +1,325 @@
+/*
+ * pixconvtest.c
+ *
+ * checks the SSE2 and AVX2 pixel conversions give exactly the same output as the plain C versions
+ * runs each one on every width up to MAX_WIDTH, with the buffers at every alignment
+ * the vector versions are static, so we include pixconv.c to get at them
+ * exits with EXIT_FAILURE and says which function failed if any output is different
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pixconv.c"
+
+/* longer than a few vectors, so the main loops and the left over pixels are both tested */
+#define MAX_WIDTH	67
+/* pixel offsets, so the buffers start at every alignment a 32 byte vector can see */
+#define MAX_OFFSET	8
+
+typedef void (*premultiply_fn)(uint32_t *, uint32_t *, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int);
+typedef void (*over_fn)(uint32_t *, uint32_t *, unsigned int);
+typedef void (*over_solid_fn)(uint32_t *, uint32_t, unsigned int);
+typedef void (*over_mask_fn)(uint32_t *, uint32_t, uint8_t *, unsigned int);
+
+void usage(char *);
+unsigned int test_premultiply(char *, premultiply_fn);
+unsigned int test_over(char *, over_fn);
+unsigned int test_over_solid(char *, over_solid_fn);
+unsigned int test_over_mask(char *, over_mask_fn);
+void random_pixels(uint32_t *, unsigned int, bool);
+uint32_t random_pixel(bool);
+unsigned int random_byte(void);
+bool check(char *, unsigned int, unsigned int, uint32_t *, uint32_t *, unsigned int);
+
+/* the component shifts MHEGDisplay_convertRGBA may be given */
+static unsigned int shifts[][4] =
+{
+	{ 24, 16, 8, 0 },	/* ARGB */
+	{ 24, 0, 8, 16 },	/* ABGR */
+	{ 0, 24, 16, 8 },	/* RGBA */
+	{ 0, 8, 16, 24 }	/* BGRA */
+};
+
+#define NSHIFTS	(sizeof(shifts) / sizeof(shifts[0]))
+
+/* repeatable random numbers */
+static uint32_t seed = 1;
+
+int
+main(int argc, char *argv[])
+{
+	char *prog = argv[0];
+	int arg;
+	unsigned int nfailed = 0;
+
+	while((arg = getopt(argc, argv, "s:")) != EOF)
+	{
+		switch(arg)
+		{
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+
+		default:
+			usage(prog);
+			break;
+		}
+	}
+
+	/* xorshift never gets out of 0 */
+	if(optind != argc || seed == 0)
+		usage(prog);
+
+#ifdef PIXCONV_X86
+	if(__builtin_cpu_supports("sse2"))
+	{
+		nfailed += test_premultiply("premultiply_sse2", premultiply_sse2);
+		nfailed += test_over("over_sse2", over_sse2);
+		nfailed += test_over_solid("over_solid_sse2", over_solid_sse2);
+		nfailed += test_over_mask("over_mask_sse2", over_mask_sse2);
+	}
+	else
+	{
+		printf("CPU does not have SSE2, not tested\n");
+	}
+	if(__builtin_cpu_supports("avx2"))
+		nfailed += test_premultiply("premultiply_avx2", premultiply_avx2);
+	else
+		printf("CPU does not have AVX2, premultiply_avx2 not tested\n");
+#else
+	printf("Not an x86 CPU, there are no vector versions to test\n");
+#endif
+
+	if(nfailed > 0)
+	{
+		printf("%u tests failed\n", nfailed);
+		return EXIT_FAILURE;
+	}
+
+	printf("all tests passed\n");
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * each test returns the number of failures
+ * the src and dst are at different offsets, so they are not aligned with each other either
+ */
+
+unsigned int
+test_premultiply(char *name, premultiply_fn fn)
+{
+	uint32_t src[MAX_WIDTH + MAX_OFFSET];
+	uint32_t expect[MAX_WIDTH + MAX_OFFSET];
+	uint32_t got[MAX_WIDTH + MAX_OFFSET];
+	unsigned int *s;
+	unsigned int width, offset, i;
+	unsigned int nfailed = 0;
+
+	for(i=0; i<NSHIFTS; i++)
+	{
+		s = shifts[i];
+		for(width=0; width<=MAX_WIDTH; width++)
+		{
+			for(offset=0; offset<MAX_OFFSET; offset++)
+			{
+				/* not premultiplied yet, so any values */
+				random_pixels(src, MAX_WIDTH + MAX_OFFSET, false);
+				/* so we can see if it writes passed the end */
+				random_pixels(expect, MAX_WIDTH + MAX_OFFSET, false);
+				memcpy(got, expect, sizeof(got));
+				premultiply_c(&expect[offset], &src[MAX_OFFSET - 1 - offset], width, s[0], s[1], s[2], s[3]);
+				(*fn)(&got[offset], &src[MAX_OFFSET - 1 - offset], width, s[0], s[1], s[2], s[3]);
+				if(!check(name, width, offset, expect, got, MAX_WIDTH + MAX_OFFSET))
+					nfailed ++;
+			}
+		}
+		/* in place */
+		for(width=0; width<=MAX_WIDTH; width++)
+		{
+			for(offset=0; offset<MAX_OFFSET; offset++)
+			{
+				random_pixels(expect, MAX_WIDTH + MAX_OFFSET, false);
+				memcpy(got, expect, sizeof(got));
+				premultiply_c(&expect[offset], &expect[offset], width, s[0], s[1], s[2], s[3]);
+				(*fn)(&got[offset], &got[offset], width, s[0], s[1], s[2], s[3]);
+				if(!check(name, width, offset, expect, got, MAX_WIDTH + MAX_OFFSET))
+					nfailed ++;
+			}
+		}
+	}
+
+	return nfailed;
+}
+
+unsigned int
+test_over(char *name, over_fn fn)
+{
+	uint32_t src[MAX_WIDTH + MAX_OFFSET];
+	uint32_t expect[MAX_WIDTH + MAX_OFFSET];
+	uint32_t got[MAX_WIDTH + MAX_OFFSET];
+	unsigned int width, offset;
+	unsigned int nfailed = 0;
+
+	for(width=0; width<=MAX_WIDTH; width++)
+	{
+		for(offset=0; offset<MAX_OFFSET; offset++)
+		{
+			random_pixels(src, MAX_WIDTH + MAX_OFFSET, true);
+			random_pixels(expect, MAX_WIDTH + MAX_OFFSET, true);
+			memcpy(got, expect, sizeof(got));
+			over_c(&expect[offset], &src[MAX_OFFSET - 1 - offset], width);
+			(*fn)(&got[offset], &src[MAX_OFFSET - 1 - offset], width);
+			if(!check(name, width, offset, expect, got, MAX_WIDTH + MAX_OFFSET))
+				nfailed ++;
+		}
+	}
+
+	return nfailed;
+}
+
+unsigned int
+test_over_solid(char *name, over_solid_fn fn)
+{
+	uint32_t expect[MAX_WIDTH + MAX_OFFSET];
+	uint32_t got[MAX_WIDTH + MAX_OFFSET];
+	uint32_t pix;
+	unsigned int width, offset;
+	unsigned int nfailed = 0;
+
+	for(width=0; width<=MAX_WIDTH; width++)
+	{
+		for(offset=0; offset<MAX_OFFSET; offset++)
+		{
+			pix = random_pixel(true);
+			random_pixels(expect, MAX_WIDTH + MAX_OFFSET, true);
+			memcpy(got, expect, sizeof(got));
+			over_solid_c(&expect[offset], pix, width);
+			(*fn)(&got[offset], pix, width);
+			if(!check(name, width, offset, expect, got, MAX_WIDTH + MAX_OFFSET))
+				nfailed ++;
+		}
+	}
+
+	return nfailed;
+}
+
+unsigned int
+test_over_mask(char *name, over_mask_fn fn)
+{
+	/* the mask is bytes, so it gets offsets that are not a multiple of 4 */
+	uint8_t mask[MAX_WIDTH + (MAX_OFFSET * 4)];
+	uint32_t expect[MAX_WIDTH + MAX_OFFSET];
+	uint32_t got[MAX_WIDTH + MAX_OFFSET];
+	uint32_t pix;
+	unsigned int width, offset, mask_offset, i;
+	unsigned int nfailed = 0;
+
+	for(width=0; width<=MAX_WIDTH; width++)
+	{
+		for(offset=0; offset<MAX_OFFSET; offset++)
+		{
+			for(mask_offset=0; mask_offset<MAX_OFFSET*4; mask_offset++)
+			{
+				pix = random_pixel(true);
+				for(i=0; i<sizeof(mask); i++)
+					mask[i] = random_byte();
+				random_pixels(expect, MAX_WIDTH + MAX_OFFSET, true);
+				memcpy(got, expect, sizeof(got));
+				over_mask_c(&expect[offset], pix, &mask[mask_offset], width);
+				(*fn)(&got[offset], pix, &mask[mask_offset], width);
+				if(!check(name, width, offset, expect, got, MAX_WIDTH + MAX_OFFSET))
+					nfailed ++;
+			}
+		}
+	}
+
+	return nfailed;
+}
+
+/*
+ * if premultiplied is true, the RGB components are no bigger than the alpha
+ * fully transparent and fully opaque pixels are more likely than the others, as they have their own code paths
+ */
+
+void
+random_pixels(uint32_t *pixs, unsigned int npixs, bool premultiplied)
+{
+	unsigned int i;
+
+	for(i=0; i<npixs; i++)
+		pixs[i] = random_pixel(premultiplied);
+
+	return;
+}
+
+uint32_t
+random_pixel(bool premultiplied)
+{
+	unsigned int a, r, g, b;
+
+	a = random_byte();
+	r = random_byte();
+	g = random_byte();
+	b = random_byte();
+
+	if(premultiplied)
+	{
+		r = MUL_DIV255(r, a);
+		g = MUL_DIV255(g, a);
+		b = MUL_DIV255(b, a);
+	}
+
+	return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+unsigned int
+random_byte(void)
+{
+	unsigned int r;
+
+	/* xorshift */
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+
+	r = seed % 320;
+
+	/* a quarter of them are 0 or 255 */
+	if(r >= 256)
+		return (r & 1) ? 255 : 0;
+
+	return r;
+}
+
+/*
+ * compares the whole buffer, so we also find anything written outside the pixels we asked for
+ */
+
+bool
+check(char *name, unsigned int width, unsigned int offset, uint32_t *expect, uint32_t *got, unsigned int npixs)
+{
+	unsigned int i;
+
+	if(memcmp(expect, got, npixs * sizeof(uint32_t)) == 0)
+		return true;
+
+	for(i=0; i<npixs && expect[i] == got[i]; i++)
+		;
+
+	printf("%s: width %u, offset %u: pixel %u is 0x%08x, should be 0x%08x\n",
+		name, width, offset, i, got[i], expect[i]);
+
+	return false;
+}
+
+void
+usage(char *prog)
+{
+	fprintf(stderr, "Syntax: %s [-s <random_seed>]\n", prog);
+
+	exit(EXIT_FAILURE);
+}
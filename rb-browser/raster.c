@@ -0,0 +1,876 @@
+/*
+ * raster.c
+ *
+ * anti-aliased scanline rasteriser for MHEGCanvas
+ * works a pixel row at a time, each edge that crosses the row adds the exact area it covers to the cells it passes through
+ * the coverage of a pixel is then the running total of the cells up to and including it (the same idea as FreeType)
+ * only the cells an edge passes through are touched, the pixels in between are filled in with the running total
+ * so the cost depends on the length of the edges, not on the area being filled
+ * overlapping polygons add up, anything covered more than once is treated as completely covered
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "raster.h"
+#include "utils.h"
+
+/* coverage above/below these is treated as all/none of the pixel, so rounding errors don't leave faint pixels */
+#define RASTER_OPAQUE		0.998
+#define RASTER_TRANSPARENT	0.002
+
+/* same as X, joins sharper than about 11 degrees are bevelled */
+#define RASTER_MITER_LIMIT	10.43
+
+/* how far a flattened arc may be from the real curve, in pixels */
+#define RASTER_ARC_TOLERANCE	0.2
+#define RASTER_ARC_MAX_POINTS	2048
+
+/* internal functions */
+static void *grow(void *, unsigned int *, unsigned int, size_t);
+static void add_polygon(Raster *, RasterPoint *, unsigned int, bool);
+static void add_edge(Raster *, double, double, double, double, int);
+static void add_quad(Raster *, RasterPoint *, RasterPoint *, RasterPoint *, RasterPoint *);
+static void add_join(Raster *, RasterPoint *, RasterPoint *, RasterPoint *, double);
+static void add_stroke(Raster *, RasterPoint *, unsigned int, bool, double);
+static void add_dashes(Raster *, RasterPoint *, unsigned int, bool, double, double, double);
+static void add_dash_point(Raster *, unsigned int *, double, double);
+static void render(Raster *, uint32_t);
+static void add_coverage(Raster *, RasterEdge *, int);
+static void touch(Raster *, int);
+static void sort_cells(int *, unsigned int);
+static int cmp_cells(const void *, const void *);
+static void fill_run(uint32_t *, int, float, uint32_t);
+static int cmp_edges(const void *, const void *);
+static uint32_t lerp(uint32_t, uint32_t, unsigned int);
+
+void
+raster_init(Raster *r, uint32_t *pixels, unsigned int width, unsigned int height)
+{
+	bzero(r, sizeof(Raster));
+
+	r->pixels = pixels;
+	r->width = width;
+	r->height = height;
+
+	raster_setClip(r, 0, 0, width, height);
+	raster_resetDamage(r);
+
+	/* +2 because an edge on the right of the clip rectangle changes the 2 cells after it */
+	r->cover = safe_mallocz((width + 2) * sizeof(float));
+	r->touched = safe_mallocz((width + 2) * sizeof(bool));
+	r->cells = safe_malloc((width + 2) * sizeof(int));
+	r->ncells = 0;
+
+	return;
+}
+
+void
+raster_fini(Raster *r)
+{
+	safe_free(r->edges);
+	safe_free(r->points);
+	safe_free(r->path);
+	safe_free(r->dash);
+	safe_free(r->cover);
+	safe_free(r->touched);
+	safe_free(r->cells);
+	safe_free(r->active);
+
+	return;
+}
+
+/*
+ * only draw inside the rectangle {x0,y0} to {x1,y1} (x1 and y1 are not included)
+ */
+
+void
+raster_setClip(Raster *r, int x0, int y0, int x1, int y1)
+{
+	r->clip_x0 = MAX(x0, 0);
+	r->clip_y0 = MAX(y0, 0);
+	r->clip_x1 = MIN(x1, (int) r->width);
+	r->clip_y1 = MIN(y1, (int) r->height);
+
+	return;
+}
+
+void
+raster_resetDamage(Raster *r)
+{
+	r->damage_x0 = r->width;
+	r->damage_y0 = r->height;
+	r->damage_x1 = 0;
+	r->damage_y1 = 0;
+
+	return;
+}
+
+/*
+ * add the w x h rectangle at {x,y} to the area that has been changed
+ */
+
+void
+raster_addDamage(Raster *r, int x, int y, int w, int h)
+{
+	if(w <= 0 || h <= 0)
+		return;
+
+	r->damage_x0 = MIN(r->damage_x0, MAX(x, 0));
+	r->damage_y0 = MIN(r->damage_y0, MAX(y, 0));
+	r->damage_x1 = MAX(r->damage_x1, MIN(x + w, (int) r->width));
+	r->damage_y1 = MAX(r->damage_y1, MIN(y + h, (int) r->height));
+
+	return;
+}
+
+/*
+ * fill the polygon with the given (premultiplied) pixel value
+ * the polygon is closed for you
+ * pixels that are only partly covered are mixed with what is already there
+ * pixels that are completely covered are replaced, ie there is no alpha blending inside the polygon
+ */
+
+void
+raster_fillPolygon(Raster *r, RasterPoint *pts, unsigned int npts, uint32_t pixel)
+{
+	add_polygon(r, pts, npts, false);
+
+	render(r, pixel);
+
+	return;
+}
+
+/*
+ * draw a line width pixels wide along the path
+ * if closed is true, the last point is joined back to the first
+ * style is RASTER_SOLID, RASTER_DASHED or RASTER_DOTTED
+ * the ends of the line are square and finish at the first and last points (like X's CapButt)
+ * the corners are mitred, unless they are very sharp, in which case they are bevelled (like X's JoinMiter)
+ */
+
+void
+raster_strokePath(Raster *r, RasterPoint *pts, unsigned int npts, bool closed, double width, int style, uint32_t pixel)
+{
+	unsigned int i, n;
+	double on, off;
+
+	if(width <= 0.0 || npts == 0)
+		return;
+
+	/* get rid of repeated points, they have no direction so we can't join them */
+	r->path = grow(r->path, &r->path_size, npts, sizeof(RasterPoint));
+	n = 0;
+	for(i=0; i<npts; i++)
+	{
+		if(n == 0 || pts[i].x != r->path[n - 1].x || pts[i].y != r->path[n - 1].y)
+			r->path[n++] = pts[i];
+	}
+	if(closed && n > 1 && r->path[0].x == r->path[n - 1].x && r->path[0].y == r->path[n - 1].y)
+		n --;
+
+	if(n < 2)
+		return;
+
+	if(style == RASTER_DASHED)
+	{
+		on = MAX(3.0 * width, 4.0);
+		off = MAX(2.0 * width, 3.0);
+		add_dashes(r, r->path, n, closed, width / 2.0, on, off);
+	}
+	else if(style == RASTER_DOTTED)
+	{
+		on = width;
+		off = MAX(2.0 * width, 2.0);
+		add_dashes(r, r->path, n, closed, width / 2.0, on, off);
+	}
+	else
+	{
+		add_stroke(r, r->path, n, closed, width / 2.0);
+	}
+
+	render(r, pixel);
+
+	return;
+}
+
+/*
+ * points on the ellipse centred at {cx,cy} with radii rx and ry
+ * starting at start radians (0 = 3 o' clock) for arc radians anticlockwise (a -ve arc goes clockwise)
+ * if pie is true, the first point is the centre of the ellipse
+ * if the arc goes all the way round, the last point is not repeated, treat it as a closed path
+ * sets *pts to the points, they are only valid until the next call
+ * returns the number of points
+ */
+
+unsigned int
+raster_arcPoints(Raster *r, RasterPoint **pts, double cx, double cy, double rx, double ry, double start, double arc, bool pie)
+{
+	double radius = MAX(fabs(rx), fabs(ry));
+	bool full = false;
+	double step;
+	unsigned int nsegs;
+	unsigned int npts;
+	unsigned int i;
+	double angle;
+
+	if(arc >= 2.0 * M_PI || arc <= -2.0 * M_PI)
+	{
+		arc = (arc > 0.0) ? 2.0 * M_PI : -2.0 * M_PI;
+		full = true;
+	}
+
+	/* enough segments that no part of the arc is more than RASTER_ARC_TOLERANCE from the curve */
+	if(radius > RASTER_ARC_TOLERANCE)
+		step = 2.0 * acos(1.0 - (RASTER_ARC_TOLERANCE / radius));
+	else
+		step = M_PI / 2.0;
+	nsegs = (unsigned int) ceil(fabs(arc) / step);
+	nsegs = MAX(nsegs, 1);
+	nsegs = MIN(nsegs, RASTER_ARC_MAX_POINTS);
+
+	/* +2 for the centre and the last point */
+	r->points = grow(r->points, &r->points_size, nsegs + 2, sizeof(RasterPoint));
+
+	npts = 0;
+	if(pie)
+	{
+		r->points[npts].x = cx;
+		r->points[npts].y = cy;
+		npts ++;
+	}
+	for(i=0; i<=nsegs; i++)
+	{
+		/* don't repeat the first point */
+		if(full && i == nsegs)
+			break;
+		angle = start + ((arc * i) / nsegs);
+		/* Y increases as we go down the screen */
+		r->points[npts].x = cx + (rx * cos(angle));
+		r->points[npts].y = cy - (ry * sin(angle));
+		npts ++;
+	}
+
+	*pts = r->points;
+
+	return npts;
+}
+
+/*
+ * make sure buf can hold at least needed items
+ */
+
+static void *
+grow(void *buf, unsigned int *size, unsigned int needed, size_t item)
+{
+	if(needed <= *size)
+		return buf;
+
+	*size = MAX(needed, *size * 2);
+
+	return safe_realloc(buf, *size * item);
+}
+
+/*
+ * add the edges of a polygon
+ * if normalise is true, the edges are all given the same winding direction
+ * this means overlapping parts of a stroke don't cancel each other out
+ */
+
+static void
+add_polygon(Raster *r, RasterPoint *pts, unsigned int npts, bool normalise)
+{
+	RasterPoint *p0, *p1;
+	double area;
+	int flip = 1;
+	unsigned int i;
+
+	if(npts < 3)
+		return;
+
+	if(normalise)
+	{
+		area = 0.0;
+		for(i=0; i<npts; i++)
+		{
+			p0 = &pts[i];
+			p1 = &pts[(i + 1) % npts];
+			area += (p0->x * p1->y) - (p1->x * p0->y);
+		}
+		if(area == 0.0)
+			return;
+		flip = (area > 0.0) ? 1 : -1;
+	}
+
+	for(i=0; i<npts; i++)
+	{
+		p0 = &pts[i];
+		p1 = &pts[(i + 1) % npts];
+		add_edge(r, p0->x, p0->y, p1->x, p1->y, flip);
+	}
+
+	return;
+}
+
+/*
+ * add the edge from {xa,ya} to {xb,yb}
+ * anything to the left of the clip rectangle still covers the pixels to its right, so it is moved onto the left side
+ * anything to the right is moved onto the right side, where it can't change any pixels we draw
+ * this means edges crossing the sides of the clip rectangle have to be split
+ */
+
+static void
+add_edge(Raster *r, double xa, double ya, double xb, double yb, int dir)
+{
+	double left = r->clip_x0;
+	double right = r->clip_x1;
+	double ym;
+	unsigned int old_size;
+	RasterEdge *e;
+
+	/* horizontal edges don't cover anything */
+	if(ya == yb)
+		return;
+
+	if((xa < left && xb > left) || (xa > left && xb < left))
+	{
+		ym = ya + ((left - xa) * (yb - ya)) / (xb - xa);
+		add_edge(r, xa, ya, left, ym, dir);
+		add_edge(r, left, ym, xb, yb, dir);
+		return;
+	}
+	if((xa < right && xb > right) || (xa > right && xb < right))
+	{
+		ym = ya + ((right - xa) * (yb - ya)) / (xb - xa);
+		add_edge(r, xa, ya, right, ym, dir);
+		add_edge(r, right, ym, xb, yb, dir);
+		return;
+	}
+	xa = MIN(MAX(xa, left), right);
+	xb = MIN(MAX(xb, left), right);
+
+	old_size = r->edges_size;
+	r->edges = grow(r->edges, &r->edges_size, r->nedges + 1, sizeof(RasterEdge));
+	/* render needs room for every edge to be active at once */
+	if(r->edges_size != old_size)
+		r->active = safe_realloc(r->active, r->edges_size * sizeof(unsigned int));
+
+	e = &r->edges[r->nedges++];
+	if(ya < yb)
+	{
+		e->x0 = xa;
+		e->y0 = ya;
+		e->y1 = yb;
+		e->dir = dir;
+	}
+	else
+	{
+		e->x0 = xb;
+		e->y0 = yb;
+		e->y1 = ya;
+		e->dir = -dir;
+	}
+	e->dxdy = (xb - xa) / (yb - ya);
+
+	return;
+}
+
+static void
+add_quad(Raster *r, RasterPoint *a, RasterPoint *b, RasterPoint *c, RasterPoint *d)
+{
+	RasterPoint quad[4];
+
+	quad[0] = *a;
+	quad[1] = *b;
+	quad[2] = *c;
+	quad[3] = *d;
+
+	add_polygon(r, quad, 4, true);
+
+	return;
+}
+
+/*
+ * fill in the gap on the outside of the corner at p
+ * where a line going in direction d_in (a unit vector) turns into direction d_out
+ * hw is half the line width
+ */
+
+static void
+add_join(Raster *r, RasterPoint *p, RasterPoint *d_in, RasterPoint *d_out, double hw)
+{
+	double cross = (d_in->x * d_out->y) - (d_in->y * d_out->x);
+	double dot = (d_in->x * d_out->x) + (d_in->y * d_out->y);
+	double side;
+	double scale;
+	RasterPoint join[4];
+
+	/* straight on, no gap to fill */
+	if(cross == 0.0 && dot > 0.0)
+		return;
+
+	/* the gap is on the opposite side to the way we turn */
+	side = (cross > 0.0) ? -hw : hw;
+
+	join[0] = *p;
+	join[1].x = p->x - (d_in->y * side);
+	join[1].y = p->y + (d_in->x * side);
+	join[3].x = p->x - (d_out->y * side);
+	join[3].y = p->y + (d_out->x * side);
+
+	/* the miter length is 1 / cos(half the angle between the normals), so compare its square to the limit */
+	if((1.0 + dot) * RASTER_MITER_LIMIT * RASTER_MITER_LIMIT > 2.0)
+	{
+		/* the corner where the outside edges meet */
+		scale = side / (1.0 + dot);
+		join[2].x = p->x - ((d_in->y + d_out->y) * scale);
+		join[2].y = p->y + ((d_in->x + d_out->x) * scale);
+		add_polygon(r, join, 4, true);
+	}
+	else
+	{
+		/* bevel */
+		join[2] = join[3];
+		add_polygon(r, join, 3, true);
+	}
+
+	return;
+}
+
+/*
+ * add polygons covering a solid line along the path
+ * the path must not have any repeated points
+ */
+
+static void
+add_stroke(Raster *r, RasterPoint *pts, unsigned int npts, bool closed, double hw)
+{
+	unsigned int nsegs = closed ? npts : npts - 1;
+	unsigned int i;
+	RasterPoint *p0, *p1;
+	RasterPoint dir, prev_dir, first_dir;
+	RasterPoint a, b, c, d;
+	double len;
+
+	/* keep gcc happy */
+	first_dir.x = first_dir.y = 0.0;
+	prev_dir = first_dir;
+
+	for(i=0; i<nsegs; i++)
+	{
+		p0 = &pts[i];
+		p1 = &pts[(i + 1) % npts];
+		len = hypot(p1->x - p0->x, p1->y - p0->y);
+		dir.x = (p1->x - p0->x) / len;
+		dir.y = (p1->y - p0->y) / len;
+		/* the rectangle covering this segment */
+		a.x = p0->x - (dir.y * hw);
+		a.y = p0->y + (dir.x * hw);
+		b.x = p1->x - (dir.y * hw);
+		b.y = p1->y + (dir.x * hw);
+		c.x = p1->x + (dir.y * hw);
+		c.y = p1->y - (dir.x * hw);
+		d.x = p0->x + (dir.y * hw);
+		d.y = p0->y - (dir.x * hw);
+		add_quad(r, &a, &b, &c, &d);
+		/* join it to the previous segment */
+		if(i == 0)
+			first_dir = dir;
+		else
+			add_join(r, p0, &prev_dir, &dir, hw);
+		prev_dir = dir;
+	}
+
+	/* join the end back to the start */
+	if(closed)
+		add_join(r, &pts[0], &prev_dir, &first_dir, hw);
+
+	return;
+}
+
+/*
+ * add polygons covering a dashed line along the path
+ * dashes are on pixels long, with off pixels between them
+ * the pattern carries on round corners, a dash that goes round a corner is joined
+ */
+
+static void
+add_dashes(Raster *r, RasterPoint *pts, unsigned int npts, bool closed, double hw, double on, double off)
+{
+	unsigned int nsegs = closed ? npts : npts - 1;
+	unsigned int i;
+	RasterPoint *p0, *p1;
+	double dx, dy, len;
+	double pos, step;
+	bool drawing = true;
+	double left = on;
+	unsigned int ndash;
+
+	/* start with a dash */
+	ndash = 0;
+	add_dash_point(r, &ndash, pts[0].x, pts[0].y);
+
+	for(i=0; i<nsegs; i++)
+	{
+		p0 = &pts[i];
+		p1 = &pts[(i + 1) % npts];
+		dx = p1->x - p0->x;
+		dy = p1->y - p0->y;
+		len = hypot(dx, dy);
+		pos = 0.0;
+		while(pos < len)
+		{
+			step = MIN(left, len - pos);
+			pos += step;
+			left -= step;
+			if(drawing)
+				add_dash_point(r, &ndash, p0->x + (dx * pos) / len, p0->y + (dy * pos) / len);
+			if(left <= 0.0)
+			{
+				if(drawing)
+				{
+					/* end of a dash */
+					if(ndash > 1)
+						add_stroke(r, r->dash, ndash, false, hw);
+					left = off;
+				}
+				else
+				{
+					/* start of a dash */
+					ndash = 0;
+					add_dash_point(r, &ndash, p0->x + (dx * pos) / len, p0->y + (dy * pos) / len);
+					left = on;
+				}
+				drawing = !drawing;
+			}
+		}
+	}
+
+	/* the last dash may be cut short */
+	if(drawing && ndash > 1)
+		add_stroke(r, r->dash, ndash, false, hw);
+
+	return;
+}
+
+static void
+add_dash_point(Raster *r, unsigned int *ndash, double x, double y)
+{
+	/* don't repeat points */
+	if(*ndash > 0 && r->dash[*ndash - 1].x == x && r->dash[*ndash - 1].y == y)
+		return;
+
+	r->dash = grow(r->dash, &r->dash_size, *ndash + 1, sizeof(RasterPoint));
+	r->dash[*ndash].x = x;
+	r->dash[*ndash].y = y;
+	(*ndash) ++;
+
+	return;
+}
+
+/*
+ * draw all the polygons we have added, then forget them
+ */
+
+static void
+render(Raster *r, uint32_t pixel)
+{
+	double min_y, max_y;
+	int y0, y1;
+	unsigned int next, nactive;
+	unsigned int i, j;
+	RasterEdge *e;
+	int x, y;
+	float cov;
+	uint32_t *dst;
+	int first, prev;
+	int damage_x0, damage_x1, damage_y0, damage_y1;
+
+	if(r->nedges == 0)
+		return;
+
+	/* which rows might we change */
+	min_y = r->edges[0].y0;
+	max_y = r->edges[0].y1;
+	for(i=1; i<r->nedges; i++)
+	{
+		min_y = MIN(min_y, r->edges[i].y0);
+		max_y = MAX(max_y, r->edges[i].y1);
+	}
+	y0 = MAX(r->clip_y0, (int) floor(min_y));
+	y1 = MIN(r->clip_y1, (int) ceil(max_y));
+	if(r->clip_x0 >= r->clip_x1 || y0 >= y1)
+	{
+		r->nedges = 0;
+		return;
+	}
+
+	/* sort by the first row each edge crosses */
+	qsort(r->edges, r->nedges, sizeof(RasterEdge), cmp_edges);
+
+	next = 0;
+	nactive = 0;
+
+	damage_x0 = r->clip_x1;
+	damage_x1 = r->clip_x0;
+	damage_y0 = y1;
+	damage_y1 = y0;
+
+	for(y=y0; y<y1; y++)
+	{
+		/* add the edges that start in this row */
+		while(next < r->nedges && r->edges[next].y0 < y + 1)
+			r->active[nactive++] = next++;
+		/* add the coverage of each edge, and remove the ones that finish in this row */
+		j = 0;
+		for(i=0; i<nactive; i++)
+		{
+			e = &r->edges[r->active[i]];
+			/* finished above the clip rectangle */
+			if(e->y1 <= y)
+				continue;
+			add_coverage(r, e, y);
+			if(e->y1 > y + 1)
+				r->active[j++] = r->active[i];
+		}
+		nactive = j;
+		/* nothing on this row */
+		if(r->ncells == 0)
+			continue;
+		/* mix the pixel into the row, a cell at a time */
+		sort_cells(r->cells, r->ncells);
+		dst = &r->pixels[y * r->width];
+		cov = 0.0;
+		first = -1;
+		prev = r->cells[0];
+		for(i=0; i<r->ncells; i++)
+		{
+			x = r->cells[i];
+			/* the pixels between cells are all covered by the same amount */
+			if(x > prev + 1 && prev + 1 < r->clip_x1)
+				fill_run(&dst[prev + 1], MIN(x, r->clip_x1) - (prev + 1), fabsf(cov), pixel);
+			cov += r->cover[x];
+			r->cover[x] = 0.0;
+			r->touched[x] = false;
+			if(x < r->clip_x1)
+			{
+				fill_run(&dst[x], 1, fabsf(cov), pixel);
+				if(first == -1)
+					first = x;
+			}
+			prev = x;
+		}
+		if(first != -1)
+		{
+			damage_x0 = MIN(damage_x0, first);
+			damage_x1 = MAX(damage_x1, MIN(prev + 1, r->clip_x1));
+			damage_y0 = MIN(damage_y0, y);
+			damage_y1 = y + 1;
+		}
+		r->ncells = 0;
+	}
+
+	raster_addDamage(r, damage_x0, damage_y0, damage_x1 - damage_x0, damage_y1 - damage_y0);
+
+	r->nedges = 0;
+
+	return;
+}
+
+/*
+ * add the area the part of the edge in row y covers to the cells it passes through
+ * each cell gets the area to the right of the edge inside it, less the area the previous cells got
+ * so the running total across the row goes from 0 before the edge to the height of the edge after it
+ */
+
+static void
+add_coverage(Raster *r, RasterEdge *e, int y)
+{
+	double ya = MAX(e->y0, (double) y);
+	double yb = MIN(e->y1, (double) (y + 1));
+	double xa = e->x0 + ((ya - e->y0) * e->dxdy);
+	double xb = e->x0 + ((yb - e->y0) * e->dxdy);
+	float height = (yb - ya) * e->dir;
+	double left, right;
+	double fl, fr;
+	double slope;
+	float a0, a1, an;
+	int il, ir;
+	int x;
+
+	/* add_edge keeps x >= 0, so we don't need to call floor() */
+	/* vertical, the commonest case */
+	if(e->dxdy == 0.0)
+	{
+		il = (int) xa;
+		fl = xa - il;
+		r->cover[il] += height * (1.0 - fl);
+		touch(r, il);
+		if(fl != 0.0)
+		{
+			r->cover[il + 1] += height * fl;
+			touch(r, il + 1);
+		}
+		return;
+	}
+
+	if(xa < xb)
+	{
+		left = xa;
+		right = xb;
+	}
+	else
+	{
+		left = xb;
+		right = xa;
+	}
+	il = (int) left;
+	ir = (int) right;
+	if(ir < right)
+		ir ++;
+
+	if(ir <= il + 1)
+	{
+		/* all in one pixel, split by the average x */
+		fl = ((xa + xb) / 2.0) - il;
+		r->cover[il] += height * (1.0 - fl);
+		r->cover[il + 1] += height * fl;
+		touch(r, il);
+		touch(r, il + 1);
+		return;
+	}
+
+	/* each pixel it passes right through gets slope * height, the ones at each end get a triangle */
+	slope = 1.0 / (right - left);
+	fl = left - il;
+	fr = right - (ir - 1);
+	a0 = 0.5 * slope * (1.0 - fl) * (1.0 - fl);
+	an = 0.5 * slope * fr * fr;
+	r->cover[il] += height * a0;
+	touch(r, il);
+	if(ir == il + 2)
+	{
+		r->cover[il + 1] += height * (1.0 - a0 - an);
+		touch(r, il + 1);
+	}
+	else
+	{
+		a1 = slope * (1.5 - fl);
+		r->cover[il + 1] += height * (a1 - a0);
+		touch(r, il + 1);
+		for(x=il+2; x<ir-1; x++)
+		{
+			r->cover[x] += height * slope;
+			touch(r, x);
+		}
+		a1 += (ir - il - 3) * slope;
+		r->cover[ir - 1] += height * (1.0 - a1 - an);
+		touch(r, ir - 1);
+	}
+	r->cover[ir] += height * an;
+	touch(r, ir);
+
+	return;
+}
+
+/*
+ * remember that this pixel in the current row has some coverage
+ */
+
+static void
+touch(Raster *r, int x)
+{
+	if(!r->touched[x])
+	{
+		r->touched[x] = true;
+		r->cells[r->ncells++] = x;
+	}
+
+	return;
+}
+
+static void
+sort_cells(int *cells, unsigned int ncells)
+{
+	unsigned int i, j;
+	int x;
+
+	/* there are usually only a few */
+	if(ncells > 32)
+	{
+		qsort(cells, ncells, sizeof(int), cmp_cells);
+		return;
+	}
+
+	for(i=1; i<ncells; i++)
+	{
+		x = cells[i];
+		for(j=i; j>0 && cells[j - 1] > x; j--)
+			cells[j] = cells[j - 1];
+		cells[j] = x;
+	}
+
+	return;
+}
+
+static int
+cmp_cells(const void *a, const void *b)
+{
+	return *((const int *) a) - *((const int *) b);
+}
+
+/*
+ * mix pixel into npixels pixels that are all covered by the same amount
+ */
+
+static void
+fill_run(uint32_t *dst, int npixels, float cov, uint32_t pixel)
+{
+	unsigned int alpha;
+	int i;
+
+	if(cov >= RASTER_OPAQUE)
+	{
+		for(i=0; i<npixels; i++)
+			dst[i] = pixel;
+	}
+	else if(cov > RASTER_TRANSPARENT)
+	{
+		alpha = (unsigned int) ((cov * 256.0) + 0.5);
+		for(i=0; i<npixels; i++)
+			dst[i] = lerp(dst[i], pixel, alpha);
+	}
+
+	return;
+}
+
+static int
+cmp_edges(const void *a, const void *b)
+{
+	const RasterEdge *ea = (const RasterEdge *) a;
+	const RasterEdge *eb = (const RasterEdge *) b;
+
+	if(ea->y0 < eb->y0)
+		return -1;
+	else if(ea->y0 > eb->y0)
+		return 1;
+	else
+		return 0;
+}
+
+/*
+ * alpha/256 of src, the rest from dst
+ * does two components at a time
+ */
+
+static uint32_t
+lerp(uint32_t dst, uint32_t src, unsigned int alpha)
+{
+	uint32_t rb, ag;
+
+	rb = (((src & 0x00ff00ff) * alpha) + ((dst & 0x00ff00ff) * (256 - alpha))) >> 8;
+	ag = (((src >> 8) & 0x00ff00ff) * alpha) + (((dst >> 8) & 0x00ff00ff) * (256 - alpha));
+
+	return (rb & 0x00ff00ff) | (ag & 0xff00ff00);
+}
@@ -0,0 +1,76 @@
+/*
+ * raster.h
+ */
+
+#ifndef __RASTER_H__
+#define __RASTER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* line styles, the same values as MHEG's LineStyle */
+#define RASTER_SOLID	1
+#define RASTER_DASHED	2
+#define RASTER_DOTTED	3
+
+typedef struct
+{
+	double x;
+	double y;
+} RasterPoint;
+
+/* an edge of a polygon, y0 < y1 */
+typedef struct
+{
+	double x0, y0;
+	double y1;
+	double dxdy;
+	int dir;			/* +1 if it went down the screen, -1 if it went up */
+} RasterEdge;
+
+/*
+ * anti-aliased scanline rasteriser that draws on a block of premultiplied ARGB pixels
+ * shapes are built up as a set of polygons and then drawn in one go, using the non-zero winding rule
+ */
+typedef struct
+{
+	uint32_t *pixels;
+	unsigned int width;
+	unsigned int height;
+	/* only pixels in this rectangle are changed */
+	int clip_x0, clip_y0;
+	int clip_x1, clip_y1;
+	/* bounding box of the pixels changed since raster_resetDamage, empty if x0 >= x1 */
+	int damage_x0, damage_y0;
+	int damage_x1, damage_y1;
+	/* the polygons waiting to be drawn */
+	RasterEdge *edges;
+	unsigned int nedges;
+	unsigned int edges_size;
+	/* scratch space */
+	RasterPoint *points;		/* returned by raster_arcPoints */
+	unsigned int points_size;
+	RasterPoint *path;		/* the path we are stroking, without any repeated points */
+	unsigned int path_size;
+	RasterPoint *dash;		/* the dash we are currently stroking */
+	unsigned int dash_size;
+	float *cover;			/* change in coverage from the previous pixel in the current row */
+	bool *touched;			/* true if the pixel is in cells */
+	int *cells;			/* the pixels in the current row that have a change in coverage */
+	unsigned int ncells;
+	unsigned int *active;		/* index of the edges that cross the current row */
+} Raster;
+
+void raster_init(Raster *, uint32_t *, unsigned int, unsigned int);
+void raster_fini(Raster *);
+
+void raster_setClip(Raster *, int, int, int, int);
+
+void raster_resetDamage(Raster *);
+void raster_addDamage(Raster *, int, int, int, int);
+
+void raster_fillPolygon(Raster *, RasterPoint *, unsigned int, uint32_t);
+void raster_strokePath(Raster *, RasterPoint *, unsigned int, bool, double, int, uint32_t);
+unsigned int raster_arcPoints(Raster *, RasterPoint **, double, double, double, double, double, double, bool);
+
+#endif	/* __RASTER_H__ */
@@ -1,14 +1,20 @@
 /*
- * rb-browser [-v] [-f] [-d] [-o <video_output_method>] [-k <keymap_file>] [-t <timeout>] [-r] [<service_gateway>]
+ * rb-browser [-v] [-f] [-d] [-D <display_method>] [-p <png_prefix>] [-o <video_output_method>] [-k <keymap_file>] [-t <timeout>] [-s <replay_script>] [-j <json_file>] [-r] [<service_gateway>]
  *
  * -v is verbose/debug mode
  * -f is full screen, otherwise it uses a window
  * -d disables all video and audio output
+ * -D allows you to choose a display method, eg "soft" draws in memory and does not need an X server
+ * (do 'rb-browser -D' for a list of available methods)
+ * -p saves each frame the display shows as <png_prefix>NNNNNN.png (NNNNNN is the frame number)
  * -o allows you to choose a video output method if the default is not supported/too slow on your graphics card
  * (do 'rb-browser -o' for a list of available methods)
  * -k changes the default key map to the given file
  * (use rb-keymap to generate a keymap config file)
  * -t is how long to poll for missing files before generating a ContentRefError (default 10 seconds)
+ * -s runs the app from the given script instead of taking key presses from the display, and prints how long it took
+ * (see MHEGReplay.c for the script format, the display method defaults to "soft" if you use -s)
+ * -j saves the -s results in the given file as JSON
  * -r means use a remote backend (rb-download running on another host), <service_gateway> should be host[:port]
  * if -r is not specified, rb-download is running on the same machine
  * and <service_gateway> should be an entry in the services directory, eg. services/4165
@@ -51,12 +57,16 @@ main(int argc, char *argv[])
 	opts.srg_loc = DEFAULT_BACKEND;
 	opts.verbose = 0;
 	opts.fullscreen = false;
+	opts.display_method = NULL;
+	opts.dump_prefix = NULL;
 	opts.vo_method = NULL;
 	opts.av_disabled = false;
 	opts.timeout = MISSING_CONTENT_TIMEOUT;
 	opts.keymap = NULL;
+	opts.replay = NULL;
+	opts.replay_json = NULL;
 
-	while((arg = getopt(argc, argv, "rvfdo:k:t:")) != EOF)
+	while((arg = getopt(argc, argv, "rvfdD:p:o:k:t:s:j:")) != EOF)
 	{
 		switch(arg)
 		{
@@ -76,6 +86,14 @@ main(int argc, char *argv[])
 			opts.av_disabled = true;
 			break;
 
+		case 'D':
+			opts.display_method = optarg;
+			break;
+
+		case 'p':
+			opts.dump_prefix = optarg;
+			break;
+
 		case 'o':
 			opts.vo_method = optarg;
 			break;
@@ -88,6 +106,14 @@ main(int argc, char *argv[])
 			opts.timeout = strtoul(optarg, NULL, 0);
 			break;
 
+		case 's':
+			opts.replay = optarg;
+			break;
+
+		case 'j':
+			opts.replay_json = optarg;
+			break;
+
 		default:
 			usage(prog_name);
 			break;
@@ -109,6 +135,10 @@ main(int argc, char *argv[])
 			opts.srg_loc[last--] = '\0';
 	}
 
+	/* replays don't need an X server */
+	if(opts.replay != NULL && opts.display_method == NULL)
+		opts.display_method = "soft";
+
 	MHEGEngine_init(&opts);
 
 	rc = MHEGEngine_run();
@@ -125,12 +155,17 @@ usage(char *prog_name)
 		"[-v] "
 		"[-f] "
 		"[-d] "
+		"[-D <display_method>] "
+		"[-p <png_prefix>] "
 		"[-o <video_output_method>] "
 		"[-k <keymap_file>] "
 		"[-t <timeout>] "
+		"[-s <replay_script>] "
+		"[-j <json_file>] "
 		"[-r] "
 		"[<service_gateway>]\n\n"
+		"%s\n\n"
 		"%s",
-		prog_name, MHEGVideoOutputMethod_getUsage());
+		prog_name, MHEGDisplayMethod_getUsage(), MHEGVideoOutputMethod_getUsage());
 }
 
@@ -41,7 +41,7 @@
 #include "utils.h"
 
 /* internal */
-static struct
+typedef struct
 {
 	unsigned char *data;	/* base of PNG data in memory */
 	unsigned int size;	/* size of PNG data */
@@ -65,6 +65,8 @@ readpng_get_image(unsigned char *png_data, unsigned int png_size, png_uint_32 *w
 	int colour_type;
 	png_uint_32 i, rowbytes;
 	png_bytepp row_pointers = NULL;
+	/* on our stack, the PNG decode threads and the engine thread can all be in here at once */
+	read_mem_state state;
 
 	/* check the signature */
 	if(!png_check_sig(png_data, 8))
@@ -92,11 +94,11 @@ readpng_get_image(unsigned char *png_data, unsigned int png_size, png_uint_32 *w
 	}
 
 	/* read from memory rather than a file */
-	read_mem_state.data = png_data;
-	read_mem_state.size = png_size;
+	state.data = png_data;
+	state.size = png_size;
 	/* unlike file IO we don't need to seek passed the signature */
-	read_mem_state.used = 0;
-	png_set_read_fn(png_ptr, &read_mem_state, read_mem);
+	state.used = 0;
+	png_set_read_fn(png_ptr, &state, read_mem);
 
 	/* read all PNG info up to image data */
 	png_read_info(png_ptr, info_ptr);
@@ -173,19 +175,22 @@ readpng_free_image(unsigned char *rgba)
 /*
  * the default libpng reader reads from a file
  * this reads from a block of memory
+ * the read_mem_state is passed in via png_set_read_fn()
  */
 
 static void
 read_mem(png_structp png_ptr, png_bytep data, png_size_t length)
 {
-	if(read_mem_state.used + length > read_mem_state.size)
+	read_mem_state *state = (read_mem_state *) png_get_io_ptr(png_ptr);
+
+	if(state->used + length > state->size)
 	{
 		png_error(png_ptr, "Unexpected end of PNG data");
 		return;
 	}
 
-	memcpy(data, read_mem_state.data + read_mem_state.used, length);
-	read_mem_state.used += length;
+	memcpy(data, state->data + state->used, length);
+	state->used += length;
 
 	return;
 }
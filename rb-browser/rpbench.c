@@ -0,0 +1,188 @@
+/*
+ * rpbench.c
+ *
+ * Call the string ResidentPrograms over and over, like apps do when they are formatting text
+ * reports how long each Call takes, including the parameter checks and copying the results
+ * links against the engine, but doesn't start it up, so only literal parameters are used
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "MHEGEngine.h"
+#include "ResidentProgramClass.h"
+#include "rtti.h"
+#include "intern.h"
+#include "utils.h"
+
+/* the string we chop up */
+#define BENCH_STRING	"Now: The quick brown fox jumps over the lazy dog. Next: Not the news"
+
+void usage(char *);
+double now(void);
+void init_program(ResidentProgramClass *, char *, unsigned int);
+void add_octetstring(LIST_OF(Parameter) **, char *);
+void add_integer(LIST_OF(Parameter) **, int);
+double time_calls(ResidentProgramClass *, Call *, unsigned int);
+
+/* all our objects are in this group */
+static OctetString bench_gid = { 8, "~//bench" };
+
+int
+main(int argc, char *argv[])
+{
+	char *prog = argv[0];
+	int arg;
+	unsigned int repeat = 1000000;
+	BooleanVariableClass succeeded;
+	ResidentProgramClass gsl, gss, sss;
+	Call gsl_call, gss_call, sss_call;
+
+	while((arg = getopt(argc, argv, "n:")) != EOF)
+	{
+		switch(arg)
+		{
+		case 'n':
+			repeat = strtoul(optarg, NULL, 0);
+			break;
+
+		default:
+			usage(prog);
+			break;
+		}
+	}
+
+	if(optind != argc || repeat == 0)
+		usage(prog);
+
+	/* the BooleanVariable each Call sets */
+	bzero(&succeeded, sizeof(succeeded));
+	succeeded.rootClass.inst.ref.group_identifier = bench_gid;
+	succeeded.rootClass.inst.ref.object_number = 1;
+	succeeded.rootClass.inst.gid = intern_id(&bench_gid);
+	succeeded.rootClass.inst.rtti = RTTI_VariableClass;
+	succeeded.inst.Value.choice = OriginalValue_boolean;
+	MHEGEngine_addObjectReference(&succeeded.rootClass);
+
+	/* GetStringLength(string, length) */
+	init_program(&gsl, "GSL", 2);
+	bzero(&gsl_call, sizeof(gsl_call));
+	gsl_call.call_succeeded.choice = ObjectReference_external_reference;
+	gsl_call.call_succeeded.u.external_reference = succeeded.rootClass.inst.ref;
+	add_octetstring(&gsl_call.parameters, BENCH_STRING);
+	add_integer(&gsl_call.parameters, 0);
+
+	/* GetSubString(string, beginExtract, endExtract, stringResult) */
+	init_program(&gss, "GSS", 3);
+	gss_call = gsl_call;
+	gss_call.parameters = NULL;
+	add_octetstring(&gss_call.parameters, BENCH_STRING);
+	add_integer(&gss_call.parameters, 6);
+	add_integer(&gss_call.parameters, 49);
+	add_octetstring(&gss_call.parameters, "");
+
+	/* SearchSubString(string, startIndex, searchString, stringPosition) */
+	init_program(&sss, "SSS", 4);
+	sss_call = gsl_call;
+	sss_call.parameters = NULL;
+	add_octetstring(&sss_call.parameters, BENCH_STRING);
+	add_integer(&sss_call.parameters, 1);
+	add_octetstring(&sss_call.parameters, "Next:");
+	add_integer(&sss_call.parameters, 0);
+
+	printf("%u Calls of each program\n", repeat);
+	printf("GetStringLength: %.1f ns per Call\n", time_calls(&gsl, &gsl_call, repeat));
+	printf("GetSubString: %.1f ns per Call\n", time_calls(&gss, &gss_call, repeat));
+	printf("SearchSubString: %.1f ns per Call\n", time_calls(&sss, &sss_call, repeat));
+
+	return EXIT_SUCCESS;
+}
+
+void
+init_program(ResidentProgramClass *p, char *name, unsigned int num)
+{
+	bzero(p, sizeof(ResidentProgramClass));
+
+	p->rootClass.inst.ref.group_identifier = bench_gid;
+	p->rootClass.inst.ref.object_number = num;
+	p->rootClass.inst.rtti = RTTI_ResidentProgramClass;
+
+	p->name.size = strlen(name);
+	p->name.data = name;
+
+	return;
+}
+
+void
+add_octetstring(LIST_OF(Parameter) **params, char *str)
+{
+	LIST_TYPE(Parameter) *par = safe_malloc(sizeof(LIST_TYPE(Parameter)));
+	OctetString oct;
+
+	bzero(par, sizeof(LIST_TYPE(Parameter)));
+	par->item.choice = Parameter_new_generic_octetstring;
+	par->item.u.new_generic_octetstring.choice = GenericOctetString_octetstring;
+	oct.size = strlen(str);
+	oct.data = str;
+	OctetString_dup(&par->item.u.new_generic_octetstring.u.octetstring, &oct);
+
+	LIST_APPEND(params, par);
+
+	return;
+}
+
+void
+add_integer(LIST_OF(Parameter) **params, int val)
+{
+	LIST_TYPE(Parameter) *par = safe_malloc(sizeof(LIST_TYPE(Parameter)));
+
+	bzero(par, sizeof(LIST_TYPE(Parameter)));
+	par->item.choice = Parameter_new_generic_integer;
+	par->item.u.new_generic_integer.choice = GenericInteger_integer;
+	par->item.u.new_generic_integer.u.integer = val;
+
+	LIST_APPEND(params, par);
+
+	return;
+}
+
+/*
+ * returns nano seconds per Call
+ */
+
+double
+time_calls(ResidentProgramClass *p, Call *call, unsigned int repeat)
+{
+	double start, secs;
+	unsigned int i;
+
+	start = now();
+
+	for(i=0; i<repeat; i++)
+		ResidentProgramClass_Call(p, call, &bench_gid);
+
+	secs = now() - start;
+
+	return (secs * 1e9) / repeat;
+}
+
+double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+void
+usage(char *prog)
+{
+	fprintf(stderr, "Syntax: %s [-n <repeat>]\n", prog);
+
+	exit(EXIT_FAILURE);
+}
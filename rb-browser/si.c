@@ -3,14 +3,17 @@
  */
 
 #include <ctype.h>
+#include <stdint.h>
 
 #include "si.h"
 #include "MHEGEngine.h"
+#include "intern.h"
 #include "utils.h"
 
 /* looks like we can just make this index up */
 static int si_max_index = -1;
-static OctetString *si_channel = NULL;
+static unsigned int *si_channel = NULL;		/* intern_id() of the dvb:// URL for each index */
+static InternMap si_index;			/* intern_id() of a dvb:// URL -> its index + 1 (so 0 means not assigned) */
 
 /*
  * service can be:
@@ -28,9 +31,31 @@ static OctetString *si_channel = NULL;
 int
 si_get_index(OctetString *ref)
 {
-	int i;
+	int index;
 
 	/* resolve it to dvb:// format */
+	ref = si_resolve(ref);
+
+	/* have we assigned it already */
+	if((index = si_find_index(ref)) != -1)
+		return index;
+
+	/* does the backend say it is available */
+	if(!MHEGEngine_isServiceAvailable(ref))
+		return -1;
+
+	/* add it to the list */
+	return si_add_index(ref);
+}
+
+/*
+ * returns the dvb:// format URL for the given service reference
+ * the result may be ref itself, or may be overwritten when we retune, so copy it if you need to keep it
+ */
+
+OctetString *
+si_resolve(OctetString *ref)
+{
 	if(OctetString_strcmp(ref, "rec://svc/def") == 0)
 	{
 		/* promise we wont change it */
@@ -51,19 +76,44 @@ printf("TODO: si_get_index: service='%.*s'\n", ref->size, ref->data);
 		error("si_get_index: unexpected service '%.*s'", ref->size, ref->data);
 	}
 
-	/* have we assigned it already */
-	for(i=0; i<=si_max_index; i++)
-		if(OctetString_cmp(ref, &si_channel[i]) == 0)
-			return i;
+	return ref;
+}
 
-	/* does the backend say it is available */
-	if(!MHEGEngine_isServiceAvailable(ref))
+/*
+ * returns the index we have already assigned to the given dvb:// URL
+ * returns -1 if we have not assigned it one yet
+ */
+
+int
+si_find_index(OctetString *url)
+{
+	unsigned int id;
+
+	/* if it has not been interned, we can't have assigned it an index */
+	if((id = intern_find(url)) == 0)
 		return -1;
 
-	/* add it to the list */
+	return ((int) (intptr_t) intern_map_get(&si_index, id)) - 1;
+}
+
+/*
+ * assign an index to the given dvb:// URL
+ * only call this if the backend says the service is available
+ */
+
+int
+si_add_index(OctetString *url)
+{
+	int index;
+
+	/* in case it got added while we were asking the backend about it */
+	if((index = si_find_index(url)) != -1)
+		return index;
+
 	si_max_index ++;
-	si_channel = safe_realloc(si_channel, (si_max_index + 1) * sizeof(OctetString));
-	OctetString_dup(&si_channel[si_max_index], ref);
+	si_channel = safe_realloc(si_channel, (si_max_index + 1) * sizeof(unsigned int));
+	si_channel[si_max_index] = intern_id(url);
+	intern_map_put(&si_index, si_channel[si_max_index], (void *) (intptr_t) (si_max_index + 1));
 
 	return si_max_index;
 }
@@ -77,7 +127,7 @@ si_get_url(int index)
 		return NULL;
 	}
 
-	return &si_channel[index];
+	return intern_string(si_channel[index]);
 }
 
 bool
@@ -89,7 +139,7 @@ si_tune_index(int index)
 		return false;
 	}
 
-	MHEGEngine_quit(QuitReason_Retune, &si_channel[index]);
+	MHEGEngine_quit(QuitReason_Retune, intern_string(si_channel[index]));
 
 	return true;
 }
@@ -178,12 +228,12 @@ si_get_service_id(OctetString *ref)
 void
 si_free(void)
 {
-	int i;
-
-	for(i=0; i<=si_max_index; i++)
-		safe_free(si_channel[i].data);
-
+	/* the URLs belong to the intern table */
 	safe_free(si_channel);
+	intern_map_free(&si_index);
+
+	si_channel = NULL;
+	si_max_index = -1;
 
 	return;
 }
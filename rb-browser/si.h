@@ -8,6 +8,9 @@
 #include "der_decode.h"
 
 int si_get_index(OctetString *);
+OctetString *si_resolve(OctetString *);
+int si_find_index(OctetString *);
+int si_add_index(OctetString *);
 OctetString *si_get_url(int);
 
 bool si_tune_index(int);
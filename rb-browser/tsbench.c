@@ -0,0 +1,143 @@
+/*
+ * tsbench.c
+ *
+ * demux the audio and video frames from a recorded MPEG Transport Stream as fast as we can
+ * reports how many MB/s mpegts.c manages
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <ffmpeg/avformat.h>
+
+#include "mpegts.h"
+#include "utils.h"
+
+void usage(char *);
+double now(void);
+
+/* mpegts.c wants this from MHEGEngine.c */
+static int _verbose = 0;
+
+void
+verbose(char *message, ...)
+{
+	va_list ap;
+
+	if(_verbose)
+	{
+		va_start(ap, message);
+		vprintf(message, ap);
+		printf("\n");
+		va_end(ap);
+	}
+
+	return;
+}
+
+int
+main(int argc, char *argv[])
+{
+	char *prog = argv[0];
+	int arg;
+	unsigned int repeat = 1;
+	int apid, vpid;
+	char *tsname;
+	FILE *ts;
+	MpegTSContext *tsdemux;
+	AVPacket pkt;
+	unsigned int i;
+	unsigned int aframes = 0;
+	unsigned int vframes = 0;
+	double abytes = 0.0;
+	double vbytes = 0.0;
+	double total = 0.0;
+	double start, secs;
+
+	while((arg = getopt(argc, argv, "n:v")) != EOF)
+	{
+		switch(arg)
+		{
+		case 'n':
+			repeat = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'v':
+			_verbose = 1;
+			break;
+
+		default:
+			usage(prog);
+			break;
+		}
+	}
+
+	if(optind != argc - 3)
+		usage(prog);
+
+	apid = strtol(argv[optind], NULL, 0);
+	vpid = strtol(argv[optind + 1], NULL, 0);
+	tsname = argv[optind + 2];
+
+	start = now();
+
+	for(i=0; i<repeat; i++)
+	{
+		if((ts = fopen(tsname, "r")) == NULL)
+			fatal("Unable to open '%s': %s", tsname, strerror(errno));
+		if((tsdemux = mpegts_open(ts, apid, vpid)) == NULL)
+			fatal("Out of memory");
+		while(!mpegts_eof(tsdemux))
+		{
+			if(mpegts_demux_frame(tsdemux, &pkt) < 0)
+				continue;
+			if(pkt.stream_index == apid)
+			{
+				aframes ++;
+				abytes += pkt.size;
+			}
+			else
+			{
+				vframes ++;
+				vbytes += pkt.size;
+			}
+			av_free_packet(&pkt);
+		}
+		mpegts_close(tsdemux);
+		total += ftell(ts);
+		fclose(ts);
+	}
+
+	secs = now() - start;
+	if(secs <= 0.0)
+		secs = 1e-6;
+
+	printf("%s: %.1f MB in %.3f secs = %.1f MB/s\n", tsname, total / (1024 * 1024), secs, (total / (1024 * 1024)) / secs);
+	printf("audio PID %d: %u frames, %.1f MB\n", apid, aframes, abytes / (1024 * 1024));
+	printf("video PID %d: %u frames, %.1f MB\n", vpid, vframes, vbytes / (1024 * 1024));
+
+	return EXIT_SUCCESS;
+}
+
+double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+void
+usage(char *prog)
+{
+	fprintf(stderr, "Syntax: %s [-v] [-n <repeat>] <audio-PID> <video-PID> <ts-file>\n", prog);
+	fprintf(stderr, "Use -1 for a PID you do not want to demux\n");
+
+	exit(EXIT_FAILURE);
+}
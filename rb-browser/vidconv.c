@@ -0,0 +1,219 @@
+/*
+ * vidconv.c
+ *
+ * colour conversion of video frames, split across several threads
+ * each thread converts a horizontal band of the frame with img_convert()
+ */
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <ffmpeg/avcodec.h>
+
+#include "vidconv.h"
+#include "utils.h"
+
+/* internal functions */
+static void *worker_thread(void *);
+static void convert_band(VidConv *, unsigned int);
+static void offset_picture(AVPicture *, AVPicture *, enum PixelFormat, int);
+static bool is_planar_yuv(enum PixelFormat);
+
+/*
+ * nworkers is the number of extra threads to use, 0 => the caller does all the work
+ */
+
+VidConv *
+vidconv_new(unsigned int nworkers)
+{
+	VidConv *vc = safe_mallocz(sizeof(VidConv));
+	unsigned int i;
+
+	pthread_mutex_init(&vc->lock, NULL);
+	pthread_cond_init(&vc->start_cond, NULL);
+	pthread_cond_init(&vc->done_cond, NULL);
+
+	vc->job = 0;
+	vc->nbusy = 0;
+	vc->quit = false;
+
+	vc->nworkers = 0;
+	for(i=0; i<MIN(nworkers, VIDCONV_MAX_THREADS); i++)
+	{
+		vc->worker[i].vc = vc;
+		/* the caller does band 0 */
+		vc->worker[i].band = i + 1;
+		if(pthread_create(&vc->worker[i].tid, NULL, worker_thread, &vc->worker[i]) != 0)
+		{
+			error("Unable to create video conversion thread");
+			break;
+		}
+		vc->nworkers ++;
+	}
+
+	return vc;
+}
+
+void
+vidconv_free(VidConv *vc)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&vc->lock);
+	vc->quit = true;
+	pthread_cond_broadcast(&vc->start_cond);
+	pthread_mutex_unlock(&vc->lock);
+
+	for(i=0; i<vc->nworkers; i++)
+		pthread_join(vc->worker[i].tid, NULL);
+
+	pthread_mutex_destroy(&vc->lock);
+	pthread_cond_destroy(&vc->start_cond);
+	pthread_cond_destroy(&vc->done_cond);
+
+	safe_free(vc);
+
+	return;
+}
+
+/*
+ * same as img_convert(), but uses the worker threads to convert parts of the frame at the same time
+ * returns when the whole frame has been converted
+ */
+
+void
+vidconv_convert(VidConv *vc, AVPicture *dst, enum PixelFormat dst_fmt, AVPicture *src, enum PixelFormat src_fmt, int width, int height)
+{
+	/* we only know how to find the start of a band in planar YUV frames, and RGB frames with no palette */
+	if(vc->nworkers == 0 || !is_planar_yuv(src_fmt) || dst->data[1] != NULL)
+	{
+		img_convert(dst, dst_fmt, src, src_fmt, width, height);
+		return;
+	}
+
+	pthread_mutex_lock(&vc->lock);
+	vc->dst = dst;
+	vc->dst_fmt = dst_fmt;
+	vc->src = src;
+	vc->src_fmt = src_fmt;
+	vc->width = width;
+	vc->height = height;
+	vc->nbusy = vc->nworkers;
+	vc->job ++;
+	pthread_cond_broadcast(&vc->start_cond);
+	pthread_mutex_unlock(&vc->lock);
+
+	/* do our share */
+	convert_band(vc, 0);
+
+	/* wait for the others */
+	pthread_mutex_lock(&vc->lock);
+	while(vc->nbusy > 0)
+		pthread_cond_wait(&vc->done_cond, &vc->lock);
+	pthread_mutex_unlock(&vc->lock);
+
+	return;
+}
+
+static void *
+worker_thread(void *arg)
+{
+	VidConvWorker *w = (VidConvWorker *) arg;
+	VidConv *vc = w->vc;
+	unsigned int done = 0;
+
+	pthread_mutex_lock(&vc->lock);
+	while(true)
+	{
+		/* wait for a new frame */
+		while(!vc->quit && vc->job == done)
+			pthread_cond_wait(&vc->start_cond, &vc->lock);
+		if(vc->quit)
+			break;
+		done = vc->job;
+		pthread_mutex_unlock(&vc->lock);
+		/* the frame params won't change until we have all finished */
+		convert_band(vc, w->band);
+		pthread_mutex_lock(&vc->lock);
+		if(--vc->nbusy == 0)
+			pthread_cond_signal(&vc->done_cond);
+	}
+	pthread_mutex_unlock(&vc->lock);
+
+	return NULL;
+}
+
+static void
+convert_band(VidConv *vc, unsigned int band)
+{
+	unsigned int nbands = vc->nworkers + 1;
+	int h_shift, v_shift;
+	int align;
+	int rows;
+	int y0, y1;
+	AVPicture src;
+	AVPicture dst;
+
+	/* each band must start on a chroma row */
+	avcodec_get_chroma_sub_sample(vc->src_fmt, &h_shift, &v_shift);
+	align = MAX(2, 1 << v_shift);
+
+	rows = (vc->height + nbands - 1) / nbands;
+	rows = ((rows + align - 1) / align) * align;
+
+	y0 = band * rows;
+	y1 = MIN(y0 + rows, vc->height);
+	if(y0 >= y1)
+		return;
+
+	offset_picture(&src, vc->src, vc->src_fmt, y0);
+	offset_picture(&dst, vc->dst, vc->dst_fmt, y0);
+
+	img_convert(&dst, vc->dst_fmt, &src, vc->src_fmt, vc->width, y1 - y0);
+
+	return;
+}
+
+/*
+ * set out to the part of in that starts at row y
+ */
+
+static void
+offset_picture(AVPicture *out, AVPicture *in, enum PixelFormat pix_fmt, int y)
+{
+	int h_shift, v_shift;
+	unsigned int i;
+
+	*out = *in;
+
+	out->data[0] = in->data[0] + (y * in->linesize[0]);
+
+	/* chroma planes */
+	if(is_planar_yuv(pix_fmt))
+	{
+		avcodec_get_chroma_sub_sample(pix_fmt, &h_shift, &v_shift);
+		for(i=1; i<3; i++)
+			out->data[i] = in->data[i] + ((y >> v_shift) * in->linesize[i]);
+	}
+
+	return;
+}
+
+static bool
+is_planar_yuv(enum PixelFormat pix_fmt)
+{
+	switch(pix_fmt)
+	{
+	case PIX_FMT_YUV420P:
+	case PIX_FMT_YUV422P:
+	case PIX_FMT_YUV444P:
+	case PIX_FMT_YUV410P:
+	case PIX_FMT_YUV411P:
+	case PIX_FMT_YUVJ420P:
+	case PIX_FMT_YUVJ422P:
+	case PIX_FMT_YUVJ444P:
+		return true;
+
+	default:
+		return false;
+	}
+}
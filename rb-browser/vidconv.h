@@ -0,0 +1,52 @@
+/*
+ * vidconv.h
+ */
+
+#ifndef __VIDCONV_H__
+#define __VIDCONV_H__
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <ffmpeg/avcodec.h>
+
+/* max number of extra threads used to convert each frame */
+#define VIDCONV_MAX_THREADS	4
+
+struct VidConv;
+
+typedef struct
+{
+	struct VidConv *vc;
+	unsigned int band;		/* which part of the frame this thread converts */
+	pthread_t tid;
+} VidConvWorker;
+
+/*
+ * converts each frame in horizontal bands
+ * the caller converts the first band, the worker threads do the others
+ */
+typedef struct VidConv
+{
+	unsigned int nworkers;
+	VidConvWorker worker[VIDCONV_MAX_THREADS];
+	pthread_mutex_t lock;
+	pthread_cond_t start_cond;	/* tells the workers there is a new frame */
+	pthread_cond_t done_cond;	/* tells the caller the workers have finished */
+	unsigned int job;		/* incremented for each new frame */
+	unsigned int nbusy;		/* workers still converting the current frame */
+	bool quit;			/* true => workers should exit */
+	/* the frame being converted */
+	AVPicture *dst;
+	enum PixelFormat dst_fmt;
+	AVPicture *src;
+	enum PixelFormat src_fmt;
+	int width;
+	int height;
+} VidConv;
+
+VidConv *vidconv_new(unsigned int);
+void vidconv_free(VidConv *);
+
+void vidconv_convert(VidConv *, AVPicture *, enum PixelFormat, AVPicture *, enum PixelFormat, int, int);
+
+#endif	/* __VIDCONV_H__ */
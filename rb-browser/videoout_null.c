@@ -12,14 +12,16 @@
 void *vo_null_init(void);
 void vo_null_fini(void *);
 void vo_null_prepareFrame(void *, VideoFrame *, unsigned int, unsigned int);
-void vo_null_drawFrame(void *, int, int);
+void vo_null_drawFrame(void *, VideoFrame *, int, int);
+void vo_null_releaseFrame(void *, VideoFrame *);
 
 MHEGVideoOutputMethod vo_null_fns =
 {
 	vo_null_init,
 	vo_null_fini,
 	vo_null_prepareFrame,
-	vo_null_drawFrame
+	vo_null_drawFrame,
+	vo_null_releaseFrame
 };
 
 void *
@@ -52,25 +54,27 @@ vo_null_fini(void *ctx)
 void
 vo_null_prepareFrame(void *ctx, VideoFrame *f, unsigned int out_width, unsigned int out_height)
 {
-	vo_null_ctx *v = (vo_null_ctx *) ctx;
-
-	v->width = out_width;
-	v->height = out_height;
-
+	/* nothing to do, the frame remembers its output size */
 	return;
 }
 
 void
-vo_null_drawFrame(void *ctx, int x, int y)
+vo_null_drawFrame(void *ctx, VideoFrame *f, int x, int y)
 {
 	vo_null_ctx *v = (vo_null_ctx *) ctx;
 	MHEGDisplay *d = MHEGEngine_getDisplay();
 
 	/* draw an empty rectangle onto the Window contents Pixmap */
-	XFillRectangle(d->dpy, d->contents, v->gc, x, y, v->width, v->height);
+	XFillRectangle(d->dpy, d->contents, v->gc, x, y, f->out_width, f->out_height);
 
 	/* get it drawn straight away */
 	XFlush(d->dpy);
 
 	return;
 }
+
+void
+vo_null_releaseFrame(void *ctx, VideoFrame *f)
+{
+	return;
+}
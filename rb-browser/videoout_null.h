@@ -10,8 +10,6 @@
 typedef struct
 {
 	GC gc;				/* GC to draw on the content Pixmap */
-	unsigned int width;		/* size to output blank frame */
-	unsigned int height;
 } vo_null_ctx;
 
 extern MHEGVideoOutputMethod vo_null_fns;
@@ -2,6 +2,7 @@
  * videoout_xshm.c
  */
 
+#include <unistd.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
 #include <X11/Xlib.h>
@@ -17,26 +18,43 @@
 void *vo_xshm_init(void);
 void vo_xshm_fini(void *);
 void vo_xshm_prepareFrame(void *, VideoFrame *, unsigned int, unsigned int);
-void vo_xshm_drawFrame(void *, int, int);
+void vo_xshm_drawFrame(void *, VideoFrame *, int, int);
+void vo_xshm_releaseFrame(void *, VideoFrame *);
 
 MHEGVideoOutputMethod vo_xshm_fns =
 {
 	vo_xshm_init,
 	vo_xshm_fini,
 	vo_xshm_prepareFrame,
-	vo_xshm_drawFrame
+	vo_xshm_drawFrame,
+	vo_xshm_releaseFrame
 };
 
-static void vo_xshm_create_frame(vo_xshm_ctx *, unsigned int, unsigned int);
-static void vo_xshm_resize_frame(vo_xshm_ctx *, unsigned int, unsigned int);
-static void vo_xshm_destroy_frame(vo_xshm_ctx *);
+static vo_xshm_frame *vo_xshm_get_frame(vo_xshm_ctx *, unsigned int, unsigned int);
+static void vo_xshm_create_frame(vo_xshm_ctx *, vo_xshm_frame *, unsigned int, unsigned int);
+static void vo_xshm_destroy_frame(vo_xshm_frame *);
 
 void *
 vo_xshm_init(void)
 {
 	vo_xshm_ctx *v = safe_mallocz(sizeof(vo_xshm_ctx));
+	long ncpus;
+	unsigned int i;
 
-	v->current_frame = NULL;
+	pthread_mutex_init(&v->lock, NULL);
+
+	for(i=0; i<VO_XSHM_NFRAMES; i++)
+	{
+		v->frames[i].in_use = false;
+		v->frames[i].image = NULL;
+	}
+
+	v->out_format = PIX_FMT_NONE;
+
+	/* the thread calling prepareFrame does some of the conversion too */
+	if((ncpus = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		ncpus = 1;
+	v->conv = vidconv_new(ncpus - 1);
 
 	v->resize_ctx = NULL;
 	v->resized_data = NULL;
@@ -48,6 +66,7 @@ void
 vo_xshm_fini(void *ctx)
 {
 	vo_xshm_ctx *v = (vo_xshm_ctx *) ctx;
+	unsigned int i;
 
 	if(v->resize_ctx != NULL)
 	{
@@ -55,28 +74,36 @@ vo_xshm_fini(void *ctx)
 		safe_free(v->resized_data);
 	}
 
-	if(v->current_frame != NULL)
-		vo_xshm_destroy_frame(v);
+	vidconv_free(v->conv);
+
+	for(i=0; i<VO_XSHM_NFRAMES; i++)
+	{
+		if(v->frames[i].image != NULL)
+			vo_xshm_destroy_frame(&v->frames[i]);
+	}
+
+	pthread_mutex_destroy(&v->lock);
 
 	safe_free(ctx);
 
 	return;
 }
 
+/*
+ * scale the frame and convert it to RGB in one of our shared memory XImages
+ * the frame can be drawn while we prepare the next one
+ */
+
 void
 vo_xshm_prepareFrame(void *ctx, VideoFrame *f, unsigned int out_width, unsigned int out_height)
 {
 	vo_xshm_ctx *v = (vo_xshm_ctx *) ctx;
+	vo_xshm_frame *out;
 	AVPicture *yuv_frame;
 	int resized_size;
 
-	/* have we created the output frame yet */
-	if(v->current_frame == NULL)
-		vo_xshm_create_frame(v, out_width, out_height);
-
-	/* see if the output size has changed since the last frame */
-	if(v->current_frame->width != out_width || v->current_frame->height != out_height)
-		vo_xshm_resize_frame(v, out_width, out_height);
+	/* find an XImage to convert it into */
+	out = vo_xshm_get_frame(v, out_width, out_height);
 
 	/* see if the input size is different than the output size */
 	if(f->width != out_width || f->height != out_height)
@@ -112,99 +139,140 @@ vo_xshm_prepareFrame(void *ctx, VideoFrame *f, unsigned int out_width, unsigned
 	}
 
 	/* convert the frame to RGB */
-	img_convert(&v->rgb_frame, v->out_format, yuv_frame, f->pix_fmt, out_width, out_height);
+	vidconv_convert(v->conv, &out->rgb_frame, v->out_format, yuv_frame, f->pix_fmt, out_width, out_height);
+
+	f->output = out;
 
 	return;
 }
 
 void
-vo_xshm_drawFrame(void *ctx, int x, int y)
+vo_xshm_drawFrame(void *ctx, VideoFrame *f, int x, int y)
 {
-	vo_xshm_ctx *v = (vo_xshm_ctx *) ctx;
+	vo_xshm_frame *out = (vo_xshm_frame *) f->output;
 	MHEGDisplay *d = MHEGEngine_getDisplay();
-	unsigned int out_width;
-	unsigned int out_height;
 
-	if(v->current_frame != NULL)
+	if(out != NULL)
 	{
 		/* video frame is already scaled as needed */
-		out_width = v->current_frame->width;
-		out_height = v->current_frame->height;
-		/* draw it onto the Window contents Pixmap */
-		XShmPutImage(d->dpy, d->contents, d->win_gc, v->current_frame, 0, 0, x, y, out_width, out_height, False);
-		/* get it drawn straight away */
-		XFlush(d->dpy);
+		XShmPutImage(d->dpy, d->contents, d->win_gc, out->image, 0, 0, x, y, f->out_width, f->out_height, False);
+		/*
+		 * wait for the X server to finish with it
+		 * so prepareFrame can reuse the shared memory as soon as the frame is released
+		 */
+		XSync(d->dpy, False);
 	}
 
 	return;
 }
 
+void
+vo_xshm_releaseFrame(void *ctx, VideoFrame *f)
+{
+	vo_xshm_ctx *v = (vo_xshm_ctx *) ctx;
+	vo_xshm_frame *out = (vo_xshm_frame *) f->output;
+
+	if(out != NULL)
+	{
+		pthread_mutex_lock(&v->lock);
+		out->in_use = false;
+		pthread_mutex_unlock(&v->lock);
+	}
+
+	return;
+}
+
+/*
+ * returns an unused XImage of the given size
+ * prefers one that is already the right size
+ */
+
+static vo_xshm_frame *
+vo_xshm_get_frame(vo_xshm_ctx *v, unsigned int out_width, unsigned int out_height)
+{
+	vo_xshm_frame *out = NULL;
+	vo_xshm_frame *spare = NULL;
+	unsigned int i;
+
+	pthread_mutex_lock(&v->lock);
+	for(i=0; out==NULL && i<VO_XSHM_NFRAMES; i++)
+	{
+		if(v->frames[i].in_use)
+			continue;
+		if(v->frames[i].image != NULL
+		&& v->frames[i].image->width == out_width && v->frames[i].image->height == out_height)
+			out = &v->frames[i];
+		else if(spare == NULL)
+			spare = &v->frames[i];
+	}
+	if(out == NULL)
+		out = spare;
+	/* assert */
+	if(out == NULL)
+		fatal("vo_xshm_prepareFrame: too many frames in use");
+	out->in_use = true;
+	pthread_mutex_unlock(&v->lock);
+
+	/* see if the output size has changed since we last used it */
+	if(out->image != NULL && (out->image->width != out_width || out->image->height != out_height))
+		vo_xshm_destroy_frame(out);
+
+	/* have we created the output frame yet */
+	if(out->image == NULL)
+		vo_xshm_create_frame(v, out, out_width, out_height);
+
+	return out;
+}
+
 static void
-vo_xshm_create_frame(vo_xshm_ctx *v, unsigned int out_width, unsigned int out_height)
+vo_xshm_create_frame(vo_xshm_ctx *v, vo_xshm_frame *out, unsigned int out_width, unsigned int out_height)
 {
 	MHEGDisplay *d = MHEGEngine_getDisplay();
 	int rgb_size;
 
-	if((v->current_frame = XShmCreateImage(d->dpy, d->vis, d->depth, ZPixmap, NULL, &v->shm, out_width, out_height)) == NULL)
+	if((out->image = XShmCreateImage(d->dpy, d->vis, d->depth, ZPixmap, NULL, &out->shm, out_width, out_height)) == NULL)
 		fatal("XShmCreateImage failed");
 
 	/* work out what ffmpeg pixel format matches our XImage format */
-	if((v->out_format = find_av_pix_fmt(v->current_frame->bits_per_pixel,
+	if((v->out_format = find_av_pix_fmt(out->image->bits_per_pixel,
 					    d->vis->red_mask, d->vis->green_mask, d->vis->blue_mask)) == PIX_FMT_NONE)
 		fatal("Unsupported XImage pixel format");
 
-	rgb_size = v->current_frame->bytes_per_line * out_height;
+	rgb_size = out->image->bytes_per_line * out_height;
 
 	if(rgb_size != avpicture_get_size(v->out_format, out_width, out_height))
 		fatal("XImage and ffmpeg pixel formats differ");
 
-	if((v->shm.shmid = shmget(IPC_PRIVATE, rgb_size, IPC_CREAT | 0777)) == -1)
+	if((out->shm.shmid = shmget(IPC_PRIVATE, rgb_size, IPC_CREAT | 0777)) == -1)
 		fatal("shmget failed");
-	if((v->shm.shmaddr = shmat(v->shm.shmid, NULL, 0)) == (void *) -1)
+	if((out->shm.shmaddr = shmat(out->shm.shmid, NULL, 0)) == (void *) -1)
 		fatal("shmat failed");
-	v->shm.readOnly = True;
-	if(!XShmAttach(d->dpy, &v->shm))
+	out->shm.readOnly = True;
+	if(!XShmAttach(d->dpy, &out->shm))
 		fatal("XShmAttach failed");
 
 	/* we made sure these pixel formats are the same */
-	v->current_frame->data = v->shm.shmaddr;
-	avpicture_fill(&v->rgb_frame, v->shm.shmaddr, v->out_format, out_width, out_height);
+	out->image->data = out->shm.shmaddr;
+	avpicture_fill(&out->rgb_frame, out->shm.shmaddr, v->out_format, out_width, out_height);
 
 	return;
 }
 
 static void
-vo_xshm_resize_frame(vo_xshm_ctx  *v, unsigned int out_width, unsigned int out_height)
-{
-/* TODO */
-/* better if create_frame makes the max size shm we will need (ie d->xres, d->yres) */
-/* then this just updates the XImage and AVFrame params in current_frame and rgb_frame */
-
-	if(v->current_frame != NULL)
-		vo_xshm_destroy_frame(v);
-
-	vo_xshm_create_frame(v, out_width, out_height);
-
-	return;
-}
-
-static void
-vo_xshm_destroy_frame(vo_xshm_ctx  *v)
+vo_xshm_destroy_frame(vo_xshm_frame *out)
 {
 	MHEGDisplay *d = MHEGEngine_getDisplay();
 
-	/* get rid of the current frame */
 	/* the XImage data is our shared memory, make sure XDestroyImage doesn't try to free it */
-	v->current_frame->data = NULL;
-	XDestroyImage(v->current_frame);
+	out->image->data = NULL;
+	XDestroyImage(out->image);
 	/* make sure no-one tries to use it */
-	v->current_frame = NULL;
+	out->image = NULL;
 
 	/* get rid of the shared memory */
-	XShmDetach(d->dpy, &v->shm);
-	shmdt(v->shm.shmaddr);
-	shmctl(v->shm.shmid, IPC_RMID, NULL);
+	XShmDetach(d->dpy, &out->shm);
+	shmdt(out->shm.shmaddr);
+	shmctl(out->shm.shmid, IPC_RMID, NULL);
 
 	return;
 }
-
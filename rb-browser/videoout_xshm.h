@@ -6,10 +6,20 @@
 #define __VIDEOOUT_XSHM_H__
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
 #include <X11/Xlib.h>
 #include <X11/extensions/XShm.h>
 #include <ffmpeg/avcodec.h>
 
+#include "vidconv.h"
+
+/*
+ * number of RGB frames we can have prepared at once
+ * must be more than the stream player can have between prepareFrame and releaseFrame
+ */
+#define VO_XSHM_NFRAMES	8
+
 typedef struct
 {
 	unsigned int width;
@@ -18,10 +28,19 @@ typedef struct
 
 typedef struct
 {
-	XImage *current_frame;			/* frame we are currently displaying */
-	XShmSegmentInfo shm;			/* shared memory used by current_frame */
-	AVPicture rgb_frame;			/* ffmpeg wrapper for current_frame SHM data */
+	bool in_use;				/* true between prepareFrame and releaseFrame */
+	XImage *image;				/* NULL if we have not created it yet */
+	XShmSegmentInfo shm;			/* shared memory used by image */
+	AVPicture rgb_frame;			/* ffmpeg wrapper for the image SHM data */
+} vo_xshm_frame;
+
+typedef struct
+{
+	pthread_mutex_t lock;			/* protects in_use */
+	vo_xshm_frame frames[VO_XSHM_NFRAMES];
 	enum PixelFormat out_format;		/* rgb_frame ffmpeg pixel format */
+	VidConv *conv;				/* converts YUV frames to RGB */
+	/* only the thread calling prepareFrame uses these */
 	ImgReSampleContext *resize_ctx;		/* NULL if we do not need to resize the frame */
 	FrameSize resize_in;			/* resize_ctx input dimensions */
 	FrameSize resize_out;			/* resize_ctx output dimensions */
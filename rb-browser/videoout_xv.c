@@ -0,0 +1,416 @@
+/*
+ * videoout_xv.c
+ *
+ * copies the YUV frames into shared memory XvImages
+ * the X server converts them to RGB and scales them to the output size
+ * falls back to xshm if the X server has no Xv adaptor that can do planar YUV images
+ * we draw on the contents Pixmap, so we also need an adaptor that can draw on Pixmaps
+ * overlay adaptors can only draw on Windows, they give a BadMatch error for Pixmaps
+ */
+
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/Xlib.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/Xvlib.h>
+#include <ffmpeg/avformat.h>
+
+#include "MHEGEngine.h"
+#include "MHEGVideoOutput.h"
+#include "videoout_xshm.h"
+#include "videoout_xv.h"
+#include "utils.h"
+
+void *vo_xv_init(void);
+void vo_xv_fini(void *);
+void vo_xv_prepareFrame(void *, VideoFrame *, unsigned int, unsigned int);
+void vo_xv_drawFrame(void *, VideoFrame *, int, int);
+void vo_xv_releaseFrame(void *, VideoFrame *);
+
+MHEGVideoOutputMethod vo_xv_fns =
+{
+	vo_xv_init,
+	vo_xv_fini,
+	vo_xv_prepareFrame,
+	vo_xv_drawFrame,
+	vo_xv_releaseFrame
+};
+
+static bool vo_xv_find_port(vo_xv_ctx *);
+static bool vo_xv_has_colorkey(MHEGDisplay *, XvPortID);
+static bool vo_xv_can_draw_pixmap(MHEGDisplay *, XvPortID, int);
+static int put_error(Display *, XErrorEvent *);
+
+/* set if XvPutImage fails in vo_xv_can_draw_pixmap() */
+static bool _put_failed;
+static vo_xv_frame *vo_xv_get_frame(vo_xv_ctx *, unsigned int, unsigned int);
+static void vo_xv_create_frame(vo_xv_ctx *, vo_xv_frame *, unsigned int, unsigned int);
+static void vo_xv_destroy_frame(vo_xv_frame *);
+
+void *
+vo_xv_init(void)
+{
+	vo_xv_ctx *v = safe_mallocz(sizeof(vo_xv_ctx));
+	unsigned int i;
+
+	pthread_mutex_init(&v->lock, NULL);
+
+	for(i=0; i<VO_XV_NFRAMES; i++)
+	{
+		v->frames[i].in_use = false;
+		v->frames[i].image = NULL;
+	}
+
+	v->fallback = NULL;
+
+	if(!vo_xv_find_port(v))
+	{
+		error("No usable XVideo adaptor; using XShm video output");
+		v->fallback = (*vo_xshm_fns.init)();
+	}
+
+	return v;
+}
+
+void
+vo_xv_fini(void *ctx)
+{
+	vo_xv_ctx *v = (vo_xv_ctx *) ctx;
+	MHEGDisplay *d = MHEGEngine_getDisplay();
+	unsigned int i;
+
+	if(v->fallback != NULL)
+	{
+		(*vo_xshm_fns.fini)(v->fallback);
+	}
+	else
+	{
+		for(i=0; i<VO_XV_NFRAMES; i++)
+		{
+			if(v->frames[i].image != NULL)
+				vo_xv_destroy_frame(&v->frames[i]);
+		}
+		XvUngrabPort(d->dpy, v->port, CurrentTime);
+	}
+
+	pthread_mutex_destroy(&v->lock);
+
+	safe_free(ctx);
+
+	return;
+}
+
+/*
+ * copy the frame into one of our shared memory XvImages
+ * the X server does the scaling when we draw it
+ */
+
+void
+vo_xv_prepareFrame(void *ctx, VideoFrame *f, unsigned int out_width, unsigned int out_height)
+{
+	vo_xv_ctx *v = (vo_xv_ctx *) ctx;
+	vo_xv_frame *out;
+
+	if(v->fallback != NULL)
+	{
+		(*vo_xshm_fns.prepareFrame)(v->fallback, f, out_width, out_height);
+		return;
+	}
+
+	/* the image is the size of the decoded frame, not the output size */
+	out = vo_xv_get_frame(v, f->width, f->height);
+
+	/* MPEG video is nearly always YUV420P already */
+	if(f->pix_fmt == PIX_FMT_YUV420P || f->pix_fmt == PIX_FMT_YUVJ420P)
+		img_copy(&out->yuv_frame, &f->frame, PIX_FMT_YUV420P, f->width, f->height);
+	else
+		img_convert(&out->yuv_frame, PIX_FMT_YUV420P, &f->frame, f->pix_fmt, f->width, f->height);
+
+	f->output = out;
+
+	return;
+}
+
+void
+vo_xv_drawFrame(void *ctx, VideoFrame *f, int x, int y)
+{
+	vo_xv_ctx *v = (vo_xv_ctx *) ctx;
+	vo_xv_frame *out = (vo_xv_frame *) f->output;
+	MHEGDisplay *d = MHEGEngine_getDisplay();
+
+	if(v->fallback != NULL)
+	{
+		(*vo_xshm_fns.drawFrame)(v->fallback, f, x, y);
+		return;
+	}
+
+	if(out != NULL)
+	{
+		/* the X server scales it to the output size */
+		XvShmPutImage(d->dpy, v->port, d->contents, d->win_gc, out->image,
+			      0, 0, f->width, f->height,
+			      x, y, f->out_width, f->out_height, False);
+		/*
+		 * wait for the X server to finish with it
+		 * so prepareFrame can reuse the shared memory as soon as the frame is released
+		 */
+		XSync(d->dpy, False);
+	}
+
+	return;
+}
+
+void
+vo_xv_releaseFrame(void *ctx, VideoFrame *f)
+{
+	vo_xv_ctx *v = (vo_xv_ctx *) ctx;
+	vo_xv_frame *out = (vo_xv_frame *) f->output;
+
+	if(v->fallback != NULL)
+	{
+		(*vo_xshm_fns.releaseFrame)(v->fallback, f);
+		return;
+	}
+
+	if(out != NULL)
+	{
+		pthread_mutex_lock(&v->lock);
+		out->in_use = false;
+		pthread_mutex_unlock(&v->lock);
+	}
+
+	return;
+}
+
+/*
+ * find an Xv port that can take I420 or YV12 images and grab it
+ * returns false if there isn't one
+ */
+
+static bool
+vo_xv_find_port(vo_xv_ctx *v)
+{
+	MHEGDisplay *d = MHEGEngine_getDisplay();
+	unsigned int version, release, req_base, event_base, error_base;
+	unsigned int nadaptors;
+	XvAdaptorInfo *adaptors;
+	XvImageFormatValues *formats;
+	int nformats;
+	XvPortID port;
+	int fourcc;
+	bool found = false;
+	unsigned int i;
+	int j;
+
+	if(XvQueryExtension(d->dpy, &version, &release, &req_base, &event_base, &error_base) != Success)
+		return false;
+
+	if(XvQueryAdaptors(d->dpy, d->win, &nadaptors, &adaptors) != Success)
+		return false;
+
+	for(i=0; !found && i<nadaptors; i++)
+	{
+		if((adaptors[i].type & (XvInputMask | XvImageMask)) != (XvInputMask | XvImageMask))
+			continue;
+		for(port=adaptors[i].base_id; !found && port<adaptors[i].base_id+adaptors[i].num_ports; port++)
+		{
+			if((formats = XvListImageFormats(d->dpy, port, &nformats)) == NULL)
+				continue;
+			/* prefer I420, it has the planes in the same order as ffmpeg */
+			fourcc = 0;
+			for(j=0; j<nformats; j++)
+			{
+				if(formats[j].id == XV_FOURCC_I420)
+					fourcc = XV_FOURCC_I420;
+				else if(formats[j].id == XV_FOURCC_YV12 && fourcc == 0)
+					fourcc = XV_FOURCC_YV12;
+			}
+			XFree(formats);
+			/* someone else may be using it */
+			if(fourcc == 0 || XvGrabPort(d->dpy, port, CurrentTime) != Success)
+				continue;
+			/* overlay adaptors have a colour key and can't draw on our contents Pixmap */
+			if(vo_xv_has_colorkey(d, port) || !vo_xv_can_draw_pixmap(d, port, fourcc))
+			{
+				verbose("XVideo adaptor '%s' port %lu can't draw on Pixmaps", adaptors[i].name, (unsigned long) port);
+				XvUngrabPort(d->dpy, port, CurrentTime);
+			}
+			else
+			{
+				verbose("Using XVideo adaptor '%s' port %lu", adaptors[i].name, (unsigned long) port);
+				v->port = port;
+				v->fourcc = fourcc;
+				found = true;
+			}
+		}
+	}
+
+	XvFreeAdaptorInfo(adaptors);
+
+	return found;
+}
+
+/*
+ * returns true if the port has an XV_COLORKEY attribute
+ * ie it is an overlay, which can only draw on Windows
+ */
+
+static bool
+vo_xv_has_colorkey(MHEGDisplay *d, XvPortID port)
+{
+	XvAttribute *attrs;
+	int nattrs;
+	bool found = false;
+	int i;
+
+	if((attrs = XvQueryPortAttributes(d->dpy, port, &nattrs)) == NULL)
+		return false;
+
+	for(i=0; !found && i<nattrs; i++)
+		found = (strcmp(attrs[i].name, "XV_COLORKEY") == 0);
+
+	XFree(attrs);
+
+	return found;
+}
+
+/*
+ * try drawing a small image on a Pixmap
+ * returns false if the X server gives us an error
+ */
+
+static bool
+vo_xv_can_draw_pixmap(MHEGDisplay *d, XvPortID port, int fourcc)
+{
+	XvImage *image;
+	Pixmap pixmap;
+	XErrorHandler old_handler;
+
+	if((image = XvCreateImage(d->dpy, port, fourcc, NULL, VO_XV_PROBE_SIZE, VO_XV_PROBE_SIZE)) == NULL)
+		return false;
+	/* the contents don't matter */
+	image->data = safe_mallocz(image->data_size);
+
+	/* same depth as the contents Pixmap, so we can use the same GC */
+	pixmap = XCreatePixmap(d->dpy, d->win, VO_XV_PROBE_SIZE, VO_XV_PROBE_SIZE, d->depth);
+
+	/* don't let the default error handler exit */
+	XSync(d->dpy, False);
+	_put_failed = false;
+	old_handler = XSetErrorHandler(put_error);
+	XvPutImage(d->dpy, port, pixmap, d->win_gc, image,
+		   0, 0, VO_XV_PROBE_SIZE, VO_XV_PROBE_SIZE,
+		   0, 0, VO_XV_PROBE_SIZE, VO_XV_PROBE_SIZE);
+	XSync(d->dpy, False);
+	XSetErrorHandler(old_handler);
+
+	XFreePixmap(d->dpy, pixmap);
+	safe_free(image->data);
+	image->data = NULL;
+	XFree(image);
+
+	return !_put_failed;
+}
+
+static int
+put_error(Display *dpy, XErrorEvent *ev)
+{
+	_put_failed = true;
+
+	return 0;
+}
+
+/*
+ * returns an unused XvImage of the given size
+ * prefers one that is already the right size
+ */
+
+static vo_xv_frame *
+vo_xv_get_frame(vo_xv_ctx *v, unsigned int width, unsigned int height)
+{
+	vo_xv_frame *out = NULL;
+	vo_xv_frame *spare = NULL;
+	unsigned int i;
+
+	pthread_mutex_lock(&v->lock);
+	for(i=0; out==NULL && i<VO_XV_NFRAMES; i++)
+	{
+		if(v->frames[i].in_use)
+			continue;
+		if(v->frames[i].image != NULL
+		&& v->frames[i].image->width == width && v->frames[i].image->height == height)
+			out = &v->frames[i];
+		else if(spare == NULL)
+			spare = &v->frames[i];
+	}
+	if(out == NULL)
+		out = spare;
+	/* assert */
+	if(out == NULL)
+		fatal("vo_xv_prepareFrame: too many frames in use");
+	out->in_use = true;
+	pthread_mutex_unlock(&v->lock);
+
+	/* see if the frame size has changed since we last used it */
+	if(out->image != NULL && (out->image->width != width || out->image->height != height))
+		vo_xv_destroy_frame(out);
+
+	/* have we created the image yet */
+	if(out->image == NULL)
+		vo_xv_create_frame(v, out, width, height);
+
+	return out;
+}
+
+static void
+vo_xv_create_frame(vo_xv_ctx *v, vo_xv_frame *out, unsigned int width, unsigned int height)
+{
+	MHEGDisplay *d = MHEGEngine_getDisplay();
+	/* YV12 has V before U */
+	int u_plane = (v->fourcc == XV_FOURCC_I420) ? 1 : 2;
+	int v_plane = (v->fourcc == XV_FOURCC_I420) ? 2 : 1;
+
+	if((out->image = XvShmCreateImage(d->dpy, v->port, v->fourcc, NULL, width, height, &out->shm)) == NULL)
+		fatal("XvShmCreateImage failed");
+
+	if((out->shm.shmid = shmget(IPC_PRIVATE, out->image->data_size, IPC_CREAT | 0777)) == -1)
+		fatal("shmget failed");
+	if((out->shm.shmaddr = shmat(out->shm.shmid, NULL, 0)) == (void *) -1)
+		fatal("shmat failed");
+	out->shm.readOnly = True;
+	if(!XShmAttach(d->dpy, &out->shm))
+		fatal("XShmAttach failed");
+
+	out->image->data = out->shm.shmaddr;
+
+	/* the X server tells us where each plane is */
+	out->yuv_frame.data[0] = (uint8_t *) out->shm.shmaddr + out->image->offsets[0];
+	out->yuv_frame.linesize[0] = out->image->pitches[0];
+	out->yuv_frame.data[1] = (uint8_t *) out->shm.shmaddr + out->image->offsets[u_plane];
+	out->yuv_frame.linesize[1] = out->image->pitches[u_plane];
+	out->yuv_frame.data[2] = (uint8_t *) out->shm.shmaddr + out->image->offsets[v_plane];
+	out->yuv_frame.linesize[2] = out->image->pitches[v_plane];
+	out->yuv_frame.data[3] = NULL;
+	out->yuv_frame.linesize[3] = 0;
+
+	return;
+}
+
+static void
+vo_xv_destroy_frame(vo_xv_frame *out)
+{
+	MHEGDisplay *d = MHEGEngine_getDisplay();
+
+	/* the XvImage data is our shared memory */
+	XFree(out->image);
+	/* make sure no-one tries to use it */
+	out->image = NULL;
+
+	/* get rid of the shared memory */
+	XShmDetach(d->dpy, &out->shm);
+	shmdt(out->shm.shmaddr);
+	shmctl(out->shm.shmid, IPC_RMID, NULL);
+
+	return;
+}
@@ -0,0 +1,44 @@
+/*
+ * videoout_xv.h
+ */
+
+#ifndef __VIDEOOUT_XV_H__
+#define __VIDEOOUT_XV_H__
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <X11/Xlib.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/Xvlib.h>
+#include <ffmpeg/avcodec.h>
+
+/* FOURCCs of the planar YUV 4:2:0 image formats we can upload */
+#define XV_FOURCC_I420	0x30323449
+#define XV_FOURCC_YV12	0x32315659
+
+/* size of the image we draw to see if the adaptor can draw on Pixmaps */
+#define VO_XV_PROBE_SIZE	16
+
+/* same as VO_XSHM_NFRAMES */
+#define VO_XV_NFRAMES	8
+
+typedef struct
+{
+	bool in_use;				/* true between prepareFrame and releaseFrame */
+	XvImage *image;				/* NULL if we have not created it yet */
+	XShmSegmentInfo shm;			/* shared memory used by image */
+	AVPicture yuv_frame;			/* ffmpeg YUV420P wrapper for the image SHM data */
+} vo_xv_frame;
+
+typedef struct
+{
+	void *fallback;				/* vo_xshm ctx if the X server can't do Xv, NULL otherwise */
+	XvPortID port;				/* Xv port we have grabbed */
+	int fourcc;				/* image format we use */
+	pthread_mutex_t lock;			/* protects in_use */
+	vo_xv_frame frames[VO_XV_NFRAMES];
+} vo_xv_ctx;
+
+extern MHEGVideoOutputMethod vo_xv_fns;
+
+#endif	/* __VIDEOOUT_XV_H__ */
@@ -136,6 +136,7 @@ bool output_tagmatch(FILE *, struct typeinfo *, struct typeinfo *, int);
 void output_extend_seq(FILE *, char *, char *, char *, int);
 
 void output_freefunc(FILE *, struct typeinfo *);
+void output_dupfunc(FILE *, struct typeinfo *);
 
 char *output_typename(char *);
 char *output_decodename(char *);
@@ -1002,13 +1003,16 @@ output_typedef(FILE *src, FILE *hdr, struct typeinfo *t, struct typeinfo *types)
 	fprintf(hdr, "DEFINE_LIST_OF(%s);\n\n", t->name);
 
 	/* function prototypes */
-	fprintf(hdr, "int der_decode_%s(FILE *, %s *, int);\n", t->name, t->name);
+	fprintf(hdr, "int der_decode_%s(der_cursor *, %s *, int);\n", t->name, t->name);
 	fprintf(hdr, "/* only free's the contents, not the type itself */\n");
-	fprintf(hdr, "void free_%s(%s *);\n\n", t->name, t->name);
+	fprintf(hdr, "void free_%s(%s *);\n", t->name, t->name);
+	fprintf(hdr, "/* deep copy, uses der_alloc so the copy can go in an arena */\n");
+	fprintf(hdr, "void dup_%s(%s *, %s *);\n\n", t->name, t->name, t->name);
 
 	/* .c file */
 	output_decodefunc(src, t, types);
 	output_freefunc(src, t);
+	output_dupfunc(src, t);
 
 	/* don't output this type more than once */
 	t->output = true;
@@ -1166,7 +1170,7 @@ output_decodefunc(FILE *src, struct typeinfo *t, struct typeinfo *types)
 	int indent;
 
 	fprintf(src, "int\n");
-	fprintf(src, "der_decode_%s(FILE *der, %s *type, int length)\n", t->name, t->name);
+	fprintf(src, "der_decode_%s(der_cursor *der, %s *type, int length)\n", t->name, t->name);
 	fprintf(src, "{\n");
 	fprintf(src, "\tint left = length;\n");
 	fprintf(src, "\tint sublen;\n");
@@ -1225,7 +1229,7 @@ output_decodefunc(FILE *src, struct typeinfo *t, struct typeinfo *types)
 			fprintf(src, "\t\t/* %s */\n", st->name);
 			/* is the subtype also a CHOICE type => it needs the tag included */
 			if(need_tag)
-				fprintf(src, "\t\tfseek(der, -sublen, SEEK_CUR);\n");
+				fprintf(src, "\t\tder->pos -= sublen;\n");
 			else
 				fprintf(src, "\t\tleft -= sublen;\n");
 			/* set choice value */
@@ -1266,7 +1270,7 @@ output_decodefunc(FILE *src, struct typeinfo *t, struct typeinfo *types)
 		fprintf(src, "))\n");
 		fprintf(src, "\t\t\treturn der_error(\"%s: unexpected tag %%u\", tag.number);\n", t->name);
 		if(need_tag)
-			fprintf(src, "\t\tfseek(der, -sublen, SEEK_CUR);\n");
+			fprintf(src, "\t\tder->pos -= sublen;\n");
 		else
 			fprintf(src, "\t\tleft -= sublen;\n");
 		/* extend the elements array */
@@ -1333,7 +1337,7 @@ output_decodefunc(FILE *src, struct typeinfo *t, struct typeinfo *types)
 				/* does the subtype decoder need the tag */
 				print_indent(src, indent + 1);
 				if(need_tag)
-					fprintf(src, "fseek(der, -sublen, SEEK_CUR);\n");
+					fprintf(src, "der->pos -= sublen;\n");
 				else
 					fprintf(src, "seqtag.length -= sublen;\n");
 				/* extend the array */
@@ -1376,7 +1380,7 @@ output_decodefunc(FILE *src, struct typeinfo *t, struct typeinfo *types)
 					/* if the subtype decoder doesnt need the tag, skip over it */
 					if(!need_tag)
 					{
-						fprintf(src, "\t\t\tfseek(der, sublen, SEEK_CUR);\n");
+						fprintf(src, "\t\t\tder->pos += sublen;\n");
 						fprintf(src, "\t\t\tleft -= sublen;\n");
 					}
 					/* set the have_ flag if is OPTIONAL (not DEFAULT) */
@@ -1400,7 +1404,7 @@ output_decodefunc(FILE *src, struct typeinfo *t, struct typeinfo *types)
 					fprintf(src, "\t\treturn der_error(\"%s: unexpected tag %%u\", tag.number);\n", t->name);
 					/* does the subtype decoder need the tag */
 					if(need_tag)
-						fprintf(src, "\tfseek(der, -sublen, SEEK_CUR);\n");
+						fprintf(src, "\tder->pos -= sublen;\n");
 					else
 						fprintf(src, "\tleft -= sublen;\n");
 					/* decode the type */
@@ -1454,7 +1458,7 @@ output_decodefunc(FILE *src, struct typeinfo *t, struct typeinfo *types)
 				fprintf(src, "\t\t\t\t\treturn der_error(\"%s: unexpected tag %%u\", tag.number);\n", t->name);
 				/* does the subtype decoder need the tag */
 				if(need_tag)
-					fprintf(src, "\t\t\t\tfseek(der, -sublen, SEEK_CUR);\n");
+					fprintf(src, "\t\t\t\tder->pos -= sublen;\n");
 				else
 					fprintf(src, "\t\t\t\tseqlen -= sublen;\n");
 				/* extend the array */
@@ -1473,7 +1477,7 @@ output_decodefunc(FILE *src, struct typeinfo *t, struct typeinfo *types)
 			{
 				/* does the subtype decoder need the tag */
 				if(need_tag)
-					fprintf(src, "\t\t\tfseek(der, -sublen, SEEK_CUR);\n");
+					fprintf(src, "\t\t\tder->pos -= sublen;\n");
 				else
 					fprintf(src, "\t\t\tleft -= sublen;\n");
 				/* if its optional set the have_ flag */
@@ -1761,6 +1765,90 @@ output_freefunc(FILE *src, struct typeinfo *t)
 	return;
 }
 
+/*
+ * the dup_TYPE functions copy everything with a struct assignment
+ * then replace any pointers with pointers to copies of what they point to
+ * they follow the same structure as the free_TYPE functions
+ */
+
+void
+output_dupfunc(FILE *src, struct typeinfo *t)
+{
+	struct typeinfo *st;
+
+	fprintf(src, "void\n");
+	fprintf(src, "dup_%s(%s *dst, %s *src)\n", t->name, t->name, t->name);
+	fprintf(src, "{\n");
+
+	fprintf(src, "\t*dst = *src;\n\n");
+
+	/* is it an alias for another complex type */
+	if(t->subtypes == NULL
+	&& (strcmp(t->type, "xsd:hexBinary") == 0 || strchr(t->type, ':') == NULL))
+	{
+		fprintf(src, "\tdup_%s((%s *) dst, (%s *) src);\n\n", output_typename(t->type), output_typename(t->type), output_typename(t->type));
+	}
+	/* is it a CHOICE */
+	else if(strcmp(t->type, "xsd:choice") == 0)
+	{
+		fprintf(src, "\tswitch(src->choice)\n");
+		fprintf(src, "\t{\n");
+		for(st=t->subtypes; st; st=st->next)
+		{
+			fprintf(src, "\tcase %s_%s:\n", t->name, st->name);
+			if(strcmp(st->type, "xsd:hexBinary") == 0
+			|| strchr(st->type, ':') == NULL)
+				fprintf(src, "\t\tdup_%s(&dst->u.%s, &src->u.%s);\n", output_typename(st->type), st->name, st->name);
+			fprintf(src, "\t\tbreak;\n\n");
+		}
+		fprintf(src, "\tdefault:\n");
+		fprintf(src, "\t\tder_error(\"dup_%s: invalid choice (%%u)\", src->choice);\n", t->name);
+		fprintf(src, "\t\tbreak;\n");
+		fprintf(src, "\t}\n\n");
+	}
+	/* is it a SEQUENCE OF primitive-type */
+	else if(strcmp(t->type, "xsd:list") == 0 && t->subtypes && t->subtypes->next == NULL)
+	{
+		fprintf(src, "\tLIST_DUP(dst, *src, %s, der_alloc);\n\n", output_typename(t->subtypes->type));
+	}
+	/* is it a SEQUENCE OF complex-type */
+	else if(strcmp(t->type, "xsd:sequence") == 0 && t->subtypes && t->subtypes->next == NULL)
+	{
+		fprintf(src, "\tLIST_DUP_ITEMS(dst, *src, %s, dup_%s, der_alloc);\n\n", output_typename(t->subtypes->type), output_typename(t->subtypes->type));
+	}
+	/* normal complex type */
+	else
+	{
+		/* call each subtype's dup function */
+		for(st=t->subtypes; st; st=st->next)
+		{
+			/* copy lists */
+			if(strcmp(st->type, "xsd:sequence") == 0 && st->subtypes)
+			{
+				/* if its a primitive type, just copy the list, for complex types copy the elements too */
+				if(strcmp(st->subtypes->type, "xsd:hexBinary") == 0
+				|| strchr(st->subtypes->type, ':') == NULL)
+					fprintf(src, "\tLIST_DUP_ITEMS(&dst->%s, src->%s, %s, dup_%s, der_alloc);\n\n", st->name, st->name, output_typename(st->subtypes->type), output_typename(st->subtypes->type));
+				else
+					fprintf(src, "\tLIST_DUP(&dst->%s, src->%s, %s, der_alloc);\n\n", st->name, st->name, output_typename(st->subtypes->type));
+			}
+			/* the struct assignment has already copied primitive types */
+			else if(strcmp(st->type, "xsd:hexBinary") == 0
+			     || strchr(st->type, ':') == NULL)
+			{
+				if(st->optional)
+					fprintf(src, "\tif(src->have_%s)\n\t", st->name);
+				fprintf(src, "\tdup_%s(&dst->%s, &src->%s);\n\n", output_typename(st->type), st->name, st->name);
+			}
+		}
+	}
+
+	fprintf(src, "\treturn;\n");
+	fprintf(src, "}\n\n");
+
+	return;
+}
+
 char *
 output_typename(char *xsd_type)
 {